@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <glib.h>
+
+#include <camunits/cam.h>
+#include <camunits/log.h>
+
+static int64_t _timestamp_now()
+{
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* Finds the offset of the first frame at or after offset_s seconds into the
+ * log.  Returns -1 if there is no such frame. */
+static int64_t
+find_frame_offset (CamLog *log, const CamLogFrameInfo *first, double offset_s)
+{
+    CamLogFrameInfo info;
+    int64_t timestamp = first->timestamp + (int64_t) (offset_s * 1e6);
+    if (timestamp <= (int64_t) first->timestamp)
+        return first->offset;
+    if (0 != cam_log_seek_to_timestamp (log, timestamp) ||
+            0 != cam_log_get_frame_info (log, &info))
+        return -1;
+    return info.offset;
+}
+
+static void
+usage()
+{
+    fprintf(stderr,
+        "Usage: camlog-cut [OPTIONS] -o OUTPUT INPUT...\n"
+        "\n"
+        "camlog-cut copies a clip of each log file INPUT to the new log file\n"
+        "OUTPUT, one after the other.  Frames are copied as they are, without\n"
+        "decoding them, and on file systems that support reflinks, such as\n"
+        "btrfs and XFS, OUTPUT shares its data with the inputs.\n"
+        "\n"
+        "Options:\n"
+        " -h, --help          Shows this help text\n"
+        " -o, --output FILE   Write the clips to FILE.\n"
+        " -s, --start SEC     Start each clip at the first frame SEC seconds or\n"
+        "                     more after the first frame of its log.  The\n"
+        "                     default is the first frame.\n"
+        " -e, --end SEC       End each clip before the first frame SEC seconds\n"
+        "                     or more after the first frame of its log.  The\n"
+        "                     default is the end of the log.\n"
+        " -f, --force         Overwrite OUTPUT if it already exists.\n");
+}
+
+int main(int argc, char **argv)
+{
+    int status = 1;
+    char *output_fname = NULL;
+    double start_s = 0;
+    double end_s = -1;
+    int overwrite = 0;
+    CamLog *output = NULL;
+
+    char *optstring = "ho:s:e:f";
+    int c;
+    struct option long_opts[] = {
+        { "help", no_argument, 0, 'h' },
+        { "output", required_argument, 0, 'o' },
+        { "start", required_argument, 0, 's' },
+        { "end", required_argument, 0, 'e' },
+        { "force", no_argument, 0, 'f' },
+        { 0, 0, 0, 0 }
+    };
+
+    g_type_init();
+
+    while ((c = getopt_long (argc, argv, optstring, long_opts, 0)) >= 0)
+    {
+        switch (c) {
+            case 'o':
+                free (output_fname);
+                output_fname = strdup (optarg);
+                break;
+            case 's':
+                start_s = atof (optarg);
+                break;
+            case 'e':
+                end_s = atof (optarg);
+                break;
+            case 'f':
+                overwrite = 1;
+                break;
+            case 'h':
+            default:
+                usage();
+                return 1;
+        };
+    }
+    if (!output_fname || optind >= argc ||
+            (end_s >= 0 && end_s <= start_s)) {
+        usage();
+        goto done;
+    }
+
+    struct stat statbuf;
+    if (!overwrite && 0 == stat (output_fname, &statbuf)) {
+        fprintf (stderr, "%s already exists.  Use -f to overwrite it.\n",
+                output_fname);
+        goto done;
+    }
+    output = cam_log_new (output_fname, "w");
+    if (!output) {
+        fprintf (stderr, "Couldn't create %s\n", output_fname);
+        goto done;
+    }
+
+    int64_t start_time = _timestamp_now ();
+    int total_frames = 0;
+    for (int i = optind; i < argc; i++) {
+        CamLog *input = cam_log_new (argv[i], "r");
+        CamLogFrameInfo first;
+        if (!input || 0 != cam_log_get_frame_info (input, &first)) {
+            fprintf (stderr, "Couldn't read %s\n", argv[i]);
+            if (input)
+                cam_log_destroy (input);
+            goto done;
+        }
+
+        int64_t start_offset = find_frame_offset (input, &first, start_s);
+        int64_t end_offset = cam_log_get_file_size (input);
+        if (end_s >= 0) {
+            int64_t offset = find_frame_offset (input, &first, end_s);
+            if (offset >= 0)
+                end_offset = offset;
+        }
+
+        int nframes = 0;
+        if (start_offset >= 0)
+            nframes = cam_log_append_frames (output, input, start_offset,
+                    end_offset);
+        cam_log_destroy (input);
+        if (nframes < 0) {
+            fprintf (stderr, "Couldn't copy frames from %s\n", argv[i]);
+            goto done;
+        }
+        printf ("%s: %d frames\n", argv[i], nframes);
+        total_frames += nframes;
+    }
+
+    printf ("%d frames, %.1f MB in %.2f s\n", total_frames,
+            cam_log_get_file_size (output) / 1e6,
+            (_timestamp_now () - start_time) * 1e-6);
+    status = 0;
+
+done:
+    if (output)
+        cam_log_destroy (output);
+    free (output_fname);
+    return status;
+}
@@ -0,0 +1,549 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <glib.h>
+
+#include <camunits/cam.h>
+#include <camunits/log.h>
+
+#define DEFAULT_UNITS       "convert.to_rgb8,convert.jpeg_compress"
+#define DEFAULT_RANGE_SIZE  16
+#define FRAMES_PER_PRINTF   500
+
+typedef struct _range_t {
+    int done;
+    int nframes;
+    CamFrameBuffer **frames;
+    CamLogFrameFormat *formats;
+} range_t;
+
+typedef struct _transcoder_t transcoder_t;
+
+typedef struct _worker_t {
+    transcoder_t *t;
+    CamUnitChain *chain;
+    CamUnit *source;
+    CamLogFrameFormat format;
+    int buf_size;
+    GThread *thread;
+    range_t *range;
+    int nproduced;
+} worker_t;
+
+/* Frames are handed out to the workers in ranges of range_size consecutive
+ * frames.  Each range has a slot in a ring of max_ranges slots, which bounds
+ * how far the workers can get ahead of the writer.  end_frame is the number
+ * of frames in the input, once a worker has read past the end of it.  error
+ * is set when a frame can't be read or converted, which stops everything.
+ *
+ * chain_mutex is held by a worker while it restarts its chain, since
+ * starting units can use the unit manager, which is not thread safe. */
+struct _transcoder_t {
+    CamLog *input;
+    CamLog *output;
+    CamLogFrameFormat input_format;
+    int range_size;
+    int max_ranges;
+    range_t *ranges;
+
+    GMutex *mutex;
+    GCond *cond;
+    int next_range;
+    int write_range;
+    int end_frame;
+    int error;
+
+    GMutex *chain_mutex;
+};
+
+static int64_t _timestamp_now()
+{
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void
+on_output_frame_ready (CamUnit *unit, const CamFrameBuffer *buf,
+        const CamUnitFormat *fmt, void *user_data)
+{
+    worker_t *w = (worker_t*) user_data;
+    range_t *range = w->range;
+    // the output must have one frame for each input frame.  Only the first
+    // is kept, and the worker fails if there are more.
+    if (!range || ++w->nproduced > 1)
+        return;
+
+    // units reuse their output buffers, so keep a copy
+    CamFrameBuffer *copy = cam_framebuffer_new_alloc (buf->bytesused);
+    memcpy (copy->data, buf->data, buf->bytesused);
+    copy->bytesused = buf->bytesused;
+    cam_framebuffer_copy_metadata (copy, buf);
+
+    CamLogFrameFormat *format = &range->formats[range->nframes];
+    format->pixelformat = fmt->pixelformat;
+    format->width = fmt->width;
+    format->height = fmt->height;
+    format->stride = fmt->row_stride;
+    range->frames[range->nframes++] = copy;
+}
+
+/* Reads a frame into a new buffer, so that no metadata is carried over from
+ * the previous frame.  Returns 0 on success, 1 at the end of the log, and -1
+ * on error, as cam_log_read_frame_at() does. */
+static int
+read_frame (worker_t *w, int frameno, CamFrameBuffer **buf,
+        CamLogFrameFormat *format)
+{
+    CamLogFrameInfo info;
+    info.data_len = 0;
+    *buf = cam_framebuffer_new_alloc (w->buf_size);
+    int status = cam_log_read_frame_at (w->t->input, frameno, *buf, format,
+            &info);
+    if (status < 0 && info.data_len > (*buf)->length) {
+        g_object_unref (*buf);
+        w->buf_size = info.data_len;
+        *buf = cam_framebuffer_new_alloc (w->buf_size);
+        status = cam_log_read_frame_at (w->t->input, frameno, *buf, format,
+                NULL);
+    }
+    if (status != 0) {
+        g_object_unref (*buf);
+        *buf = NULL;
+    }
+    return status;
+}
+
+static int
+_formats_equal (const CamLogFrameFormat *a, const CamLogFrameFormat *b)
+{
+    return a->pixelformat == b->pixelformat &&
+        a->width == b->width && a->height == b->height &&
+        a->stride == b->stride;
+}
+
+/* Restarts the chain of a worker to convert frames of a new format.
+ * Returns 0 on success, -1 if the chain can't convert them. */
+static int
+set_source_format (worker_t *w, const CamLogFrameFormat *f)
+{
+    g_mutex_lock (w->t->chain_mutex);
+    cam_unit_chain_all_units_stream_shutdown (w->chain);
+    cam_unit_remove_all_output_formats (w->source);
+    cam_unit_add_output_format (w->source, f->pixelformat, NULL,
+            f->width, f->height, f->stride);
+    w->format = *f;
+
+    CamUnit *faulty_unit = cam_unit_chain_all_units_stream_init (w->chain);
+    g_mutex_unlock (w->t->chain_mutex);
+    if (faulty_unit) {
+        fprintf (stderr, "Unit [%s] can't convert %s %dx%d frames\n",
+                cam_unit_get_name (faulty_unit),
+                cam_pixel_format_nickname (f->pixelformat),
+                f->width, f->height);
+        return -1;
+    }
+    return 0;
+}
+
+static void *
+worker_thread (void *user_data)
+{
+    worker_t *w = (worker_t*) user_data;
+    transcoder_t *t = w->t;
+    const CamUnitFormat *fmt = cam_unit_get_output_format (w->source);
+    w->buf_size = fmt->row_stride ?
+        fmt->row_stride * fmt->height : fmt->width * fmt->height * 4;
+
+    while (1) {
+        g_mutex_lock (t->mutex);
+        while (!t->error &&
+                t->next_range - t->write_range >= t->max_ranges)
+            g_cond_wait (t->cond, t->mutex);
+        int r = t->next_range;
+        int first = r * t->range_size;
+        if (t->error || first >= t->end_frame) {
+            g_mutex_unlock (t->mutex);
+            break;
+        }
+        t->next_range++;
+        g_mutex_unlock (t->mutex);
+
+        w->range = &t->ranges[r % t->max_ranges];
+        int end = first;
+        int status = 0;
+        for (; end < first + t->range_size; end++) {
+            CamFrameBuffer *buf;
+            CamLogFrameFormat format;
+            status = read_frame (w, end, &buf, &format);
+            if (status < 0)
+                fprintf (stderr, "Couldn't read frame %d\n", end);
+            if (0 == status && !_formats_equal (&format, &w->format) &&
+                    0 != set_source_format (w, &format)) {
+                g_object_unref (buf);
+                status = -1;
+            }
+            if (status != 0)
+                break;
+            w->nproduced = 0;
+            cam_unit_produce_frame (w->source, buf,
+                    cam_unit_get_output_format (w->source));
+            g_object_unref (buf);
+            if (w->nproduced != 1) {
+                fprintf (stderr, "The chain produced %d frames from frame "
+                        "%d, expected 1\n", w->nproduced, end);
+                status = -1;
+                break;
+            }
+        }
+        w->range = NULL;
+
+        g_mutex_lock (t->mutex);
+        if (status > 0 && end < t->end_frame)
+            t->end_frame = end;
+        if (status < 0)
+            t->error = 1;
+        t->ranges[r % t->max_ranges].done = 1;
+        g_cond_broadcast (t->cond);
+        g_mutex_unlock (t->mutex);
+    }
+    return NULL;
+}
+
+/* Writes the ranges to the output log in order as the workers finish them.
+ * Returns the number of frames written, or -1 on error. */
+static int
+write_ranges (transcoder_t *t)
+{
+    int nwritten = 0;
+    int64_t start_time = _timestamp_now ();
+    for (int r = 0; ; r++) {
+        range_t *range = &t->ranges[r % t->max_ranges];
+
+        g_mutex_lock (t->mutex);
+        while (!t->error && !range->done && r * t->range_size < t->end_frame)
+            g_cond_wait (t->cond, t->mutex);
+        int done = range->done;
+        int error = t->error;
+        g_mutex_unlock (t->mutex);
+        if (error)
+            return -1;
+        if (!done)
+            break;
+
+        int status = 0;
+        for (int i = 0; i < range->nframes; i++) {
+            if (0 == status && 0 != cam_log_write_frame (t->output,
+                        &range->formats[i], range->frames[i], NULL)) {
+                perror ("write");
+                status = -1;
+            }
+            g_object_unref (range->frames[i]);
+        }
+        nwritten += range->nframes;
+        if (nwritten / FRAMES_PER_PRINTF !=
+                (nwritten - range->nframes) / FRAMES_PER_PRINTF) {
+            printf ("%d frames at %.1f Hz\n", nwritten,
+                    nwritten * 1000000.0 / (_timestamp_now () - start_time));
+        }
+
+        g_mutex_lock (t->mutex);
+        range->done = 0;
+        range->nframes = 0;
+        t->write_range++;
+        if (status < 0)
+            t->error = 1;
+        g_cond_broadcast (t->cond);
+        g_mutex_unlock (t->mutex);
+        if (status < 0)
+            return -1;
+    }
+    return nwritten;
+}
+
+static CamUnitChain *
+create_chain (transcoder_t *t, const char *chain_xml, char **unit_ids,
+        int quality, CamUnit **source)
+{
+    CamUnitChain *chain = cam_unit_chain_new ();
+    if (chain_xml) {
+        GError *error = NULL;
+        cam_unit_chain_load_from_str (chain, chain_xml, &error);
+        if (error) {
+            fprintf (stderr, "Couldn't load chain: %s\n", error->message);
+            g_error_free (error);
+            g_object_unref (chain);
+            return NULL;
+        }
+    }
+    for (int i = 0; unit_ids && unit_ids[i]; i++) {
+        if (!cam_unit_chain_add_unit_by_id (chain, unit_ids[i])) {
+            fprintf (stderr, "Couldn't create unit [%s]\n", unit_ids[i]);
+            g_object_unref (chain);
+            return NULL;
+        }
+    }
+
+    // the frames read from the log are fed into the chain by a plain CamUnit
+    // at its head
+    *source = CAM_UNIT (g_object_new (CAM_TYPE_UNIT, NULL));
+    CamLogFrameFormat *f = &t->input_format;
+    cam_unit_add_output_format (*source, f->pixelformat, NULL,
+            f->width, f->height, f->stride);
+    cam_unit_chain_insert_unit (chain, *source, 0);
+
+    if (quality > 0) {
+        GList *units = cam_unit_chain_get_units (chain);
+        for (GList *uiter = units; uiter; uiter = uiter->next) {
+            CamUnit *unit = CAM_UNIT (uiter->data);
+            if (cam_unit_find_control (unit, "quality"))
+                cam_unit_set_control_int (unit, "quality", quality);
+        }
+        g_list_free (units);
+    }
+
+    CamUnit *faulty_unit = cam_unit_chain_all_units_stream_init (chain);
+    if (faulty_unit) {
+        fprintf (stderr, "Unit [%s] is not ready, aborting...\n",
+                cam_unit_get_name (faulty_unit));
+        g_object_unref (chain);
+        return NULL;
+    }
+    return chain;
+}
+
+static void
+usage()
+{
+    fprintf(stderr,
+        "Usage: camlog-transcode [OPTIONS] INPUT OUTPUT\n"
+        "\n"
+        "camlog-transcode converts every frame of the log file INPUT with a\n"
+        "chain of Camunits filter units, and writes the results to the new log\n"
+        "file OUTPUT.  Frame metadata is preserved.  Frames are converted in\n"
+        "parallel, one chain per thread, and written in their original order.\n"
+        "\n"
+        "Options:\n"
+        " -h, --help          Shows this help text\n"
+        " -u, --units LIST    Convert with the units in LIST, a comma-separated\n"
+        "                     list of unit IDs.  The default is\n"
+        "                     " DEFAULT_UNITS "\n"
+        " -c, --chain NAME    Convert with the units in chain file NAME.  The\n"
+        "                     chain should not contain an input unit.\n"
+        " -q, --quality N     Set the quality control of the units that have\n"
+        "                     one, e.g. convert.jpeg_compress, to N.\n"
+        " -j, --threads N     Use N threads.  The default is one per CPU.\n"
+        " -r, --range N       Give each thread N consecutive frames at a time.\n"
+        "                     The default is %d.\n"
+        " -f, --force         Overwrite OUTPUT if it already exists.\n"
+        " --plugin-path PATH  Add the directories in PATH to the plugin\n"
+        "                     search path.  PATH should be a colon-delimited\n"
+        "                     list.\n",
+        DEFAULT_RANGE_SIZE);
+}
+
+int main(int argc, char **argv)
+{
+    int status = 1;
+    char *units_arg = NULL;
+    char *chain_fname = NULL;
+    char *chain_xml = NULL;
+    char **unit_ids = NULL;
+    char *extra_plugin_path = NULL;
+    int quality = 0;
+    int nthreads = sysconf (_SC_NPROCESSORS_ONLN);
+    int range_size = DEFAULT_RANGE_SIZE;
+    int overwrite = 0;
+    worker_t *workers = NULL;
+    int nworkers = 0;
+
+    transcoder_t t;
+    memset (&t, 0, sizeof (t));
+
+    setlinebuf (stdout);
+
+    char *optstring = "hu:c:q:j:r:fp:";
+    int c;
+    struct option long_opts[] = {
+        { "help", no_argument, 0, 'h' },
+        { "units", required_argument, 0, 'u' },
+        { "chain", required_argument, 0, 'c' },
+        { "quality", required_argument, 0, 'q' },
+        { "threads", required_argument, 0, 'j' },
+        { "range", required_argument, 0, 'r' },
+        { "force", no_argument, 0, 'f' },
+        { "plugin-path", required_argument, 0, 'p' },
+        { 0, 0, 0, 0 }
+    };
+
+    g_type_init();
+    if (!g_thread_supported ()) g_thread_init (NULL);
+
+    while ((c = getopt_long (argc, argv, optstring, long_opts, 0)) >= 0)
+    {
+        switch (c) {
+            case 'u':
+                free (units_arg);
+                units_arg = strdup (optarg);
+                break;
+            case 'c':
+                free (chain_fname);
+                chain_fname = strdup (optarg);
+                break;
+            case 'q':
+                quality = atoi (optarg);
+                break;
+            case 'j':
+                nthreads = atoi (optarg);
+                break;
+            case 'r':
+                range_size = atoi (optarg);
+                break;
+            case 'f':
+                overwrite = 1;
+                break;
+            case 'p':
+                free (extra_plugin_path);
+                extra_plugin_path = strdup (optarg);
+                break;
+            case 'h':
+            default:
+                usage();
+                return 1;
+        };
+    }
+    if (optind != argc - 2 || nthreads < 1 || range_size < 1) {
+        usage();
+        goto done;
+    }
+    const char *input_fname = argv[optind];
+    const char *output_fname = argv[optind + 1];
+
+    // search for plugins in non-standard directories
+    if (extra_plugin_path) {
+        CamUnitManager *manager = cam_unit_manager_get_and_ref();
+        char **path_dirs = g_strsplit(extra_plugin_path, ":", 0);
+        for (int i=0; path_dirs[i]; i++) {
+            cam_unit_manager_add_plugin_dir (manager, path_dirs[i]);
+        }
+        g_strfreev (path_dirs);
+        g_object_unref(manager);
+    }
+
+    if (chain_fname) {
+        if (units_arg) {
+            fprintf (stderr, "Only one of -c and -u can be specified\n");
+            goto done;
+        }
+        if (!g_file_get_contents (chain_fname, &chain_xml, NULL, NULL)) {
+            fprintf (stderr, "Couldn't read chain file [%s]\n", chain_fname);
+            goto done;
+        }
+    } else {
+        unit_ids = g_strsplit (units_arg ? units_arg : DEFAULT_UNITS, ",", 0);
+    }
+
+    struct stat statbuf;
+    if (!overwrite && 0 == stat (output_fname, &statbuf)) {
+        fprintf (stderr, "%s already exists.  Use -f to overwrite it.\n",
+                output_fname);
+        goto done;
+    }
+
+    t.input = cam_log_new (input_fname, "r");
+    if (!t.input) {
+        fprintf (stderr, "Couldn't open %s\n", input_fname);
+        goto done;
+    }
+    if (0 != cam_log_get_frame_format (t.input, &t.input_format)) {
+        fprintf (stderr, "%s has no frames\n", input_fname);
+        goto done;
+    }
+    t.output = cam_log_new (output_fname, "w");
+    if (!t.output) {
+        fprintf (stderr, "Couldn't create %s\n", output_fname);
+        goto done;
+    }
+
+    t.range_size = range_size;
+    t.max_ranges = 2 * nthreads;
+    t.ranges = (range_t*) calloc (t.max_ranges, sizeof (range_t));
+    for (int i = 0; i < t.max_ranges; i++) {
+        t.ranges[i].frames = (CamFrameBuffer**)
+            calloc (range_size, sizeof (CamFrameBuffer*));
+        t.ranges[i].formats = (CamLogFrameFormat*)
+            calloc (range_size, sizeof (CamLogFrameFormat));
+    }
+    t.mutex = g_mutex_new ();
+    t.cond = g_cond_new ();
+    t.chain_mutex = g_mutex_new ();
+    t.end_frame = G_MAXINT;
+
+    // plugins are loaded and units created here, since the unit manager is
+    // not thread safe.  After that, each chain is only used by its worker.
+    workers = (worker_t*) calloc (nthreads, sizeof (worker_t));
+    for (nworkers = 0; nworkers < nthreads; nworkers++) {
+        worker_t *w = &workers[nworkers];
+        w->t = &t;
+        w->chain = create_chain (&t, chain_xml, unit_ids, quality,
+                &w->source);
+        if (!w->chain)
+            goto done;
+        w->format = t.input_format;
+        g_signal_connect (G_OBJECT (cam_unit_chain_get_last_unit (w->chain)),
+                "frame-ready", G_CALLBACK (on_output_frame_ready), w);
+    }
+    const CamUnitFormat *outfmt =
+        cam_unit_get_output_format (cam_unit_chain_get_last_unit (
+                    workers[0].chain));
+    printf ("%s %dx%d -> %s %dx%d, %d threads\n",
+            cam_pixel_format_nickname (t.input_format.pixelformat),
+            t.input_format.width, t.input_format.height,
+            cam_pixel_format_nickname (outfmt->pixelformat),
+            outfmt->width, outfmt->height, nthreads);
+
+    int64_t start_time = _timestamp_now ();
+    for (int i = 0; i < nworkers; i++)
+        workers[i].thread = g_thread_create (worker_thread, &workers[i],
+                TRUE, NULL);
+    int nwritten = write_ranges (&t);
+    for (int i = 0; i < nworkers; i++)
+        g_thread_join (workers[i].thread);
+    double elapsed = (_timestamp_now () - start_time) * 1e-6;
+
+    if (nwritten < 0)
+        goto done;
+    printf ("%d frames in %.1f s (%.1f Hz)\n", nwritten, elapsed,
+            nwritten / elapsed);
+    status = 0;
+
+done:
+    for (int i = 0; i < nworkers; i++) {
+        cam_unit_chain_all_units_stream_shutdown (workers[i].chain);
+        g_object_unref (workers[i].chain);
+    }
+    free (workers);
+    for (int i = 0; t.ranges && i < t.max_ranges; i++) {
+        for (int j = 0; j < t.ranges[i].nframes; j++)
+            g_object_unref (t.ranges[i].frames[j]);
+        free (t.ranges[i].frames);
+        free (t.ranges[i].formats);
+    }
+    free (t.ranges);
+    if (t.cond) g_cond_free (t.cond);
+    if (t.mutex) g_mutex_free (t.mutex);
+    if (t.chain_mutex) g_mutex_free (t.chain_mutex);
+    if (t.input) cam_log_destroy (t.input);
+    if (t.output) cam_log_destroy (t.output);
+    g_strfreev (unit_ids);
+    g_free (chain_xml);
+    free (units_arg);
+    free (chain_fname);
+    free (extra_plugin_path);
+    return status;
+}
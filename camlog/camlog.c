@@ -8,6 +8,7 @@
 #include <glib.h>
 
 #include <camunits/cam.h>
+#include <camunits/trace.h>
 
 #include "signal_pipe.h"
 
@@ -19,6 +20,16 @@ typedef struct _state_t {
 
 #define FRAMES_PER_PRINTF   100
 
+// long options without a short equivalent
+enum {
+    OPT_CPUS = 256,
+    OPT_WORKER_CPUS,
+    OPT_SCHED,
+    OPT_PRIORITY,
+    OPT_MLOCK,
+    OPT_TRACE
+};
+
 static int64_t _timestamp_now()
 {
     struct timeval tv;
@@ -98,7 +109,35 @@ usage()
         " -v, --verbose       Print information about each frame.\n\n"
         " --plugin-path PATH  Add the directories in PATH to the plugin\n"
         "                     search path.  PATH should be a colon-delimited\n"
-        "                     list.\n");
+        "                     list.\n"
+        "\n"
+        "Low-latency options.  These override the settings of a chain file.\n"
+        " --cpus LIST         Pin the capture and processing threads of the\n"
+        "                     chain to the CPUs in LIST, e.g. 2,3 or 2-3.\n"
+        " --worker-cpus LIST  Pin the shared worker threads to the CPUs in\n"
+        "                     LIST.\n"
+        " --sched POLICY      Scheduling policy for the chain's threads: other,\n"
+        "                     fifo, or rr.\n"
+        " --priority N        Real-time priority for --sched fifo or rr, or for\n"
+        "                     the policy of the chain file.\n"
+        " --mlock             Lock all memory, including frame buffers, into\n"
+        "                     RAM.\n"
+        "\n"
+        " --trace FILE        Record when each unit processes each frame, and\n"
+        "                     write the timeline to FILE on exit, in the Chrome\n"
+        "                     trace format.\n");
+}
+
+static int
+parse_cpus_arg (const char *arg, int **cpus, int *ncpus)
+{
+    free (*cpus);
+    *cpus = cam_thread_parse_cpu_list (arg, ncpus);
+    if (!*cpus) {
+        fprintf (stderr, "Invalid CPU list [%s]\n", arg);
+        return -1;
+    }
+    return 0;
 }
 
 int main(int argc, char **argv)
@@ -112,6 +151,15 @@ int main(int argc, char **argv)
     int do_logging = 1;
     GMainLoop *mainloop = NULL;
     char *extra_plugin_path = NULL;
+    int *cpus = NULL;
+    int ncpus = 0;
+    int *worker_cpus = NULL;
+    int nworker_cpus = 0;
+    int have_sched = 0;
+    int have_priority = 0;
+    CamThreadSchedPolicy sched_policy = CAM_THREAD_SCHED_OTHER;
+    int sched_priority = 0;
+    int do_mlock = 0;
     state_t *self = (state_t*)calloc(1, sizeof(state_t));
     self->verbose = 0;
     self->frameno = 0;
@@ -130,6 +178,12 @@ int main(int argc, char **argv)
         { "no-write", no_argument, 0, 'n' },
         { "verbose", no_argument, 0, 'v' },
         { "plugin-path", no_argument, 0, 'p' },
+        { "cpus", required_argument, 0, OPT_CPUS },
+        { "worker-cpus", required_argument, 0, OPT_WORKER_CPUS },
+        { "sched", required_argument, 0, OPT_SCHED },
+        { "priority", required_argument, 0, OPT_PRIORITY },
+        { "mlock", no_argument, 0, OPT_MLOCK },
+        { "trace", required_argument, 0, OPT_TRACE },
         { 0, 0, 0, 0 }
     };
 
@@ -162,6 +216,32 @@ int main(int argc, char **argv)
             case 'p':
                 extra_plugin_path = strdup (optarg);
                 break;
+            case OPT_CPUS:
+                if (0 != parse_cpus_arg (optarg, &cpus, &ncpus))
+                    return 1;
+                break;
+            case OPT_WORKER_CPUS:
+                if (0 != parse_cpus_arg (optarg, &worker_cpus, &nworker_cpus))
+                    return 1;
+                break;
+            case OPT_SCHED:
+                if (0 != cam_thread_sched_policy_from_string (optarg,
+                            &sched_policy)) {
+                    fprintf (stderr, "Unrecognized policy [%s]\n", optarg);
+                    return 1;
+                }
+                have_sched = 1;
+                break;
+            case OPT_PRIORITY:
+                sched_priority = atoi (optarg);
+                have_priority = 1;
+                break;
+            case OPT_MLOCK:
+                do_mlock = 1;
+                break;
+            case OPT_TRACE:
+                cam_trace_write_on_exit (optarg);
+                break;
             case 'h':
             default:
                 usage();
@@ -218,6 +298,31 @@ int main(int argc, char **argv)
         free(xml_str);
     }
 
+    if (cpus && 0 != cam_unit_chain_set_cpu_affinity (chain, cpus, ncpus))
+        goto done;
+    if (worker_cpus)
+        cam_thread_pool_set_affinity (cam_thread_pool_get_default (),
+                worker_cpus, nworker_cpus);
+    if (have_sched || have_priority) {
+        // an option that isn't given keeps the setting of the chain file
+        CamThreadSchedPolicy policy;
+        int priority;
+        cam_unit_chain_get_scheduling (chain, &policy, &priority);
+        if (have_sched)
+            policy = sched_policy;
+        if (have_priority)
+            priority = sched_priority;
+        if (have_priority && policy == CAM_THREAD_SCHED_OTHER) {
+            fprintf (stderr, "--priority needs a real-time policy, "
+                    "from --sched or the chain file\n");
+            goto done;
+        }
+        if (0 != cam_unit_chain_set_scheduling (chain, policy, priority))
+            goto done;
+    }
+    if (do_mlock && 0 != cam_unit_chain_set_mlock (chain, TRUE))
+        goto done;
+
     CamUnit *logger_unit = NULL;
     if (do_logging) {
         // create the logger unit and add it to the chain.
@@ -276,6 +381,8 @@ done:
     free(input_id);
     free(log_fname);
     free(chain_fname);
+    free(cpus);
+    free(worker_cpus);
     if (self) {
         free (self);
     }
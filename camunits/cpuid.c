@@ -1,13 +1,26 @@
 #include "cpuid.h"
 
-#define CPUID(func,ax,bx,cx,dx)\
+/* On x86-64, %rbx is not reserved for the PIC register, and swapping only
+ * its lower half with xchgl would clobber the upper half. */
+#ifdef __x86_64__
+#define CPUID_COUNT(func,sub,ax,bx,cx,dx)\
+    __asm__ __volatile__ ( \
+            "cpuid              \n\t" \
+            : "=a" (ax), "=b" (bx), "=c" (cx), "=d" (dx) \
+            : "a" (func), "c" (sub) \
+            : "cc")
+#else
+#define CPUID_COUNT(func,sub,ax,bx,cx,dx)\
     __asm__ __volatile__ ( \
             "xchgl %%ebx, %1    \n\t" \
             "cpuid              \n\t" \
             "xchgl %%ebx, %1    \n\t" \
             : "=a" (ax), "=r" (bx), "=c" (cx), "=d" (dx) \
-            : "a" (func) \
+            : "a" (func), "c" (sub) \
             : "cc")
+#endif
+
+#define CPUID(func,ax,bx,cx,dx) CPUID_COUNT(func,0,ax,bx,cx,dx)
 
 void
 cpuid_detect (int * sse2, int * sse3)
@@ -20,3 +33,32 @@ cpuid_detect (int * sse2, int * sse3)
     if (sse3)
         *sse3 = c & 1;
 }
+
+void
+cpuid_detect_ext (int * ssse3, int * avx2)
+{
+    int a, b, c, d;
+    *avx2 = 0;
+
+    CPUID (0, a, b, c, d);
+    int max_leaf = a;
+
+    CPUID (1, a, b, c, d);
+    *ssse3 = (c >> 9) & 1;
+    if (max_leaf < 7)
+        return;
+
+    /* The CPU must support AVX, and the OS must save the YMM registers on
+     * context switches (OSXSAVE set, XCR0 bits 1 and 2 set). */
+    if (!((c >> 27) & 1) || !((c >> 28) & 1))
+        return;
+
+    unsigned int xcr0_lo, xcr0_hi;
+    __asm__ __volatile__ (".byte 0x0f, 0x01, 0xd0" /* xgetbv */
+            : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+    if ((xcr0_lo & 6) != 6)
+        return;
+
+    CPUID_COUNT (7, 0, a, b, c, d);
+    *avx2 = (b >> 5) & 1;
+}
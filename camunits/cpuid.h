@@ -2,5 +2,6 @@
 #define __CPUID_H__
 
 void cpuid_detect (int * sse2, int * sse3);
+void cpuid_detect_ext (int * ssse3, int * avx2);
 
 #endif
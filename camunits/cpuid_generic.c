@@ -8,3 +8,10 @@ cpuid_detect (int * sse2, int * sse3)
     if (sse3)
         *sse3 = 0;
 }
+
+void
+cpuid_detect_ext (int * ssse3, int * avx2)
+{
+    *ssse3 = 0;
+    *avx2 = 0;
+}
@@ -0,0 +1,454 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib-object.h>
+
+#include "format_planner.h"
+#include "dbg.h"
+
+#define err(args...) fprintf (stderr, args)
+
+struct _CamFormatPlanner {
+    GList *conversions;
+};
+
+typedef struct _default_conv_t {
+    const char *unit_id;
+    CamPixelFormat inpfmt;
+    CamPixelFormat outpfmt;
+    double cost;
+} default_conv_t;
+
+/* Conversions provided by the standard plugins.  Costs are in nanoseconds
+ * per pixel, from timing the pixels.c kernels at 1920x1080 with the SSSE3
+ * build of libcamunits.  The fast_debayer costs include its plane splitting,
+ * and the JPEG costs are typical of each library rather than measured. */
+static const default_conv_t default_conversions[] = {
+    { "convert.colorspace", CAM_PIXEL_FORMAT_GRAY, CAM_PIXEL_FORMAT_RGB, 0.3 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_RGB, CAM_PIXEL_FORMAT_GRAY, 2.5 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_RGB, CAM_PIXEL_FORMAT_BGRA, 0.4 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_RGB, CAM_PIXEL_FORMAT_BGR, 0.3 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_BGRA, CAM_PIXEL_FORMAT_RGB, 0.4 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_BGRA, CAM_PIXEL_FORMAT_BGR, 0.4 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_BGRA, CAM_PIXEL_FORMAT_I420, 0.9 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_BGR, CAM_PIXEL_FORMAT_RGB, 0.3 },
+
+    { "convert.colorspace", CAM_PIXEL_FORMAT_I420, CAM_PIXEL_FORMAT_RGB, 3.0 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_I420, CAM_PIXEL_FORMAT_RGBA, 3.2 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_I420, CAM_PIXEL_FORMAT_BGR, 3.4 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_I420, CAM_PIXEL_FORMAT_BGRA, 3.9 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_I420, CAM_PIXEL_FORMAT_GRAY, 0.1 },
+
+    { "convert.colorspace", CAM_PIXEL_FORMAT_YUYV, CAM_PIXEL_FORMAT_BGRA, 4.5 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_YUYV, CAM_PIXEL_FORMAT_GRAY, 1.0 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_YUYV, CAM_PIXEL_FORMAT_RGB, 5.2 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_YUYV, CAM_PIXEL_FORMAT_I420, 0.3 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_UYVY, CAM_PIXEL_FORMAT_BGRA, 4.2 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_UYVY, CAM_PIXEL_FORMAT_GRAY, 0.9 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_UYVY, CAM_PIXEL_FORMAT_RGB, 4.9 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_UYVY, CAM_PIXEL_FORMAT_I420, 0.3 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_IYU1, CAM_PIXEL_FORMAT_BGRA, 4.0 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_IYU1, CAM_PIXEL_FORMAT_GRAY, 2.6 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_IYU1, CAM_PIXEL_FORMAT_RGB, 3.3 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_NV12, CAM_PIXEL_FORMAT_RGB, 0.7 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_NV12, CAM_PIXEL_FORMAT_BGRA, 0.6 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_NV12, CAM_PIXEL_FORMAT_GRAY, 0.1 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_YUV411P,
+        CAM_PIXEL_FORMAT_RGB, 0.7 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_YUV411P,
+        CAM_PIXEL_FORMAT_BGRA, 0.6 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_IYU2, CAM_PIXEL_FORMAT_RGB, 1.0 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_IYU2, CAM_PIXEL_FORMAT_BGRA, 0.9 },
+
+    { "convert.colorspace", CAM_PIXEL_FORMAT_BE_GRAY16,
+        CAM_PIXEL_FORMAT_LE_GRAY16, 0.3 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_LE_GRAY16,
+        CAM_PIXEL_FORMAT_BE_GRAY16, 0.3 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_BE_RGB16,
+        CAM_PIXEL_FORMAT_LE_RGB16, 0.8 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_LE_RGB16,
+        CAM_PIXEL_FORMAT_BE_RGB16, 0.8 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_BE_GRAY16,
+        CAM_PIXEL_FORMAT_GRAY, 0.2 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_LE_GRAY16,
+        CAM_PIXEL_FORMAT_GRAY, 0.2 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_BE_RGB16,
+        CAM_PIXEL_FORMAT_RGB, 0.5 },
+    { "convert.colorspace", CAM_PIXEL_FORMAT_LE_RGB16,
+        CAM_PIXEL_FORMAT_RGB, 0.5 },
+
+    { "ipp.jpeg_decompress", CAM_PIXEL_FORMAT_MJPEG,
+        CAM_PIXEL_FORMAT_RGB, 2.0 },
+    { "framewave.jpeg_decompress", CAM_PIXEL_FORMAT_MJPEG,
+        CAM_PIXEL_FORMAT_RGB, 3.0 },
+    { "convert.jpeg_decompress", CAM_PIXEL_FORMAT_MJPEG,
+        CAM_PIXEL_FORMAT_RGB, 8.0 },
+    { "convert.jpeg_decompress", CAM_PIXEL_FORMAT_MJPEG,
+        CAM_PIXEL_FORMAT_GRAY, 5.0 },
+};
+
+static const CamPixelFormat bayer8_formats[] = {
+    CAM_PIXEL_FORMAT_BAYER_BGGR, CAM_PIXEL_FORMAT_BAYER_GBRG,
+    CAM_PIXEL_FORMAT_BAYER_GRBG, CAM_PIXEL_FORMAT_BAYER_RGGB
+};
+static const CamPixelFormat be_bayer16_formats[] = {
+    CAM_PIXEL_FORMAT_BE_BAYER16_BGGR, CAM_PIXEL_FORMAT_BE_BAYER16_GBRG,
+    CAM_PIXEL_FORMAT_BE_BAYER16_GRBG, CAM_PIXEL_FORMAT_BE_BAYER16_RGGB
+};
+static const CamPixelFormat le_bayer16_formats[] = {
+    CAM_PIXEL_FORMAT_LE_BAYER16_BGGR, CAM_PIXEL_FORMAT_LE_BAYER16_GBRG,
+    CAM_PIXEL_FORMAT_LE_BAYER16_GRBG, CAM_PIXEL_FORMAT_LE_BAYER16_RGGB
+};
+
+static int
+unit_available (CamUnitManager *manager, const char *unit_id)
+{
+    return !manager ||
+        cam_unit_manager_find_unit_description (manager, unit_id);
+}
+
+static void
+add_default (CamFormatPlanner *self, CamUnitManager *manager,
+        const char *unit_id, CamPixelFormat inpfmt, CamPixelFormat outpfmt,
+        double cost)
+{
+    if (unit_available (manager, unit_id))
+        cam_format_planner_add_conversion (self, unit_id, inpfmt, outpfmt,
+                cost);
+}
+
+CamFormatPlanner *
+cam_format_planner_new (CamUnitManager *manager)
+{
+    CamFormatPlanner *self = g_slice_new0 (CamFormatPlanner);
+
+    int ndefaults = sizeof (default_conversions) / sizeof (default_conv_t);
+    for (int i=0; i<ndefaults; i++) {
+        const default_conv_t *dc = &default_conversions[i];
+        add_default (self, manager, dc->unit_id, dc->inpfmt, dc->outpfmt,
+                dc->cost);
+    }
+
+    for (int i=0; i<4; i++) {
+        add_default (self, manager, "convert.fast_debayer",
+                bayer8_formats[i], CAM_PIXEL_FORMAT_BGRA, 1.5);
+        add_default (self, manager, "convert.fast_debayer",
+                bayer8_formats[i], CAM_PIXEL_FORMAT_GRAY, 1.0);
+        add_default (self, manager, "convert.fast_debayer",
+                bayer8_formats[i], CAM_PIXEL_FORMAT_I420, 1.9);
+        add_default (self, manager, "convert.fast_debayer",
+                be_bayer16_formats[i], CAM_PIXEL_FORMAT_BGRA, 1.7);
+        add_default (self, manager, "convert.fast_debayer",
+                le_bayer16_formats[i], CAM_PIXEL_FORMAT_BGRA, 1.7);
+        add_default (self, manager, "convert.fast_debayer",
+                be_bayer16_formats[i], CAM_PIXEL_FORMAT_BE_RGB16, 1.8);
+        add_default (self, manager, "convert.fast_debayer",
+                le_bayer16_formats[i], CAM_PIXEL_FORMAT_LE_RGB16, 1.8);
+
+        add_default (self, manager, "convert.colorspace",
+                be_bayer16_formats[i], CAM_PIXEL_FORMAT_BGRA, 0.9);
+        add_default (self, manager, "convert.colorspace",
+                le_bayer16_formats[i], CAM_PIXEL_FORMAT_BGRA, 0.9);
+        add_default (self, manager, "convert.colorspace",
+                be_bayer16_formats[i], CAM_PIXEL_FORMAT_BE_RGB16, 1.8);
+        add_default (self, manager, "convert.colorspace",
+                le_bayer16_formats[i], CAM_PIXEL_FORMAT_LE_RGB16, 1.8);
+    }
+    return self;
+}
+
+static void
+conversion_free (CamFormatConversion *conv)
+{
+    free (conv->unit_id);
+    g_slice_free (CamFormatConversion, conv);
+}
+
+void
+cam_format_planner_destroy (CamFormatPlanner *self)
+{
+    for (GList *citer=self->conversions; citer; citer=citer->next)
+        conversion_free ((CamFormatConversion*) citer->data);
+    g_list_free (self->conversions);
+    g_slice_free (CamFormatPlanner, self);
+}
+
+void
+cam_format_planner_add_conversion (CamFormatPlanner *self,
+        const char *unit_id, CamPixelFormat inpfmt, CamPixelFormat outpfmt,
+        double cost)
+{
+    for (GList *citer=self->conversions; citer; citer=citer->next) {
+        CamFormatConversion *conv = (CamFormatConversion*) citer->data;
+        if (conv->inpfmt == inpfmt && conv->outpfmt == outpfmt &&
+                !strcmp (conv->unit_id, unit_id)) {
+            conv->cost = cost;
+            return;
+        }
+    }
+
+    CamFormatConversion *conv = g_slice_new (CamFormatConversion);
+    conv->unit_id = strdup (unit_id);
+    conv->inpfmt = inpfmt;
+    conv->outpfmt = outpfmt;
+    conv->cost = cost;
+    self->conversions = g_list_append (self->conversions, conv);
+}
+
+void
+cam_format_planner_remove_unit (CamFormatPlanner *self, const char *unit_id)
+{
+    GList *citer = self->conversions;
+    while (citer) {
+        GList *next = citer->next;
+        CamFormatConversion *conv = (CamFormatConversion*) citer->data;
+        if (!strcmp (conv->unit_id, unit_id)) {
+            conversion_free (conv);
+            self->conversions = g_list_delete_link (self->conversions, citer);
+        }
+        citer = next;
+    }
+}
+
+static int
+is_accepted (CamPixelFormat pfmt, const CamPixelFormat *accepted,
+        int naccepted)
+{
+    for (int i=0; i<naccepted; i++) {
+        if (accepted[i] == pfmt || accepted[i] == CAM_PIXEL_FORMAT_ANY)
+            return 1;
+    }
+    return 0;
+}
+
+/* Conversions that discard color, bit depth, or chroma resolution are charged
+ * this much extra, so that they are only used when every path loses the same
+ * information, and never to reach a cheap intermediate format (e.g. YUYV to
+ * GRAY to RGB, or YUYV to I420 to RGB). */
+#define LOSSY_PENALTY 1e6
+
+static int
+format_channels (CamPixelFormat pfmt)
+{
+    switch (pfmt) {
+        case CAM_PIXEL_FORMAT_GRAY:
+        case CAM_PIXEL_FORMAT_BE_GRAY16:
+        case CAM_PIXEL_FORMAT_LE_GRAY16:
+        case CAM_PIXEL_FORMAT_BE_SIGNED_GRAY16:
+        case CAM_PIXEL_FORMAT_FLOAT_GRAY32:
+            return 1;
+        default:
+            return 3;
+    }
+}
+
+static int
+format_depth (CamPixelFormat pfmt)
+{
+    switch (pfmt) {
+        case CAM_PIXEL_FORMAT_BE_BAYER16_BGGR:
+        case CAM_PIXEL_FORMAT_BE_BAYER16_GBRG:
+        case CAM_PIXEL_FORMAT_BE_BAYER16_GRBG:
+        case CAM_PIXEL_FORMAT_BE_BAYER16_RGGB:
+        case CAM_PIXEL_FORMAT_LE_BAYER16_BGGR:
+        case CAM_PIXEL_FORMAT_LE_BAYER16_GBRG:
+        case CAM_PIXEL_FORMAT_LE_BAYER16_GRBG:
+        case CAM_PIXEL_FORMAT_LE_BAYER16_RGGB:
+        case CAM_PIXEL_FORMAT_BE_RGB16:
+        case CAM_PIXEL_FORMAT_LE_RGB16:
+        case CAM_PIXEL_FORMAT_BE_GRAY16:
+        case CAM_PIXEL_FORMAT_LE_GRAY16:
+        case CAM_PIXEL_FORMAT_BE_SIGNED_GRAY16:
+        case CAM_PIXEL_FORMAT_BE_SIGNED_RGB16:
+            return 16;
+        case CAM_PIXEL_FORMAT_FLOAT_GRAY32:
+            return 32;
+        default:
+            return 8;
+    }
+}
+
+/* Number of pixels that share each chroma sample */
+static int
+format_chroma_subsampling (CamPixelFormat pfmt)
+{
+    switch (pfmt) {
+        case CAM_PIXEL_FORMAT_YUYV:
+        case CAM_PIXEL_FORMAT_UYVY:
+            return 2;
+        case CAM_PIXEL_FORMAT_I420:
+        case CAM_PIXEL_FORMAT_NV12:
+        case CAM_PIXEL_FORMAT_YUV411P:
+        case CAM_PIXEL_FORMAT_IYU1:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+static int
+is_lossy (const CamFormatConversion *conv)
+{
+    return format_channels (conv->outpfmt) < format_channels (conv->inpfmt) ||
+        format_depth (conv->outpfmt) < format_depth (conv->inpfmt) ||
+        format_chroma_subsampling (conv->outpfmt) >
+            format_chroma_subsampling (conv->inpfmt);
+}
+
+typedef struct _plan_node_t {
+    CamPixelFormat pfmt;
+    // cost including penalties, used to order the search
+    double cost;
+    // actual cost of the conversions, in nanoseconds per pixel
+    double ns;
+    int done;
+    // the conversion that reaches this node on the cheapest known path
+    CamFormatConversion *via;
+} plan_node_t;
+
+static plan_node_t *
+find_node (GArray *nodes, CamPixelFormat pfmt)
+{
+    for (int i=0; i<nodes->len; i++) {
+        plan_node_t *node = &g_array_index (nodes, plan_node_t, i);
+        if (node->pfmt == pfmt) return node;
+    }
+    return NULL;
+}
+
+int
+cam_format_planner_plan (CamFormatPlanner *self, CamPixelFormat src,
+        const CamPixelFormat *accepted, int naccepted, GList **steps,
+        double *cost)
+{
+    *steps = NULL;
+    if (is_accepted (src, accepted, naccepted)) {
+        if (cost) *cost = 0;
+        return 0;
+    }
+
+    // Dijkstra's algorithm.  There are only a few dozen formats, so the
+    // nodes are kept in an array and searched linearly.
+    GArray *nodes = g_array_new (FALSE, FALSE, sizeof (plan_node_t));
+    plan_node_t start = { src, 0, 0, 0, NULL };
+    g_array_append_val (nodes, start);
+
+    plan_node_t *goal = NULL;
+    while (1) {
+        plan_node_t *cur = NULL;
+        for (int i=0; i<nodes->len; i++) {
+            plan_node_t *node = &g_array_index (nodes, plan_node_t, i);
+            if (!node->done && (!cur || node->cost < cur->cost))
+                cur = node;
+        }
+        if (!cur) break;
+        cur->done = 1;
+
+        if (is_accepted (cur->pfmt, accepted, naccepted)) {
+            goal = cur;
+            break;
+        }
+
+        CamPixelFormat cur_pfmt = cur->pfmt;
+        double cur_cost = cur->cost;
+        double cur_ns = cur->ns;
+        for (GList *citer=self->conversions; citer; citer=citer->next) {
+            CamFormatConversion *conv = (CamFormatConversion*) citer->data;
+            if (conv->inpfmt != cur_pfmt) continue;
+
+            double ns = cur_ns + conv->cost + CAM_FORMAT_PLANNER_HOP_COST;
+            double new_cost = cur_cost + conv->cost +
+                CAM_FORMAT_PLANNER_HOP_COST +
+                (is_lossy (conv) ? LOSSY_PENALTY : 0);
+            plan_node_t *next = find_node (nodes, conv->outpfmt);
+            if (!next) {
+                // may reallocate the array, so cur is not used after this
+                plan_node_t node = { conv->outpfmt, new_cost, ns, 0, conv };
+                g_array_append_val (nodes, node);
+            } else if (!next->done && new_cost < next->cost) {
+                next->cost = new_cost;
+                next->ns = ns;
+                next->via = conv;
+            }
+        }
+    }
+
+    if (!goal) {
+        dbg (DBG_MANAGER, "no conversion from %s\n",
+                cam_pixel_format_nickname (src));
+        g_array_free (nodes, TRUE);
+        return -1;
+    }
+
+    if (cost) *cost = goal->ns;
+    for (plan_node_t *node=goal; node->via;
+            node=find_node (nodes, node->via->inpfmt)) {
+        *steps = g_list_prepend (*steps, node->via);
+    }
+    g_array_free (nodes, TRUE);
+    return 0;
+}
+
+static void
+free_units (GList *units)
+{
+    for (GList *uiter=units; uiter; uiter=uiter->next) {
+        cam_unit_set_input (CAM_UNIT (uiter->data), NULL);
+        g_object_unref (uiter->data);
+    }
+    g_list_free (units);
+}
+
+int
+cam_format_planner_create_units (CamFormatPlanner *self,
+        CamUnitManager *manager, CamUnit *input, CamPixelFormat src,
+        const CamPixelFormat *accepted, int naccepted, GList **units)
+{
+    *units = NULL;
+    while (1) {
+        GList *steps = NULL;
+        double cost = 0;
+        if (0 != cam_format_planner_plan (self, src, accepted, naccepted,
+                    &steps, &cost))
+            return -1;
+
+        GList *result = NULL;
+        CamUnit *prev = input;
+        char *failed_id = NULL;
+        for (GList *siter=steps; siter; siter=siter->next) {
+            CamFormatConversion *conv = (CamFormatConversion*) siter->data;
+            CamUnit *unit = cam_unit_manager_create_unit_by_id (manager,
+                    conv->unit_id);
+            if (!unit) {
+                failed_id = strdup (conv->unit_id);
+                break;
+            }
+            g_object_ref_sink (unit);
+            dbg (DBG_MANAGER, "[%s] %s -> %s\n", conv->unit_id,
+                    cam_pixel_format_nickname (conv->inpfmt),
+                    cam_pixel_format_nickname (conv->outpfmt));
+
+            cam_unit_set_preferred_format (unit, conv->outpfmt, 0, 0, NULL);
+            cam_unit_set_input (unit, prev);
+            result = g_list_append (result, unit);
+            prev = unit;
+        }
+        g_list_free (steps);
+
+        if (!failed_id) {
+            dbg (DBG_MANAGER, "conversion from %s uses %d units, cost %f\n",
+                    cam_pixel_format_nickname (src),
+                    g_list_length (result), cost);
+            *units = result;
+            return 0;
+        }
+
+        // a unit that is listed but can't be created (e.g. fast_debayer
+        // without SSE2) is left out, and the plan is made again.
+        err ("FormatPlanner: unable to create [%s]\n", failed_id);
+        free_units (result);
+        cam_format_planner_remove_unit (self, failed_id);
+        free (failed_id);
+    }
+}
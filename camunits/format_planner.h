@@ -0,0 +1,144 @@
+#ifndef __cam_format_planner_h__
+#define __cam_format_planner_h__
+
+#include <glib.h>
+
+#include "pixels.h"
+#include "unit.h"
+#include "unit_manager.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * SECTION:format_planner
+ * @short_description: Finds the cheapest sequence of conversion units
+ * between two pixel formats.
+ *
+ * A CamFormatPlanner knows which units can convert from one pixel format to
+ * another, and how much each conversion costs.  Given the format produced by
+ * a unit and the formats accepted by whatever consumes its frames, the
+ * planner finds the sequence of conversions with the lowest total cost, and
+ * can instantiate and connect the units that perform it.
+ *
+ * Costs are expressed in nanoseconds per pixel.  The planner is created with
+ * a table of the conversions provided by the standard convert plugins, with
+ * costs measured at 1920x1080.  Every unit in a plan also adds
+ * #CAM_FORMAT_PLANNER_HOP_COST, which accounts for allocating, writing, and
+ * reading back the intermediate frame.  This keeps the planner from
+ * preferring two cheap conversions through an intermediate format, such as
+ * YUYV to BGRA to RGB, over a single direct one of about the same cost.
+ *
+ * Conversions that discard color, bit depth, or chroma resolution are only
+ * used when there is no other way to reach an accepted format, so a plan
+ * never passes through GRAY, an 8-bit format, or a subsampled YUV format on
+ * the way to a format that could have kept the information.
+ */
+
+typedef struct _CamFormatPlanner CamFormatPlanner;
+
+/**
+ * CamFormatConversion:
+ * @unit_id: the unit that performs the conversion.
+ * @inpfmt: the input pixel format.
+ * @outpfmt: the output pixel format.
+ * @cost: the cost of the conversion, in nanoseconds per pixel.
+ */
+typedef struct _CamFormatConversion {
+    char *unit_id;
+    CamPixelFormat inpfmt;
+    CamPixelFormat outpfmt;
+    double cost;
+} CamFormatConversion;
+
+/**
+ * CAM_FORMAT_PLANNER_HOP_COST:
+ *
+ * Cost, in nanoseconds per pixel, added for each unit in a plan.
+ */
+#define CAM_FORMAT_PLANNER_HOP_COST 1.0
+
+/**
+ * cam_format_planner_new:
+ * @manager: if not NULL, only conversions performed by units that @manager
+ *           can create are added to the planner.
+ *
+ * Returns: a new CamFormatPlanner, populated with the conversions of the
+ * standard convert plugins.
+ */
+CamFormatPlanner * cam_format_planner_new (CamUnitManager *manager);
+
+void cam_format_planner_destroy (CamFormatPlanner *self);
+
+/**
+ * cam_format_planner_add_conversion:
+ * @unit_id: the unit that performs the conversion
+ * @inpfmt: the input pixel format
+ * @outpfmt: the output pixel format
+ * @cost: the cost of the conversion, in nanoseconds per pixel
+ *
+ * Adds a conversion to the planner, or changes the cost of an existing one.
+ */
+void cam_format_planner_add_conversion (CamFormatPlanner *self,
+        const char *unit_id, CamPixelFormat inpfmt, CamPixelFormat outpfmt,
+        double cost);
+
+/**
+ * cam_format_planner_remove_unit:
+ *
+ * Removes all conversions performed by @unit_id.
+ */
+void cam_format_planner_remove_unit (CamFormatPlanner *self,
+        const char *unit_id);
+
+/**
+ * cam_format_planner_plan:
+ * @src: the pixel format to convert from.
+ * @accepted: the pixel formats that are acceptable results.
+ *            #CAM_PIXEL_FORMAT_ANY accepts any format.
+ * @naccepted: the number of entries in @accepted.
+ * @steps: output parameter.  On success, set to a list of
+ *         #CamFormatConversion, in the order they should be applied.  The
+ *         list is empty if @src is already acceptable.  The list must be
+ *         freed with g_list_free(), but its contents belong to the planner.
+ * @cost: output parameter.  If not NULL, set to the total cost of the plan.
+ *
+ * Finds the cheapest sequence of conversions from @src to any of the
+ * formats in @accepted.
+ *
+ * Returns: 0 on success, -1 if there is no such sequence.
+ */
+int cam_format_planner_plan (CamFormatPlanner *self, CamPixelFormat src,
+        const CamPixelFormat *accepted, int naccepted, GList **steps,
+        double *cost);
+
+/**
+ * cam_format_planner_create_units:
+ * @manager: the unit manager used to create units.
+ * @input: the unit whose output is to be converted.
+ * @src: the pixel format produced by @input.
+ * @accepted: the pixel formats that are acceptable results.
+ * @naccepted: the number of entries in @accepted.
+ * @units: output parameter.  On success, set to a newly allocated list of
+ *         the units that perform the conversion, each holding a reference
+ *         that belongs to the caller.
+ *
+ * Plans a conversion from @src, then creates the units that perform it.
+ * Each unit takes its input from the one before it, the first unit takes its
+ * input from @input, and each unit's preferred format is set to the output
+ * of its step in the plan, so that streaming the units in order with a NULL
+ * format reproduces the plan.  If a unit cannot be created, its conversions
+ * are removed from the planner and the conversion is planned again.
+ *
+ * Returns: 0 on success, -1 if the conversion is not possible.
+ */
+int cam_format_planner_create_units (CamFormatPlanner *self,
+        CamUnitManager *manager, CamUnit *input, CamPixelFormat src,
+        const CamPixelFormat *accepted, int naccepted, GList **units);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,434 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "frame_socket.h"
+#include "dbg.h"
+
+#define err(args...) fprintf (stderr, args)
+
+#define MAX_CLIENTS 16
+#define SOCKET_BUFFER_SIZE (4 << 20)
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+
+struct _CamFrameSocketWriter {
+    int listen_fd;
+    char *path;
+    CamLogFrameFormat format;
+    int memfd_threshold;
+
+    int clients[MAX_CLIENTS];
+    int nclients;
+
+    uint64_t frameno;
+    uint64_t dropped;
+
+    uint8_t *header;
+    int header_max;
+};
+
+struct _CamFrameSocketReader {
+    int fd;
+    CamLogFrameFormat format;
+
+    uint8_t *buf;
+    int buf_size;
+
+    // mapping of the most recent frame passed by file descriptor
+    void *map;
+    size_t map_len;
+};
+
+static int
+_make_address (const char *path, struct sockaddr_un *addr)
+{
+    memset (addr, 0, sizeof (struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    if (strlen (path) >= sizeof (addr->sun_path)) {
+        err ("FrameSocket: path too long [%s]\n", path);
+        return -1;
+    }
+    strcpy (addr->sun_path, path);
+    return 0;
+}
+
+// ========================== writer ===========================
+
+static int
+_send_frame (CamFrameSocketWriter *self, int client, const uint8_t *header,
+        int header_len, const CamFrameBuffer *frame, int memfd)
+{
+    struct iovec iov[2];
+    iov[0].iov_base = (void*) header;
+    iov[0].iov_len = header_len;
+
+    struct msghdr msg;
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 1;
+
+    char cmsg_buf[CMSG_SPACE (sizeof (int))];
+    if (memfd >= 0) {
+        msg.msg_control = cmsg_buf;
+        msg.msg_controllen = sizeof (cmsg_buf);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN (sizeof (int));
+        memcpy (CMSG_DATA (cmsg), &memfd, sizeof (int));
+    } else if (frame && frame->bytesused) {
+        iov[1].iov_base = frame->data;
+        iov[1].iov_len = frame->bytesused;
+        msg.msg_iovlen = 2;
+    }
+
+    return sendmsg (client, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+static void
+_remove_client (CamFrameSocketWriter *self, int index)
+{
+    dbg (DBG_LOG, "FrameSocket: client %d disconnected\n",
+            self->clients[index]);
+    close (self->clients[index]);
+    self->clients[index] = self->clients[self->nclients - 1];
+    self->nclients--;
+}
+
+CamFrameSocketWriter *
+cam_frame_socket_writer_new (const char *path,
+        const CamLogFrameFormat *format, int memfd_threshold)
+{
+    struct sockaddr_un addr;
+    if (0 != _make_address (path, &addr))
+        return NULL;
+
+    int fd = socket (AF_UNIX, SOCK_SEQPACKET, 0);
+    if (fd < 0) {
+        perror ("socket");
+        return NULL;
+    }
+    unlink (path);
+    if (0 != bind (fd, (struct sockaddr*) &addr, sizeof (addr)) ||
+            0 != listen (fd, MAX_CLIENTS)) {
+        perror ("FrameSocket");
+        close (fd);
+        return NULL;
+    }
+    fcntl (fd, F_SETFL, O_NONBLOCK);
+    fcntl (fd, F_SETFD, FD_CLOEXEC);
+
+    CamFrameSocketWriter *self =
+        (CamFrameSocketWriter*) calloc (1, sizeof (CamFrameSocketWriter));
+    self->listen_fd = fd;
+    self->path = strdup (path);
+    self->format = *format;
+    self->memfd_threshold = memfd_threshold;
+    self->header_max = 4096;
+    self->header = (uint8_t*) malloc (self->header_max);
+    return self;
+}
+
+void
+cam_frame_socket_writer_destroy (CamFrameSocketWriter *self)
+{
+    while (self->nclients)
+        _remove_client (self, 0);
+    close (self->listen_fd);
+    unlink (self->path);
+    free (self->path);
+    free (self->header);
+    free (self);
+}
+
+void
+cam_frame_socket_writer_set_memfd_threshold (CamFrameSocketWriter *self,
+        int memfd_threshold)
+{
+    self->memfd_threshold = memfd_threshold;
+}
+
+int
+cam_frame_socket_writer_accept_clients (CamFrameSocketWriter *self)
+{
+    while (self->nclients < MAX_CLIENTS) {
+        int client = accept (self->listen_fd, NULL, NULL);
+        if (client < 0)
+            break;
+        fcntl (client, F_SETFD, FD_CLOEXEC);
+        int bufsize = SOCKET_BUFFER_SIZE;
+        setsockopt (client, SOL_SOCKET, SO_SNDBUF, &bufsize,
+                sizeof (bufsize));
+
+        // greet the new reader with an empty frame, so that it knows the
+        // frame format before the first real frame arrives.
+        CamFrameBuffer *empty = cam_framebuffer_new (NULL, 0);
+        int header_len = cam_log_encode_frame_header (&self->format, empty,
+                0, 0, self->header, self->header_max);
+        int status = _send_frame (self, client, self->header, header_len,
+                NULL, -1);
+        g_object_unref (empty);
+        if (status < 0) {
+            close (client);
+            continue;
+        }
+
+        dbg (DBG_LOG, "FrameSocket: client %d connected\n", client);
+        self->clients[self->nclients++] = client;
+    }
+    return self->nclients;
+}
+
+static int
+_create_memfd (const uint8_t *data, int len)
+{
+#ifdef SYS_memfd_create
+    int fd = syscall (SYS_memfd_create, "camunits-frame",
+            MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
+        return -1;
+    int written = 0;
+    while (written < len) {
+        int status = write (fd, data + written, len - written);
+        if (status < 0) {
+            if (errno == EINTR)
+                continue;
+            close (fd);
+            return -1;
+        }
+        written += status;
+    }
+#ifdef F_ADD_SEALS
+    // readers map the file directly, so make sure it can't change under them
+    fcntl (fd, F_ADD_SEALS,
+            F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+    return fd;
+#else
+    return -1;
+#endif
+}
+
+int
+cam_frame_socket_writer_publish (CamFrameSocketWriter *self,
+        const CamFrameBuffer *frame)
+{
+    if (!cam_frame_socket_writer_accept_clients (self))
+        return 0;
+
+    int header_len = cam_log_get_frame_header_size (frame);
+    if (header_len > self->header_max) {
+        self->header_max = header_len;
+        self->header = (uint8_t*) realloc (self->header, self->header_max);
+    }
+    cam_log_encode_frame_header (&self->format, frame, self->frameno, 0,
+            self->header, self->header_max);
+    self->frameno++;
+
+    int memfd = -1;
+    if (frame->bytesused >= self->memfd_threshold)
+        memfd = _create_memfd (frame->data, frame->bytesused);
+
+    int nsent = 0;
+    for (int i = 0; i < self->nclients; i++) {
+        int status = _send_frame (self, self->clients[i], self->header,
+                header_len, frame, memfd);
+        if (status >= 0) {
+            nsent++;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            self->dropped++;
+        } else if (errno == EMSGSIZE) {
+            err ("FrameSocket: frame too large to send inline (%d bytes)\n",
+                    frame->bytesused);
+            self->dropped++;
+        } else {
+            _remove_client (self, i);
+            i--;
+        }
+    }
+
+    if (memfd >= 0)
+        close (memfd);
+    return nsent;
+}
+
+uint64_t
+cam_frame_socket_writer_get_dropped (const CamFrameSocketWriter *self)
+{
+    return self->dropped;
+}
+
+// ========================== reader ===========================
+
+static void
+_release_map (CamFrameSocketReader *self)
+{
+    if (self->map) {
+        munmap (self->map, self->map_len);
+        self->map = NULL;
+        self->map_len = 0;
+    }
+}
+
+CamFrameSocketReader *
+cam_frame_socket_reader_new (const char *path, int timeout_ms)
+{
+    struct sockaddr_un addr;
+    if (0 != _make_address (path, &addr))
+        return NULL;
+
+    int fd = socket (AF_UNIX, SOCK_SEQPACKET, 0);
+    if (fd < 0) {
+        perror ("socket");
+        return NULL;
+    }
+    fcntl (fd, F_SETFD, FD_CLOEXEC);
+    if (0 != connect (fd, (struct sockaddr*) &addr, sizeof (addr))) {
+        dbg (DBG_LOG, "FrameSocket: unable to connect to [%s]\n", path);
+        close (fd);
+        return NULL;
+    }
+    int bufsize = SOCKET_BUFFER_SIZE;
+    setsockopt (fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof (bufsize));
+
+    CamFrameSocketReader *self =
+        (CamFrameSocketReader*) calloc (1, sizeof (CamFrameSocketReader));
+    self->fd = fd;
+
+    // The writer only accepts connections when it publishes a frame, so
+    // wait for the greeting that carries the frame format.
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    if (poll (&pfd, 1, timeout_ms) <= 0) {
+        err ("FrameSocket: timed out waiting for [%s]\n", path);
+        cam_frame_socket_reader_destroy (self);
+        return NULL;
+    }
+    CamFrameBuffer *greeting = cam_frame_socket_reader_read (self, NULL);
+    if (!greeting) {
+        cam_frame_socket_reader_destroy (self);
+        return NULL;
+    }
+    g_object_unref (greeting);
+    return self;
+}
+
+void
+cam_frame_socket_reader_destroy (CamFrameSocketReader *self)
+{
+    _release_map (self);
+    close (self->fd);
+    free (self->buf);
+    free (self);
+}
+
+void
+cam_frame_socket_reader_get_format (const CamFrameSocketReader *self,
+        CamLogFrameFormat *format)
+{
+    *format = self->format;
+}
+
+int
+cam_frame_socket_reader_get_fileno (const CamFrameSocketReader *self)
+{
+    return self->fd;
+}
+
+CamFrameBuffer *
+cam_frame_socket_reader_read (CamFrameSocketReader *self,
+        CamLogFrameInfo *info)
+{
+    _release_map (self);
+
+    // find out how big the next message is
+    int msg_len = recv (self->fd, NULL, 0, MSG_PEEK | MSG_TRUNC);
+    if (msg_len <= 0)
+        return NULL;
+    if (msg_len > self->buf_size) {
+        self->buf_size = msg_len;
+        self->buf = (uint8_t*) realloc (self->buf, self->buf_size);
+    }
+
+    struct iovec iov = { self->buf, self->buf_size };
+    char cmsg_buf[CMSG_SPACE (sizeof (int))];
+    struct msghdr msg;
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsg_buf;
+    msg.msg_controllen = sizeof (cmsg_buf);
+
+    msg_len = recvmsg (self->fd, &msg, MSG_CMSG_CLOEXEC);
+    if (msg_len <= 0)
+        return NULL;
+
+    int memfd = -1;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy (&memfd, CMSG_DATA (cmsg), sizeof (int));
+
+    CamLogFrameInfo finfo;
+    CamFrameBuffer *frame = cam_framebuffer_new (NULL, 0);
+    if (0 != cam_log_decode_frame_header (self->buf, msg_len,
+                &self->format, &finfo, frame))
+        goto fail;
+
+    if (memfd >= 0) {
+        // a memfd shorter than the frame would raise SIGBUS when the data
+        // past its end is touched, rather than fail here
+        struct stat st;
+        if (finfo.data_len && (0 != fstat (memfd, &st) ||
+                    st.st_size < (off_t) finfo.data_len))
+            goto fail;
+        if (finfo.data_len) {
+            self->map = mmap (NULL, finfo.data_len, PROT_READ,
+                    MAP_SHARED | MAP_POPULATE, memfd, 0);
+            if (self->map == MAP_FAILED) {
+                perror ("mmap");
+                self->map = NULL;
+                goto fail;
+            }
+            self->map_len = finfo.data_len;
+        }
+        close (memfd);
+        memfd = -1;
+        frame->data = (uint8_t*) self->map;
+    } else {
+        if (finfo.data_offset + finfo.data_len > msg_len)
+            goto fail;
+        frame->data = self->buf + finfo.data_offset;
+    }
+    frame->length = finfo.data_len;
+    frame->bytesused = finfo.data_len;
+
+    if (info)
+        *info = finfo;
+    return frame;
+
+fail:
+    err ("FrameSocket: received malformed frame\n");
+    if (memfd >= 0)
+        close (memfd);
+    g_object_unref (frame);
+    return NULL;
+}
@@ -0,0 +1,148 @@
+#ifndef __cam_frame_socket_h__
+#define __cam_frame_socket_h__
+
+#include <stdint.h>
+
+#include "framebuffer.h"
+#include "log.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * SECTION:frame_socket
+ * @short_description: Stream frames to other processes over a Unix domain
+ * socket.
+ *
+ * A CamFrameSocketWriter listens on a SOCK_SEQPACKET Unix domain socket and
+ * sends each published frame to every connected CamFrameSocketReader.  Each
+ * frame is one message, encoded in the same format as a Camunits log record
+ * (see cam_log_encode_frame_header()).
+ *
+ * Frames smaller than the writer's memfd threshold are sent inline.  Larger
+ * frames are copied once into a sealed anonymous memory file, and only the
+ * file descriptor is passed to the readers, which map it directly.
+ *
+ * The writer never blocks on slow readers.  If a reader's socket buffer is
+ * full, the frame is dropped for that reader.
+ *
+ * This is only available on Linux.
+ */
+
+typedef struct _CamFrameSocketWriter CamFrameSocketWriter;
+typedef struct _CamFrameSocketReader CamFrameSocketReader;
+
+/**
+ * cam_frame_socket_writer_new:
+ * @path: filesystem path of the socket.  An existing socket at @path is
+ *        replaced.
+ * @format: format of the frames to be sent
+ * @memfd_threshold: frames with at least this many bytes of image data are
+ *        passed by file descriptor instead of being copied into the socket.
+ *
+ * Returns: a new CamFrameSocketWriter, or NULL on failure.
+ */
+CamFrameSocketWriter * cam_frame_socket_writer_new (const char *path,
+        const CamLogFrameFormat *format, int memfd_threshold);
+
+/**
+ * cam_frame_socket_writer_destroy:
+ *
+ * Disconnects all readers and removes the socket.
+ */
+void cam_frame_socket_writer_destroy (CamFrameSocketWriter *self);
+
+/**
+ * cam_frame_socket_writer_set_memfd_threshold:
+ *
+ * Changes the frame size at which frames are passed by file descriptor.
+ */
+void cam_frame_socket_writer_set_memfd_threshold (
+        CamFrameSocketWriter *self, int memfd_threshold);
+
+/**
+ * cam_frame_socket_writer_accept_clients:
+ *
+ * Accepts any pending reader connections without blocking.  This is called
+ * automatically by cam_frame_socket_writer_publish().
+ *
+ * Returns: the number of connected readers.
+ */
+int cam_frame_socket_writer_accept_clients (CamFrameSocketWriter *self);
+
+/**
+ * cam_frame_socket_writer_publish:
+ *
+ * Sends a frame to all connected readers.
+ *
+ * Returns: the number of readers the frame was sent to, or -1 on error.
+ */
+int cam_frame_socket_writer_publish (CamFrameSocketWriter *self,
+        const CamFrameBuffer *frame);
+
+/**
+ * cam_frame_socket_writer_get_dropped:
+ *
+ * Returns: the number of times a frame was not sent to a reader because its
+ * socket buffer was full.
+ */
+uint64_t cam_frame_socket_writer_get_dropped (
+        const CamFrameSocketWriter *self);
+
+/**
+ * cam_frame_socket_reader_new:
+ * @path: filesystem path of the socket to connect to.
+ * @timeout_ms: how long to wait for the writer to send the frame format.
+ *
+ * Connects to a CamFrameSocketWriter.
+ *
+ * Returns: a new CamFrameSocketReader, or NULL on failure.
+ */
+CamFrameSocketReader * cam_frame_socket_reader_new (const char *path,
+        int timeout_ms);
+
+void cam_frame_socket_reader_destroy (CamFrameSocketReader *self);
+
+/**
+ * cam_frame_socket_reader_get_format:
+ *
+ * Retrieves the format of the frames sent by the writer.
+ */
+void cam_frame_socket_reader_get_format (const CamFrameSocketReader *self,
+        CamLogFrameFormat *format);
+
+/**
+ * cam_frame_socket_reader_get_fileno:
+ *
+ * Returns: a file descriptor that becomes readable when a frame is
+ * available.
+ */
+int cam_frame_socket_reader_get_fileno (const CamFrameSocketReader *self);
+
+/**
+ * cam_frame_socket_reader_read:
+ * @info: output parameter.  If not NULL, filled in with the frame number,
+ *        timestamp, and data size of the frame.
+ *
+ * Receives the next frame, blocking until one is available.
+ *
+ * The data field of the returned frame points into memory owned by the
+ * reader: either a mapping of the shared memory that the writer sent, or the
+ * reader's receive buffer.  Both are released or reused by the next call to
+ * cam_frame_socket_reader_read() and by cam_frame_socket_reader_destroy(),
+ * so the image data must be copied if it is needed after that.  The
+ * CamFrameBuffer itself, with its timestamp and metadata, belongs to the
+ * caller and stays valid until it is unreferenced.
+ *
+ * Returns: a new CamFrameBuffer, or NULL if the writer disconnected or an
+ * error occurred.
+ */
+CamFrameBuffer * cam_frame_socket_reader_read (CamFrameSocketReader *self,
+        CamLogFrameInfo *info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
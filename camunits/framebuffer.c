@@ -16,16 +16,29 @@ static void cam_framebuffer_finalize (GObject *obj);
 
 G_DEFINE_TYPE (CamFrameBuffer, cam_framebuffer, G_TYPE_OBJECT);
 
+/* Metadata entries are never modified once created, so they can be shared
+ * by any number of dictionaries. */
 typedef struct _CamMetadataPair {
+    int refcount;
     char * key;
     uint8_t * value;
     int len;
 } CamMetadataPair;
 
+/* A metadata dictionary may be shared by several framebuffers, e.g. when a
+ * filter copies the metadata of its input frame to its output frame.  A
+ * shared dictionary is read-only; a framebuffer that wants to modify it
+ * first makes its own copy (see metadata_make_writable). */
+struct _CamMetadataDict {
+    int refcount;
+    GHashTable *table;
+};
+
 static CamMetadataPair *
 cam_metadata_pair_new (const char * key, const uint8_t * value, int len)
 {
     CamMetadataPair * p = calloc (1, sizeof (CamMetadataPair));
+    p->refcount = 1;
     p->key = strdup (key);
     p->len = len;
     p->value = malloc (len + 1);
@@ -35,14 +48,68 @@ cam_metadata_pair_new (const char * key, const uint8_t * value, int len)
 }
 
 static void
-cam_metadata_pair_free (void * data)
+cam_metadata_pair_unref (void * data)
 {
     CamMetadataPair * p = data;
+    if (!g_atomic_int_dec_and_test (&p->refcount))
+        return;
     free (p->key);
     free (p->value);
     free (p);
 }
 
+static CamMetadataDict *
+metadata_dict_new (void)
+{
+    CamMetadataDict *dict = malloc (sizeof (CamMetadataDict));
+    dict->refcount = 1;
+    dict->table = g_hash_table_new_full (g_str_hash, g_str_equal,
+            NULL, cam_metadata_pair_unref);
+    return dict;
+}
+
+static CamMetadataDict *
+metadata_dict_ref (CamMetadataDict *dict)
+{
+    g_atomic_int_inc (&dict->refcount);
+    return dict;
+}
+
+static void
+metadata_dict_unref (CamMetadataDict *dict)
+{
+    if (!g_atomic_int_dec_and_test (&dict->refcount))
+        return;
+    g_hash_table_destroy (dict->table);
+    free (dict);
+}
+
+static void
+_share_keyval (void *key, void *value, void *user_data)
+{
+    GHashTable *dest_ht = user_data;
+    CamMetadataPair * p = value;
+    g_atomic_int_inc (&p->refcount);
+    g_hash_table_replace (dest_ht, p->key, p);
+}
+
+/* Ensures that self has a metadata dictionary that is not shared with any
+ * other framebuffer, and returns its hash table. */
+static GHashTable *
+metadata_make_writable (CamFrameBuffer *self)
+{
+    if (!self->metadata) {
+        self->metadata = metadata_dict_new ();
+    } else if (g_atomic_int_get (&self->metadata->refcount) > 1) {
+        CamMetadataDict *copy = metadata_dict_new ();
+        g_hash_table_foreach (self->metadata->table, _share_keyval,
+                copy->table);
+        metadata_dict_unref (self->metadata);
+        self->metadata = copy;
+    }
+    return self->metadata->table;
+}
+
 static void
 cam_framebuffer_init (CamFrameBuffer *self)
 {
@@ -52,8 +119,8 @@ cam_framebuffer_init (CamFrameBuffer *self)
     self->timestamp = 0;
     self->owns_data = 0;
 
-    self->metadata = g_hash_table_new_full (g_str_hash, g_str_equal,
-            NULL, cam_metadata_pair_free);
+    // created on first use
+    self->metadata = NULL;
 }
 
 static void
@@ -73,7 +140,9 @@ cam_framebuffer_finalize (GObject *obj)
     }
     self->data = NULL;
     self->length = 0;
-    g_hash_table_destroy (self->metadata);
+    if (self->metadata)
+        metadata_dict_unref (self->metadata);
+    self->metadata = NULL;
 
     G_OBJECT_CLASS (cam_framebuffer_parent_class)->finalize(obj);
 }
@@ -101,29 +170,36 @@ cam_framebuffer_new_alloc (int length)
     return self;
 }
 
-static void
-_copy_keyval (void *key, void *value, void *user_data)
-{
-    GHashTable *dest_ht = user_data;
-    CamMetadataPair * src = value;
-    CamMetadataPair * p = cam_metadata_pair_new (src->key, src->value,
-            src->len);
-    g_hash_table_replace (dest_ht, p->key, p);
-}
-
 void
 cam_framebuffer_copy_metadata (CamFrameBuffer * self, 
         const CamFrameBuffer *from)
 {
     self->timestamp = from->timestamp;
-    g_hash_table_foreach (from->metadata, _copy_keyval, self->metadata);
+    if (!from->metadata || from->metadata == self->metadata)
+        return;
+
+    if (!self->metadata ||
+        !g_hash_table_size (self->metadata->table)) {
+        // the common case.  Just share the source dictionary.
+        if (self->metadata)
+            metadata_dict_unref (self->metadata);
+        self->metadata = metadata_dict_ref (from->metadata);
+        return;
+    }
+
+    // merge the source entries into our existing entries
+    GHashTable *table = metadata_make_writable (self);
+    g_hash_table_foreach (from->metadata->table, _share_keyval, table);
 }
 
 uint8_t *
 cam_framebuffer_metadata_get (const CamFrameBuffer * self,
         const char * key, int * len)
 {
-    CamMetadataPair * p = g_hash_table_lookup (self->metadata, key);
+    if (!self->metadata)
+        return NULL;
+
+    CamMetadataPair * p = g_hash_table_lookup (self->metadata->table, key);
     if (!p)
         return NULL;
 
@@ -144,8 +220,9 @@ cam_framebuffer_metadata_set (CamFrameBuffer *self, const char *key,
         g_warning ("refusing to set NULL key in metadata dictionary");
         return;
     }
+    GHashTable *table = metadata_make_writable (self);
     CamMetadataPair * p = cam_metadata_pair_new (key, value, len);
-    g_hash_table_replace (self->metadata, p->key, p);
+    g_hash_table_replace (table, p->key, p);
 }
 
 static void
@@ -159,6 +236,75 @@ GList *
 cam_framebuffer_metadata_list_keys (const CamFrameBuffer * self)
 {
     GList * list = NULL;
-    g_hash_table_foreach (self->metadata, append_key, &list);
+    if (self->metadata)
+        g_hash_table_foreach (self->metadata->table, append_key, &list);
     return list;
 }
+
+void
+cam_framebuffer_set_planes (CamFrameBuffer *self, int nplanes,
+        const int *offsets, const int *strides)
+{
+    if (nplanes <= 0) {
+        if (cam_framebuffer_metadata_get (self, "Plane Offsets", NULL) ||
+                cam_framebuffer_metadata_get (self, "Plane Strides", NULL)) {
+            GHashTable *table = metadata_make_writable (self);
+            g_hash_table_remove (table, "Plane Offsets");
+            g_hash_table_remove (table, "Plane Strides");
+        }
+        return;
+    }
+
+    GString *ostr = g_string_new ("");
+    GString *sstr = g_string_new ("");
+    for (int p = 0; p < nplanes; p++) {
+        g_string_append_printf (ostr, p ? ",%d" : "%d", offsets[p]);
+        g_string_append_printf (sstr, p ? ",%d" : "%d", strides[p]);
+    }
+    cam_framebuffer_metadata_set (self, "Plane Offsets",
+            (uint8_t*) ostr->str, ostr->len);
+    cam_framebuffer_metadata_set (self, "Plane Strides",
+            (uint8_t*) sstr->str, sstr->len);
+    g_string_free (ostr, TRUE);
+    g_string_free (sstr, TRUE);
+}
+
+/* Parses a comma-separated list of at most max non-negative integers.
+ * Returns the number parsed, or -1 if the list is malformed or too long. */
+static int
+_parse_int_list (const uint8_t *value, int *vals, int max)
+{
+    const char *s = (const char*) value;
+    int n = 0;
+    while (1) {
+        char *end;
+        long v = strtol (s, &end, 10);
+        if (end == s || v < 0 || v > G_MAXINT || n == max)
+            return -1;
+        vals[n++] = v;
+        if (*end == '\0')
+            return n;
+        if (*end != ',')
+            return -1;
+        s = end + 1;
+    }
+}
+
+int
+cam_framebuffer_get_planes (const CamFrameBuffer *self, int max_planes,
+        int *offsets, int *strides)
+{
+    // metadata values are always NUL-terminated
+    const uint8_t *ostr =
+        cam_framebuffer_metadata_get (self, "Plane Offsets", NULL);
+    const uint8_t *sstr =
+        cam_framebuffer_metadata_get (self, "Plane Strides", NULL);
+    if (!ostr && !sstr)
+        return 0;
+    if (!ostr || !sstr)
+        return -1;
+    int n = _parse_int_list (ostr, offsets, max_planes);
+    if (n < 0 || n != _parse_int_list (sstr, strides, max_planes))
+        return -1;
+    return n;
+}
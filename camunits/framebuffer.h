@@ -34,6 +34,7 @@ extern "C" {
 
 typedef struct _CamFrameBuffer CamFrameBuffer;
 typedef struct _CamFrameBufferClass CamFrameBufferClass;
+typedef struct _CamMetadataDict CamMetadataDict;
 
 #define CAM_TYPE_FRAMEBUFFER  cam_framebuffer_get_type()
 #define CAM_FRAMEBUFFER(obj)  (G_TYPE_CHECK_INSTANCE_CAST( (obj), \
@@ -66,7 +67,7 @@ struct _CamFrameBuffer {
 
     /*< private >*/
     int owns_data;
-    GHashTable *metadata;
+    CamMetadataDict *metadata;
 };
 
 struct _CamFrameBufferClass {
@@ -104,6 +105,10 @@ CamFrameBuffer * cam_framebuffer_new_alloc (int length);
  *
  * Convenience method to copy the metadata dictionary from the @from buffer to
  * @self.  Also copies the %timestamp field.
+ *
+ * This is cheap.  If @self has no metadata of its own, the two buffers share
+ * one dictionary until either of them modifies it with
+ * cam_framebuffer_metadata_set().
  */
 void cam_framebuffer_copy_metadata (CamFrameBuffer *self, 
         const CamFrameBuffer *from);
@@ -152,6 +157,42 @@ void cam_framebuffer_metadata_set (CamFrameBuffer *self, const char *key,
  */
 GList * cam_framebuffer_metadata_list_keys (const CamFrameBuffer * self);
 
+/**
+ * cam_framebuffer_set_planes:
+ * @self: the CamFrameBuffer
+ * @nplanes: the number of planes, or 0 to remove the plane layout
+ * @offsets: the byte offset of each plane from the start of the data buffer
+ * @strides: the row stride of each plane, in bytes
+ *
+ * Records where the planes of a planar image are in the data buffer, for
+ * an image whose planes do not simply follow one another, such as a frame
+ * captured by a multi-planar V4L2 device.  The layout is stored in the
+ * metadata dictionary, under the "Plane Offsets" and "Plane Strides" keys
+ * as comma-separated lists, so it is also logged.
+ *
+ * A unit that copies the metadata of a planar frame to a frame with
+ * different image data should remove the layout.
+ */
+void cam_framebuffer_set_planes (CamFrameBuffer *self, int nplanes,
+        const int *offsets, const int *strides);
+
+/**
+ * cam_framebuffer_get_planes:
+ * @self: the CamFrameBuffer
+ * @max_planes: the number of elements in @offsets and @strides
+ * @offsets: output parameter.  Filled with the offset of each plane.
+ * @strides: output parameter.  Filled with the row stride of each plane.
+ *
+ * Retrieves the plane layout set with cam_framebuffer_set_planes().
+ *
+ * Returns: the number of planes, 0 if the buffer has no plane layout, in
+ * which case its planes follow one another as described by its pixel
+ * format, or -1 if the layout is malformed or has more than @max_planes
+ * planes.
+ */
+int cam_framebuffer_get_planes (const CamFrameBuffer *self, int max_planes,
+        int *offsets, int *strides);
+
 #ifdef __cplusplus
 }
 #endif
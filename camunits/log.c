@@ -1,17 +1,31 @@
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <errno.h>
 #include <assert.h>
 #include <string.h>
 
 #include <inttypes.h>
+#include <zlib.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
 
 #include "log.h"
 #include "pixels.h"
 #include "dbg.h"
+#include "probes.h"
 
 #ifndef MAX
 #define MAX(a,b) ((a)>(b)?(a):(b))
@@ -21,7 +35,8 @@
 typedef enum {
     CAMLOG_VERSION_INVALID,
     CAMLOG_VERSION_LEGACY,
-    CAMLOG_VERSION_0
+    CAMLOG_VERSION_0,
+    CAMLOG_VERSION_1
 } cam_log_version_t;
 
 typedef enum {
@@ -29,6 +44,35 @@ typedef enum {
     CAMLOG_MODE_WRITE
 } cam_log_mode_t;
 
+// state of each stream written to a log
+typedef struct {
+    uint64_t frameno;
+    // offset of the last frame written, or -1 before the first
+    int64_t prev_offset;
+    // delta encoding, see cam_log_set_keyframe_interval.  last_metadata
+    // holds the metadata of the last frame written, and is NULL when the
+    // next frame must be a keyframe.
+    int frames_since_keyframe;
+    CamLogFrameFormat last_format;
+    CamFrameBuffer *last_metadata;
+    // temporal compression, see cam_log_set_temporal_compression.  The data
+    // of the last frame written, which the next one is compared against.
+    uint8_t *last_data;
+    uint32_t last_data_len;
+    uint32_t last_data_size;
+} log_stream_t;
+
+typedef struct {
+    int64_t offset;
+    int64_t data_offset;
+    uint32_t data_len;
+    // index of the keyframe that a delta frame depends on, or of the frame
+    // itself for a keyframe
+    int keyframe;
+    // set if the data is stored as a difference from the previous frame
+    int diff;
+} log_index_entry_t;
+
 struct _CamLog {
     FILE *fp;
     cam_log_mode_t mode;
@@ -44,6 +88,54 @@ struct _CamLog {
 
     int64_t next_offset;
     uint64_t prev_offset;
+
+    // the format and metadata of the last frame read, which the next frame
+    // inherits if it is a delta frame
+    CamFrameBuffer *state_frame;
+    CamLogFrameFormat state_format;
+    int64_t state_offset;
+    int replaying;
+
+    // temporal compression.  The reader keeps the data of the last frame
+    // read in ref_data if it was stored as a difference, and ref_offset is
+    // the offset of that frame.  state_data_offset and state_data_len are
+    // where the data of the last frame is if it was stored as it is.
+    int temporal;
+    z_stream *zstream;
+    uint8_t *ref_data;
+    uint32_t ref_len;
+    uint32_t ref_size;
+    int64_t ref_offset;
+    int curr_is_diff;
+    int64_t state_data_offset;
+    uint32_t state_data_len;
+    uint8_t *diff_buf;
+    uint32_t diff_size;
+    uint8_t *zbuf;
+    uint32_t zbuf_size;
+
+    // the stream that is read, and the stream of the current frame
+    int stream;
+    int curr_stream;
+
+    // writer state of streams 0 to nstreams - 1
+    log_stream_t *streams;
+    int nstreams;
+    int keyframe_interval;
+
+    // frame data is padded to start at a multiple of this, if not 0
+    int data_alignment;
+
+    // frame index used by cam_log_read_frame_at.  It is built lazily, as far
+    // as the highest frame requested so far, and protected by index_mutex.
+    GMutex *index_mutex;
+    log_index_entry_t *index;
+    int index_len;
+    int index_size;
+    int64_t index_scan_offset;
+
+    // set once cam_log_append_frames finds that reflinks don't work
+    int no_reflink;
 };
 
 
@@ -55,11 +147,14 @@ typedef enum {
     LOG_TYPE_FRAME_DATA = 1,
     LOG_TYPE_FRAME_FORMAT = 2,
     LOG_TYPE_FRAME_TIMESTAMP = 3,   // legacy, from v1
-    LOG_TYPE_COMMENT = 4,           // legacy, from v1
+    LOG_TYPE_COMMENT = 4,           // legacy, from v1.  Now used as padding
     LOG_TYPE_SOURCE_UID = 6,        // legacy, from v1
     LOG_TYPE_FRAME_INFO_0 = 7,      // legacy, from v2
     LOG_TYPE_FRAME_INFO_1 = 8,
     LOG_TYPE_METADATA = 9,
+    LOG_TYPE_FRAME_DELTA = 10,      // from v1
+    LOG_TYPE_STREAM = 11,           // from v1
+    LOG_TYPE_FRAME_DATA_DIFF = 12,  // from v1
     LOG_TYPE_MAX
 } LogType;
 
@@ -95,6 +190,27 @@ typedef enum {
 //       uint32_t value_len;
 //       data_len * uint8_t value;
 
+// LOG_TYPE_FRAME_DELTA:
+//    same as LOG_TYPE_FRAME_INFO_1, but starts a frame that has the format
+//    and metadata of the previous frame.  It is followed by a METADATA field
+//    holding only the keys that changed, if any.  Keys are never removed in a
+//    delta frame, and the previous frame is either a keyframe (a frame that
+//    starts with a FORMAT field) or another delta frame.
+
+// LOG_TYPE_STREAM:
+//    uint32_t stream;
+//    starts a frame of a stream other than 0, and is followed by the fields
+//    of the frame as usual.  Frames without it belong to stream 0.  Frame
+//    numbers count the frames of each stream separately, and the
+//    prev_frame_offset of a frame is that of the previous frame in the same
+//    stream.
+
+// LOG_TYPE_FRAME_DATA_DIFF:
+//    uint32_t data_len;
+//    the frame data minus the data of the previous frame, bytewise modulo
+//    256, compressed as a zlib stream.  It replaces the DATA field of a delta
+//    frame whose data is the same size as that of the previous frame.
+
 static inline int
 log_put_uint8 (uint8_t val, FILE * f)
 {
@@ -250,22 +366,26 @@ log_resync (FILE * f)
                 continue;
             
             /* Assume the length is correct, and seek to the next field. */
+            off_t resume = ftello (f);
             off_t seekdist = (off_t)length - (off_t)(len-i-8);
             if (fseeko (f, seekdist, SEEK_CUR) < 0)
                 return -1;
 
-            /* Check for the presence of marker and type at next field */
-            if (log_get_uint16 (&marker, f) < 0)
-                return -1;
-            if (log_get_uint16 (&type, f) < 0)
-                return -1;
-            if (marker == LOG_MARKER && type > 0 && type < 10) {
+            /* Check for the presence of marker and type at next field.
+             * Random data, such as compressed frames, can look like a field
+             * whose length runs past the end of the file, so that is not an
+             * error. */
+            if (log_get_uint16 (&marker, f) == 0 &&
+                    log_get_uint16 (&type, f) == 0 &&
+                    marker == LOG_MARKER && type > 0 && type < LOG_TYPE_MAX) {
                 /* Seek back to the start of the field */
                 fseeko (f, -(off_t)length-12, SEEK_CUR);
                 return 0;
             }
             /* Seek back to where the last chunk left off */
-            fseeko (f, -seekdist-4, SEEK_CUR);
+            clearerr (f);
+            if (fseeko (f, resume, SEEK_SET) < 0)
+                return -1;
         }
 
         /* Copy any unscanned bytes at the end of the chunk to the
@@ -275,10 +395,78 @@ log_resync (FILE * f)
     }
     return -1;
 }
+/* The stream field of a frame must be read along with the rest of the frame.
+ * If the field before the current position is a stream field, moves back to
+ * it. */
+static void
+log_back_up_to_stream_field (FILE *f)
+{
+    off_t pos = ftello (f);
+    uint8_t b[LOG_HEADER_SIZE + 4];
+    if (pos < (off_t) sizeof (b) ||
+            fseeko (f, pos - sizeof (b), SEEK_SET) < 0)
+        return;
+    if (fread (b, 1, sizeof (b), f) == sizeof (b) &&
+            b[0] == 0xED && b[1] == 0xED &&
+            ((b[2] << 8) | b[3]) == LOG_TYPE_STREAM &&
+            b[4] == 0 && b[5] == 0 && b[6] == 0 && b[7] == 4)
+        pos -= sizeof (b);
+    fseeko (f, pos, SEEK_SET);
+}
+
+/* Returns the size of a padding field that moves offset up to a multiple of
+ * alignment, or 0 if offset is already aligned.  A field can't be smaller
+ * than its header, so the padding may be more than alignment bytes. */
+static inline int64_t
+log_alignment_padding (int64_t offset, int alignment)
+{
+    int64_t pad = ((alignment - offset % alignment) % alignment);
+    if (pad && pad < LOG_HEADER_SIZE)
+        pad += alignment;
+    return pad;
+}
+
+/* Makes sure that *buf holds at least len bytes. */
+static int
+log_reserve (uint8_t **buf, uint32_t *size, uint32_t len)
+{
+    if (*size >= len)
+        return 0;
+    uint8_t *p = (uint8_t*) realloc (*buf, len);
+    if (!p)
+        return -1;
+    *buf = p;
+    *size = len;
+    return 0;
+}
+
+/* Decompresses the len bytes at src, which must expand to exactly dst_len
+ * bytes. */
+static int
+log_inflate (z_stream *zs, const uint8_t *src, uint32_t len, uint8_t *dst,
+        uint32_t dst_len)
+{
+    zs->next_in = (Bytef*) src;
+    zs->avail_in = len;
+    zs->next_out = dst;
+    zs->avail_out = dst_len;
+    int status = inflate (zs, Z_FINISH);
+    int ok = (status == Z_STREAM_END && zs->avail_out == 0);
+    inflateReset (zs);
+    return ok ? 0 : -1;
+}
 // =================================================
 
 static int find_last_frame_info (CamLog *self);
 static int process_frame (CamLog * self);
+static int init_stream (CamLog *self);
+static GList * log_changed_metadata_keys (const CamFrameBuffer *prev,
+        const CamFrameBuffer *frame, int *removed);
+static int log_get_delta_header_size (const CamFrameBuffer *frame,
+        GList *keys);
+static int log_encode_delta_header (const CamFrameBuffer *frame,
+        GList *keys, uint64_t frameno, uint64_t prev_frame_offset,
+        uint16_t data_type, uint32_t data_len, uint8_t *buf);
 
 #define MAX64 ((uint64_t)-1)
 
@@ -318,32 +506,135 @@ cam_log_new (const char *fname, const char *mode)
     self->curr_info.frameno = 0;
     self->file_size = 0;
     self->first_frame_info.frameno = MAX64;
+    self->ref_offset = -1;
 
     if (self->mode == CAMLOG_MODE_READ) {
+        if (!g_thread_supported ()) g_thread_init (NULL);
+        self->index_mutex = g_mutex_new ();
+
         self->file_size = statbuf.st_size;
         dbg (DBG_LOG, "File size %"PRId64" bytes\n", self->file_size);
 
-        process_frame (self);
-        memcpy (&self->first_frame_info, &self->curr_info,
-                sizeof (CamLogFrameInfo));
-
-        if (find_last_frame_info (self) < 0) {
+        // read the stream of the first frame
+        self->stream = -1;
+        if (init_stream (self) < 0) {
             cam_log_destroy (self);
             return NULL;
         }
-        rewind (self->fp);
-        process_frame (self);
     }
 
     return self;
 }
 
+/* Finds the first and last frames of the stream being read, or of the
+ * stream of the first frame if self->stream is -1, and leaves the reader at
+ * the first frame. */
+static int
+init_stream (CamLog *self)
+{
+    self->first_frame_info.frameno = MAX64;
+    rewind (self->fp);
+    process_frame (self);
+    if (self->stream < 0)
+        self->stream = self->curr_stream;
+    memcpy (&self->first_frame_info, &self->curr_info,
+            sizeof (CamLogFrameInfo));
+
+    if (find_last_frame_info (self) < 0)
+        return -1;
+    rewind (self->fp);
+    process_frame (self);
+    return 0;
+}
+
+int
+cam_log_set_stream (CamLog *self, int stream)
+{
+    if (self->mode != CAMLOG_MODE_READ || stream < 0)
+        return -1;
+    if (stream == self->stream)
+        return 0;
+
+    int old_stream = self->stream;
+    self->stream = stream;
+    if (init_stream (self) < 0) {
+        dbg (DBG_LOG, "No frames in stream %d\n", stream);
+        self->stream = old_stream;
+        init_stream (self);
+        return -1;
+    }
+
+    g_mutex_lock (self->index_mutex);
+    self->index_len = 0;
+    self->index_scan_offset = 0;
+    g_mutex_unlock (self->index_mutex);
+    return 0;
+}
+
+int
+cam_log_get_stream (CamLog *self)
+{
+    return self->stream;
+}
+
+/* Returns the writer state of a stream, adding streams as needed. */
+static log_stream_t *
+get_stream (CamLog *self, int stream)
+{
+    if (stream >= self->nstreams) {
+        log_stream_t *streams = (log_stream_t*) realloc (self->streams,
+                (stream + 1) * sizeof (log_stream_t));
+        if (!streams)
+            return NULL;
+        memset (streams + self->nstreams, 0,
+                (stream + 1 - self->nstreams) * sizeof (log_stream_t));
+        for (int i = self->nstreams; i <= stream; i++)
+            streams[i].prev_offset = -1;
+        self->streams = streams;
+        self->nstreams = stream + 1;
+    }
+    return &self->streams[stream];
+}
+
+/* Makes the next frame written to each stream a keyframe. */
+static void
+reset_keyframes (CamLog *self)
+{
+    for (int i = 0; i < self->nstreams; i++) {
+        if (self->streams[i].last_metadata) {
+            g_object_unref (self->streams[i].last_metadata);
+            self->streams[i].last_metadata = NULL;
+        }
+    }
+}
+
 void 
 cam_log_destroy (CamLog *self)
 {
     if (self->fp) {
         fclose (self->fp);
     }
+    if (self->index_mutex)
+        g_mutex_free (self->index_mutex);
+    if (self->curr_frame)
+        g_object_unref (self->curr_frame);
+    if (self->state_frame)
+        g_object_unref (self->state_frame);
+    if (self->zstream) {
+        if (self->mode == CAMLOG_MODE_WRITE)
+            deflateEnd (self->zstream);
+        else
+            inflateEnd (self->zstream);
+        free (self->zstream);
+    }
+    reset_keyframes (self);
+    for (int i = 0; i < self->nstreams; i++)
+        free (self->streams[i].last_data);
+    free (self->streams);
+    free (self->ref_data);
+    free (self->diff_buf);
+    free (self->zbuf);
+    free (self->index);
     memset (self,0,sizeof(CamLog));
     free (self);
 }
@@ -382,29 +673,133 @@ cam_log_get_frame (CamLog * self)
 {
     if (!self->curr_frame)
         return NULL;
-    int64_t offset = ftello (self->fp);
-    if (fseeko (self->fp, self->curr_info.data_offset, SEEK_SET) < 0)
-        return NULL;
     CamFrameBuffer * framebuffer =
         cam_framebuffer_new_alloc (self->curr_info.data_len);
     cam_framebuffer_copy_metadata (framebuffer, self->curr_frame);
-    int ret = fread (framebuffer->data, 1, self->curr_info.data_len, self->fp);
-    if (ret != self->curr_info.data_len) {
-        g_object_unref (framebuffer);
-        return NULL;
+    if (self->curr_is_diff) {
+        // process_frame has already decoded it
+        memcpy (framebuffer->data, self->ref_data, self->curr_info.data_len);
+    } else {
+        int64_t offset = ftello (self->fp);
+        if (fseeko (self->fp, self->curr_info.data_offset, SEEK_SET) < 0 ||
+                fread (framebuffer->data, 1, self->curr_info.data_len,
+                    self->fp) != self->curr_info.data_len) {
+            g_object_unref (framebuffer);
+            return NULL;
+        }
+        fseeko (self->fp, offset, SEEK_SET);
     }
     framebuffer->bytesused = self->curr_info.data_len;
-    fseeko (self->fp, offset, SEEK_SET);
+    CAM_PROBE3 (log_get_frame, self->curr_info.offset,
+            framebuffer->timestamp, framebuffer->bytesused);
     return framebuffer;
 }
 
 // =============
 
+/* Reads the delta frame that starts at offset when the frame before it, at
+ * prev_offset, is not the last one read, e.g. after a seek, by following the
+ * chain of delta frames back to their keyframe and reading forward from
+ * there. */
+static int
+replay_to_frame (CamLog *self, int64_t offset, int64_t prev_offset)
+{
+    FILE *f = self->fp;
+    if (self->replaying) {
+        dbg (DBG_LOG, "Delta frame at %"PRId64" has no keyframe\n", offset);
+        return -1;
+    }
+
+    int64_t keyframe_offset = prev_offset;
+    while (1) {
+        uint16_t type;
+        uint32_t len;
+        uint64_t prev;
+        int64_t pos = keyframe_offset;
+        if (pos < 0 || fseeko (f, pos, SEEK_SET) < 0 ||
+                log_get_next_field (&type, &len, f) < 0)
+            return -1;
+        if (type == LOG_TYPE_STREAM) {
+            pos += LOG_HEADER_SIZE + len;
+            if (fseeko (f, len, SEEK_CUR) < 0 ||
+                    log_get_next_field (&type, &len, f) < 0)
+                return -1;
+        }
+        if (type != LOG_TYPE_FRAME_DELTA)
+            break;
+        if (len != 24 || fseeko (f, 16, SEEK_CUR) < 0 ||
+                log_get_uint64 (&prev, f) != 0 || !prev)
+            return -1;
+        keyframe_offset = pos - prev;
+    }
+
+    if (fseeko (f, keyframe_offset, SEEK_SET) < 0)
+        return -1;
+    self->replaying = 1;
+    int status;
+    do {
+        status = process_frame (self);
+    } while (0 == status && self->curr_info.offset < offset);
+    self->replaying = 0;
+    if (0 == status && self->curr_info.offset != offset)
+        return -1;
+    return status;
+}
+
+/* Decodes the data of a frame stored as a difference from the previous frame
+ * into ref_data.  The file must be at the start of the frame's data field,
+ * of len bytes, and the previous frame must be the last one read. */
+static int
+log_read_data_diff (CamLog *self, uint32_t len)
+{
+    FILE *f = self->fp;
+    uint32_t data_len;
+    if (len < 4 || log_get_uint32 (&data_len, f) != 0)
+        return -1;
+    if (!self->zstream) {
+        self->zstream = (z_stream*) calloc (1, sizeof (z_stream));
+        if (inflateInit (self->zstream) != Z_OK) {
+            free (self->zstream);
+            self->zstream = NULL;
+            return -1;
+        }
+    }
+
+    // the data of the previous frame is only in ref_data if it was stored as
+    // a difference too
+    if (self->ref_offset != self->state_offset) {
+        int64_t pos = ftello (f);
+        self->ref_offset = -1;
+        if (self->state_data_len != data_len ||
+                log_reserve (&self->ref_data, &self->ref_size, data_len) < 0 ||
+                fseeko (f, self->state_data_offset, SEEK_SET) < 0 ||
+                fread (self->ref_data, 1, data_len, f) != data_len ||
+                fseeko (f, pos, SEEK_SET) < 0)
+            return -1;
+        self->ref_len = data_len;
+    }
+
+    self->ref_offset = -1;
+    if (self->ref_len != data_len ||
+            log_reserve (&self->zbuf, &self->zbuf_size, len - 4) < 0 ||
+            log_reserve (&self->diff_buf, &self->diff_size, data_len) < 0 ||
+            fread (self->zbuf, 1, len - 4, f) != len - 4 ||
+            log_inflate (self->zstream, self->zbuf, len - 4, self->diff_buf,
+                data_len) < 0)
+        return -1;
+    cam_pixel_add_8u (self->ref_data, self->ref_data, self->diff_buf,
+            data_len);
+    self->ref_offset = self->curr_info.offset;
+    return 0;
+}
+
 static int
 process_frame (CamLog * self)
 {
     int got_info = 0;
     int got_data = 0;
+    int skip = 0;
+    int delta = 0;
     if (self->curr_frame) {
         g_object_unref (self->curr_frame);
         self->curr_frame = NULL;
@@ -419,11 +814,37 @@ process_frame (CamLog * self)
             return -1;
         }
 
+        // skip frames of the streams that aren't being read
+        if (skip) {
+            if (fseeko (f, len, SEEK_CUR) < 0)
+                return -1;
+            skip = (type != LOG_TYPE_FRAME_DATA &&
+                    type != LOG_TYPE_FRAME_DATA_DIFF);
+            continue;
+        }
+
         if ((type == LOG_TYPE_FRAME_FORMAT ||
-                type == LOG_TYPE_FRAME_INFO_0) && !self->curr_frame) {
+                type == LOG_TYPE_FRAME_INFO_0 ||
+                type == LOG_TYPE_FRAME_DELTA ||
+                type == LOG_TYPE_STREAM) && !self->curr_frame) {
+            uint32_t stream = 0;
+            if (type == LOG_TYPE_STREAM &&
+                    (len != 4 || log_get_uint32 (&stream, f) != 0)) {
+                dbg (DBG_LOG, "Error parsing stream field\n");
+                return -1;
+            }
+            if (self->stream >= 0 && (int) stream != self->stream) {
+                if (type != LOG_TYPE_STREAM)
+                    fseeko (f, len, SEEK_CUR);
+                skip = 1;
+                continue;
+            }
             self->curr_frame = cam_framebuffer_new_alloc (0);
             self->curr_info.offset = offset;
             self->curr_info.frameno = MAX64;
+            self->curr_stream = stream;
+            if (type == LOG_TYPE_STREAM)
+                continue;
         }
         else if (!self->curr_frame) {
             fseeko (f, len, SEEK_CUR);
@@ -477,6 +898,23 @@ process_frame (CamLog * self)
             self->curr_info.data_offset = ftello (f);
             if (fseeko (f, len, SEEK_CUR) < 0)
                 return -1;
+            self->curr_is_diff = 0;
+            got_data = 1;
+        }
+        else if (type == LOG_TYPE_FRAME_DATA_DIFF) {
+            if (!delta) {
+                dbg (DBG_LOG, "Keyframe at %"PRIu64" has a data difference\n",
+                        self->curr_info.offset);
+                return -1;
+            }
+            self->curr_info.data_offset = ftello (f);
+            if (log_read_data_diff (self, len) < 0) {
+                dbg (DBG_LOG, "Failed to decode frame data at %"PRIu64"\n",
+                        offset);
+                return -1;
+            }
+            self->curr_info.data_len = self->ref_len;
+            self->curr_is_diff = 1;
             got_data = 1;
         }
         else if (type == LOG_TYPE_FRAME_TIMESTAMP) {
@@ -522,6 +960,36 @@ process_frame (CamLog * self)
             self->prev_offset = offset - self->prev_offset;
             got_info = 1;
         }
+        else if (type == LOG_TYPE_FRAME_DELTA) {
+            CamLogFrameInfo * ci = &self->curr_info;
+            uint64_t prev_frame_offset;
+            if (len != 24) {
+                dbg (DBG_LOG, "Delta field had wrong length\n");
+                return -1;
+            }
+            if (log_get_uint64 (&ci->timestamp, f) != 0 ||
+                    log_get_uint64 (&ci->frameno, f) != 0 ||
+                    log_get_uint64 (&prev_frame_offset, f) != 0) {
+                dbg (DBG_LOG, "Error parsing delta field\n");
+                return -1;
+            }
+            if (!prev_frame_offset) {
+                dbg (DBG_LOG, "Delta frame at %"PRIu64" has no keyframe\n",
+                        offset);
+                return -1;
+            }
+            if (!self->state_frame ||
+                    self->state_offset != offset - prev_frame_offset)
+                return replay_to_frame (self, self->curr_info.offset,
+                        offset - prev_frame_offset);
+            cam_framebuffer_copy_metadata (self->curr_frame,
+                    self->state_frame);
+            self->curr_format = self->state_format;
+            self->curr_frame->timestamp = ci->timestamp;
+            self->prev_offset = offset - prev_frame_offset;
+            delta = 1;
+            got_info = 1;
+        }
         else if (type == LOG_TYPE_METADATA) {
             int b = 2, i;
             uint16_t num;
@@ -548,6 +1016,9 @@ process_frame (CamLog * self)
             }
             fseeko (f, len - b, SEEK_CUR);
         }
+        else {
+            fseeko (f, len, SEEK_CUR);
+        }
     }
     if (self->curr_info.frameno == MAX64) {
         if (self->first_frame_info.frameno == MAX64)
@@ -557,6 +1028,14 @@ process_frame (CamLog * self)
                 (self->curr_info.offset - self->first_frame_info.offset) /
                 (ftello (self->fp) - self->curr_info.offset);
     }
+
+    if (self->state_frame)
+        g_object_unref (self->state_frame);
+    self->state_frame = g_object_ref (self->curr_frame);
+    self->state_format = self->curr_format;
+    self->state_offset = self->curr_info.offset;
+    self->state_data_offset = self->curr_info.data_offset;
+    self->state_data_len = self->curr_info.data_len;
     return 0;
 }
 
@@ -582,6 +1061,7 @@ cam_log_seek_to_offset (CamLog *self, int64_t offset)
         dbg (DBG_LOG, "Failed to resync after seek to %"PRId64"\n", offset);
         goto fail;
     }
+    log_back_up_to_stream_field (self->fp);
 
     if (process_frame (self) < 0) {
         dbg (DBG_LOG, "Failed to process frame after seek to %"PRId64"\n",
@@ -596,74 +1076,1023 @@ fail:
     return -1;
 }
 
+/* Compresses the difference between the data of frame and that of the
+ * previous frame of its stream into zbuf.  Returns the compressed size, or -1
+ * if that is not smaller than the data itself. */
+static int
+log_encode_data_diff (CamLog *self, log_stream_t *st,
+        const CamFrameBuffer *frame)
+{
+    uint32_t len = frame->bytesused;
+    if (len <= 4)
+        return -1;
+    if (!self->zstream) {
+        // run-length matching is fast and suits the mostly small values of
+        // differences between frames
+        self->zstream = (z_stream*) calloc (1, sizeof (z_stream));
+        if (deflateInit2 (self->zstream, 1, Z_DEFLATED, 15, 8, Z_RLE) !=
+                Z_OK) {
+            free (self->zstream);
+            self->zstream = NULL;
+            return -1;
+        }
+    }
+    if (log_reserve (&self->diff_buf, &self->diff_size, len) < 0 ||
+            log_reserve (&self->zbuf, &self->zbuf_size, len) < 0)
+        return -1;
+    cam_pixel_subtract_8u (self->diff_buf, frame->data, st->last_data, len);
+
+    z_stream *zs = self->zstream;
+    zs->next_in = self->diff_buf;
+    zs->avail_in = len;
+    zs->next_out = self->zbuf;
+    zs->avail_out = len - 4;
+    int status = deflate (zs, Z_FINISH);
+    int zlen = (status == Z_STREAM_END) ? (int) zs->total_out : -1;
+    deflateReset (zs);
+    return zlen;
+}
+
 int
 cam_log_write_frame (CamLog * self, CamLogFrameFormat * format,
         CamFrameBuffer * frame, int64_t * offset)
 {
-    if (self->mode != CAMLOG_MODE_WRITE)
+    return cam_log_write_stream_frame (self, 0, format, frame, offset);
+}
+
+int
+cam_log_write_stream_frame (CamLog * self, int stream,
+        CamLogFrameFormat * format, CamFrameBuffer * frame, int64_t * offset)
+{
+    if (self->mode != CAMLOG_MODE_WRITE || stream < 0)
+        return -1;
+    log_stream_t *st = get_stream (self, stream);
+    if (!st)
         return -1;
 
     int64_t frame_start_offset = ftello (self->fp);
+
+    // write a delta frame if only the metadata has changed, and not too
+    // many frames have been written since the last keyframe
+    int delta = 0;
+    GList *changed = NULL;
+    if (st->last_metadata &&
+            st->frames_since_keyframe < self->keyframe_interval &&
+            format->width == st->last_format.width &&
+            format->height == st->last_format.height &&
+            format->stride == st->last_format.stride &&
+            format->pixelformat == st->last_format.pixelformat) {
+        int removed;
+        changed = log_changed_metadata_keys (st->last_metadata, frame,
+                &removed);
+        delta = !removed;
+    }
+
+    // store the data of a delta frame as its difference from the data of the
+    // previous frame, if that compresses to less than the data itself
+    int diff_len = -1;
+    if (delta && self->temporal && st->last_data_len == frame->bytesused)
+        diff_len = log_encode_data_diff (self, st, frame);
+    uint32_t data_len = diff_len >= 0 ? 4 + diff_len : frame->bytesused;
+
+    int stream_len = stream ? LOG_HEADER_SIZE + 4 : 0;
+    int header_len = delta ? log_get_delta_header_size (frame, changed) :
+        cam_log_get_frame_header_size (frame);
+
+    // pad with a comment field, which readers skip, so that the frame data
+    // starts on an alignment boundary.  Data stored as a difference can't
+    // be used in place, so it isn't aligned.
+    if (self->data_alignment > 0 && diff_len < 0) {
+        int64_t pad = log_alignment_padding (frame_start_offset +
+                stream_len + header_len, self->data_alignment);
+        if (pad && (log_put_field (LOG_TYPE_COMMENT, pad - LOG_HEADER_SIZE,
+                        self->fp) <= 0 ||
+                    fseeko (self->fp, pad - LOG_HEADER_SIZE, SEEK_CUR) < 0)) {
+            g_list_free (changed);
+            return -1;
+        }
+        frame_start_offset += pad;
+    }
     if (offset)
         *offset = frame_start_offset;
 
-    // write frame info
-    log_put_field (LOG_TYPE_FRAME_FORMAT, 10, self->fp);
-    log_put_uint16 (format->width, self->fp);
-    log_put_uint16 (format->height, self->fp);
-    log_put_uint16 (format->stride, self->fp);
-    log_put_uint32 (format->pixelformat, self->fp);
-
-    uint64_t info_offset = ftello (self->fp);
-    log_put_field (LOG_TYPE_FRAME_INFO_1, 24, self->fp);
-    log_put_uint64 ((uint64_t) frame->timestamp, self->fp);
-    log_put_uint64 (self->curr_info.frameno, self->fp);
-    if (self->curr_info.frameno == 0)
-        log_put_uint64 (0, self->fp);
+    // the info field immediately follows the format field of a keyframe,
+    // and starts a delta frame
+    uint64_t prev_frame_offset = 0;
+    if (st->prev_offset >= 0)
+        prev_frame_offset = frame_start_offset + stream_len -
+            st->prev_offset + (delta ? 0 : LOG_HEADER_SIZE + 10);
+
+    uint8_t *header = (uint8_t*) malloc (header_len);
+    if (delta) {
+        log_encode_delta_header (frame, changed, st->frameno,
+                prev_frame_offset, diff_len >= 0 ?
+                LOG_TYPE_FRAME_DATA_DIFF : LOG_TYPE_FRAME_DATA, data_len,
+                header);
+        st->frames_since_keyframe++;
+    } else {
+        cam_log_encode_frame_header (format, frame, st->frameno,
+                prev_frame_offset, header, header_len);
+        st->frames_since_keyframe = 1;
+    }
+
+    // keep a reference to the metadata for the next frame to be compared
+    // against.  Framebuffers share their metadata until it is modified, so
+    // this doesn't copy it.
+    if (self->keyframe_interval > 0 && (!delta || changed)) {
+        if (st->last_metadata)
+            g_object_unref (st->last_metadata);
+        st->last_metadata = cam_framebuffer_new_alloc (0);
+        cam_framebuffer_copy_metadata (st->last_metadata, frame);
+        st->last_format = *format;
+    }
+    g_list_free (changed);
+    if (self->temporal && self->keyframe_interval > 0) {
+        st->last_data_len = 0;
+        if (0 == log_reserve (&st->last_data, &st->last_data_size,
+                    frame->bytesused)) {
+            memcpy (st->last_data, frame->data, frame->bytesused);
+            st->last_data_len = frame->bytesused;
+        }
+    }
+
+    st->frameno++;
+    st->prev_offset = frame_start_offset;
+
+    // write the stream field of streams other than 0
+    if (stream && (log_put_field (LOG_TYPE_STREAM, 4, self->fp) <= 0 ||
+                log_put_uint32 (stream, self->fp) <= 0)) {
+        free (header);
+        return -1;
+    }
+
+    // write frame format, info, metadata, and data field header
+    int status = fwrite (header, 1, header_len, self->fp);
+    free (header);
+    if (status != header_len)
+        return -1;
+
+    // write frame data
+    int ok;
+    if (diff_len >= 0)
+        ok = log_put_uint32 (frame->bytesused, self->fp) > 0 &&
+            fwrite (self->zbuf, 1, diff_len, self->fp) == diff_len;
     else
-        log_put_uint64 (info_offset - self->prev_offset, self->fp);
+        ok = fwrite (frame->data, 1, frame->bytesused, self->fp) ==
+            frame->bytesused;
+    self->file_size = ftello (self->fp);
 
-    self->curr_info.frameno++;
-    self->prev_offset = frame_start_offset;
+    if (!ok)
+        return -1;
+    CAM_PROBE3 (log_write_frame, frame_start_offset, frame->timestamp,
+            stream_len + header_len + data_len);
+    return 0;
+}
+
+int
+cam_log_set_data_alignment (CamLog *self, int alignment)
+{
+    if (self->mode != CAMLOG_MODE_WRITE || alignment < 0 ||
+            (alignment & (alignment - 1)))
+        return -1;
+    self->data_alignment = alignment;
+    return 0;
+}
+
+int
+cam_log_set_keyframe_interval (CamLog *self, int interval)
+{
+    if (self->mode != CAMLOG_MODE_WRITE || interval < 0)
+        return -1;
+    self->keyframe_interval = interval;
+    reset_keyframes (self);
+    return 0;
+}
+
+int
+cam_log_set_temporal_compression (CamLog *self, int enable)
+{
+    if (self->mode != CAMLOG_MODE_WRITE)
+        return -1;
+    self->temporal = (enable != 0);
+    reset_keyframes (self);
+    return 0;
+}
+
+// ====================== in-memory frame encoding ========================
+
+static inline uint8_t *
+log_encode_uint16 (uint8_t *p, uint16_t val)
+{
+    p[0] = val >> 8;
+    p[1] = val;
+    return p + 2;
+}
+
+static inline uint8_t *
+log_encode_uint32 (uint8_t *p, uint32_t val)
+{
+    p[0] = val >> 24;
+    p[1] = val >> 16;
+    p[2] = val >> 8;
+    p[3] = val;
+    return p + 4;
+}
+
+static inline uint8_t *
+log_encode_uint64 (uint8_t *p, uint64_t val)
+{
+    p = log_encode_uint32 (p, val >> 32);
+    return log_encode_uint32 (p, val);
+}
+
+static inline uint8_t *
+log_encode_field (uint8_t *p, uint16_t type, uint32_t length)
+{
+    p = log_encode_uint16 (p, LOG_MARKER);
+    p = log_encode_uint16 (p, type);
+    return log_encode_uint32 (p, length);
+}
+
+static inline uint16_t
+log_decode_uint16 (const uint8_t *p)
+{
+    return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static inline uint32_t
+log_decode_uint32 (const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+        ((uint32_t)p[2] << 8) | p[3];
+}
 
+static inline uint64_t
+log_decode_uint64 (const uint8_t *p)
+{
+    return ((uint64_t)log_decode_uint32 (p) << 32) | log_decode_uint32 (p + 4);
+}
+
+static int
+log_metadata_size (const CamFrameBuffer *frame, GList *keys)
+{
+    int size = 2;
+    for (GList * iter = keys; iter; iter = iter->next) {
+        int value_len;
+        cam_framebuffer_metadata_get (frame, iter->data, &value_len);
+        size += 2 + strlen (iter->data) + 1 + 4 + value_len;
+    }
+    return size;
+}
+
+static uint8_t *
+log_encode_metadata (uint8_t *p, const CamFrameBuffer *frame, GList *keys)
+{
+    p = log_encode_field (p, LOG_TYPE_METADATA,
+            log_metadata_size (frame, keys));
+    p = log_encode_uint16 (p, g_list_length (keys));
+    for (GList * iter = keys; iter; iter = iter->next) {
+        uint16_t key_len = strlen (iter->data);
+        p = log_encode_uint16 (p, key_len);
+        memcpy (p, iter->data, key_len);
+        p += key_len;
+        *p++ = 0;
+        int value_len;
+        const uint8_t * value = cam_framebuffer_metadata_get (frame,
+                iter->data, &value_len);
+        p = log_encode_uint32 (p, value_len);
+        memcpy (p, value, value_len);
+        p += value_len;
+    }
+    return p;
+}
+
+int
+cam_log_get_frame_header_size (const CamFrameBuffer *frame)
+{
+    int size = LOG_HEADER_SIZE + 10 + LOG_HEADER_SIZE + 24 + LOG_HEADER_SIZE;
     GList * list = cam_framebuffer_metadata_list_keys (frame);
     if (list) {
-        int size = 2;
-        for (GList * iter = list; iter; iter = iter->next) {
-            size += 2 + strlen (iter->data) + 1 + 4;
-            int value_len;
-            cam_framebuffer_metadata_get (frame, iter->data, &value_len);
-            size += value_len;
+        size += LOG_HEADER_SIZE + log_metadata_size (frame, list);
+        g_list_free (list);
+    }
+    return size;
+}
+
+int
+cam_log_encode_frame_header (const CamLogFrameFormat *format,
+        const CamFrameBuffer *frame, uint64_t frameno,
+        uint64_t prev_frame_offset, uint8_t *buf, int buf_len)
+{
+    if (buf_len < cam_log_get_frame_header_size (frame))
+        return -1;
+
+    uint8_t *p = buf;
+    p = log_encode_field (p, LOG_TYPE_FRAME_FORMAT, 10);
+    p = log_encode_uint16 (p, format->width);
+    p = log_encode_uint16 (p, format->height);
+    p = log_encode_uint16 (p, format->stride);
+    p = log_encode_uint32 (p, format->pixelformat);
+
+    p = log_encode_field (p, LOG_TYPE_FRAME_INFO_1, 24);
+    p = log_encode_uint64 (p, (uint64_t) frame->timestamp);
+    p = log_encode_uint64 (p, frameno);
+    p = log_encode_uint64 (p, prev_frame_offset);
+
+    GList * list = cam_framebuffer_metadata_list_keys (frame);
+    if (list) {
+        p = log_encode_metadata (p, frame, list);
+        g_list_free (list);
+    }
+
+    p = log_encode_field (p, LOG_TYPE_FRAME_DATA, frame->bytesused);
+    return p - buf;
+}
+
+/* Returns the metadata keys of frame that are not in prev or have a
+ * different value there, and sets removed if prev has any keys that frame
+ * doesn't. */
+static GList *
+log_changed_metadata_keys (const CamFrameBuffer *prev,
+        const CamFrameBuffer *frame, int *removed)
+{
+    GList *changed = NULL;
+    GList *keys = cam_framebuffer_metadata_list_keys (frame);
+    int nshared = 0;
+    for (GList * iter = keys; iter; iter = iter->next) {
+        int len, prev_len;
+        const uint8_t *value = cam_framebuffer_metadata_get (frame,
+                iter->data, &len);
+        const uint8_t *prev_value = cam_framebuffer_metadata_get (prev,
+                iter->data, &prev_len);
+        if (prev_value)
+            nshared++;
+        if (!prev_value || len != prev_len || memcmp (value, prev_value, len))
+            changed = g_list_prepend (changed, iter->data);
+    }
+    g_list_free (keys);
+
+    GList *prev_keys = cam_framebuffer_metadata_list_keys (prev);
+    *removed = (nshared != g_list_length (prev_keys));
+    g_list_free (prev_keys);
+    return changed;
+}
+
+static int
+log_get_delta_header_size (const CamFrameBuffer *frame, GList *keys)
+{
+    int size = LOG_HEADER_SIZE + 24 + LOG_HEADER_SIZE;
+    if (keys)
+        size += LOG_HEADER_SIZE + log_metadata_size (frame, keys);
+    return size;
+}
+
+/* Encodes the header of a delta frame, whose metadata differs from that of
+ * the previous frame only in keys, up to and including the header of its
+ * data field.  buf must hold log_get_delta_header_size() bytes. */
+static int
+log_encode_delta_header (const CamFrameBuffer *frame, GList *keys,
+        uint64_t frameno, uint64_t prev_frame_offset, uint16_t data_type,
+        uint32_t data_len, uint8_t *buf)
+{
+    uint8_t *p = buf;
+    p = log_encode_field (p, LOG_TYPE_FRAME_DELTA, 24);
+    p = log_encode_uint64 (p, (uint64_t) frame->timestamp);
+    p = log_encode_uint64 (p, frameno);
+    p = log_encode_uint64 (p, prev_frame_offset);
+    if (keys)
+        p = log_encode_metadata (p, frame, keys);
+    p = log_encode_field (p, data_type, data_len);
+    return p - buf;
+}
+
+int
+cam_log_decode_frame_header (const uint8_t *buf, int buf_len,
+        CamLogFrameFormat *format, CamLogFrameInfo *info,
+        CamFrameBuffer *frame)
+{
+    int got_format = 0;
+    int got_info = 0;
+    int delta = 0;
+    int pos = 0;
+    while (pos + LOG_HEADER_SIZE <= buf_len) {
+        const uint8_t *p = buf + pos;
+        if (log_decode_uint16 (p) != LOG_MARKER) {
+            dbg (DBG_LOG, "marker not found when decoding frame\n");
+            return -1;
+        }
+        uint16_t type = log_decode_uint16 (p + 2);
+        uint32_t len = log_decode_uint32 (p + 4);
+        p += LOG_HEADER_SIZE;
+        pos += LOG_HEADER_SIZE;
+
+        if (type == LOG_TYPE_FRAME_DATA ||
+                (type == LOG_TYPE_FRAME_DATA_DIFF && delta)) {
+            if ((!got_format && !delta) || !got_info)
+                return -1;
+            info->offset = 0;
+            info->data_len = len;
+            info->data_offset = pos;
+            return 0;
         }
 
-        log_put_field (LOG_TYPE_METADATA, size, self->fp);
-        log_put_uint16 (g_list_length (list), self->fp);
-        for (GList * iter = list; iter; iter = iter->next) {
-            uint16_t key_len = strlen (iter->data);
-            log_put_uint16 (key_len, self->fp);
-            if(fwrite (iter->data, 1, key_len, self->fp) != key_len)
+        if (pos + len > buf_len)
+            return -1;
+
+        if (type == LOG_TYPE_FRAME_FORMAT) {
+            if (len != 10)
                 return -1;
-            log_put_uint8 (0, self->fp);
-            int value_len;
-            uint8_t * value = cam_framebuffer_metadata_get (frame,
-                    iter->data, &value_len);
-            log_put_uint32 (value_len, self->fp);
-            if(fwrite (value, 1, value_len, self->fp) != value_len)
+            format->width = log_decode_uint16 (p);
+            format->height = log_decode_uint16 (p + 2);
+            format->stride = log_decode_uint16 (p + 4);
+            format->pixelformat = log_decode_uint32 (p + 6);
+            got_format = 1;
+        }
+        else if (type == LOG_TYPE_FRAME_INFO_1 ||
+                type == LOG_TYPE_FRAME_DELTA) {
+            if (len != 24)
                 return -1;
+            info->timestamp = log_decode_uint64 (p);
+            info->frameno = log_decode_uint64 (p + 8);
+            if (frame)
+                frame->timestamp = info->timestamp;
+            got_info = 1;
+            delta = (type == LOG_TYPE_FRAME_DELTA);
         }
-        g_list_free (list);
+        else if (type == LOG_TYPE_FRAME_INFO_0) {
+            if (len != LOG_FRAME_INFO_0_SIZE)
+                return -1;
+            format->width = log_decode_uint16 (p);
+            format->height = log_decode_uint16 (p + 2);
+            format->stride = log_decode_uint16 (p + 4);
+            format->pixelformat = log_decode_uint32 (p + 6);
+            info->timestamp = log_decode_uint64 (p + 10);
+            info->frameno = log_decode_uint32 (p + 30);
+            if (frame) {
+                char str[20];
+                frame->timestamp = info->timestamp;
+                sprintf (str, "0x%016"PRIx64, log_decode_uint64 (p + 22));
+                cam_framebuffer_metadata_set (frame, "Source GUID",
+                        (uint8_t *) str, strlen (str));
+                sprintf (str, "%u", log_decode_uint32 (p + 18));
+                cam_framebuffer_metadata_set (frame, "Bus Timestamp",
+                        (uint8_t *) str, strlen (str));
+            }
+            got_format = 1;
+            got_info = 1;
+        }
+        else if (type == LOG_TYPE_FRAME_TIMESTAMP) {
+            if (len != 12)
+                return -1;
+            info->timestamp = (uint64_t) log_decode_uint32 (p) * 1000000 +
+                log_decode_uint32 (p + 4);
+            if (frame) {
+                char str[20];
+                frame->timestamp = info->timestamp;
+                sprintf (str, "%u", log_decode_uint32 (p + 8));
+                cam_framebuffer_metadata_set (frame, "Bus Timestamp",
+                        (uint8_t *) str, strlen (str));
+            }
+            got_info = 1;
+        }
+        else if (type == LOG_TYPE_SOURCE_UID && frame) {
+            if (len != 8)
+                return -1;
+            char str[20];
+            sprintf (str, "0x%016"PRIx64, log_decode_uint64 (p));
+            cam_framebuffer_metadata_set (frame, "Source GUID",
+                    (uint8_t *) str, strlen (str));
+        }
+        else if (type == LOG_TYPE_METADATA && frame) {
+            const uint8_t *end = p + len;
+            uint16_t num = log_decode_uint16 (p);
+            p += 2;
+            for (int i = 0; i < num && p + 2 <= end; i++) {
+                uint16_t key_len = log_decode_uint16 (p);
+                p += 2;
+                if (p + key_len + 1 + 4 > end)
+                    return -1;
+                char key[key_len + 1];
+                memcpy (key, p, key_len);
+                key[key_len] = '\0';
+                p += key_len + 1;
+                uint32_t value_len = log_decode_uint32 (p);
+                p += 4;
+                if (p + value_len > end)
+                    return -1;
+                cam_framebuffer_metadata_set (frame, key, p, value_len);
+                p += value_len;
+            }
+        }
+        pos += len;
     }
+    return -1;
+}
 
-    // write frame data
-    log_put_field (LOG_TYPE_FRAME_DATA, frame->bytesused, self->fp);
-    int status = fwrite (frame->data, 1, frame->bytesused, self->fp);
-    self->file_size = ftello (self->fp);
+// ====================== concurrent random access ========================
+
+static int
+log_pread (int fd, void *buf, size_t len, off_t offset)
+{
+    while (len > 0) {
+        ssize_t n = pread (fd, buf, len, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf = (uint8_t*) buf + n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+/* Extends the frame index until it holds at least nframes frames, by reading
+ * field headers from where the last call left off.  Must be called with
+ * index_mutex held.  Only uses pread, so the stdio file position used by the
+ * sequential reader is left alone.  Returns 1 if the file ends cleanly
+ * before then, and -1 if it is truncated or corrupt. */
+static int
+log_index_frames (CamLog *self, int nframes)
+{
+    int fd = fileno (self->fp);
+    int64_t pos = self->index_scan_offset;
+    int64_t frame_offset = -1;
+    int delta = 0;
+    uint32_t stream = 0;
+
+    while (self->index_len < nframes) {
+        uint8_t hdr[LOG_HEADER_SIZE];
+        if (pos == self->file_size)
+            return 1;
+        if (pos + LOG_HEADER_SIZE > self->file_size ||
+                log_pread (fd, hdr, LOG_HEADER_SIZE, pos) < 0)
+            return -1;
+        if (log_decode_uint16 (hdr) != LOG_MARKER) {
+            dbg (DBG_LOG, "marker not found at %"PRId64" when indexing\n",
+                    pos);
+            return -1;
+        }
+        uint16_t type = log_decode_uint16 (hdr + 2);
+        uint32_t len = log_decode_uint32 (hdr + 4);
 
-    if (status != frame->bytesused)
+        // same rule as process_frame for where a frame starts
+        if (type == LOG_TYPE_STREAM && frame_offset < 0) {
+            uint8_t val[4];
+            if (len != 4 || log_pread (fd, val, 4, pos + LOG_HEADER_SIZE) < 0)
+                return -1;
+            frame_offset = pos;
+            stream = log_decode_uint32 (val);
+        }
+        if (type == LOG_TYPE_FRAME_FORMAT ||
+                type == LOG_TYPE_FRAME_INFO_0 ||
+                type == LOG_TYPE_FRAME_DELTA) {
+            if (frame_offset < 0) {
+                frame_offset = pos;
+                stream = 0;
+            }
+            delta = (type == LOG_TYPE_FRAME_DELTA);
+        }
+        pos += LOG_HEADER_SIZE;
+        int is_data = (type == LOG_TYPE_FRAME_DATA ||
+                type == LOG_TYPE_FRAME_DATA_DIFF);
+
+        if (is_data && frame_offset >= 0 && (int) stream != self->stream) {
+            frame_offset = -1;
+            self->index_scan_offset = pos + len;
+        } else if (is_data && frame_offset >= 0) {
+            if (pos + len > self->file_size)
+                return -1;
+            if (self->index_len == self->index_size) {
+                int size = self->index_size ? self->index_size * 2 : 1024;
+                log_index_entry_t *index = (log_index_entry_t*)
+                    realloc (self->index, size * sizeof (log_index_entry_t));
+                if (!index)
+                    return -1;
+                self->index = index;
+                self->index_size = size;
+            }
+            log_index_entry_t *entry = &self->index[self->index_len++];
+            entry->offset = frame_offset;
+            entry->data_offset = pos;
+            entry->data_len = len;
+            entry->keyframe = self->index_len - 1;
+            if (delta && self->index_len > 1)
+                entry->keyframe = self->index[self->index_len - 2].keyframe;
+            entry->diff = (type == LOG_TYPE_FRAME_DATA_DIFF);
+            frame_offset = -1;
+            self->index_scan_offset = pos + len;
+        }
+        pos += len;
+    }
+    return 0;
+}
+
+/* Adds the differences stored in the data fields of n frames, in order, to
+ * the len bytes at data. */
+static int
+log_apply_data_diffs (int fd, const log_index_entry_t *entries, int n,
+        uint8_t *data, uint32_t len)
+{
+    if (!n)
+        return 0;
+    z_stream zs;
+    memset (&zs, 0, sizeof (zs));
+    if (inflateInit (&zs) != Z_OK)
+        return -1;
+    uint8_t *zbuf = NULL;
+    uint32_t zbuf_size = 0;
+    uint8_t *diff = (uint8_t*) malloc (len);
+    int status = diff ? 0 : -1;
+    for (int i = 0; i < n && 0 == status; i++) {
+        uint32_t zlen = entries[i].data_len;
+        if (zlen < 4 || log_reserve (&zbuf, &zbuf_size, zlen) < 0 ||
+                log_pread (fd, zbuf, zlen, entries[i].data_offset) < 0 ||
+                log_decode_uint32 (zbuf) != len ||
+                log_inflate (&zs, zbuf + 4, zlen - 4, diff, len) < 0) {
+            dbg (DBG_LOG, "Failed to decode frame data at %"PRId64"\n",
+                    entries[i].offset);
+            status = -1;
+        } else {
+            cam_pixel_add_8u (data, data, diff, len);
+        }
+    }
+    inflateEnd (&zs);
+    free (zbuf);
+    free (diff);
+    return status;
+}
+
+int
+cam_log_read_frame_at (CamLog *self, int frameno, CamFrameBuffer *frame,
+        CamLogFrameFormat *format, CamLogFrameInfo *info)
+{
+    if (self->mode != CAMLOG_MODE_READ || frameno < 0)
         return -1;
+
+    // the index array may be reallocated while it is extended, so copy the
+    // entries out under the lock.  A delta frame needs the headers of all
+    // frames back to its keyframe.
+    log_index_entry_t *entries = NULL;
+    int nentries = 0;
+    g_mutex_lock (self->index_mutex);
+    int status = 0;
+    if (frameno >= self->index_len)
+        status = log_index_frames (self, frameno + 1);
+    if (0 == status) {
+        int keyframe = self->index[frameno].keyframe;
+        nentries = frameno - keyframe + 1;
+        entries = (log_index_entry_t*) g_memdup (&self->index[keyframe],
+                nentries * sizeof (log_index_entry_t));
+    }
+    g_mutex_unlock (self->index_mutex);
+    if (status != 0)
+        return status;
+
+    int fd = fileno (self->fp);
+    log_index_entry_t entry = entries[nentries - 1];
+    CamLogFrameFormat fmt;
+    CamLogFrameInfo inf;
+    for (int i = 0; i < nentries; i++) {
+        int header_len = entries[i].data_offset - entries[i].offset;
+        uint8_t *header = (uint8_t*) malloc (header_len);
+        // legacy frames may not record a frame number
+        inf.frameno = self->first_frame_info.frameno + frameno;
+        if (!header ||
+                log_pread (fd, header, header_len, entries[i].offset) < 0 ||
+                cam_log_decode_frame_header (header, header_len, &fmt, &inf,
+                    frame) < 0) {
+            dbg (DBG_LOG, "Failed to read frame header at %"PRId64"\n",
+                    entries[i].offset);
+            free (header);
+            g_free (entries);
+            return -1;
+        }
+        free (header);
+    }
+
+    // data stored as a difference is rebuilt from the data of the last frame
+    // before it that was stored as it is
+    int first = nentries - 1;
+    while (first > 0 && entries[first].diff)
+        first--;
+    uint32_t data_len = entries[first].data_len;
+
+    inf.offset = entry.offset;
+    inf.data_offset = entry.data_offset;
+    inf.data_len = data_len;
+    if (format)
+        *format = fmt;
+    if (info)
+        *info = inf;
+
+    status = -1;
+    if (frame->length < data_len) {
+        dbg (DBG_LOG, "Frame buffer too small (%u < %u)\n", frame->length,
+                data_len);
+    } else if (0 == log_pread (fd, frame->data, data_len,
+                entries[first].data_offset)) {
+        status = log_apply_data_diffs (fd, entries + first + 1,
+                nentries - first - 1, frame->data, data_len);
+    }
+    g_free (entries);
+    if (status < 0)
+        return -1;
+    frame->bytesused = data_len;
+    CAM_PROBE3 (log_get_frame, entry.offset, frame->timestamp,
+            frame->bytesused);
     return 0;
 }
 
+// ========================= verbatim frame copy ==========================
+
+typedef struct {
+    int nframes;
+    uint64_t first_frameno;
+    uint64_t last_frameno;
+    int64_t first_info_offset;
+    int64_t last_frame_offset;
+    int64_t end;
+    int first_is_delta;
+    int64_t first_end;
+} log_run_t;
+
+/* Walks the frames of a log in [start, end) using pread.  Stops early at a
+ * frame that does not fit in the range.  If patch_fd is not -1, the frame
+ * number of each frame is increased by delta in the copy of the range that
+ * starts at patch_offset in patch_fd. */
+static int
+log_scan_run (int fd, int64_t start, int64_t end, log_run_t *run,
+        int patch_fd, int64_t patch_offset, int64_t delta)
+{
+    memset (run, 0, sizeof (log_run_t));
+    run->end = start;
+    int64_t pos = start;
+    int64_t frame_offset = -1;
+    int got_info = 0;
+    while (pos + LOG_HEADER_SIZE <= end) {
+        uint8_t hdr[LOG_HEADER_SIZE + 24];
+        if (log_pread (fd, hdr, LOG_HEADER_SIZE, pos) < 0)
+            return -1;
+        if (log_decode_uint16 (hdr) != LOG_MARKER) {
+            dbg (DBG_LOG, "marker not found at %"PRId64"\n", pos);
+            return -1;
+        }
+        uint16_t type = log_decode_uint16 (hdr + 2);
+        uint32_t len = log_decode_uint32 (hdr + 4);
+        if (pos + LOG_HEADER_SIZE + len > end)
+            break;
+
+        if (type == LOG_TYPE_FRAME_INFO_0 || type == LOG_TYPE_FRAME_TIMESTAMP) {
+            dbg (DBG_LOG, "can't copy legacy frames\n");
+            return -1;
+        }
+        if (type == LOG_TYPE_STREAM) {
+            dbg (DBG_LOG, "can't copy frames of multiple streams\n");
+            return -1;
+        }
+        if ((type == LOG_TYPE_FRAME_FORMAT || type == LOG_TYPE_FRAME_DELTA)
+                && frame_offset < 0) {
+            frame_offset = pos;
+            if (!run->nframes)
+                run->first_is_delta = (type == LOG_TYPE_FRAME_DELTA);
+        }
+        if ((type == LOG_TYPE_FRAME_INFO_1 || type == LOG_TYPE_FRAME_DELTA)
+                && frame_offset >= 0) {
+            if (len != 24 ||
+                    log_pread (fd, hdr + LOG_HEADER_SIZE, 24,
+                        pos + LOG_HEADER_SIZE) < 0)
+                return -1;
+            uint64_t frameno = log_decode_uint64 (hdr + LOG_HEADER_SIZE + 8);
+            if (!run->nframes) {
+                run->first_frameno = frameno;
+                run->first_info_offset = pos;
+            }
+            run->last_frameno = frameno;
+            got_info = 1;
+            if (patch_fd >= 0) {
+                uint8_t val[8];
+                log_encode_uint64 (val, frameno + delta);
+                if (pwrite (patch_fd, val, 8, patch_offset + pos - start +
+                            LOG_HEADER_SIZE + 8) != 8)
+                    return -1;
+            }
+        }
+        if ((type == LOG_TYPE_FRAME_DATA ||
+                    type == LOG_TYPE_FRAME_DATA_DIFF) && frame_offset >= 0) {
+            if (!got_info) {
+                dbg (DBG_LOG, "frame at %"PRId64" has no info\n",
+                        frame_offset);
+                return -1;
+            }
+            run->last_frame_offset = frame_offset;
+            run->nframes++;
+            run->end = pos + LOG_HEADER_SIZE + len;
+            if (run->nframes == 1)
+                run->first_end = run->end;
+            frame_offset = -1;
+            got_info = 0;
+        }
+        pos += LOG_HEADER_SIZE + len;
+    }
+    return 0;
+}
+
+static int
+log_copy_bytes (int in_fd, int64_t src, int out_fd, int64_t dst, int64_t len)
+{
+#ifdef HAVE_COPY_FILE_RANGE
+    while (len > 0) {
+        loff_t in_off = src;
+        loff_t out_off = dst;
+        ssize_t n = copy_file_range (in_fd, &in_off, out_fd, &out_off,
+                len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == ENOSYS || errno == EXDEV ||
+                    errno == EINVAL || errno == EOPNOTSUPP))
+            break;
+        if (n <= 0)
+            return -1;
+        src += n;
+        dst += n;
+        len -= n;
+    }
+#endif
+    // copy through userspace if the kernel can't do it
+    uint8_t *buf = NULL;
+    if (len > 0 && !(buf = (uint8_t*) malloc (1 << 20)))
+        return -1;
+    while (len > 0) {
+        int n = MIN (len, 1 << 20);
+        if (log_pread (in_fd, buf, n, src) < 0 ||
+                pwrite (out_fd, buf, n, dst) != n) {
+            free (buf);
+            return -1;
+        }
+        src += n;
+        dst += n;
+        len -= n;
+    }
+    free (buf);
+    return 0;
+}
+
+/* Shares the blocks in [src, src + len) with the output file where the file
+ * system supports it, and copies them otherwise.  src and dst must be at the
+ * same offset within a block for the blocks to be shared. */
+static int
+log_clone_bytes (CamLog *self, int in_fd, int64_t src, int out_fd,
+        int64_t dst, int64_t len, int block_size)
+{
+#ifdef FICLONERANGE
+    int64_t head = MIN (len, (block_size - src % block_size) % block_size);
+    int64_t body = (len - head) / block_size * block_size;
+    if (!self->no_reflink && body > 0 &&
+            (src - dst) % block_size == 0) {
+        if (log_copy_bytes (in_fd, src, out_fd, dst, head) < 0)
+            return -1;
+        struct file_clone_range range = {
+            .src_fd = in_fd,
+            .src_offset = src + head,
+            .src_length = body,
+            .dest_offset = dst + head
+        };
+        if (0 == ioctl (out_fd, FICLONERANGE, &range))
+            return log_copy_bytes (in_fd, src + head + body, out_fd,
+                    dst + head + body, len - head - body);
+        dbg (DBG_LOG, "reflinks not available: %s\n", strerror (errno));
+        self->no_reflink = 1;
+        return log_copy_bytes (in_fd, src + head, out_fd, dst + head,
+                len - head);
+    }
+#endif
+    return log_copy_bytes (in_fd, src, out_fd, dst, len);
+}
+
+static int
+log_append_run (CamLog *self, CamLog *src, int64_t start_offset,
+        log_run_t run)
+{
+    int in_fd = fileno (src->fp);
+    log_stream_t *st = get_stream (self, 0);
+    if (!st || fflush (self->fp) != 0)
+        return -1;
+    int out_fd = fileno (self->fp);
+    int64_t dst = ftello (self->fp);
+    int empty = (st->prev_offset < 0);
+    struct stat statbuf;
+    int block_size = 4096;
+    if (0 == fstat (out_fd, &statbuf) && statbuf.st_blksize > 0)
+        block_size = statbuf.st_blksize;
+
+    // Pad with a comment field, which readers skip, so that the frames have
+    // the same offset within a block as in the source and can be reflinked.
+    // Not worth it for short runs, unless the frame data is to be aligned.
+    int64_t len = run.end - start_offset;
+    int align = 0;
+    if (!self->no_reflink && len >= 16 * block_size)
+        align = block_size;
+    if (self->data_alignment > align)
+        align = self->data_alignment;
+    int64_t pad = 0;
+    if (align)
+        pad = log_alignment_padding (dst - start_offset % align, align);
+    if (pad) {
+        uint8_t hdr[LOG_HEADER_SIZE];
+        log_encode_field (hdr, LOG_TYPE_COMMENT, pad - LOG_HEADER_SIZE);
+        if (pwrite (out_fd, hdr, LOG_HEADER_SIZE, dst) != LOG_HEADER_SIZE ||
+                ftruncate (out_fd, dst + pad) < 0)
+            return -1;
+        dst += pad;
+    }
+
+    if (log_clone_bytes (self, in_fd, start_offset, out_fd, dst, len,
+                block_size) < 0)
+        return -1;
+
+    // link the first frame to the last frame already in the log
+    uint8_t val[8];
+    int64_t info_offset = dst + run.first_info_offset - start_offset;
+    log_encode_uint64 (val, empty ? 0 : info_offset - st->prev_offset);
+    if (pwrite (out_fd, val, 8, info_offset + LOG_HEADER_SIZE + 16) != 8)
+        return -1;
+
+    // frame numbers are only rewritten if they don't continue on from the
+    // frames already in the log
+    uint64_t frameno = empty ? run.first_frameno : st->frameno;
+    if (frameno != run.first_frameno ||
+            run.last_frameno - run.first_frameno + 1 != run.nframes) {
+        if (log_scan_run (in_fd, start_offset, run.end, &run, out_fd, dst,
+                    frameno - run.first_frameno) < 0)
+            return -1;
+    }
+
+    st->frameno = frameno + run.nframes;
+    st->prev_offset = dst + run.last_frame_offset - start_offset;
+    self->file_size = dst + len;
+    if (fseeko (self->fp, self->file_size, SEEK_SET) < 0)
+        return -1;
+
+    // the next frame written can't be a delta frame, as the metadata of the
+    // last frame copied is unknown
+    if (st->last_metadata) {
+        g_object_unref (st->last_metadata);
+        st->last_metadata = NULL;
+    }
+    return run.nframes;
+}
+
+int
+cam_log_append_frames (CamLog *self, CamLog *src, int64_t start_offset,
+        int64_t end_offset)
+{
+    if (self->mode != CAMLOG_MODE_WRITE || src->mode != CAMLOG_MODE_READ)
+        return -1;
+
+    int in_fd = fileno (src->fp);
+    log_run_t run;
+    if (log_scan_run (in_fd, start_offset, end_offset, &run, -1, 0, 0) < 0)
+        return -1;
+    if (!run.nframes)
+        return 0;
+    if (!run.first_is_delta)
+        return log_append_run (self, src, start_offset, run);
+
+    // A delta frame can't be read without the frames before it, so the first
+    // frame is decoded and written in full.  The frames after it are copied
+    // as they are, since they only depend on the frames before them.
+    if (cam_log_seek_to_offset (src, start_offset) < 0 ||
+            src->curr_info.offset != start_offset)
+        return -1;
+    CamFrameBuffer *frame = cam_log_get_frame (src);
+    if (!frame)
+        return -1;
+    log_stream_t *st = get_stream (self, 0);
+    if (!st) {
+        g_object_unref (frame);
+        return -1;
+    }
+    if (st->prev_offset < 0)
+        st->frameno = run.first_frameno;
+    if (st->last_metadata) {
+        g_object_unref (st->last_metadata);
+        st->last_metadata = NULL;
+    }
+    int status = cam_log_write_frame (self, &src->curr_format, frame, NULL);
+    g_object_unref (frame);
+    if (status < 0)
+        return -1;
+
+    int64_t next_offset = run.first_end;
+    if (log_scan_run (in_fd, next_offset, end_offset, &run, -1, 0, 0) < 0)
+        return -1;
+    if (!run.nframes)
+        return 1;
+    int nframes = log_append_run (self, src, next_offset, run);
+    return nframes < 0 ? -1 : nframes + 1;
+}
+
 int 
 cam_log_count_frames (CamLog *self)
 {
@@ -806,7 +2235,7 @@ find_last_frame_info (CamLog *self)
 {
     int64_t search_inc = 5000000;
 
-    for (int i=1; i < (self->file_size / search_inc) + 1 ; i++) {
+    for (int i=1; i <= (self->file_size / search_inc) + 1 ; i++) {
         off_t offset = MAX (0, self->file_size - i * search_inc);
 
         if (0 == cam_log_seek_to_offset (self, offset)) {
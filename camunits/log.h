@@ -53,6 +53,224 @@ CamFrameBuffer * cam_log_get_frame (CamLog * self);
 int cam_log_write_frame (CamLog * self, CamLogFrameFormat * format,
         CamFrameBuffer * frame, int64_t * offset);
 
+/**
+ * cam_log_write_stream_frame:
+ * @stream: the stream to write the frame to, from 0 up
+ *
+ * Writes a frame to one of several streams in the log, e.g. one per camera,
+ * so that frames from several sources can be recorded into one file with
+ * sequential writes.  Each stream has its own frame numbers, and the frames
+ * of one stream are read back with cam_log_set_stream().  Frames written with
+ * cam_log_write_frame() belong to stream 0, and frames of other streams cost
+ * 12 more bytes each.  Versions of Camunits without streams read the frames
+ * of all streams in turn.
+ *
+ * Write-mode only.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+int cam_log_write_stream_frame (CamLog * self, int stream,
+        CamLogFrameFormat * format, CamFrameBuffer * frame, int64_t * offset);
+
+/**
+ * cam_log_set_stream:
+ * @stream: the stream to read
+ *
+ * Selects the stream whose frames are read, and moves the reader to its
+ * first frame.  The sequential and random access readers, the frame count
+ * and the seek functions all work on the frames of the selected stream only,
+ * as if the log held no others.  A newly opened log reads the stream of the
+ * first frame in the file.
+ *
+ * Read-mode only.
+ *
+ * Returns: 0 on success, -1 if there are no frames in @stream
+ */
+int cam_log_set_stream (CamLog *self, int stream);
+
+/**
+ * cam_log_get_stream:
+ *
+ * Returns: the stream being read
+ */
+int cam_log_get_stream (CamLog *self);
+
+/**
+ * cam_log_set_data_alignment:
+ * @alignment: a power of two, or 0 to not align frame data
+ *
+ * Pads each frame written from now on so that its image data starts at a
+ * multiple of @alignment bytes in the file, e.g. 4096 for page-aligned data.
+ * A reader can then read the data with O_DIRECT, or map the file and pass
+ * pointers to the data straight to SIMD code that needs aligned input.  The
+ * padding is written as a field that all versions of Camunits skip, and
+ * costs about @alignment / 2 bytes per frame.
+ *
+ * The default is 0.
+ *
+ * Write-mode only.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+int cam_log_set_data_alignment (CamLog *self, int alignment);
+
+/**
+ * cam_log_set_keyframe_interval:
+ * @interval: the maximum number of frames from one keyframe to the next, or
+ *            0 to write every frame as a keyframe
+ *
+ * Enables delta frames, which leave out the frame format and any metadata
+ * that is the same as in the previous frame.  For small frames, e.g. JPEG
+ * images, this saves a lot of space.  A keyframe, which records the format
+ * and metadata in full, is still written every @interval frames, and
+ * whenever the format changes or a metadata key is removed.  Readers
+ * reconstruct delta frames transparently, but seeking to one may read back
+ * as far as its keyframe.  Versions of Camunits without delta frames skip
+ * them and only read the keyframes.
+ *
+ * The default is 0.
+ *
+ * Write-mode only.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+int cam_log_set_keyframe_interval (CamLog *self, int interval);
+
+/**
+ * cam_log_set_temporal_compression:
+ * @enable: 1 to store delta frames as differences from the previous frame
+ *
+ * Stores the image data of each delta frame (see
+ * cam_log_set_keyframe_interval()) as its bytewise difference from the data
+ * of the previous frame in the stream, compressed with zlib, when that is
+ * smaller than the data itself.  This is lossless, and intended for raw
+ * images, e.g. gray or Bayer, of mostly static scenes, which typically shrink
+ * several times over.  It has no effect unless the keyframe interval is
+ * greater than 0.  Keyframes still store their data as it is, so readers
+ * decode a frame from its keyframe onwards after a seek.  Compressing costs
+ * CPU time in the writer, and the frame data of compressed frames is not
+ * aligned (see cam_log_set_data_alignment()).
+ *
+ * The default is 0.
+ *
+ * Write-mode only.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+int cam_log_set_temporal_compression (CamLog *self, int enable);
+
+/**
+ * cam_log_read_frame_at:
+ * @frameno: the frame to read, counting from 0 at the first frame in the
+ *           file, as for cam_log_seek_to_frame()
+ * @frame: receives the image data, timestamp, and metadata of the frame.  Its
+ *         data buffer must hold at least @info->data_len bytes.
+ * @format: output parameter.  If not NULL, the frame format.
+ * @info: output parameter.  If not NULL, the frame info.  This is filled in
+ *        even when @frame is too small, so that the caller can allocate a
+ *        larger buffer and try again.
+ *
+ * Reads a frame without using or changing the position of the sequential
+ * reader.  Unlike the other read functions, this may be called concurrently
+ * from any number of threads on one #CamLog.  The frame offsets are indexed
+ * on first use, up to the highest frame requested so far, so reading frames
+ * in order does not scan the file twice.  For a delta frame, the headers of
+ * the frames back to its keyframe are read as well, and if its data is
+ * stored as a difference (see cam_log_set_temporal_compression()), their
+ * data too.
+ *
+ * Read-mode only.
+ *
+ * Returns: 0 on success, 1 if the log ends before frame @frameno, -1 on
+ * failure, including when the log is truncated or corrupt before that frame
+ */
+int cam_log_read_frame_at (CamLog *self, int frameno, CamFrameBuffer *frame,
+        CamLogFrameFormat *format, CamLogFrameInfo *info);
+
+/**
+ * cam_log_append_frames:
+ * @self: a log opened for writing
+ * @src: a log opened for reading
+ * @start_offset: offset in @src of the first frame to copy, as in
+ *                #CamLogFrameInfo
+ * @end_offset: offset in @src just past the last frame to copy, e.g. the
+ *              offset of the following frame or the size of @src.  A frame
+ *              that doesn't fit before @end_offset is not copied.
+ *
+ * Appends frames from @src to @self as they are, without decoding them.  The
+ * data is copied within the kernel with copy_file_range() where available,
+ * and shared with @src using reflinks on file systems that support them, so
+ * that even very long clips are copied quickly.  To allow reflinks, a padding
+ * field that readers skip may be written before the frames.  If @self has a
+ * data alignment (see cam_log_set_data_alignment()), the frames are also
+ * padded to keep their offsets modulo the alignment, so that frames copied
+ * from a log with the same alignment stay aligned.
+ *
+ * Only the first frame is modified, to link it to the previous frame in
+ * @self.  The frame numbers of the copied frames are rewritten only when they
+ * do not follow on from those already in @self.  If the first frame is a
+ * delta frame (see cam_log_set_keyframe_interval()), it is decoded and
+ * written in full instead, which moves the read position of @src.  Frames
+ * written with the legacy log formats, and logs with several streams (see
+ * cam_log_write_stream_frame()), cannot be copied.  The copied frames belong
+ * to stream 0 of @self.
+ *
+ * Returns: the number of frames appended, or -1 on failure
+ */
+int cam_log_append_frames (CamLog *self, CamLog *src, int64_t start_offset,
+        int64_t end_offset);
+
+/**
+ * cam_log_get_frame_header_size:
+ *
+ * Returns: the number of bytes that cam_log_encode_frame_header() needs to
+ * encode the header of @frame.
+ */
+int cam_log_get_frame_header_size (const CamFrameBuffer *frame);
+
+/**
+ * cam_log_encode_frame_header:
+ * @format: the frame format
+ * @frame: the frame whose timestamp and metadata are to be encoded
+ * @frameno: the frame number to encode
+ * @prev_frame_offset: distance in bytes back to the start of the previous
+ *                     frame, or 0
+ * @buf: output buffer
+ * @buf_len: size of @buf
+ *
+ * Encodes a frame in the log file format, up to and including the header
+ * of the frame data field.  Appending the @frame->bytesused bytes of image
+ * data produces a complete log record, the same as cam_log_write_frame()
+ * would write.  Used to stream frames over transports other than files.
+ *
+ * Returns: the number of bytes written to @buf, or -1 if @buf is too small.
+ */
+int cam_log_encode_frame_header (const CamLogFrameFormat *format,
+        const CamFrameBuffer *frame, uint64_t frameno,
+        uint64_t prev_frame_offset, uint8_t *buf, int buf_len);
+
+/**
+ * cam_log_decode_frame_header:
+ * @buf: an encoded frame, as produced by cam_log_encode_frame_header()
+ * @buf_len: size of @buf
+ * @format: output parameter.  The frame format.
+ * @info: output parameter.  On return, data_len is the size of the image
+ *        data, and data_offset is where the image data starts in @buf.
+ * @frame: if not NULL, the timestamp and metadata of the frame are stored
+ *         here.
+ *
+ * Decodes a frame header produced by cam_log_encode_frame_header().  The
+ * image data itself need not be present in @buf.  The header of a delta frame
+ * read from a log file holds only the changes from the previous frame, so
+ * @format is left as it is and only the changed metadata is stored in
+ * @frame.
+ *
+ * Returns: 0 on success, -1 if @buf does not contain a valid header.
+ */
+int cam_log_decode_frame_header (const uint8_t *buf, int buf_len,
+        CamLogFrameFormat *format, CamLogFrameInfo *info,
+        CamFrameBuffer *frame);
+
 /**
  * cam_log_count_frames:
  *
@@ -7,6 +7,8 @@
 #include "cpuid.h"
 #include "pixels_sse2.h"
 #include "pixels_sse3.h"
+#include "pixels_ssse3.h"
+#include "pixels_avx2.h"
 
 // HAVE_INTEL is defined in config.h by autotools
 #ifdef HAVE_CONFIG_H
@@ -30,15 +32,52 @@
 static int cpuid_detected = 0;
 static int has_sse2;
 static int has_sse3;
+static int has_ssse3;
+static int has_avx2;
 
 int cam_pixel_check_sse2(){
     if (!cpuid_detected) {
         cpuid_detect (&has_sse2, &has_sse3);
+        cpuid_detect_ext (&has_ssse3, &has_avx2);
         cpuid_detected = 1;
     }
     return has_sse2;
 }
 
+/* The SSSE3 and AVX2 channel reordering and YUV kernels convert as much of
+ * each row as they can, and return the number of pixels converted in each
+ * row.  The scalar loops finish the rest. */
+typedef int (*swizzle_func_t) (uint8_t *dst, int dstride,
+        const uint8_t *src, int sstride, int width, int height);
+
+#ifdef HAVE_INTEL
+#define SSSE3_KERNEL(name) cam_pixel_##name##_ssse3
+#else
+#define SSSE3_KERNEL(name) NULL
+#endif
+#ifdef HAVE_AVX2
+#define AVX2_KERNEL(name) cam_pixel_##name##_avx2
+#else
+#define AVX2_KERNEL(name) NULL
+#endif
+
+static int
+swizzle_simd (swizzle_func_t ssse3, swizzle_func_t avx2,
+        uint8_t *dst, int dstride, const uint8_t *src, int sstride,
+        int width, int height)
+{
+    cam_pixel_check_sse2 ();
+    if (avx2 && has_avx2)
+        return avx2 (dst, dstride, src, sstride, width, height);
+    if (ssse3 && has_ssse3)
+        return ssse3 (dst, dstride, src, sstride, width, height);
+    return 0;
+}
+
+#define SWIZZLE_SIMD(name, dst, dstride, src, sstride, width, height) \
+    swizzle_simd (SSSE3_KERNEL(name), AVX2_KERNEL(name), \
+            dst, dstride, src, sstride, width, height)
+
 GType
 cam_pixel_format_get_type (void)
 {
@@ -121,7 +160,7 @@ cam_pixel_format_bpp (CamPixelFormat p)
         case CAM_PIXEL_FORMAT_I420:
             return 12;
         case CAM_PIXEL_FORMAT_NV12:
-            return 10;
+            return 12;
         case CAM_PIXEL_FORMAT_RGBA:
         case CAM_PIXEL_FORMAT_BGRA:
             return 32;
@@ -176,11 +215,13 @@ cam_pixel_convert_8u_gray_to_8u_RGB (uint8_t * dest, int dstride,
         int dwidth, int dheight, const uint8_t * src, int sstride)
 {
     int i, j;
+    int done = SWIZZLE_SIMD (gray_to_rgb, dest, dstride, src, sstride,
+            dwidth, dheight);
 
     for (i = 0; i < dheight; i++) {
         uint8_t * drow = dest + i * dstride;
         const uint8_t * srow = src + i * sstride;
-        for (j = 0; j < dwidth; j++) {
+        for (j = done; j < dwidth; j++) {
             drow[3*j] = drow[3*j+1] = drow[3*j+2] = srow[j];
         }
     }
@@ -236,11 +277,13 @@ cam_pixel_convert_8u_gray_to_8u_RGBA (uint8_t * dest, int dstride,
         int dwidth, int dheight, const uint8_t * src, int sstride)
 {
     int i, j;
+    int done = SWIZZLE_SIMD (gray_to_rgba, dest, dstride, src, sstride,
+            dwidth, dheight);
 
     for (i = 0; i < dheight; i++) {
         uint8_t * drow = dest + i * dstride;
         const uint8_t * srow = src + i * sstride;
-        for (j = 0; j < dwidth; j++) {
+        for (j = done; j < dwidth; j++) {
             drow[4*j] = drow[4*j+1] = drow[4*j+2] = srow[j];
             drow[4*j+3] = 0xff;
         }
@@ -301,10 +344,12 @@ cam_pixel_convert_8u_rgb_to_8u_bgr(uint8_t *dest, int dstride, int dwidth,
         int dheight, const uint8_t *src, int sstride)
 {
     int i, j;
+    int done = SWIZZLE_SIMD (rgb_to_bgr, dest, dstride, src, sstride,
+            dwidth, dheight);
     for (i = 0; i < dheight; i++) {
         uint8_t * drow = dest + i * dstride;
         const uint8_t * srow = src + i * sstride;
-        for (j = 0; j < dwidth; j++) {
+        for (j = done; j < dwidth; j++) {
             drow[j*3 + 0] = srow[j*3 + 2];
             drow[j*3 + 1] = srow[j*3 + 1];
             drow[j*3 + 2] = srow[j*3 + 0];
@@ -326,13 +371,16 @@ cam_pixel_convert_8u_rgb_to_8u_bgra(uint8_t *dest, int dstride, int dwidth,
         int dheight, const uint8_t *src, int sstride)
 {
     int i, j;
+    int done = SWIZZLE_SIMD (rgb_to_bgra, dest, dstride, src, sstride,
+            dwidth, dheight);
     for (i = 0; i < dheight; i++) {
         uint8_t * drow = dest + i * dstride;
         const uint8_t * srow = src + i * sstride;
-        for (j = 0; j < dwidth; j++) {
+        for (j = done; j < dwidth; j++) {
             drow[j*4 + 0] = srow[j*3 + 2];
             drow[j*4 + 1] = srow[j*3 + 1];
             drow[j*4 + 2] = srow[j*3 + 0];
+            drow[j*4 + 3] = 0xff;
         }
     }
     return 0;
@@ -343,10 +391,12 @@ cam_pixel_convert_8u_bgra_to_8u_bgr(uint8_t *dest, int dstride, int dwidth,
         int dheight, const uint8_t *src, int sstride)
 {
     int i, j;
+    int done = SWIZZLE_SIMD (bgra_to_bgr, dest, dstride, src, sstride,
+            dwidth, dheight);
     for (i = 0; i < dheight; i++) {
         uint8_t * drow = dest + i * dstride;
         const uint8_t * srow = src + i * sstride;
-        for (j = 0; j < dwidth; j++) {
+        for (j = done; j < dwidth; j++) {
             drow[j*3 + 0] = srow[j*4 + 0];
             drow[j*3 + 1] = srow[j*4 + 1];
             drow[j*3 + 2] = srow[j*4 + 2];
@@ -360,10 +410,12 @@ cam_pixel_convert_8u_bgra_to_8u_rgb(uint8_t *dest, int dstride, int dwidth,
         int dheight, const uint8_t *src, int sstride)
 {
     int i, j;
+    int done = SWIZZLE_SIMD (bgra_to_rgb, dest, dstride, src, sstride,
+            dwidth, dheight);
     for (i = 0; i < dheight; i++) {
         uint8_t * drow = dest + i * dstride;
         const uint8_t * srow = src + i * sstride;
-        for (j = 0; j < dwidth; j++) {
+        for (j = done; j < dwidth; j++) {
             drow[j*3 + 0] = srow[j*4 + 2];
             drow[j*3 + 1] = srow[j*4 + 1];
             drow[j*3 + 2] = srow[j*4 + 0];
@@ -372,18 +424,16 @@ cam_pixel_convert_8u_bgra_to_8u_rgb(uint8_t *dest, int dstride, int dwidth,
     return 0;
 }
 
-int 
-cam_pixel_convert_8u_yuv420p_to_8u_rgb(uint8_t *dest, int dstride, int dwidth,
-        int dheight, const uint8_t *src, int sstride)
+int
+cam_pixel_convert_8u_i420_planes_to_8u_rgb (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *y, int ystride,
+        const uint8_t *u, const uint8_t *v, int cstride)
 {
-    const uint8_t *uplane = src + dheight*sstride;
-    const uint8_t *vplane = uplane + dheight*sstride/4;
-
     for (int i=0; i<dheight/2; i++) {
-        const uint8_t *yrow1 = src + i*2*sstride;
-        const uint8_t *yrow2 = src + i*2*sstride + sstride;
-        const uint8_t *urow = uplane + i*sstride/2;
-        const uint8_t *vrow = vplane + i*sstride/2;
+        const uint8_t *yrow1 = y + i*2*ystride;
+        const uint8_t *yrow2 = y + i*2*ystride + ystride;
+        const uint8_t *urow = u + i*cstride;
+        const uint8_t *vrow = v + i*cstride;
         uint8_t *rgb1 = dest + i*2*dstride;
         uint8_t *rgb2 = dest + i*2*dstride + dstride;
         for (int j=0; j<dwidth/2; j++) {
@@ -430,17 +480,25 @@ cam_pixel_convert_8u_yuv420p_to_8u_rgb(uint8_t *dest, int dstride, int dwidth,
 }
 
 int
-cam_pixel_convert_8u_yuv420p_to_8u_bgr(uint8_t *dest, int dstride, int dwidth,
+cam_pixel_convert_8u_yuv420p_to_8u_rgb (uint8_t *dest, int dstride, int dwidth,
         int dheight, const uint8_t *src, int sstride)
 {
     const uint8_t *uplane = src + dheight*sstride;
     const uint8_t *vplane = uplane + dheight*sstride/4;
+    return cam_pixel_convert_8u_i420_planes_to_8u_rgb (dest, dstride,
+            dwidth, dheight, src, sstride, uplane, vplane, sstride/2);
+}
 
+int
+cam_pixel_convert_8u_i420_planes_to_8u_bgr (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *y, int ystride,
+        const uint8_t *u, const uint8_t *v, int cstride)
+{
     for (int i=0; i<dheight/2; i++) {
-        const uint8_t *yrow1 = src + i*2*sstride;
-        const uint8_t *yrow2 = src + i*2*sstride + sstride;
-        const uint8_t *urow = uplane + i*sstride/2;
-        const uint8_t *vrow = vplane + i*sstride/2;
+        const uint8_t *yrow1 = y + i*2*ystride;
+        const uint8_t *yrow2 = y + i*2*ystride + ystride;
+        const uint8_t *urow = u + i*cstride;
+        const uint8_t *vrow = v + i*cstride;
         uint8_t *rgb1 = dest + i*2*dstride;
         uint8_t *rgb2 = dest + i*2*dstride + dstride;
         for (int j=0; j<dwidth/2; j++) {
@@ -485,18 +543,26 @@ cam_pixel_convert_8u_yuv420p_to_8u_bgr(uint8_t *dest, int dstride, int dwidth,
     }
     return 0;
 }
-int 
-cam_pixel_convert_8u_yuv420p_to_8u_rgba(uint8_t *dest, int dstride, int dwidth,
+
+int
+cam_pixel_convert_8u_yuv420p_to_8u_bgr (uint8_t *dest, int dstride, int dwidth,
         int dheight, const uint8_t *src, int sstride)
 {
     const uint8_t *uplane = src + dheight*sstride;
     const uint8_t *vplane = uplane + dheight*sstride/4;
-
+    return cam_pixel_convert_8u_i420_planes_to_8u_bgr (dest, dstride,
+            dwidth, dheight, src, sstride, uplane, vplane, sstride/2);
+}
+int
+cam_pixel_convert_8u_i420_planes_to_8u_rgba (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *y, int ystride,
+        const uint8_t *u, const uint8_t *v, int cstride)
+{
     for (int i=0; i<dheight/2; i++) {
-        const uint8_t *yrow1 = src + i*2*sstride;
-        const uint8_t *yrow2 = src + i*2*sstride + sstride;
-        const uint8_t *urow = uplane + i*sstride/2;
-        const uint8_t *vrow = vplane + i*sstride/2;
+        const uint8_t *yrow1 = y + i*2*ystride;
+        const uint8_t *yrow2 = y + i*2*ystride + ystride;
+        const uint8_t *urow = u + i*cstride;
+        const uint8_t *vrow = v + i*cstride;
         uint8_t *rgb1 = dest + i*2*dstride;
         uint8_t *rgb2 = dest + i*2*dstride + dstride;
         for (int j=0; j<dwidth/2; j++) {
@@ -545,18 +611,26 @@ cam_pixel_convert_8u_yuv420p_to_8u_rgba(uint8_t *dest, int dstride, int dwidth,
     }
     return 0;
 }
+
 int
-cam_pixel_convert_8u_yuv420p_to_8u_bgra(uint8_t *dest, int dstride, int dwidth,
+cam_pixel_convert_8u_yuv420p_to_8u_rgba (uint8_t *dest, int dstride, int dwidth,
         int dheight, const uint8_t *src, int sstride)
 {
     const uint8_t *uplane = src + dheight*sstride;
     const uint8_t *vplane = uplane + dheight*sstride/4;
-
+    return cam_pixel_convert_8u_i420_planes_to_8u_rgba (dest, dstride,
+            dwidth, dheight, src, sstride, uplane, vplane, sstride/2);
+}
+int
+cam_pixel_convert_8u_i420_planes_to_8u_bgra (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *y, int ystride,
+        const uint8_t *u, const uint8_t *v, int cstride)
+{
     for (int i=0; i<dheight/2; i++) {
-        const uint8_t *yrow1 = src + i*2*sstride;
-        const uint8_t *yrow2 = src + i*2*sstride + sstride;
-        const uint8_t *urow = uplane + i*sstride/2;
-        const uint8_t *vrow = vplane + i*sstride/2;
+        const uint8_t *yrow1 = y + i*2*ystride;
+        const uint8_t *yrow2 = y + i*2*ystride + ystride;
+        const uint8_t *urow = u + i*cstride;
+        const uint8_t *vrow = v + i*cstride;
         uint8_t *rgb1 = dest + i*2*dstride;
         uint8_t *rgb2 = dest + i*2*dstride + dstride;
         for (int j=0; j<dwidth/2; j++) {
@@ -605,6 +679,16 @@ cam_pixel_convert_8u_yuv420p_to_8u_bgra(uint8_t *dest, int dstride, int dwidth,
     return 0;
 }
 
+int
+cam_pixel_convert_8u_yuv420p_to_8u_bgra (uint8_t *dest, int dstride, int dwidth,
+        int dheight, const uint8_t *src, int sstride)
+{
+    const uint8_t *uplane = src + dheight*sstride;
+    const uint8_t *vplane = uplane + dheight*sstride/4;
+    return cam_pixel_convert_8u_i420_planes_to_8u_bgra (dest, dstride,
+            dwidth, dheight, src, sstride, uplane, vplane, sstride/2);
+}
+
 int 
 cam_pixel_convert_8u_yuv420p_to_8u_gray(uint8_t *dest, int dstride, int dwidth,
         int dheight, const uint8_t *src, int sstride)
@@ -931,6 +1015,306 @@ cam_pixel_convert_8u_iyu1_to_8u_bgra(uint8_t *dest, int dstride, int dwidth,
     return 0;
 }
 
+/* Converts pixels [start, width) of one row to RGB (dbpp 3) or BGRA (dbpp
+ * 4).  Luma for pixel j is yrow[j*ystep].  Chroma sample k covers pixels
+ * [k << cshift, (k+1) << cshift) and is read from urow[k*cstep] and
+ * vrow[k*cstep]. */
+static inline void
+yuv_row_to_8u (uint8_t *drow, int dbpp, int start, int width,
+        const uint8_t *yrow, int ystep, const uint8_t *urow,
+        const uint8_t *vrow, int cstep, int cshift)
+{
+    int ri = (dbpp == 4) ? 2 : 0;
+    for (int j=start; j<width; j++) {
+        int k = (j >> cshift) * cstep;
+        int cb = ((urow[k]-128) * 454)>>8;
+        int cr = ((vrow[k]-128) * 359)>>8;
+        int cg = ((vrow[k]-128) * 183 + (urow[k]-128) * 88)>>8;
+        int yp = yrow[j*ystep];
+        uint8_t *d = drow + j*dbpp;
+        d[ri]   = MAX(0, MIN(255, yp + cr));
+        d[1]    = MAX(0, MIN(255, yp - cg));
+        d[2-ri] = MAX(0, MIN(255, yp + cb));
+        if (dbpp == 4)
+            d[3] = 0xff;
+    }
+}
+
+static int
+nv12_to_8u (uint8_t *dest, int dstride, int dbpp, int dwidth, int dheight,
+        const uint8_t *y, int ystride, const uint8_t *uv, int uvstride,
+        int done)
+{
+    int even = dwidth & ~1;
+    for (int i=0; i<dheight; i++) {
+        const uint8_t *uvrow = uv + (i/2)*uvstride;
+        yuv_row_to_8u (dest + i*dstride, dbpp, done, even,
+                y + i*ystride, 1, uvrow, uvrow + 1, 2, 1);
+        if (dwidth & 1) {
+            // the last pair of an odd width row would end one byte past
+            // the row, so the last column reuses the pair before it.  A
+            // single column has no complete pair and uses its U for V.
+            const uint8_t *pair = uvrow + MAX (even - 2, 0);
+            yuv_row_to_8u (dest + i*dstride, dbpp, even, dwidth,
+                    y + i*ystride, 1, pair, even ? pair + 1 : pair, 0, 1);
+        }
+    }
+    return 0;
+}
+
+/* The NV12 kernels read the U-V plane through its own pointer and stride,
+ * so they don't fit swizzle_simd. */
+typedef int (*nv12_func_t) (uint8_t *dst, int dstride,
+        const uint8_t *y, int ystride, const uint8_t *uv, int uvstride,
+        int width, int height);
+
+static int
+nv12_simd (nv12_func_t ssse3, uint8_t *dst, int dstride,
+        const uint8_t *y, int ystride, const uint8_t *uv, int uvstride,
+        int width, int height)
+{
+    cam_pixel_check_sse2 ();
+    if (ssse3 && has_ssse3)
+        return ssse3 (dst, dstride, y, ystride, uv, uvstride, width, height);
+    return 0;
+}
+
+int
+cam_pixel_convert_8u_nv12_planes_to_8u_rgb (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *y, int ystride,
+        const uint8_t *uv, int uvstride)
+{
+    int done = nv12_simd (SSSE3_KERNEL(nv12_to_rgb), dest, dstride,
+            y, ystride, uv, uvstride, dwidth, dheight);
+    return nv12_to_8u (dest, dstride, 3, dwidth, dheight, y, ystride,
+            uv, uvstride, done);
+}
+
+int
+cam_pixel_convert_8u_nv12_planes_to_8u_bgra (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *y, int ystride,
+        const uint8_t *uv, int uvstride)
+{
+    int done = nv12_simd (SSSE3_KERNEL(nv12_to_bgra), dest, dstride,
+            y, ystride, uv, uvstride, dwidth, dheight);
+    return nv12_to_8u (dest, dstride, 4, dwidth, dheight, y, ystride,
+            uv, uvstride, done);
+}
+
+int
+cam_pixel_convert_8u_nv12_to_8u_rgb (uint8_t *dest, int dstride, int dwidth,
+        int dheight, const uint8_t *src, int sstride)
+{
+    return cam_pixel_convert_8u_nv12_planes_to_8u_rgb (dest, dstride,
+            dwidth, dheight, src, sstride, src + dheight*sstride, sstride);
+}
+
+int
+cam_pixel_convert_8u_nv12_to_8u_bgra (uint8_t *dest, int dstride, int dwidth,
+        int dheight, const uint8_t *src, int sstride)
+{
+    return cam_pixel_convert_8u_nv12_planes_to_8u_bgra (dest, dstride,
+            dwidth, dheight, src, sstride, src + dheight*sstride, sstride);
+}
+
+int
+cam_pixel_convert_8u_nv12_to_8u_gray (uint8_t *dest, int dstride, int dwidth,
+        int dheight, const uint8_t *src, int sstride)
+{
+    for (int i=0; i<dheight; i++) {
+        memcpy (dest + i*dstride, src + i*sstride, dwidth);
+    }
+    return 0;
+}
+
+static int
+yuv411p_to_8u (uint8_t *dest, int dstride, int dbpp, int dwidth, int dheight,
+        const uint8_t *src, int sstride, int done)
+{
+    int cstride = sstride / 4;
+    const uint8_t *uplane = src + dheight*sstride;
+    const uint8_t *vplane = uplane + dheight*cstride;
+    for (int i=0; i<dheight; i++) {
+        yuv_row_to_8u (dest + i*dstride, dbpp, done, dwidth,
+                src + i*sstride, 1, uplane + i*cstride, vplane + i*cstride,
+                1, 2);
+    }
+    return 0;
+}
+
+int
+cam_pixel_convert_8u_yuv411p_to_8u_rgb (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *src, int sstride)
+{
+    int done = swizzle_simd (SSSE3_KERNEL(yuv411p_to_rgb), NULL,
+            dest, dstride, src, sstride, dwidth, dheight);
+    return yuv411p_to_8u (dest, dstride, 3, dwidth, dheight, src, sstride,
+            done);
+}
+
+int
+cam_pixel_convert_8u_yuv411p_to_8u_bgra (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *src, int sstride)
+{
+    int done = swizzle_simd (SSSE3_KERNEL(yuv411p_to_bgra), NULL,
+            dest, dstride, src, sstride, dwidth, dheight);
+    return yuv411p_to_8u (dest, dstride, 4, dwidth, dheight, src, sstride,
+            done);
+}
+
+static int
+iyu2_to_8u (uint8_t *dest, int dstride, int dbpp, int dwidth, int dheight,
+        const uint8_t *src, int sstride, int done)
+{
+    for (int i=0; i<dheight; i++) {
+        const uint8_t *srow = src + i*sstride;
+        yuv_row_to_8u (dest + i*dstride, dbpp, done, dwidth,
+                srow + 1, 3, srow, srow + 2, 3, 0);
+    }
+    return 0;
+}
+
+int
+cam_pixel_convert_8u_iyu2_to_8u_rgb (uint8_t *dest, int dstride, int dwidth,
+        int dheight, const uint8_t *src, int sstride)
+{
+    int done = swizzle_simd (SSSE3_KERNEL(iyu2_to_rgb), NULL,
+            dest, dstride, src, sstride, dwidth, dheight);
+    return iyu2_to_8u (dest, dstride, 3, dwidth, dheight, src, sstride, done);
+}
+
+int
+cam_pixel_convert_8u_iyu2_to_8u_bgra (uint8_t *dest, int dstride, int dwidth,
+        int dheight, const uint8_t *src, int sstride)
+{
+    int done = swizzle_simd (SSSE3_KERNEL(iyu2_to_bgra), NULL,
+            dest, dstride, src, sstride, dwidth, dheight);
+    return iyu2_to_8u (dest, dstride, 4, dwidth, dheight, src, sstride, done);
+}
+
+/* ============== Conversions to planar 4:2:0 ==============
+ *
+ * The chroma planes of an I420 image have half the stride of the Y plane.
+ * Each chroma sample covers a 2x2 block of pixels.  A trailing odd row or
+ * column only contributes to the Y plane.
+ */
+
+typedef int (*i420_func_t) (uint8_t *ydst, uint8_t *udst, uint8_t *vdst,
+        int dstride, const uint8_t *src, int sstride, int width, int height);
+
+#ifdef HAVE_INTEL
+#define SSSE3_I420_KERNEL(name) cam_pixel_##name##_to_i420_ssse3
+#else
+#define SSSE3_I420_KERNEL(name) NULL
+#endif
+
+static int
+i420_simd (i420_func_t ssse3, uint8_t *ydst, uint8_t *udst, uint8_t *vdst,
+        int dstride, const uint8_t *src, int sstride, int width, int height)
+{
+    cam_pixel_check_sse2 ();
+    if (ssse3 && has_ssse3)
+        return ssse3 (ydst, udst, vdst, dstride, src, sstride, width, height);
+    return 0;
+}
+
+static void
+packed422_to_i420 (uint8_t *dest, int dstride, int width, int height,
+        const uint8_t *src, int sstride, int yoff, i420_func_t ssse3)
+{
+    uint8_t *uplane = dest + height*dstride;
+    uint8_t *vplane = uplane + height*dstride/4;
+    int coff = 1 - yoff;
+    int start = i420_simd (ssse3, dest, uplane, vplane, dstride,
+            src, sstride, width, height);
+
+    for (int i = 0; i < height; i++) {
+        const uint8_t *s0 = src + i*sstride;
+        uint8_t *y0 = dest + i*dstride;
+        int first = (i + 1 < height || height % 2 == 0) ? start : 0;
+        for (int j = first; j < width; j++)
+            y0[j] = s0[2*j + yoff];
+    }
+    for (int i = 0; i + 2 <= height; i += 2) {
+        const uint8_t *s0 = src + i*sstride;
+        const uint8_t *s1 = s0 + sstride;
+        uint8_t *urow = uplane + (i/2)*(dstride/2);
+        uint8_t *vrow = vplane + (i/2)*(dstride/2);
+        for (int j = start/2; j < width/2; j++) {
+            urow[j] = (s0[4*j + coff] + s1[4*j + coff] + 1) >> 1;
+            vrow[j] = (s0[4*j + coff + 2] + s1[4*j + coff + 2] + 1) >> 1;
+        }
+    }
+}
+
+int
+cam_pixel_convert_8u_yuyv_to_8u_i420 (uint8_t *dest, int dstride, int dwidth,
+        int dheight, const uint8_t *src, int sstride)
+{
+    packed422_to_i420 (dest, dstride, dwidth, dheight, src, sstride, 0,
+            SSSE3_I420_KERNEL(yuyv));
+    return 0;
+}
+
+int
+cam_pixel_convert_8u_uyvy_to_8u_i420 (uint8_t *dest, int dstride, int dwidth,
+        int dheight, const uint8_t *src, int sstride)
+{
+    packed422_to_i420 (dest, dstride, dwidth, dheight, src, sstride, 1,
+            SSSE3_I420_KERNEL(uyvy));
+    return 0;
+}
+
+/* BT.601 full range, as used by JFIF, in 14-bit fixed point.  The chroma of
+ * a block is computed from the sum of its four pixels. */
+#define LUMA_8U(r,g,b) ((4899*(r) + 9617*(g) + 1868*(b) + (1<<13)) >> 14)
+#define CB_SUM4(r,g,b) (((-2765*(r) - 5427*(g) + 8192*(b) + (1<<15)) >> 16) + 128)
+#define CR_SUM4(r,g,b) (((8192*(r) - 6860*(g) - 1332*(b) + (1<<15)) >> 16) + 128)
+
+static void
+bgra_to_i420 (uint8_t *ydst, uint8_t *udst, uint8_t *vdst, int dstride,
+        int width, int height, const uint8_t *src, int sstride)
+{
+    int start = i420_simd (SSSE3_I420_KERNEL(bgra), ydst, udst, vdst, dstride,
+            src, sstride, width, height);
+
+    for (int i = 0; i < height; i++) {
+        const uint8_t *srow = src + i*sstride;
+        uint8_t *yrow = ydst + i*dstride;
+        int first = (i + 1 < height || height % 2 == 0) ? start : 0;
+        for (int j = first; j < width; j++)
+            yrow[j] = LUMA_8U (srow[4*j+2], srow[4*j+1], srow[4*j]);
+    }
+    for (int i = 0; i + 2 <= height; i += 2) {
+        const uint8_t *s0 = src + i*sstride;
+        const uint8_t *s1 = s0 + sstride;
+        uint8_t *urow = udst + (i/2)*(dstride/2);
+        uint8_t *vrow = vdst + (i/2)*(dstride/2);
+        for (int j = start/2; j < width/2; j++) {
+            int b = s0[8*j] + s0[8*j+4] + s1[8*j] + s1[8*j+4];
+            int g = s0[8*j+1] + s0[8*j+5] + s1[8*j+1] + s1[8*j+5];
+            int r = s0[8*j+2] + s0[8*j+6] + s1[8*j+2] + s1[8*j+6];
+            urow[j] = MAX(0, MIN(255, CB_SUM4 (r, g, b)));
+            vrow[j] = MAX(0, MIN(255, CR_SUM4 (r, g, b)));
+        }
+    }
+}
+
+#undef LUMA_8U
+#undef CB_SUM4
+#undef CR_SUM4
+
+int
+cam_pixel_convert_8u_bgra_to_8u_i420 (uint8_t *dest, int dstride, int dwidth,
+        int dheight, const uint8_t *src, int sstride)
+{
+    uint8_t *uplane = dest + dheight*dstride;
+    uint8_t *vplane = uplane + dheight*dstride/4;
+    bgra_to_i420 (dest, uplane, vplane, dstride, dwidth, dheight,
+            src, sstride);
+    return 0;
+}
+
 int
 cam_pixel_replicate_border_8u (uint8_t * src, int sstride, int width, int height)
 {
@@ -1152,6 +1536,424 @@ cam_pixel_convert_bayer_to_8u_gray (uint8_t *dest, int dstride, int width,
     return 0;
 }
 
+/* Number of rows interpolated at a time by
+ * cam_pixel_bayer_interpolate_to_8u_i420.  Small enough that the BGRA rows
+ * are still in cache when they are converted to I420. */
+#define I420_BAND_ROWS 16
+
+int
+cam_pixel_bayer_interpolate_to_8u_i420 (uint8_t ** src, int sstride,
+        uint8_t * dst, int dstride, int width, int height,
+        CamPixelFormat format)
+{
+    // the interpolation kernels write whole 32-pixel blocks
+    int bgra_stride = ((width + 31) & ~31) * 4;
+    uint8_t *bgra = MALLOC_ALIGNED (bgra_stride * I420_BAND_ROWS);
+    uint8_t *uplane = dst + height*dstride;
+    uint8_t *vplane = uplane + height*dstride/4;
+    int status = 0;
+
+    for (int row = 0; row < height && 0 == status; row += I420_BAND_ROWS) {
+        int nrows = MIN (I420_BAND_ROWS, height - row);
+        uint8_t *planes[4];
+        for (int k = 0; k < 4; k++)
+            planes[k] = src[k] + (row/2)*sstride;
+
+        status = cam_pixel_bayer_interpolate_to_8u_bgra (planes, sstride,
+                bgra, bgra_stride, width, nrows, format);
+        bgra_to_i420 (dst + row*dstride, uplane + (row/2)*(dstride/2),
+                vplane + (row/2)*(dstride/2), dstride, width, nrows,
+                bgra, bgra_stride);
+    }
+    free (bgra);
+    return status;
+}
+
+int
+cam_pixel_convert_bayer_to_8u_i420 (uint8_t *dest, int dstride, int width,
+        int height, const uint8_t *src, int sstride, CamPixelFormat format)
+{
+    if (format != CAM_PIXEL_FORMAT_BAYER_BGGR &&
+        format != CAM_PIXEL_FORMAT_BAYER_GRBG &&
+        format != CAM_PIXEL_FORMAT_BAYER_GBRG &&
+        format != CAM_PIXEL_FORMAT_BAYER_RGGB) {
+        fprintf (stderr, "%s:%d:%s invalid pixel format %s\n", 
+                __FILE__, __LINE__, __FUNCTION__, cam_pixel_format_nickname (format));
+        return -1;
+    }
+
+    cam_pixel_check_sse2 ();
+
+    void *bayer_planes[4];
+    int plane_stride = ((width + 0xf)&(~0xf)) + 32;
+    for (int i = 0; i < 4; i++) {
+        bayer_planes[i] = MALLOC_ALIGNED (plane_stride * (height + 2));
+    }
+
+    // a multiple of 32 bytes, so that cam_pixel_split_bayer_planes_8u
+    // handles whole rows without its last-column fix-up
+    int bayer_stride = (width + 0x1f)&(~0x1f);
+    void *bayer_img = MALLOC_ALIGNED (height * bayer_stride);
+    cam_pixel_copy_8u_generic (src, sstride, 
+            bayer_img, bayer_stride,
+            0, 0, 0, 0, width, height, 8);
+
+    uint8_t * planes[] = {
+        bayer_planes[0] + plane_stride + 16,
+        bayer_planes[1] + plane_stride + 16,
+        bayer_planes[2] + plane_stride + 16,
+        bayer_planes[3] + plane_stride + 16,
+    };
+    int p_width = width / 2;
+    int p_height = height / 2;
+
+    int status = cam_pixel_split_bayer_planes_8u (planes, plane_stride,
+            bayer_img, bayer_stride, p_width, p_height);
+    if (0 == status) {
+        for (int j = 0; j < 4; j++)
+            cam_pixel_replicate_border_8u (planes[j], plane_stride,
+                    p_width, p_height);
+        status = cam_pixel_bayer_interpolate_to_8u_i420 (planes,
+                plane_stride, dest, dstride, width, height, format);
+    }
+
+    free (bayer_img);
+    for (int i=0; i<4; i++) {
+        free (bayer_planes[i]);
+    }
+    return status;
+}
+
+/* ============== 16-bit conversions ==============
+ *
+ * The SIMD kernels process whole vectors and return how many samples of
+ * each row they handled.  The scalar loops below finish each row, and do
+ * all of the work when no SIMD kernel is available.
+ */
+
+static inline int
+load_16u (const uint8_t *p, int big_endian)
+{
+    return big_endian ? (p[0] << 8) | p[1] : p[0] | (p[1] << 8);
+}
+
+static inline void
+store_16u (uint8_t *p, int v, int big_endian)
+{
+    p[!big_endian] = v >> 8;
+    p[big_endian] = v & 0xff;
+}
+
+int
+cam_pixel_convert_16u_swap_bytes (uint8_t *dest, int dstride, int dwidth,
+        int dheight, const uint8_t *src, int sstride)
+{
+    int i, j;
+    int done = 0;
+
+    cam_pixel_check_sse2 ();
+#ifdef HAVE_INTEL
+#ifdef HAVE_AVX2
+    if (has_avx2)
+        done = cam_pixel_swap_16u_avx2 (dest, dstride, src, sstride,
+                dwidth, dheight);
+    else
+#endif
+    if (has_sse2)
+        done = cam_pixel_swap_16u_sse2 (dest, dstride, src, sstride,
+                dwidth, dheight);
+#endif
+
+    for (i = 0; i < dheight; i++) {
+        uint8_t *drow = dest + i * dstride;
+        const uint8_t *srow = src + i * sstride;
+        for (j = done; j < dwidth; j++) {
+            uint8_t b0 = srow[2*j];
+            drow[2*j] = srow[2*j+1];
+            drow[2*j+1] = b0;
+        }
+    }
+    return 0;
+}
+
+int
+cam_pixel_convert_16u_gray_to_8u_gray (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *src, int sstride,
+        int shift, int big_endian)
+{
+    int i, j;
+    int done = 0;
+
+    if (shift < 0 || shift > 15) {
+        fprintf (stderr, "%s: invalid shift %d\n", __FUNCTION__, shift);
+        return -1;
+    }
+
+    cam_pixel_check_sse2 ();
+#ifdef HAVE_INTEL
+#ifdef HAVE_AVX2
+    if (has_avx2)
+        done = cam_pixel_convert_16u_to_8u_shift_avx2 (dest, dstride,
+                src, sstride, dwidth, dheight, shift, big_endian);
+    else
+#endif
+    if (has_sse2)
+        done = cam_pixel_convert_16u_to_8u_shift_sse2 (dest, dstride,
+                src, sstride, dwidth, dheight, shift, big_endian);
+#endif
+
+    for (i = 0; i < dheight; i++) {
+        uint8_t *drow = dest + i * dstride;
+        const uint8_t *srow = src + i * sstride;
+        for (j = done; j < dwidth; j++) {
+            int v = load_16u (srow + 2*j, big_endian) >> shift;
+            drow[j] = MIN (v, 255);
+        }
+    }
+    return 0;
+}
+
+int
+cam_pixel_apply_lut_16u_to_8u (uint8_t *dest, int dstride, int dwidth,
+        int dheight, const uint8_t *src, int sstride,
+        const uint8_t *lut, int lut_size, int big_endian)
+{
+    int i, j;
+    int done = 0;
+
+    if (lut_size < 1 || lut_size > 65536) {
+        fprintf (stderr, "%s: invalid LUT size %d\n", __FUNCTION__, lut_size);
+        return -1;
+    }
+
+    cam_pixel_check_sse2 ();
+#ifdef HAVE_INTEL
+    if (has_sse2)
+        done = cam_pixel_apply_lut_16u_to_8u_sse2 (dest, dstride,
+                src, sstride, dwidth, dheight, lut, lut_size, big_endian);
+#endif
+
+    for (i = 0; i < dheight; i++) {
+        uint8_t *drow = dest + i * dstride;
+        const uint8_t *srow = src + i * sstride;
+        for (j = done; j < dwidth; j++) {
+            int v = load_16u (srow + 2*j, big_endian);
+            drow[j] = lut[MIN (v, lut_size - 1)];
+        }
+    }
+    return 0;
+}
+
+/* Finds the row and column parity of the red pixels of a 16-bit Bayer
+ * format. */
+static int
+bayer16_layout (CamPixelFormat format, int *r_row, int *r_col,
+        int *big_endian)
+{
+    switch (format) {
+        case CAM_PIXEL_FORMAT_BE_BAYER16_BGGR:
+        case CAM_PIXEL_FORMAT_LE_BAYER16_BGGR:
+            *r_row = 1; *r_col = 1;
+            break;
+        case CAM_PIXEL_FORMAT_BE_BAYER16_GBRG:
+        case CAM_PIXEL_FORMAT_LE_BAYER16_GBRG:
+            *r_row = 1; *r_col = 0;
+            break;
+        case CAM_PIXEL_FORMAT_BE_BAYER16_GRBG:
+        case CAM_PIXEL_FORMAT_LE_BAYER16_GRBG:
+            *r_row = 0; *r_col = 1;
+            break;
+        case CAM_PIXEL_FORMAT_BE_BAYER16_RGGB:
+        case CAM_PIXEL_FORMAT_LE_BAYER16_RGGB:
+            *r_row = 0; *r_col = 0;
+            break;
+        default:
+            return -1;
+    }
+    *big_endian = (format == CAM_PIXEL_FORMAT_BE_BAYER16_BGGR ||
+                   format == CAM_PIXEL_FORMAT_BE_BAYER16_GBRG ||
+                   format == CAM_PIXEL_FORMAT_BE_BAYER16_GRBG ||
+                   format == CAM_PIXEL_FORMAT_BE_BAYER16_RGGB);
+    return 0;
+}
+
+/* reflects out-of-range coordinates back into the image, preserving the
+ * Bayer phase */
+static inline int
+bayer_mirror (int i, int n)
+{
+    if (i < 0)
+        return -i;
+    if (i >= n)
+        return 2 * (n - 1) - i;
+    return i;
+}
+
+#define AVG_16U(a,b) (((a) + (b) + 1) >> 1)
+
+/* Scalar bilinear interpolation of one pixel.  This must give the same
+ * results as bayer16_interpolate_8() in pixels_sse2.c. */
+static void
+bayer16_interpolate_pixel (const uint8_t *src, int sstride, int width,
+        int height, int x, int y, int r_row, int r_col, int big_endian,
+        int rgb[3])
+{
+#define S(xx,yy) load_16u (src + bayer_mirror (yy, height) * sstride + \
+        2 * bayer_mirror (xx, width), big_endian)
+    int c = S (x, y);
+    int h = AVG_16U (S (x-1, y), S (x+1, y));
+    int v = AVG_16U (S (x, y-1), S (x, y+1));
+    int d = AVG_16U (AVG_16U (S (x-1, y-1), S (x+1, y-1)),
+            AVG_16U (S (x-1, y+1), S (x+1, y+1)));
+    int p = AVG_16U (h, v);
+#undef S
+    int red_row = (y & 1) == r_row;
+    int red_col = (x & 1) == r_col;
+
+    if (red_row && red_col) {
+        rgb[0] = c; rgb[1] = p; rgb[2] = d;
+    } else if (red_row) {
+        rgb[0] = h; rgb[1] = c; rgb[2] = v;
+    } else if (red_col) {
+        rgb[0] = v; rgb[1] = c; rgb[2] = h;
+    } else {
+        rgb[0] = d; rgb[1] = p; rgb[2] = c;
+    }
+}
+
+static int
+bayer16_interpolate (uint8_t *dest, int dstride, int width, int height,
+        const uint8_t *src, int sstride, CamPixelFormat format,
+        int to_bgra, int shift)
+{
+    int r_row, r_col, big_endian;
+    int i, j;
+
+    if (0 != bayer16_layout (format, &r_row, &r_col, &big_endian)) {
+        fprintf (stderr, "%s:%d:%s invalid pixel format %s\n",
+                __FILE__, __LINE__, __FUNCTION__,
+                cam_pixel_format_nickname (format));
+        return -1;
+    }
+    if (width < 2 || height < 2)
+        return -1;
+
+    /* columns [1, done) of rows 1 .. height-2 are handled by the SIMD
+     * kernels */
+    int done = 1;
+    cam_pixel_check_sse2 ();
+#ifdef HAVE_INTEL
+#ifdef HAVE_AVX2
+    if (has_avx2 && to_bgra)
+        done = cam_pixel_bayer16_interpolate_to_8u_bgra_avx2 (dest, dstride,
+                src, sstride, width, height, r_row, r_col, big_endian, shift);
+    else if (has_avx2)
+        done = cam_pixel_bayer16_interpolate_to_16u_rgb_avx2 (dest, dstride,
+                src, sstride, width, height, r_row, r_col, big_endian);
+    else
+#endif
+    if (has_sse2 && to_bgra)
+        done = cam_pixel_bayer16_interpolate_to_8u_bgra_sse2 (dest, dstride,
+                src, sstride, width, height, r_row, r_col, big_endian, shift);
+    else if (has_sse2)
+        done = cam_pixel_bayer16_interpolate_to_16u_rgb_sse2 (dest, dstride,
+                src, sstride, width, height, r_row, r_col, big_endian);
+#endif
+
+    for (i = 0; i < height; i++) {
+        uint8_t *drow = dest + i * dstride;
+        int interior = (i > 0 && i < height - 1);
+        for (j = 0; j < width; j++) {
+            int rgb[3];
+            if (interior && j == 1)
+                j = MAX (done, 1);
+            if (j >= width)
+                break;
+            bayer16_interpolate_pixel (src, sstride, width, height, j, i,
+                    r_row, r_col, big_endian, rgb);
+            if (to_bgra) {
+                drow[4*j+0] = MIN (rgb[2] >> shift, 255);
+                drow[4*j+1] = MIN (rgb[1] >> shift, 255);
+                drow[4*j+2] = MIN (rgb[0] >> shift, 255);
+                drow[4*j+3] = 0xff;
+            } else {
+                store_16u (drow + 6*j+0, rgb[0], big_endian);
+                store_16u (drow + 6*j+2, rgb[1], big_endian);
+                store_16u (drow + 6*j+4, rgb[2], big_endian);
+            }
+        }
+    }
+    return 0;
+}
+
+int
+cam_pixel_convert_bayer16_to_16u_rgb (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *src, int sstride,
+        CamPixelFormat format)
+{
+    return bayer16_interpolate (dest, dstride, dwidth, dheight, src, sstride,
+            format, 0, 0);
+}
+
+int
+cam_pixel_convert_bayer16_to_8u_bgra (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *src, int sstride,
+        CamPixelFormat format, int shift)
+{
+    if (shift < 0 || shift > 15) {
+        fprintf (stderr, "%s: invalid shift %d\n", __FUNCTION__, shift);
+        return -1;
+    }
+    return bayer16_interpolate (dest, dstride, dwidth, dheight, src, sstride,
+            format, 1, shift);
+}
+
+int
+cam_pixel_subtract_8u (uint8_t *dest, const uint8_t *src, const uint8_t *ref,
+        int n)
+{
+    int i;
+    int done = 0;
+
+    cam_pixel_check_sse2 ();
+#ifdef HAVE_INTEL
+#ifdef HAVE_AVX2
+    if (has_avx2)
+        done = cam_pixel_subtract_8u_avx2 (dest, src, ref, n);
+    else
+#endif
+    if (has_sse2)
+        done = cam_pixel_subtract_8u_sse2 (dest, src, ref, n);
+#endif
+
+    for (i = done; i < n; i++)
+        dest[i] = src[i] - ref[i];
+    return 0;
+}
+
+int
+cam_pixel_add_8u (uint8_t *dest, const uint8_t *src, const uint8_t *ref,
+        int n)
+{
+    int i;
+    int done = 0;
+
+    cam_pixel_check_sse2 ();
+#ifdef HAVE_INTEL
+#ifdef HAVE_AVX2
+    if (has_avx2)
+        done = cam_pixel_add_8u_avx2 (dest, src, ref, n);
+    else
+#endif
+    if (has_sse2)
+        done = cam_pixel_add_8u_sse2 (dest, src, ref, n);
+#endif
+
+    for (i = done; i < n; i++)
+        dest[i] = src[i] + ref[i];
+    return 0;
+}
+
 int 
 cam_pixel_copy_8u_generic (const uint8_t *src, int sstride, 
         uint8_t *dst, int dstride, 
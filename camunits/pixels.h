@@ -298,6 +298,29 @@ int cam_pixel_convert_8u_yuv420p_to_8u_bgra(uint8_t *dest, int dstride, int dwid
 int cam_pixel_convert_8u_yuv420p_to_8u_gray(uint8_t *dest, int dstride, int dwidth,
         int dheight, const uint8_t *src, int sstride);
 
+/**
+ * cam_pixel_convert_8u_i420_planes_to_8u_rgb:
+ *
+ * Same as cam_pixel_convert_8u_yuv420p_to_8u_rgb(), for an I420 image whose
+ * planes are not laid out one after the other.  The Y plane starts at @y
+ * and has a row stride of @ystride bytes.  The U and V planes start at @u
+ * and @v, and both have a row stride of @cstride bytes.
+ *
+ * Returns: 0
+ */
+int cam_pixel_convert_8u_i420_planes_to_8u_rgb (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *y, int ystride,
+        const uint8_t *u, const uint8_t *v, int cstride);
+int cam_pixel_convert_8u_i420_planes_to_8u_rgba (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *y, int ystride,
+        const uint8_t *u, const uint8_t *v, int cstride);
+int cam_pixel_convert_8u_i420_planes_to_8u_bgr (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *y, int ystride,
+        const uint8_t *u, const uint8_t *v, int cstride);
+int cam_pixel_convert_8u_i420_planes_to_8u_bgra (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *y, int ystride,
+        const uint8_t *u, const uint8_t *v, int cstride);
+
 int cam_pixel_convert_8u_uyvy_to_8u_gray (uint8_t *dest, int dstride,
         int dwidth, int dheight, const uint8_t *src, int sstride);
 int cam_pixel_convert_8u_uyvy_to_8u_bgra(uint8_t *dest, int dstride,
@@ -318,6 +341,95 @@ int cam_pixel_convert_8u_iyu1_to_8u_bgra(uint8_t *dest, int dstride,
         int dwidth, int dheight, const uint8_t *src, int sstride);
 int cam_pixel_convert_8u_iyu1_to_8u_rgb(uint8_t *dest, int dstride,
         int dwidth, int dheight, const uint8_t *src, int sstride);
+
+/**
+ * cam_pixel_convert_8u_nv12_to_8u_rgb:
+ *
+ * Converts NV12 (a Y plane followed by an interleaved U-V plane at half
+ * resolution in both directions) to RGB.  Both planes have a row stride of
+ * @sstride bytes.  At an odd width the U-V plane holds only the complete
+ * pairs of each row, and the last column takes its chroma from the pair
+ * before it.
+ *
+ * Returns: 0
+ */
+int cam_pixel_convert_8u_nv12_to_8u_rgb (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *src, int sstride);
+int cam_pixel_convert_8u_nv12_to_8u_bgra (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *src, int sstride);
+int cam_pixel_convert_8u_nv12_to_8u_gray (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *src, int sstride);
+
+/**
+ * cam_pixel_convert_8u_nv12_planes_to_8u_rgb:
+ *
+ * Same as cam_pixel_convert_8u_nv12_to_8u_rgb(), for an NV12 image whose
+ * U-V plane does not follow its Y plane.  The Y plane starts at @y and has
+ * a row stride of @ystride bytes, and the U-V plane starts at @uv and has a
+ * row stride of @uvstride bytes.
+ *
+ * Returns: 0
+ */
+int cam_pixel_convert_8u_nv12_planes_to_8u_rgb (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *y, int ystride,
+        const uint8_t *uv, int uvstride);
+int cam_pixel_convert_8u_nv12_planes_to_8u_bgra (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *y, int ystride,
+        const uint8_t *uv, int uvstride);
+
+/**
+ * cam_pixel_convert_8u_yuv411p_to_8u_rgb:
+ *
+ * Converts planar YUV 4:1:1 (a Y plane followed by U and V planes at a
+ * quarter of the horizontal resolution) to RGB.  The Y plane has a row
+ * stride of @sstride bytes, and the U and V planes @sstride / 4.
+ *
+ * Returns: 0
+ */
+int cam_pixel_convert_8u_yuv411p_to_8u_rgb (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *src, int sstride);
+int cam_pixel_convert_8u_yuv411p_to_8u_bgra (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *src, int sstride);
+
+/**
+ * cam_pixel_convert_8u_iyu2_to_8u_rgb:
+ *
+ * Converts IYU2 (packed YUV 4:4:4, stored U-Y-V) to RGB.
+ *
+ * Returns: 0
+ */
+int cam_pixel_convert_8u_iyu2_to_8u_rgb (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *src, int sstride);
+int cam_pixel_convert_8u_iyu2_to_8u_bgra (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *src, int sstride);
+
+/**
+ * cam_pixel_convert_8u_yuyv_to_8u_i420:
+ *
+ * Converts YUYV to I420 without passing through RGB.  The Y plane of @dest
+ * has a row stride of @dstride bytes, and the U and V planes, which follow
+ * it, have a row stride of @dstride / 2.  Each chroma sample is the rounded
+ * average of the two source rows it covers.
+ *
+ * Returns: 0
+ */
+int cam_pixel_convert_8u_yuyv_to_8u_i420 (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *src, int sstride);
+int cam_pixel_convert_8u_uyvy_to_8u_i420 (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *src, int sstride);
+
+/**
+ * cam_pixel_convert_8u_bgra_to_8u_i420:
+ *
+ * Converts BGRA to I420, using the full-range BT.601 coefficients of JFIF.
+ * The chroma of each 2x2 block is computed from the average of its pixels.
+ * The planes of @dest are laid out as in
+ * cam_pixel_convert_8u_yuyv_to_8u_i420().
+ *
+ * Returns: 0
+ */
+int cam_pixel_convert_8u_bgra_to_8u_i420 (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *src, int sstride);
 /**
  * cam_pixel_replicate_border_8u:
  * @src: Pointer to the top-left pixel of the input image.  The output
@@ -460,6 +572,143 @@ int cam_pixel_convert_bayer_to_8u_bgra (uint8_t *dest, int dstride, int dwidth,
 int cam_pixel_convert_bayer_to_8u_gray (uint8_t *dest, int dstride, int dwidth,
         int dheight, const uint8_t *src, int sstride, CamPixelFormat format);
 
+/**
+ * cam_pixel_bayer_interpolate_to_8u_i420:
+ * @src: The four planes of the source bayer-patterned image, prepared as for
+ *     cam_pixel_bayer_interpolate_to_8u_bgra().
+ * @sstride: Stride in bytes of each row of the source planes.
+ * @dst: Output I420 image.
+ * @dstride: Stride in bytes of the Y plane of @dst.  The chroma planes have
+ *     a stride of @dstride / 2.
+ * @width: Width in pixels of output image.
+ * @height: Height in pixels of output image.
+ * @format: Pixel format of the bayer-patterned image.
+ *
+ * Performs bayer interpolation as cam_pixel_bayer_interpolate_to_8u_bgra()
+ * does, and converts the result to I420.  The image is interpolated a few
+ * rows at a time, so the intermediate BGRA rows never leave the cache.
+ */
+int cam_pixel_bayer_interpolate_to_8u_i420 (uint8_t ** src, int sstride,
+        uint8_t * dst, int dstride, int width, int height,
+        CamPixelFormat format);
+
+/**
+ * cam_pixel_convert_bayer_to_8u_i420:
+ *
+ * convenience function to perform bayer interpolation.  Thin wrapper around
+ * cam_pixel_bayer_interpolate_to_8u_i420 that does not require the source or
+ * destination buffers to be 16-byte aligned.
+ */
+int cam_pixel_convert_bayer_to_8u_i420 (uint8_t *dest, int dstride, int dwidth,
+        int dheight, const uint8_t *src, int sstride, CamPixelFormat format);
+
+/**
+ * cam_pixel_convert_16u_swap_bytes:
+ * @dest: The destination buffer pre-allocated by the caller.  May be the
+ *      same as @src.
+ * @dstride: Number of bytes between the start of each image row in the
+ *      destination buffer.
+ * @dwidth: Number of 16-bit samples in each row (the width of the image in
+ *      pixels times the number of channels).
+ * @dheight: Height of the destination image in pixels.
+ * @src: The source image.
+ * @sstride: Number of bytes between the start of each image row in the
+ *      source buffer.
+ *
+ * Swaps the byte order of every 16-bit sample, converting between the
+ * big-endian and little-endian variants of a 16-bit format.
+ */
+int cam_pixel_convert_16u_swap_bytes (uint8_t *dest, int dstride, int dwidth,
+        int dheight, const uint8_t *src, int sstride);
+
+/**
+ * cam_pixel_convert_16u_gray_to_8u_gray:
+ * @dwidth: Number of samples in each row.
+ * @shift: Number of bits to shift each sample right by.  Results larger than
+ *      255 are saturated.  Use 8 for data that spans the full 16-bit range,
+ *      or 4 for 12-bit data.
+ * @big_endian: Non-zero if the source samples are big-endian.
+ *
+ * Converts 16-bit samples to 8-bit samples by shifting.  Since only the
+ * samples are considered, this works for any 16-bit format, with @dwidth set
+ * to the width times the number of channels.
+ */
+int cam_pixel_convert_16u_gray_to_8u_gray (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *src, int sstride,
+        int shift, int big_endian);
+
+/**
+ * cam_pixel_apply_lut_16u_to_8u:
+ * @dwidth: Number of samples in each row.
+ * @lut: The lookup table (LUT) pre-allocated and populated by the caller.
+ * @lut_size: The number of entries in @lut, at most 65536.  Samples larger
+ *      than @lut_size - 1 use the last entry.
+ * @big_endian: Non-zero if the source samples are big-endian.
+ *
+ * Converts 16-bit samples to 8-bit samples with a lookup table, for example
+ * to apply a gamma curve to 12-bit data with a 4096 entry LUT.
+ */
+int cam_pixel_apply_lut_16u_to_8u (uint8_t *dest, int dstride, int dwidth,
+        int dheight, const uint8_t *src, int sstride,
+        const uint8_t *lut, int lut_size, int big_endian);
+
+/**
+ * cam_pixel_convert_bayer16_to_16u_rgb:
+ * @format: One of the 16-bit Bayer pixel formats.
+ *
+ * Bilinear Bayer interpolation of a 16-bit image to 48-bpp RGB.  The output
+ * has the same byte order as the input, i.e. CAM_PIXEL_FORMAT_BE_RGB16 for
+ * big-endian Bayer formats and CAM_PIXEL_FORMAT_LE_RGB16 otherwise.  The
+ * buffers do not need to be aligned.
+ */
+int cam_pixel_convert_bayer16_to_16u_rgb (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *src, int sstride,
+        CamPixelFormat format);
+
+/**
+ * cam_pixel_convert_bayer16_to_8u_bgra:
+ * @format: One of the 16-bit Bayer pixel formats.
+ * @shift: Number of bits to shift each interpolated value right by.  See
+ *      cam_pixel_convert_16u_gray_to_8u_gray().
+ *
+ * Bilinear Bayer interpolation of a 16-bit image to 8-bit BGRA.  The buffers
+ * do not need to be aligned.
+ */
+int cam_pixel_convert_bayer16_to_8u_bgra (uint8_t *dest, int dstride,
+        int dwidth, int dheight, const uint8_t *src, int sstride,
+        CamPixelFormat format, int shift);
+
+/**
+ * cam_pixel_subtract_8u:
+ * @dest: receives the @n differences.  May be the same as @src or @ref.
+ * @src: the bytes to subtract from
+ * @ref: the bytes to subtract
+ * @n: number of bytes
+ *
+ * Subtracts each byte of @ref from the byte of @src at the same position,
+ * modulo 256.  The difference of two similar images is mostly small values,
+ * which compress well, and cam_pixel_add_8u() recovers @src from it exactly.
+ *
+ * Returns: 0
+ */
+int cam_pixel_subtract_8u (uint8_t *dest, const uint8_t *src,
+        const uint8_t *ref, int n);
+
+/**
+ * cam_pixel_add_8u:
+ * @dest: receives the @n sums.  May be the same as @src or @ref.
+ * @src: the first bytes to add
+ * @ref: the second bytes to add
+ * @n: number of bytes
+ *
+ * Adds the bytes of @src and @ref at each position, modulo 256.  This undoes
+ * cam_pixel_subtract_8u().
+ *
+ * Returns: 0
+ */
+int cam_pixel_add_8u (uint8_t *dest, const uint8_t *src, const uint8_t *ref,
+        int n);
+
 int cam_pixel_copy_8u_generic (const uint8_t *src, int sstride, 
         uint8_t *dst, int dstride, 
         int src_x, int src_y, 
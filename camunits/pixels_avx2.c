@@ -0,0 +1,395 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "pixels_avx2.h"
+
+/* AVX2 versions of the 16-bit kernels in pixels_sse2.c.  Each processes as
+ * many whole vectors per row as fit, and returns the number of samples (or
+ * pixels) handled in each row. */
+
+static inline __m256i
+swap_16u (__m256i v)
+{
+    return _mm256_or_si256 (_mm256_slli_epi16 (v, 8),
+            _mm256_srli_epi16 (v, 8));
+}
+
+static inline __m256i
+load_16u (const uint8_t * p, int big_endian)
+{
+    __m256i v = _mm256_loadu_si256 ((const __m256i *) p);
+    return big_endian ? swap_16u (v) : v;
+}
+
+static inline __m256i
+shift_clamp_16u (__m256i v, __m128i shift)
+{
+    return _mm256_min_epu16 (_mm256_srl_epi16 (v, shift),
+            _mm256_set1_epi16 (255));
+}
+
+static inline __m256i
+select_16u (__m256i mask, __m256i a, __m256i b)
+{
+    return _mm256_blendv_epi8 (b, a, mask);
+}
+
+int
+cam_pixel_swap_16u_avx2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int nsamples, int height)
+{
+    int i, j;
+    int n = nsamples & ~15;
+    for (i = 0; i < height; i++) {
+        uint8_t * drow = dst + i * dstride;
+        const uint8_t * srow = src + i * sstride;
+        for (j = 0; j < n; j += 16) {
+            __m256i v = _mm256_loadu_si256 ((const __m256i *) (srow + 2*j));
+            _mm256_storeu_si256 ((__m256i *) (drow + 2*j), swap_16u (v));
+        }
+    }
+    _mm256_zeroupper ();
+    return n;
+}
+
+int
+cam_pixel_convert_16u_to_8u_shift_avx2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int nsamples, int height,
+        int shift, int big_endian)
+{
+    int i, j;
+    int n = nsamples & ~31;
+    __m128i cnt = _mm_cvtsi32_si128 (shift);
+    for (i = 0; i < height; i++) {
+        uint8_t * drow = dst + i * dstride;
+        const uint8_t * srow = src + i * sstride;
+        for (j = 0; j < n; j += 32) {
+            __m256i a = shift_clamp_16u (load_16u (srow + 2*j, big_endian),
+                    cnt);
+            __m256i b = shift_clamp_16u (load_16u (srow + 2*j + 32,
+                        big_endian), cnt);
+            /* packus works within 128-bit lanes, so put the quadwords back
+             * in order afterwards */
+            __m256i out = _mm256_permute4x64_epi64 (
+                    _mm256_packus_epi16 (a, b), 0xd8);
+            _mm256_storeu_si256 ((__m256i *) (drow + j), out);
+        }
+    }
+    _mm256_zeroupper ();
+    return n;
+}
+
+/* Bilinear interpolation of 16 consecutive pixels of a 16-bit Bayer image.
+ * See bayer16_interpolate_8() in pixels_sse2.c. */
+static inline void
+bayer16_interpolate_16 (const uint8_t * p, int sstride, int red_row,
+        __m256i xr_mask, int big_endian, __m256i * r, __m256i * g, __m256i * b)
+{
+    const uint8_t * up = p - sstride;
+    const uint8_t * dn = p + sstride;
+    __m256i c = load_16u (p, big_endian);
+    __m256i h = _mm256_avg_epu16 (load_16u (p - 2, big_endian),
+            load_16u (p + 2, big_endian));
+    __m256i v = _mm256_avg_epu16 (load_16u (up, big_endian),
+            load_16u (dn, big_endian));
+    __m256i d = _mm256_avg_epu16 (
+            _mm256_avg_epu16 (load_16u (up - 2, big_endian),
+                load_16u (up + 2, big_endian)),
+            _mm256_avg_epu16 (load_16u (dn - 2, big_endian),
+                load_16u (dn + 2, big_endian)));
+    __m256i x = _mm256_avg_epu16 (h, v);
+
+    if (red_row) {
+        *r = select_16u (xr_mask, c, h);
+        *g = select_16u (xr_mask, x, c);
+        *b = select_16u (xr_mask, d, v);
+    } else {
+        *r = select_16u (xr_mask, v, d);
+        *g = select_16u (xr_mask, c, x);
+        *b = select_16u (xr_mask, h, c);
+    }
+}
+
+static inline __m256i
+red_column_mask (int r_col)
+{
+    __m256i m = _mm256_set1_epi32 (0xffff);
+    return r_col ? m : _mm256_slli_epi32 (m, 16);
+}
+
+int
+cam_pixel_bayer16_interpolate_to_16u_rgb_avx2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height,
+        int r_row, int r_col, int big_endian)
+{
+    int i, j, k;
+    uint16_t rgb[3][16] __attribute__ ((aligned (32)));
+    __m256i xr_mask = red_column_mask (r_col);
+
+    /* interior columns 1 .. width-2 */
+    int n = 1 + ((width - 2) & ~15);
+
+    for (i = 1; i < height - 1; i++) {
+        uint16_t * drow = (uint16_t *) (dst + i * dstride);
+        const uint8_t * srow = src + i * sstride;
+        int red_row = (i & 1) == r_row;
+        for (j = 1; j < n; j += 16) {
+            __m256i r, g, b;
+            bayer16_interpolate_16 (srow + 2*j, sstride, red_row, xr_mask,
+                    big_endian, &r, &g, &b);
+            if (big_endian) {
+                r = swap_16u (r);
+                g = swap_16u (g);
+                b = swap_16u (b);
+            }
+            _mm256_store_si256 ((__m256i *) rgb[0], r);
+            _mm256_store_si256 ((__m256i *) rgb[1], g);
+            _mm256_store_si256 ((__m256i *) rgb[2], b);
+            for (k = 0; k < 16; k++) {
+                drow[3*(j+k)+0] = rgb[0][k];
+                drow[3*(j+k)+1] = rgb[1][k];
+                drow[3*(j+k)+2] = rgb[2][k];
+            }
+        }
+    }
+    _mm256_zeroupper ();
+    return n;
+}
+
+int
+cam_pixel_bayer16_interpolate_to_8u_bgra_avx2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height,
+        int r_row, int r_col, int big_endian, int shift)
+{
+    int i, j;
+    __m256i xr_mask = red_column_mask (r_col);
+    __m128i cnt = _mm_cvtsi32_si128 (shift);
+    __m256i alpha = _mm256_set1_epi16 (0xff);
+
+    int n = 1 + ((width - 2) & ~15);
+
+    for (i = 1; i < height - 1; i++) {
+        uint8_t * drow = dst + i * dstride;
+        const uint8_t * srow = src + i * sstride;
+        int red_row = (i & 1) == r_row;
+        for (j = 1; j < n; j += 16) {
+            __m256i r, g, b, bg, ra, lo, hi;
+            bayer16_interpolate_16 (srow + 2*j, sstride, red_row, xr_mask,
+                    big_endian, &r, &g, &b);
+            r = shift_clamp_16u (r, cnt);
+            g = shift_clamp_16u (g, cnt);
+            b = shift_clamp_16u (b, cnt);
+            /* every sample now fits in the low byte of its 16-bit lane */
+            bg = _mm256_or_si256 (b, _mm256_slli_epi16 (g, 8));
+            ra = _mm256_or_si256 (r, _mm256_slli_epi16 (alpha, 8));
+            lo = _mm256_unpacklo_epi16 (bg, ra);
+            hi = _mm256_unpackhi_epi16 (bg, ra);
+            _mm256_storeu_si256 ((__m256i *) (drow + 4*j),
+                    _mm256_permute2x128_si256 (lo, hi, 0x20));
+            _mm256_storeu_si256 ((__m256i *) (drow + 4*j + 32),
+                    _mm256_permute2x128_si256 (lo, hi, 0x31));
+        }
+    }
+    _mm256_zeroupper ();
+    return n;
+}
+
+/* ============== channel reordering ==============
+ *
+ * vpshufb only shuffles within each 128-bit lane, so each lane is loaded
+ * with the source bytes that it needs.  See pixels_ssse3.c for the
+ * conventions. */
+
+static inline __m256i
+load_2x128 (const uint8_t * lo, const uint8_t * hi)
+{
+    return _mm256_inserti128_si256 (_mm256_castsi128_si256 (
+                _mm_loadu_si128 ((const __m128i *) lo)),
+            _mm_loadu_si128 ((const __m128i *) hi), 1);
+}
+
+static inline __m256i
+broadcast_128 (const uint8_t * p)
+{
+    return _mm256_broadcastsi128_si256 (_mm_loadu_si128 ((const __m128i *) p));
+}
+
+int
+cam_pixel_rgb_to_bgr_avx2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height)
+{
+    int i, j = 0;
+    /* 5 pixels per lane */
+    const __m256i mask = _mm256_setr_epi8 (
+            2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15,
+            2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+    for (i = 0; i < height; i++) {
+        uint8_t * drow = dst + i * dstride;
+        const uint8_t * srow = src + i * sstride;
+        for (j = 0; j + 11 <= width; j += 10) {
+            __m256i v = _mm256_shuffle_epi8 (
+                    load_2x128 (srow + 3*j, srow + 3*j + 15), mask);
+            _mm_storeu_si128 ((__m128i *) (drow + 3*j),
+                    _mm256_castsi256_si128 (v));
+            _mm_storeu_si128 ((__m128i *) (drow + 3*j + 15),
+                    _mm256_extracti128_si256 (v, 1));
+        }
+    }
+    _mm256_zeroupper ();
+    return j;
+}
+
+int
+cam_pixel_rgb_to_bgra_avx2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height)
+{
+    int i, j = 0;
+    /* 4 pixels per lane */
+    const __m256i mask = _mm256_setr_epi8 (
+            2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+            2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    const __m256i alpha = _mm256_set1_epi32 (0xff000000);
+    for (i = 0; i < height; i++) {
+        uint8_t * drow = dst + i * dstride;
+        const uint8_t * srow = src + i * sstride;
+        for (j = 0; j + 10 <= width; j += 8) {
+            __m256i v = load_2x128 (srow + 3*j, srow + 3*j + 12);
+            v = _mm256_or_si256 (_mm256_shuffle_epi8 (v, mask), alpha);
+            _mm256_storeu_si256 ((__m256i *) (drow + 4*j), v);
+        }
+    }
+    _mm256_zeroupper ();
+    return j;
+}
+
+static inline int
+bgra_to_3 (uint8_t * dst, int dstride, const uint8_t * src, int sstride,
+        int width, int height, __m256i mask)
+{
+    int i, j = 0;
+    /* after the shuffle, each lane has 12 meaningful bytes at the bottom */
+    const __m256i pack = _mm256_setr_epi32 (0, 1, 2, 4, 5, 6, 3, 7);
+    for (i = 0; i < height; i++) {
+        uint8_t * drow = dst + i * dstride;
+        const uint8_t * srow = src + i * sstride;
+        for (j = 0; j + 11 <= width; j += 8) {
+            __m256i v = _mm256_loadu_si256 ((const __m256i *) (srow + 4*j));
+            v = _mm256_permutevar8x32_epi32 (_mm256_shuffle_epi8 (v, mask),
+                    pack);
+            _mm256_storeu_si256 ((__m256i *) (drow + 3*j), v);
+        }
+    }
+    _mm256_zeroupper ();
+    return j;
+}
+
+int
+cam_pixel_bgra_to_bgr_avx2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height)
+{
+    return bgra_to_3 (dst, dstride, src, sstride, width, height,
+            _mm256_setr_epi8 (
+                0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1));
+}
+
+int
+cam_pixel_bgra_to_rgb_avx2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height)
+{
+    return bgra_to_3 (dst, dstride, src, sstride, width, height,
+            _mm256_setr_epi8 (
+                2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+int
+cam_pixel_gray_to_rgb_avx2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height)
+{
+    int i, j = 0;
+    /* 96 output bytes from 32 input pixels.  Each 32 output bytes come from
+     * at most 16 consecutive input pixels, starting at pixel 0, 10 and 16
+     * respectively. */
+    const __m256i m0 = _mm256_setr_epi8 (
+            0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5,
+            5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+    const __m256i m1 = _mm256_setr_epi8 (
+            0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5, 5, 5,
+            6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10, 10, 11);
+    const __m256i m2 = _mm256_setr_epi8 (
+            5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10,
+            10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+    for (i = 0; i < height; i++) {
+        uint8_t * drow = dst + i * dstride;
+        const uint8_t * srow = src + i * sstride;
+        for (j = 0; j + 32 <= width; j += 32) {
+            _mm256_storeu_si256 ((__m256i *) (drow + 3*j),
+                    _mm256_shuffle_epi8 (broadcast_128 (srow + j), m0));
+            _mm256_storeu_si256 ((__m256i *) (drow + 3*j + 32),
+                    _mm256_shuffle_epi8 (broadcast_128 (srow + j + 10), m1));
+            _mm256_storeu_si256 ((__m256i *) (drow + 3*j + 64),
+                    _mm256_shuffle_epi8 (broadcast_128 (srow + j + 16), m2));
+        }
+    }
+    _mm256_zeroupper ();
+    return j;
+}
+
+int
+cam_pixel_gray_to_rgba_avx2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height)
+{
+    int i, j = 0;
+    const __m256i m0 = _mm256_setr_epi8 (
+            0, 0, 0, -1, 1, 1, 1, -1, 2, 2, 2, -1, 3, 3, 3, -1,
+            4, 4, 4, -1, 5, 5, 5, -1, 6, 6, 6, -1, 7, 7, 7, -1);
+    const __m256i m1 = _mm256_setr_epi8 (
+            8, 8, 8, -1, 9, 9, 9, -1, 10, 10, 10, -1, 11, 11, 11, -1,
+            12, 12, 12, -1, 13, 13, 13, -1, 14, 14, 14, -1, 15, 15, 15, -1);
+    const __m256i alpha = _mm256_set1_epi32 (0xff000000);
+    for (i = 0; i < height; i++) {
+        uint8_t * drow = dst + i * dstride;
+        const uint8_t * srow = src + i * sstride;
+        for (j = 0; j + 16 <= width; j += 16) {
+            __m256i v = broadcast_128 (srow + j);
+            _mm256_storeu_si256 ((__m256i *) (drow + 4*j),
+                    _mm256_or_si256 (_mm256_shuffle_epi8 (v, m0), alpha));
+            _mm256_storeu_si256 ((__m256i *) (drow + 4*j + 32),
+                    _mm256_or_si256 (_mm256_shuffle_epi8 (v, m1), alpha));
+        }
+    }
+    _mm256_zeroupper ();
+    return j;
+}
+
+int
+cam_pixel_subtract_8u_avx2 (uint8_t * dst, const uint8_t * src,
+        const uint8_t * ref, int n)
+{
+    int i;
+    int done = n & ~31;
+    for (i = 0; i < done; i += 32) {
+        __m256i a = _mm256_loadu_si256 ((const __m256i *) (src + i));
+        __m256i b = _mm256_loadu_si256 ((const __m256i *) (ref + i));
+        _mm256_storeu_si256 ((__m256i *) (dst + i), _mm256_sub_epi8 (a, b));
+    }
+    _mm256_zeroupper ();
+    return done;
+}
+
+int
+cam_pixel_add_8u_avx2 (uint8_t * dst, const uint8_t * src,
+        const uint8_t * ref, int n)
+{
+    int i;
+    int done = n & ~31;
+    for (i = 0; i < done; i += 32) {
+        __m256i a = _mm256_loadu_si256 ((const __m256i *) (src + i));
+        __m256i b = _mm256_loadu_si256 ((const __m256i *) (ref + i));
+        _mm256_storeu_si256 ((__m256i *) (dst + i), _mm256_add_epi8 (a, b));
+    }
+    _mm256_zeroupper ();
+    return done;
+}
@@ -0,0 +1,47 @@
+#ifndef __PIXELS_AVX2_H__
+#define __PIXELS_AVX2_H__
+
+#include <stdint.h>
+#include "pixels.h"
+
+int
+cam_pixel_swap_16u_avx2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int nsamples, int height);
+int
+cam_pixel_convert_16u_to_8u_shift_avx2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int nsamples, int height,
+        int shift, int big_endian);
+int
+cam_pixel_bayer16_interpolate_to_16u_rgb_avx2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height,
+        int r_row, int r_col, int big_endian);
+int
+cam_pixel_bayer16_interpolate_to_8u_bgra_avx2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height,
+        int r_row, int r_col, int big_endian, int shift);
+int
+cam_pixel_rgb_to_bgr_avx2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height);
+int
+cam_pixel_rgb_to_bgra_avx2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height);
+int
+cam_pixel_bgra_to_bgr_avx2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height);
+int
+cam_pixel_bgra_to_rgb_avx2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height);
+int
+cam_pixel_gray_to_rgb_avx2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height);
+int
+cam_pixel_gray_to_rgba_avx2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height);
+int
+cam_pixel_subtract_8u_avx2 (uint8_t * dst, const uint8_t * src,
+        const uint8_t * ref, int n);
+int
+cam_pixel_add_8u_avx2 (uint8_t * dst, const uint8_t * src,
+        const uint8_t * ref, int n);
+
+#endif
@@ -24,10 +24,12 @@ cam_pixel_split_bayer_planes_8u_sse2 (uint8_t *dst[4], int dstride,
         return -1;
     }
 
-    /* If the source stride is not a multiple of 32 pixels, we need to
-     * fix up the last column at the end. */
-    if (!CAM_IS_ALIGNED32 (sstride))
-        width -= 8;
+    /* The loop below reads 32 source bytes at a time, so it can only cover
+     * whole 32-byte blocks of each row.  If the source stride is not a
+     * multiple of 32, the last 8 columns of a wide image are left for the
+     * fix-up at the end. */
+    int full_width = (sstride / 2) & ~0xf;
+    int main_width = width < full_width ? width : full_width;
 
     mask = _mm_set1_epi16 (0xff);
     for (i = 0; i < height; i++) {
@@ -36,7 +38,7 @@ cam_pixel_split_bayer_planes_8u_sse2 (uint8_t *dst[4], int dstride,
         uint8_t * drow3 = dst[2] + i * dstride;
         uint8_t * drow4 = dst[3] + i * dstride;
         const uint8_t * srow = src + 2*i*sstride;
-        for (j = 0; j < width; j += 16) {
+        for (j = 0; j < main_width; j += 16) {
             __m128i s1, s2, t1, t2, out;
             s1 = _mm_load_si128 ((__m128i *)(srow + 2*j));
             s2 = _mm_load_si128 ((__m128i *)(srow + 2*j + 16));
@@ -69,16 +71,18 @@ cam_pixel_split_bayer_planes_8u_sse2 (uint8_t *dst[4], int dstride,
             _mm_store_si128 ((__m128i *)(drow4 + j), out);
         }
     }
-    if (CAM_IS_ALIGNED32 (sstride))
+    if (width <= full_width)
         return 0;
 
-    /* Fix up the last column if necessary */
-    const uint8_t * scol1 = src + 2*width;
-    const uint8_t * scol2 = src + 2*width + sstride;
-    uint8_t * dcol1 = dst[0] + width;
-    uint8_t * dcol2 = dst[1] + width;
-    uint8_t * dcol3 = dst[2] + width;
-    uint8_t * dcol4 = dst[3] + width;
+    /* Fix up the last 8 columns.  They start on a 32-byte boundary of the
+     * source, and only 8 bytes are stored to each plane so that nothing
+     * past the end of the plane rows is touched. */
+    const uint8_t * scol1 = src + 2*full_width;
+    const uint8_t * scol2 = src + 2*full_width + sstride;
+    uint8_t * dcol1 = dst[0] + full_width;
+    uint8_t * dcol2 = dst[1] + full_width;
+    uint8_t * dcol3 = dst[2] + full_width;
+    uint8_t * dcol4 = dst[3] + full_width;
     __m128i t2 = _mm_set1_epi16 (0);
     for (i = 0; i < height; i++) {
         __m128i s1, t1, out;
@@ -86,23 +90,23 @@ cam_pixel_split_bayer_planes_8u_sse2 (uint8_t *dst[4], int dstride,
         t1 = _mm_and_si128 (s1, mask);
 
         out = _mm_packus_epi16 (t1, t2);
-        _mm_store_si128 ((__m128i *)(dcol1 + i*dstride), out);
+        _mm_storel_epi64 ((__m128i *)(dcol1 + i*dstride), out);
 
         t1 = _mm_srli_epi16 (s1, 8);
 
         out = _mm_packus_epi16 (t1, t2);
-        _mm_store_si128 ((__m128i *)(dcol2 + i*dstride), out);
+        _mm_storel_epi64 ((__m128i *)(dcol2 + i*dstride), out);
 
         s1 = _mm_load_si128 ((__m128i *)(scol2 + 2*i*sstride));
         t1 = _mm_and_si128 (s1, mask);
 
         out = _mm_packus_epi16 (t1, t2);
-        _mm_store_si128 ((__m128i *)(dcol3 + i*dstride), out);
+        _mm_storel_epi64 ((__m128i *)(dcol3 + i*dstride), out);
 
         t1 = _mm_srli_epi16 (s1, 8);
 
         out = _mm_packus_epi16 (t1, t2);
-        _mm_store_si128 ((__m128i *)(dcol4 + i*dstride), out);
+        _mm_storel_epi64 ((__m128i *)(dcol4 + i*dstride), out);
     }
     return 0;
 }
@@ -891,3 +895,244 @@ cam_pixel_bayer_interpolate_to_8u_gray_sse2 (uint8_t * src, int sstride,
     return 0;
 }
 
+
+/* ============== 16-bit kernels ==============
+ *
+ * These process as many whole vectors per row as fit, and return the
+ * number of samples (or pixels) handled in each row.  The caller finishes
+ * the remainder of each row with scalar code.
+ */
+
+static inline __m128i
+swap_16u (__m128i v)
+{
+    return _mm_or_si128 (_mm_slli_epi16 (v, 8), _mm_srli_epi16 (v, 8));
+}
+
+static inline __m128i
+load_16u (const uint8_t * p, int big_endian)
+{
+    __m128i v = _mm_loadu_si128 ((const __m128i *) p);
+    return big_endian ? swap_16u (v) : v;
+}
+
+/* Shifts each sample right and saturates it to 255.  SSE2 has no unsigned
+ * 16-bit min, so x - sat(x - 255) is used instead. */
+static inline __m128i
+shift_clamp_16u (__m128i v, __m128i shift)
+{
+    v = _mm_srl_epi16 (v, shift);
+    return _mm_sub_epi16 (v, _mm_subs_epu16 (v, _mm_set1_epi16 (255)));
+}
+
+static inline __m128i
+select_16u (__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128 (_mm_and_si128 (mask, a), _mm_andnot_si128 (mask, b));
+}
+
+int
+cam_pixel_swap_16u_sse2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int nsamples, int height)
+{
+    int i, j;
+    int n = nsamples & ~7;
+    for (i = 0; i < height; i++) {
+        uint8_t * drow = dst + i * dstride;
+        const uint8_t * srow = src + i * sstride;
+        for (j = 0; j < n; j += 8) {
+            __m128i v = _mm_loadu_si128 ((const __m128i *) (srow + 2*j));
+            _mm_storeu_si128 ((__m128i *) (drow + 2*j), swap_16u (v));
+        }
+    }
+    return n;
+}
+
+int
+cam_pixel_convert_16u_to_8u_shift_sse2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int nsamples, int height,
+        int shift, int big_endian)
+{
+    int i, j;
+    int n = nsamples & ~15;
+    __m128i cnt = _mm_cvtsi32_si128 (shift);
+    for (i = 0; i < height; i++) {
+        uint8_t * drow = dst + i * dstride;
+        const uint8_t * srow = src + i * sstride;
+        for (j = 0; j < n; j += 16) {
+            __m128i a = shift_clamp_16u (load_16u (srow + 2*j, big_endian),
+                    cnt);
+            __m128i b = shift_clamp_16u (load_16u (srow + 2*j + 16,
+                        big_endian), cnt);
+            _mm_storeu_si128 ((__m128i *) (drow + j), _mm_packus_epi16 (a, b));
+        }
+    }
+    return n;
+}
+
+int
+cam_pixel_apply_lut_16u_to_8u_sse2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int nsamples, int height,
+        const uint8_t * lut, int lut_size, int big_endian)
+{
+    int i, j, k;
+    int n = nsamples & ~7;
+    uint16_t idx[8] __attribute__ ((aligned (16)));
+    /* x - sat(x - max) == min(x, max) */
+    __m128i max = _mm_set1_epi16 (lut_size - 1);
+    for (i = 0; i < height; i++) {
+        uint8_t * drow = dst + i * dstride;
+        const uint8_t * srow = src + i * sstride;
+        for (j = 0; j < n; j += 8) {
+            __m128i v = load_16u (srow + 2*j, big_endian);
+            v = _mm_sub_epi16 (v, _mm_subs_epu16 (v, max));
+            _mm_store_si128 ((__m128i *) idx, v);
+            for (k = 0; k < 8; k++)
+                drow[j+k] = lut[idx[k]];
+        }
+    }
+    return n;
+}
+
+/* Bilinear interpolation of 8 consecutive pixels of a 16-bit Bayer image,
+ * starting at the pixel pointed to by @p.  @xr_mask selects the lanes that
+ * are in the same column as the red pixels. */
+static inline void
+bayer16_interpolate_8 (const uint8_t * p, int sstride, int red_row,
+        __m128i xr_mask, int big_endian, __m128i * r, __m128i * g, __m128i * b)
+{
+    const uint8_t * up = p - sstride;
+    const uint8_t * dn = p + sstride;
+    __m128i c = load_16u (p, big_endian);
+    __m128i h = _mm_avg_epu16 (load_16u (p - 2, big_endian),
+            load_16u (p + 2, big_endian));
+    __m128i v = _mm_avg_epu16 (load_16u (up, big_endian),
+            load_16u (dn, big_endian));
+    __m128i d = _mm_avg_epu16 (
+            _mm_avg_epu16 (load_16u (up - 2, big_endian),
+                load_16u (up + 2, big_endian)),
+            _mm_avg_epu16 (load_16u (dn - 2, big_endian),
+                load_16u (dn + 2, big_endian)));
+    __m128i x = _mm_avg_epu16 (h, v);
+
+    if (red_row) {
+        *r = select_16u (xr_mask, c, h);
+        *g = select_16u (xr_mask, x, c);
+        *b = select_16u (xr_mask, d, v);
+    } else {
+        *r = select_16u (xr_mask, v, d);
+        *g = select_16u (xr_mask, c, x);
+        *b = select_16u (xr_mask, h, c);
+    }
+}
+
+/* Vectors start at odd columns, so lane 0 is in a red column iff the red
+ * pixels are in odd columns. */
+static inline __m128i
+red_column_mask (int r_col)
+{
+    return r_col ? _mm_setr_epi16 (-1, 0, -1, 0, -1, 0, -1, 0) :
+        _mm_setr_epi16 (0, -1, 0, -1, 0, -1, 0, -1);
+}
+
+int
+cam_pixel_bayer16_interpolate_to_16u_rgb_sse2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height,
+        int r_row, int r_col, int big_endian)
+{
+    int i, j, k;
+    uint16_t rgb[3][8] __attribute__ ((aligned (16)));
+    __m128i xr_mask = red_column_mask (r_col);
+
+    /* interior columns 1 .. width-2 */
+    int n = 1 + ((width - 2) & ~7);
+
+    for (i = 1; i < height - 1; i++) {
+        uint16_t * drow = (uint16_t *) (dst + i * dstride);
+        const uint8_t * srow = src + i * sstride;
+        int red_row = (i & 1) == r_row;
+        for (j = 1; j < n; j += 8) {
+            __m128i r, g, b;
+            bayer16_interpolate_8 (srow + 2*j, sstride, red_row, xr_mask,
+                    big_endian, &r, &g, &b);
+            if (big_endian) {
+                r = swap_16u (r);
+                g = swap_16u (g);
+                b = swap_16u (b);
+            }
+            _mm_store_si128 ((__m128i *) rgb[0], r);
+            _mm_store_si128 ((__m128i *) rgb[1], g);
+            _mm_store_si128 ((__m128i *) rgb[2], b);
+            for (k = 0; k < 8; k++) {
+                drow[3*(j+k)+0] = rgb[0][k];
+                drow[3*(j+k)+1] = rgb[1][k];
+                drow[3*(j+k)+2] = rgb[2][k];
+            }
+        }
+    }
+    return n;
+}
+
+int
+cam_pixel_bayer16_interpolate_to_8u_bgra_sse2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height,
+        int r_row, int r_col, int big_endian, int shift)
+{
+    int i, j;
+    __m128i xr_mask = red_column_mask (r_col);
+    __m128i cnt = _mm_cvtsi32_si128 (shift);
+    __m128i alpha = _mm_set1_epi8 ((char) 0xff);
+
+    /* interior columns 1 .. width-2 */
+    int n = 1 + ((width - 2) & ~7);
+
+    for (i = 1; i < height - 1; i++) {
+        uint8_t * drow = dst + i * dstride;
+        const uint8_t * srow = src + i * sstride;
+        int red_row = (i & 1) == r_row;
+        for (j = 1; j < n; j += 8) {
+            __m128i r, g, b, bg, ra;
+            bayer16_interpolate_8 (srow + 2*j, sstride, red_row, xr_mask,
+                    big_endian, &r, &g, &b);
+            r = shift_clamp_16u (r, cnt);
+            g = shift_clamp_16u (g, cnt);
+            b = shift_clamp_16u (b, cnt);
+            bg = _mm_unpacklo_epi8 (_mm_packus_epi16 (b, b),
+                    _mm_packus_epi16 (g, g));
+            ra = _mm_unpacklo_epi8 (_mm_packus_epi16 (r, r), alpha);
+            _mm_storeu_si128 ((__m128i *) (drow + 4*j),
+                    _mm_unpacklo_epi16 (bg, ra));
+            _mm_storeu_si128 ((__m128i *) (drow + 4*j + 16),
+                    _mm_unpackhi_epi16 (bg, ra));
+        }
+    }
+    return n;
+}
+
+int
+cam_pixel_subtract_8u_sse2 (uint8_t * dst, const uint8_t * src,
+        const uint8_t * ref, int n)
+{
+    int i;
+    int done = n & ~15;
+    for (i = 0; i < done; i += 16) {
+        __m128i a = _mm_loadu_si128 ((const __m128i *) (src + i));
+        __m128i b = _mm_loadu_si128 ((const __m128i *) (ref + i));
+        _mm_storeu_si128 ((__m128i *) (dst + i), _mm_sub_epi8 (a, b));
+    }
+    return done;
+}
+
+int
+cam_pixel_add_8u_sse2 (uint8_t * dst, const uint8_t * src,
+        const uint8_t * ref, int n)
+{
+    int i;
+    int done = n & ~15;
+    for (i = 0; i < done; i += 16) {
+        __m128i a = _mm_loadu_si128 ((const __m128i *) (src + i));
+        __m128i b = _mm_loadu_si128 ((const __m128i *) (ref + i));
+        _mm_storeu_si128 ((__m128i *) (dst + i), _mm_add_epi8 (a, b));
+    }
+    return done;
+}
@@ -15,5 +15,30 @@ int
 cam_pixel_bayer_interpolate_to_8u_gray_sse2 (uint8_t * src, int sstride,
         uint8_t * dst, int dstride, int width, int height,
         CamPixelFormat format);
+int
+cam_pixel_swap_16u_sse2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int nsamples, int height);
+int
+cam_pixel_convert_16u_to_8u_shift_sse2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int nsamples, int height,
+        int shift, int big_endian);
+int
+cam_pixel_apply_lut_16u_to_8u_sse2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int nsamples, int height,
+        const uint8_t * lut, int lut_size, int big_endian);
+int
+cam_pixel_bayer16_interpolate_to_16u_rgb_sse2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height,
+        int r_row, int r_col, int big_endian);
+int
+cam_pixel_bayer16_interpolate_to_8u_bgra_sse2 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height,
+        int r_row, int r_col, int big_endian, int shift);
+int
+cam_pixel_subtract_8u_sse2 (uint8_t * dst, const uint8_t * src,
+        const uint8_t * ref, int n);
+int
+cam_pixel_add_8u_sse2 (uint8_t * dst, const uint8_t * src,
+        const uint8_t * ref, int n);
 
 #endif
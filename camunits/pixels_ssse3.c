@@ -0,0 +1,599 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <tmmintrin.h>
+
+#include "pixels_ssse3.h"
+
+/* Channel reordering kernels built on pshufb.  Each processes as many
+ * whole blocks per row as fit without reading or writing past the end of
+ * the row, and returns the number of pixels handled in each row.  The
+ * caller finishes the remainder with scalar code.
+ *
+ * Some kernels store a full 16-byte vector when only 12 or 15 bytes are
+ * meaningful.  The extra bytes are always overwritten by the next block or
+ * by the caller's scalar tail. */
+
+int
+cam_pixel_rgb_to_bgr_ssse3 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height)
+{
+    int i, j = 0;
+    /* 5 pixels per vector */
+    const __m128i mask = _mm_setr_epi8 (2, 1, 0, 5, 4, 3, 8, 7, 6,
+            11, 10, 9, 14, 13, 12, 15);
+    for (i = 0; i < height; i++) {
+        uint8_t * drow = dst + i * dstride;
+        const uint8_t * srow = src + i * sstride;
+        for (j = 0; j + 6 <= width; j += 5) {
+            __m128i v = _mm_loadu_si128 ((const __m128i *) (srow + 3*j));
+            _mm_storeu_si128 ((__m128i *) (drow + 3*j),
+                    _mm_shuffle_epi8 (v, mask));
+        }
+    }
+    return j;
+}
+
+int
+cam_pixel_rgb_to_bgra_ssse3 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height)
+{
+    int i, j = 0;
+    const __m128i mask = _mm_setr_epi8 (2, 1, 0, -1, 5, 4, 3, -1,
+            8, 7, 6, -1, 11, 10, 9, -1);
+    const __m128i alpha = _mm_set1_epi32 (0xff000000);
+    for (i = 0; i < height; i++) {
+        uint8_t * drow = dst + i * dstride;
+        const uint8_t * srow = src + i * sstride;
+        for (j = 0; j + 6 <= width; j += 4) {
+            __m128i v = _mm_loadu_si128 ((const __m128i *) (srow + 3*j));
+            v = _mm_or_si128 (_mm_shuffle_epi8 (v, mask), alpha);
+            _mm_storeu_si128 ((__m128i *) (drow + 4*j), v);
+        }
+    }
+    return j;
+}
+
+static inline int
+bgra_to_3 (uint8_t * dst, int dstride, const uint8_t * src, int sstride,
+        int width, int height, __m128i mask)
+{
+    int i, j = 0;
+    for (i = 0; i < height; i++) {
+        uint8_t * drow = dst + i * dstride;
+        const uint8_t * srow = src + i * sstride;
+        for (j = 0; j + 6 <= width; j += 4) {
+            __m128i v = _mm_loadu_si128 ((const __m128i *) (srow + 4*j));
+            _mm_storeu_si128 ((__m128i *) (drow + 3*j),
+                    _mm_shuffle_epi8 (v, mask));
+        }
+    }
+    return j;
+}
+
+int
+cam_pixel_bgra_to_bgr_ssse3 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height)
+{
+    return bgra_to_3 (dst, dstride, src, sstride, width, height,
+            _mm_setr_epi8 (0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14,
+                -1, -1, -1, -1));
+}
+
+int
+cam_pixel_bgra_to_rgb_ssse3 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height)
+{
+    return bgra_to_3 (dst, dstride, src, sstride, width, height,
+            _mm_setr_epi8 (2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                -1, -1, -1, -1));
+}
+
+int
+cam_pixel_gray_to_rgb_ssse3 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height)
+{
+    int i, j = 0;
+    const __m128i m0 = _mm_setr_epi8 (0, 0, 0, 1, 1, 1, 2, 2, 2,
+            3, 3, 3, 4, 4, 4, 5);
+    const __m128i m1 = _mm_setr_epi8 (5, 5, 6, 6, 6, 7, 7, 7, 8,
+            8, 8, 9, 9, 9, 10, 10);
+    const __m128i m2 = _mm_setr_epi8 (10, 11, 11, 11, 12, 12, 12, 13, 13,
+            13, 14, 14, 14, 15, 15, 15);
+    for (i = 0; i < height; i++) {
+        uint8_t * drow = dst + i * dstride;
+        const uint8_t * srow = src + i * sstride;
+        for (j = 0; j + 16 <= width; j += 16) {
+            __m128i v = _mm_loadu_si128 ((const __m128i *) (srow + j));
+            _mm_storeu_si128 ((__m128i *) (drow + 3*j),
+                    _mm_shuffle_epi8 (v, m0));
+            _mm_storeu_si128 ((__m128i *) (drow + 3*j + 16),
+                    _mm_shuffle_epi8 (v, m1));
+            _mm_storeu_si128 ((__m128i *) (drow + 3*j + 32),
+                    _mm_shuffle_epi8 (v, m2));
+        }
+    }
+    return j;
+}
+
+int
+cam_pixel_gray_to_rgba_ssse3 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height)
+{
+    int i, j = 0, k;
+    const __m128i alpha = _mm_set1_epi32 (0xff000000);
+    __m128i m[4];
+    for (k = 0; k < 4; k++) {
+        int p = 4 * k;
+        m[k] = _mm_setr_epi8 (p, p, p, -1, p+1, p+1, p+1, -1,
+                p+2, p+2, p+2, -1, p+3, p+3, p+3, -1);
+    }
+    for (i = 0; i < height; i++) {
+        uint8_t * drow = dst + i * dstride;
+        const uint8_t * srow = src + i * sstride;
+        for (j = 0; j + 16 <= width; j += 16) {
+            __m128i v = _mm_loadu_si128 ((const __m128i *) (srow + j));
+            for (k = 0; k < 4; k++)
+                _mm_storeu_si128 ((__m128i *) (drow + 4*j + 16*k),
+                        _mm_or_si128 (_mm_shuffle_epi8 (v, m[k]), alpha));
+        }
+    }
+    return j;
+}
+
+/* YUV to RGB kernels.  These use the same fixed point arithmetic as the
+ * scalar code in pixels.c, and produce identical results:
+ *
+ *   cb = ((u-128) * 454) >> 8
+ *   cr = ((v-128) * 359) >> 8
+ *   cg = ((v-128) * 183 + (u-128) * 88) >> 8
+ *   r = y + cr,  g = y - cg,  b = y + cb,  each clamped to [0, 255]
+ *
+ * Each kernel converts 16 pixels at a time, and returns the number of pixels
+ * handled in each row. */
+
+/* u and v are eight 16-bit samples with 128 already subtracted.  Computes
+ * the chroma terms for each of them. */
+static inline void
+chroma_terms (__m128i u, __m128i v, __m128i *cr, __m128i *cg, __m128i *cb)
+{
+    /* (x << 7) * (2k) >> 16 == (x * k) >> 8, with the same rounding */
+    *cb = _mm_mulhi_epi16 (_mm_slli_epi16 (u, 7), _mm_set1_epi16 (908));
+    *cr = _mm_mulhi_epi16 (_mm_slli_epi16 (v, 7), _mm_set1_epi16 (718));
+
+    /* the green term must be summed before shifting */
+    const __m128i coeff = _mm_set1_epi32 ((88 << 16) | 183);
+    __m128i lo = _mm_madd_epi16 (_mm_unpacklo_epi16 (v, u), coeff);
+    __m128i hi = _mm_madd_epi16 (_mm_unpackhi_epi16 (v, u), coeff);
+    *cg = _mm_packs_epi32 (_mm_srai_epi32 (lo, 8), _mm_srai_epi32 (hi, 8));
+}
+
+/* Combines 16 luma samples with the chroma terms for the first and last 8
+ * of them. */
+static inline void
+yuv_to_rgb_16 (__m128i y, __m128i cr_lo, __m128i cr_hi, __m128i cg_lo,
+        __m128i cg_hi, __m128i cb_lo, __m128i cb_hi,
+        __m128i *r, __m128i *g, __m128i *b)
+{
+    const __m128i zero = _mm_setzero_si128 ();
+    __m128i y_lo = _mm_unpacklo_epi8 (y, zero);
+    __m128i y_hi = _mm_unpackhi_epi8 (y, zero);
+    *r = _mm_packus_epi16 (_mm_add_epi16 (y_lo, cr_lo),
+            _mm_add_epi16 (y_hi, cr_hi));
+    *g = _mm_packus_epi16 (_mm_sub_epi16 (y_lo, cg_lo),
+            _mm_sub_epi16 (y_hi, cg_hi));
+    *b = _mm_packus_epi16 (_mm_add_epi16 (y_lo, cb_lo),
+            _mm_add_epi16 (y_hi, cb_hi));
+}
+
+static inline void
+store_rgb_16 (uint8_t * d, __m128i r, __m128i g, __m128i b)
+{
+    const __m128i r0 = _mm_setr_epi8 (0, -1, -1, 1, -1, -1, 2, -1,
+            -1, 3, -1, -1, 4, -1, -1, 5);
+    const __m128i r1 = _mm_setr_epi8 (-1, -1, 6, -1, -1, 7, -1, -1,
+            8, -1, -1, 9, -1, -1, 10, -1);
+    const __m128i r2 = _mm_setr_epi8 (-1, 11, -1, -1, 12, -1, -1, 13,
+            -1, -1, 14, -1, -1, 15, -1, -1);
+    const __m128i g0 = _mm_setr_epi8 (-1, 0, -1, -1, 1, -1, -1, 2,
+            -1, -1, 3, -1, -1, 4, -1, -1);
+    const __m128i g1 = _mm_setr_epi8 (5, -1, -1, 6, -1, -1, 7, -1,
+            -1, 8, -1, -1, 9, -1, -1, 10);
+    const __m128i g2 = _mm_setr_epi8 (-1, -1, 11, -1, -1, 12, -1, -1,
+            13, -1, -1, 14, -1, -1, 15, -1);
+    const __m128i b0 = _mm_setr_epi8 (-1, -1, 0, -1, -1, 1, -1, -1,
+            2, -1, -1, 3, -1, -1, 4, -1);
+    const __m128i b1 = _mm_setr_epi8 (-1, 5, -1, -1, 6, -1, -1, 7,
+            -1, -1, 8, -1, -1, 9, -1, -1);
+    const __m128i b2 = _mm_setr_epi8 (10, -1, -1, 11, -1, -1, 12, -1,
+            -1, 13, -1, -1, 14, -1, -1, 15);
+
+    _mm_storeu_si128 ((__m128i *) d, _mm_or_si128 (
+                _mm_or_si128 (_mm_shuffle_epi8 (r, r0),
+                    _mm_shuffle_epi8 (g, g0)), _mm_shuffle_epi8 (b, b0)));
+    _mm_storeu_si128 ((__m128i *) (d + 16), _mm_or_si128 (
+                _mm_or_si128 (_mm_shuffle_epi8 (r, r1),
+                    _mm_shuffle_epi8 (g, g1)), _mm_shuffle_epi8 (b, b1)));
+    _mm_storeu_si128 ((__m128i *) (d + 32), _mm_or_si128 (
+                _mm_or_si128 (_mm_shuffle_epi8 (r, r2),
+                    _mm_shuffle_epi8 (g, g2)), _mm_shuffle_epi8 (b, b2)));
+}
+
+static inline void
+store_bgra_16 (uint8_t * d, __m128i r, __m128i g, __m128i b)
+{
+    const __m128i alpha = _mm_set1_epi8 ((char) 0xff);
+    __m128i bg_lo = _mm_unpacklo_epi8 (b, g);
+    __m128i bg_hi = _mm_unpackhi_epi8 (b, g);
+    __m128i ra_lo = _mm_unpacklo_epi8 (r, alpha);
+    __m128i ra_hi = _mm_unpackhi_epi8 (r, alpha);
+    _mm_storeu_si128 ((__m128i *) d, _mm_unpacklo_epi16 (bg_lo, ra_lo));
+    _mm_storeu_si128 ((__m128i *) (d + 16), _mm_unpackhi_epi16 (bg_lo, ra_lo));
+    _mm_storeu_si128 ((__m128i *) (d + 32), _mm_unpacklo_epi16 (bg_hi, ra_hi));
+    _mm_storeu_si128 ((__m128i *) (d + 48), _mm_unpackhi_epi16 (bg_hi, ra_hi));
+}
+
+/* Converts the 16 pixels of one block of an NV12 row */
+static inline void
+nv12_block (const uint8_t * yrow, const uint8_t * uvrow, int j,
+        __m128i *r, __m128i *g, __m128i *b)
+{
+    const __m128i offset = _mm_set1_epi16 (128);
+    __m128i y = _mm_loadu_si128 ((const __m128i *) (yrow + j));
+    __m128i uv = _mm_loadu_si128 ((const __m128i *) (uvrow + j));
+    __m128i u = _mm_sub_epi16 (_mm_and_si128 (uv, _mm_set1_epi16 (0xff)),
+            offset);
+    __m128i v = _mm_sub_epi16 (_mm_srli_epi16 (uv, 8), offset);
+
+    __m128i cr, cg, cb;
+    chroma_terms (u, v, &cr, &cg, &cb);
+    yuv_to_rgb_16 (y, _mm_unpacklo_epi16 (cr, cr), _mm_unpackhi_epi16 (cr, cr),
+            _mm_unpacklo_epi16 (cg, cg), _mm_unpackhi_epi16 (cg, cg),
+            _mm_unpacklo_epi16 (cb, cb), _mm_unpackhi_epi16 (cb, cb),
+            r, g, b);
+}
+
+int
+cam_pixel_nv12_to_rgb_ssse3 (uint8_t * dst, int dstride,
+        const uint8_t * y, int ystride, const uint8_t * uv, int uvstride,
+        int width, int height)
+{
+    int i, j = 0;
+    for (i = 0; i < height; i++) {
+        const uint8_t * yrow = y + i * ystride;
+        const uint8_t * uvrow = uv + (i / 2) * uvstride;
+        uint8_t * drow = dst + i * dstride;
+        for (j = 0; j + 16 <= width; j += 16) {
+            __m128i r, g, b;
+            nv12_block (yrow, uvrow, j, &r, &g, &b);
+            store_rgb_16 (drow + 3*j, r, g, b);
+        }
+    }
+    return j;
+}
+
+int
+cam_pixel_nv12_to_bgra_ssse3 (uint8_t * dst, int dstride,
+        const uint8_t * y, int ystride, const uint8_t * uv, int uvstride,
+        int width, int height)
+{
+    int i, j = 0;
+    for (i = 0; i < height; i++) {
+        const uint8_t * yrow = y + i * ystride;
+        const uint8_t * uvrow = uv + (i / 2) * uvstride;
+        uint8_t * drow = dst + i * dstride;
+        for (j = 0; j + 16 <= width; j += 16) {
+            __m128i r, g, b;
+            nv12_block (yrow, uvrow, j, &r, &g, &b);
+            store_bgra_16 (drow + 4*j, r, g, b);
+        }
+    }
+    return j;
+}
+
+/* Converts the 16 pixels of one block of a planar 4:1:1 row */
+static inline void
+yuv411p_block (const uint8_t * yrow, const uint8_t * urow,
+        const uint8_t * vrow, int j, __m128i *r, __m128i *g, __m128i *b)
+{
+    const __m128i zero = _mm_setzero_si128 ();
+    const __m128i offset = _mm_set1_epi16 (128);
+    int32_t u4, v4;
+    memcpy (&u4, urow + j/4, 4);
+    memcpy (&v4, vrow + j/4, 4);
+    __m128i u = _mm_sub_epi16 (_mm_unpacklo_epi8 (_mm_cvtsi32_si128 (u4),
+                zero), offset);
+    __m128i v = _mm_sub_epi16 (_mm_unpacklo_epi8 (_mm_cvtsi32_si128 (v4),
+                zero), offset);
+    __m128i y = _mm_loadu_si128 ((const __m128i *) (yrow + j));
+
+    /* only the first 4 chroma terms are used, each for 4 pixels */
+    __m128i cr, cg, cb;
+    chroma_terms (u, v, &cr, &cg, &cb);
+    cr = _mm_unpacklo_epi16 (cr, cr);
+    cg = _mm_unpacklo_epi16 (cg, cg);
+    cb = _mm_unpacklo_epi16 (cb, cb);
+    yuv_to_rgb_16 (y, _mm_unpacklo_epi32 (cr, cr), _mm_unpackhi_epi32 (cr, cr),
+            _mm_unpacklo_epi32 (cg, cg), _mm_unpackhi_epi32 (cg, cg),
+            _mm_unpacklo_epi32 (cb, cb), _mm_unpackhi_epi32 (cb, cb),
+            r, g, b);
+}
+
+int
+cam_pixel_yuv411p_to_rgb_ssse3 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height)
+{
+    int cstride = sstride / 4;
+    const uint8_t * uplane = src + height * sstride;
+    const uint8_t * vplane = uplane + height * cstride;
+    int i, j = 0;
+    for (i = 0; i < height; i++) {
+        const uint8_t * yrow = src + i * sstride;
+        uint8_t * drow = dst + i * dstride;
+        for (j = 0; j + 16 <= width; j += 16) {
+            __m128i r, g, b;
+            yuv411p_block (yrow, uplane + i * cstride, vplane + i * cstride,
+                    j, &r, &g, &b);
+            store_rgb_16 (drow + 3*j, r, g, b);
+        }
+    }
+    return j;
+}
+
+int
+cam_pixel_yuv411p_to_bgra_ssse3 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height)
+{
+    int cstride = sstride / 4;
+    const uint8_t * uplane = src + height * sstride;
+    const uint8_t * vplane = uplane + height * cstride;
+    int i, j = 0;
+    for (i = 0; i < height; i++) {
+        const uint8_t * yrow = src + i * sstride;
+        uint8_t * drow = dst + i * dstride;
+        for (j = 0; j + 16 <= width; j += 16) {
+            __m128i r, g, b;
+            yuv411p_block (yrow, uplane + i * cstride, vplane + i * cstride,
+                    j, &r, &g, &b);
+            store_bgra_16 (drow + 4*j, r, g, b);
+        }
+    }
+    return j;
+}
+
+/* Converts 16 packed U-Y-V pixels */
+static inline void
+iyu2_block (const uint8_t * s, __m128i *r, __m128i *g, __m128i *b)
+{
+    const __m128i zero = _mm_setzero_si128 ();
+    const __m128i offset = _mm_set1_epi16 (128);
+    const __m128i u0 = _mm_setr_epi8 (0, 3, 6, 9, 12, 15, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i u1 = _mm_setr_epi8 (-1, -1, -1, -1, -1, -1, 2, 5,
+            8, 11, 14, -1, -1, -1, -1, -1);
+    const __m128i u2 = _mm_setr_epi8 (-1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, 1, 4, 7, 10, 13);
+    const __m128i y0 = _mm_setr_epi8 (1, 4, 7, 10, 13, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i y1 = _mm_setr_epi8 (-1, -1, -1, -1, -1, 0, 3, 6,
+            9, 12, 15, -1, -1, -1, -1, -1);
+    const __m128i y2 = _mm_setr_epi8 (-1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, 2, 5, 8, 11, 14);
+    const __m128i v0 = _mm_setr_epi8 (2, 5, 8, 11, 14, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i v1 = _mm_setr_epi8 (-1, -1, -1, -1, -1, 1, 4, 7,
+            10, 13, -1, -1, -1, -1, -1, -1);
+    const __m128i v2 = _mm_setr_epi8 (-1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, 0, 3, 6, 9, 12, 15);
+
+    __m128i a = _mm_loadu_si128 ((const __m128i *) s);
+    __m128i m = _mm_loadu_si128 ((const __m128i *) (s + 16));
+    __m128i c = _mm_loadu_si128 ((const __m128i *) (s + 32));
+    __m128i u = _mm_or_si128 (_mm_or_si128 (_mm_shuffle_epi8 (a, u0),
+                _mm_shuffle_epi8 (m, u1)), _mm_shuffle_epi8 (c, u2));
+    __m128i y = _mm_or_si128 (_mm_or_si128 (_mm_shuffle_epi8 (a, y0),
+                _mm_shuffle_epi8 (m, y1)), _mm_shuffle_epi8 (c, y2));
+    __m128i v = _mm_or_si128 (_mm_or_si128 (_mm_shuffle_epi8 (a, v0),
+                _mm_shuffle_epi8 (m, v1)), _mm_shuffle_epi8 (c, v2));
+
+    __m128i cr_lo, cg_lo, cb_lo, cr_hi, cg_hi, cb_hi;
+    chroma_terms (_mm_sub_epi16 (_mm_unpacklo_epi8 (u, zero), offset),
+            _mm_sub_epi16 (_mm_unpacklo_epi8 (v, zero), offset),
+            &cr_lo, &cg_lo, &cb_lo);
+    chroma_terms (_mm_sub_epi16 (_mm_unpackhi_epi8 (u, zero), offset),
+            _mm_sub_epi16 (_mm_unpackhi_epi8 (v, zero), offset),
+            &cr_hi, &cg_hi, &cb_hi);
+    yuv_to_rgb_16 (y, cr_lo, cr_hi, cg_lo, cg_hi, cb_lo, cb_hi, r, g, b);
+}
+
+int
+cam_pixel_iyu2_to_rgb_ssse3 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height)
+{
+    int i, j = 0;
+    for (i = 0; i < height; i++) {
+        const uint8_t * srow = src + i * sstride;
+        uint8_t * drow = dst + i * dstride;
+        for (j = 0; j + 16 <= width; j += 16) {
+            __m128i r, g, b;
+            iyu2_block (srow + 3*j, &r, &g, &b);
+            store_rgb_16 (drow + 3*j, r, g, b);
+        }
+    }
+    return j;
+}
+
+int
+cam_pixel_iyu2_to_bgra_ssse3 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height)
+{
+    int i, j = 0;
+    for (i = 0; i < height; i++) {
+        const uint8_t * srow = src + i * sstride;
+        uint8_t * drow = dst + i * dstride;
+        for (j = 0; j + 16 <= width; j += 16) {
+            __m128i r, g, b;
+            iyu2_block (srow + 3*j, &r, &g, &b);
+            store_bgra_16 (drow + 4*j, r, g, b);
+        }
+    }
+    return j;
+}
+
+/* ============== Planar 4:2:0 output ==============
+ *
+ * These kernels write the three planes of an I420 image.  Each pair of
+ * source rows produces two rows of the Y plane and one row of each chroma
+ * plane, whose stride is half of @dstride.  They process 16 (packed 4:2:2)
+ * or 8 (BGRA) pixels of both rows at a time and return the number of pixels
+ * handled in each row.  A trailing odd row is left to the caller. */
+
+static inline int
+packed422_to_i420 (uint8_t * ydst, uint8_t * udst, uint8_t * vdst,
+        int dstride, const uint8_t * src, int sstride, int width, int height,
+        int luma_high)
+{
+    const __m128i lo = _mm_set1_epi16 (0x00ff);
+    int i, j = 0;
+    for (i = 0; i + 2 <= height; i += 2) {
+        const uint8_t * s0 = src + i * sstride;
+        const uint8_t * s1 = s0 + sstride;
+        uint8_t * y0 = ydst + i * dstride;
+        uint8_t * y1 = y0 + dstride;
+        uint8_t * urow = udst + (i / 2) * (dstride / 2);
+        uint8_t * vrow = vdst + (i / 2) * (dstride / 2);
+        for (j = 0; j + 16 <= width; j += 16) {
+            __m128i a0 = _mm_loadu_si128 ((const __m128i *) (s0 + 2*j));
+            __m128i a1 = _mm_loadu_si128 ((const __m128i *) (s0 + 2*j + 16));
+            __m128i b0 = _mm_loadu_si128 ((const __m128i *) (s1 + 2*j));
+            __m128i b1 = _mm_loadu_si128 ((const __m128i *) (s1 + 2*j + 16));
+            __m128i ya, yb, ca, cb;
+            if (luma_high) {
+                ya = _mm_packus_epi16 (_mm_srli_epi16 (a0, 8),
+                        _mm_srli_epi16 (a1, 8));
+                yb = _mm_packus_epi16 (_mm_srli_epi16 (b0, 8),
+                        _mm_srli_epi16 (b1, 8));
+                ca = _mm_packus_epi16 (_mm_and_si128 (a0, lo),
+                        _mm_and_si128 (a1, lo));
+                cb = _mm_packus_epi16 (_mm_and_si128 (b0, lo),
+                        _mm_and_si128 (b1, lo));
+            } else {
+                ya = _mm_packus_epi16 (_mm_and_si128 (a0, lo),
+                        _mm_and_si128 (a1, lo));
+                yb = _mm_packus_epi16 (_mm_and_si128 (b0, lo),
+                        _mm_and_si128 (b1, lo));
+                ca = _mm_packus_epi16 (_mm_srli_epi16 (a0, 8),
+                        _mm_srli_epi16 (a1, 8));
+                cb = _mm_packus_epi16 (_mm_srli_epi16 (b0, 8),
+                        _mm_srli_epi16 (b1, 8));
+            }
+            _mm_storeu_si128 ((__m128i *) (y0 + j), ya);
+            _mm_storeu_si128 ((__m128i *) (y1 + j), yb);
+
+            // U V U V ... averaged over the two rows, then split
+            __m128i c = _mm_avg_epu8 (ca, cb);
+            __m128i uv = _mm_packus_epi16 (_mm_and_si128 (c, lo),
+                    _mm_srli_epi16 (c, 8));
+            _mm_storel_epi64 ((__m128i *) (urow + j/2), uv);
+            _mm_storel_epi64 ((__m128i *) (vrow + j/2),
+                    _mm_srli_si128 (uv, 8));
+        }
+    }
+    return j;
+}
+
+int
+cam_pixel_yuyv_to_i420_ssse3 (uint8_t * ydst, uint8_t * udst,
+        uint8_t * vdst, int dstride, const uint8_t * src, int sstride,
+        int width, int height)
+{
+    return packed422_to_i420 (ydst, udst, vdst, dstride, src, sstride,
+            width, height, 0);
+}
+
+int
+cam_pixel_uyvy_to_i420_ssse3 (uint8_t * ydst, uint8_t * udst,
+        uint8_t * vdst, int dstride, const uint8_t * src, int sstride,
+        int width, int height)
+{
+    return packed422_to_i420 (ydst, udst, vdst, dstride, src, sstride,
+            width, height, 1);
+}
+
+/* Luma of 4 BGRA pixels, as 32-bit integers */
+static inline __m128i
+bgra_luma_4 (__m128i v)
+{
+    const __m128i z = _mm_setzero_si128 ();
+    const __m128i coef = _mm_setr_epi16 (1868, 9617, 4899, 0,
+            1868, 9617, 4899, 0);
+    __m128i l = _mm_madd_epi16 (_mm_unpacklo_epi8 (v, z), coef);
+    __m128i h = _mm_madd_epi16 (_mm_unpackhi_epi8 (v, z), coef);
+    return _mm_srai_epi32 (_mm_add_epi32 (_mm_hadd_epi32 (l, h),
+                _mm_set1_epi32 (1 << 13)), 14);
+}
+
+/* Sums each 2x2 block of 4 BGRA pixels from each of two rows.  Returns the
+ * 16-bit channel sums of the two blocks. */
+static inline __m128i
+bgra_block_sums_2 (__m128i a, __m128i b)
+{
+    const __m128i z = _mm_setzero_si128 ();
+    __m128i l = _mm_add_epi16 (_mm_unpacklo_epi8 (a, z),
+            _mm_unpacklo_epi8 (b, z));
+    __m128i h = _mm_add_epi16 (_mm_unpackhi_epi8 (a, z),
+            _mm_unpackhi_epi8 (b, z));
+    return _mm_add_epi16 (_mm_unpacklo_epi64 (l, h),
+            _mm_unpackhi_epi64 (l, h));
+}
+
+static inline __m128i
+block_chroma_4 (__m128i t01, __m128i t23, __m128i coef)
+{
+    __m128i c = _mm_hadd_epi32 (_mm_madd_epi16 (t01, coef),
+            _mm_madd_epi16 (t23, coef));
+    c = _mm_srai_epi32 (_mm_add_epi32 (c, _mm_set1_epi32 (1 << 15)), 16);
+    return _mm_add_epi32 (c, _mm_set1_epi32 (128));
+}
+
+int
+cam_pixel_bgra_to_i420_ssse3 (uint8_t * ydst, uint8_t * udst,
+        uint8_t * vdst, int dstride, const uint8_t * src, int sstride,
+        int width, int height)
+{
+    const __m128i cbcoef = _mm_setr_epi16 (8192, -5427, -2765, 0,
+            8192, -5427, -2765, 0);
+    const __m128i crcoef = _mm_setr_epi16 (-1332, -6860, 8192, 0,
+            -1332, -6860, 8192, 0);
+    int i, j = 0;
+    for (i = 0; i + 2 <= height; i += 2) {
+        const uint8_t * s0 = src + i * sstride;
+        const uint8_t * s1 = s0 + sstride;
+        uint8_t * y0 = ydst + i * dstride;
+        uint8_t * y1 = y0 + dstride;
+        uint8_t * urow = udst + (i / 2) * (dstride / 2);
+        uint8_t * vrow = vdst + (i / 2) * (dstride / 2);
+        for (j = 0; j + 8 <= width; j += 8) {
+            __m128i a0 = _mm_loadu_si128 ((const __m128i *) (s0 + 4*j));
+            __m128i a1 = _mm_loadu_si128 ((const __m128i *) (s0 + 4*j + 16));
+            __m128i b0 = _mm_loadu_si128 ((const __m128i *) (s1 + 4*j));
+            __m128i b1 = _mm_loadu_si128 ((const __m128i *) (s1 + 4*j + 16));
+
+            __m128i ya = _mm_packs_epi32 (bgra_luma_4 (a0), bgra_luma_4 (a1));
+            __m128i yb = _mm_packs_epi32 (bgra_luma_4 (b0), bgra_luma_4 (b1));
+            _mm_storel_epi64 ((__m128i *) (y0 + j), _mm_packus_epi16 (ya, ya));
+            _mm_storel_epi64 ((__m128i *) (y1 + j), _mm_packus_epi16 (yb, yb));
+
+            __m128i t01 = bgra_block_sums_2 (a0, b0);
+            __m128i t23 = bgra_block_sums_2 (a1, b1);
+            __m128i c = _mm_packs_epi32 (block_chroma_4 (t01, t23, cbcoef),
+                    block_chroma_4 (t01, t23, crcoef));
+            c = _mm_packus_epi16 (c, c);
+            uint32_t u = _mm_cvtsi128_si32 (c);
+            uint32_t v = _mm_cvtsi128_si32 (_mm_srli_si128 (c, 4));
+            memcpy (urow + j/2, &u, 4);
+            memcpy (vrow + j/2, &v, 4);
+        }
+    }
+    return j;
+}
@@ -0,0 +1,60 @@
+#ifndef __PIXELS_SSSE3_H__
+#define __PIXELS_SSSE3_H__
+
+#include <stdint.h>
+#include "pixels.h"
+
+int
+cam_pixel_rgb_to_bgr_ssse3 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height);
+int
+cam_pixel_rgb_to_bgra_ssse3 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height);
+int
+cam_pixel_bgra_to_bgr_ssse3 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height);
+int
+cam_pixel_bgra_to_rgb_ssse3 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height);
+int
+cam_pixel_gray_to_rgb_ssse3 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height);
+int
+cam_pixel_gray_to_rgba_ssse3 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height);
+
+int
+cam_pixel_nv12_to_rgb_ssse3 (uint8_t * dst, int dstride,
+        const uint8_t * y, int ystride, const uint8_t * uv, int uvstride,
+        int width, int height);
+int
+cam_pixel_nv12_to_bgra_ssse3 (uint8_t * dst, int dstride,
+        const uint8_t * y, int ystride, const uint8_t * uv, int uvstride,
+        int width, int height);
+int
+cam_pixel_yuv411p_to_rgb_ssse3 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height);
+int
+cam_pixel_yuv411p_to_bgra_ssse3 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height);
+int
+cam_pixel_iyu2_to_rgb_ssse3 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height);
+int
+cam_pixel_iyu2_to_bgra_ssse3 (uint8_t * dst, int dstride,
+        const uint8_t * src, int sstride, int width, int height);
+
+int
+cam_pixel_yuyv_to_i420_ssse3 (uint8_t * ydst, uint8_t * udst,
+        uint8_t * vdst, int dstride, const uint8_t * src, int sstride,
+        int width, int height);
+int
+cam_pixel_uyvy_to_i420_ssse3 (uint8_t * ydst, uint8_t * udst,
+        uint8_t * vdst, int dstride, const uint8_t * src, int sstride,
+        int width, int height);
+int
+cam_pixel_bgra_to_i420_ssse3 (uint8_t * ydst, uint8_t * udst,
+        uint8_t * vdst, int dstride, const uint8_t * src, int sstride,
+        int width, int height);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef __cam_probes_h__
+#define __cam_probes_h__
+
+/*
+ * Static tracepoints (USDT) for observing a running process with bpftrace,
+ * SystemTap, or perf.  They are compiled in when camunits is configured with
+ * --enable-usdt, and expand to nothing otherwise.  An inactive probe is a
+ * single nop instruction, so they are cheap enough to leave in release
+ * builds.
+ *
+ * All probes are in the "camunits" provider.  String arguments are unit ids,
+ * and timestamps are frame timestamps in microseconds.
+ *
+ *   unit_produce_frame   (const char *unit_id, int64 timestamp,
+ *                         int bytesused)
+ *   unit_frame_begin     (const char *unit_id, int64 timestamp)
+ *   unit_frame_end       (const char *unit_id, int64 timestamp)
+ *   unit_frame_drop      (const char *unit_id, int64 timestamp)
+ *   chain_dispatch_begin (const char *unit_id)
+ *   chain_dispatch_end   (const char *unit_id)
+ *   log_write_frame      (int64 offset, int64 timestamp, int bytes)
+ *   log_get_frame        (int64 offset, int64 timestamp, int bytes)
+ *   v4l2_dqbuf           (int fd, int index, int sequence, int64 timestamp)
+ *   v4l2_qbuf            (int fd, int index)
+ *   v4l2_frame_drop      (int fd, int sequence, int lost)
+ *
+ * unit_frame_begin and unit_frame_end bracket the on_input_frame_ready
+ * method of a unit, on whichever thread it runs.  Units that process frames
+ * synchronously nest inside the unit upstream of them.  The v4l2 probes are
+ * in the V4L2 plugin, and the others in libcamunits.  The scripts in
+ * tools/bpftrace use them to measure per-unit latency, e.g.
+ *
+ *   bpftrace tools/bpftrace/unit_latency.bt /usr/local/lib/libcamunits.so
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef ENABLE_USDT
+
+#include <sys/sdt.h>
+
+#define CAM_PROBE1(name, a) \
+    DTRACE_PROBE1 (camunits, name, a)
+#define CAM_PROBE2(name, a, b) \
+    DTRACE_PROBE2 (camunits, name, a, b)
+#define CAM_PROBE3(name, a, b, c) \
+    DTRACE_PROBE3 (camunits, name, a, b, c)
+#define CAM_PROBE4(name, a, b, c, d) \
+    DTRACE_PROBE4 (camunits, name, a, b, c, d)
+
+#else
+
+#define CAM_PROBE1(name, a) do {} while (0)
+#define CAM_PROBE2(name, a, b) do {} while (0)
+#define CAM_PROBE3(name, a, b, c) do {} while (0)
+#define CAM_PROBE4(name, a, b, c, d) do {} while (0)
+
+#endif
+
+#endif
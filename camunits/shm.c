@@ -0,0 +1,495 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#include "shm.h"
+#include "dbg.h"
+
+#define err(args...) fprintf (stderr, args)
+
+#define SHM_MAGIC 0x4353484d  // "CSHM"
+#define SHM_VERSION 1
+
+#define ROUND_UP(x, n) (((x) + (n) - 1) / (n) * (n))
+
+/*
+ * Layout of the shared memory object:
+ *
+ *   ShmHeader, padded to SHM_HEADER_SIZE bytes
+ *   nslots * slot_size bytes of slots
+ *
+ * Each slot is laid out as:
+ *
+ *   ShmSlotHeader, padded to SHM_SLOT_HEADER_SIZE bytes
+ *   metadata, padded to a multiple of 64 bytes
+ *   image data
+ *
+ * Frame n is stored in slot (n % nslots).  The seq field of a slot is a
+ * sequence lock: while frame n is being written, seq is 2n+1, and once frame
+ * n is complete, seq is 2n+2.  Readers copy a frame out, and then check that
+ * seq did not change while they were copying.
+ */
+#define SHM_HEADER_SIZE 4096
+#define SHM_SLOT_HEADER_SIZE 64
+
+typedef struct _ShmHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nslots;
+    uint32_t slot_size;
+    uint32_t max_data_len;
+    uint32_t max_metadata_len;
+    uint32_t closed;
+
+    // incremented each time a frame is published or the ring is closed.
+    // Readers wait on this with a futex.
+    uint32_t futex_word;
+    uint32_t nwaiters;
+    uint32_t reserved;
+
+    // total number of frames published
+    uint64_t write_count;
+
+    CamShmFrameFormat format;
+} ShmHeader;
+
+typedef struct _ShmSlotHeader {
+    uint64_t seq;
+    int64_t timestamp;
+    uint32_t data_len;
+    uint32_t metadata_len;
+} ShmSlotHeader;
+
+struct _CamShmWriter {
+    char *shm_name;
+    ShmHeader *header;
+    size_t map_size;
+};
+
+struct _CamShmReader {
+    ShmHeader *header;
+    size_t map_size;
+    uint64_t next_frameno;
+    uint64_t dropped;
+};
+
+static char *
+make_shm_name (const char *name)
+{
+    if (!name || !strlen (name) || strchr (name, '/')) {
+        err ("CamShm: invalid ring name [%s]\n", name ? name : "(null)");
+        return NULL;
+    }
+    char *result = malloc (strlen (name) + 11);
+    sprintf (result, "/camunits-%s", name);
+    return result;
+}
+
+static inline uint8_t *
+get_slot (ShmHeader *header, uint64_t frameno)
+{
+    return (uint8_t*) header + SHM_HEADER_SIZE +
+        (size_t) (frameno % header->nslots) * header->slot_size;
+}
+
+static void
+wake_readers (ShmHeader *header)
+{
+    __atomic_add_fetch (&header->futex_word, 1, __ATOMIC_RELEASE);
+#ifdef __linux__
+    if (__atomic_load_n (&header->nwaiters, __ATOMIC_ACQUIRE)) {
+        syscall (SYS_futex, &header->futex_word, FUTEX_WAKE, INT_MAX,
+                NULL, NULL, 0);
+    }
+#endif
+}
+
+// ============== CamShmWriter ===============
+
+/* If a ring with the same name already exists, tell its readers that it's
+ * going away before removing it. */
+static void
+close_existing_ring (const char *shm_name)
+{
+    int fd = shm_open (shm_name, O_RDWR, 0);
+    if (fd < 0) return;
+
+    struct stat st;
+    if (0 == fstat (fd, &st) && st.st_size >= SHM_HEADER_SIZE) {
+        ShmHeader *header = mmap (NULL, SHM_HEADER_SIZE,
+                PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (header != MAP_FAILED) {
+            if (header->magic == SHM_MAGIC) {
+                __atomic_store_n (&header->closed, 1, __ATOMIC_RELEASE);
+                wake_readers (header);
+            }
+            munmap (header, SHM_HEADER_SIZE);
+        }
+    }
+    close (fd);
+    shm_unlink (shm_name);
+}
+
+CamShmWriter *
+cam_shm_writer_new (const char *name, const CamShmFrameFormat *format,
+        int nslots, int max_data_len, int max_metadata_len)
+{
+    if (nslots < 2 || max_data_len <= 0 || max_metadata_len < 0) {
+        err ("CamShm: invalid ring geometry\n");
+        return NULL;
+    }
+
+    char *shm_name = make_shm_name (name);
+    if (!shm_name) return NULL;
+
+    close_existing_ring (shm_name);
+
+    int fd = shm_open (shm_name, O_RDWR | O_CREAT | O_EXCL, 0666);
+    if (fd < 0) {
+        err ("CamShm: unable to create %s: %s\n", shm_name, strerror (errno));
+        free (shm_name);
+        return NULL;
+    }
+
+    size_t slot_size = ROUND_UP (SHM_SLOT_HEADER_SIZE +
+            ROUND_UP (max_metadata_len, 64) + max_data_len, 4096);
+    size_t map_size = SHM_HEADER_SIZE + nslots * slot_size;
+
+    if (ftruncate (fd, map_size) < 0) {
+        err ("CamShm: unable to size %s: %s\n", shm_name, strerror (errno));
+        goto fail;
+    }
+
+    ShmHeader *header = mmap (NULL, map_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED) {
+        err ("CamShm: unable to map %s: %s\n", shm_name, strerror (errno));
+        goto fail;
+    }
+    close (fd);
+
+    memset (header, 0, SHM_HEADER_SIZE);
+    header->version = SHM_VERSION;
+    header->nslots = nslots;
+    header->slot_size = slot_size;
+    header->max_data_len = max_data_len;
+    header->max_metadata_len = max_metadata_len;
+    header->format = *format;
+    header->format.name[CAM_SHM_FORMAT_NAME_MAX-1] = 0;
+    // publish the magic number last, so that readers never attach to a
+    // partially initialized ring
+    __atomic_store_n (&header->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+
+    CamShmWriter *self = calloc (1, sizeof (CamShmWriter));
+    self->shm_name = shm_name;
+    self->header = header;
+    self->map_size = map_size;
+
+    dbg (DBG_OUTPUT, "CamShm: created %s (%d slots of %d bytes)\n",
+            shm_name, nslots, (int) slot_size);
+    return self;
+
+fail:
+    close (fd);
+    shm_unlink (shm_name);
+    free (shm_name);
+    return NULL;
+}
+
+void
+cam_shm_writer_destroy (CamShmWriter *self)
+{
+    __atomic_store_n (&self->header->closed, 1, __ATOMIC_RELEASE);
+    wake_readers (self->header);
+    munmap (self->header, self->map_size);
+    shm_unlink (self->shm_name);
+    free (self->shm_name);
+    free (self);
+}
+
+int
+cam_shm_writer_publish (CamShmWriter *self, int64_t timestamp,
+        const uint8_t *data, int data_len,
+        const uint8_t *metadata, int metadata_len)
+{
+    ShmHeader *header = self->header;
+    if (data_len > header->max_data_len ||
+            metadata_len > header->max_metadata_len) {
+        return -1;
+    }
+
+    uint64_t frameno = header->write_count;
+    uint8_t *slot = get_slot (header, frameno);
+    ShmSlotHeader *shdr = (ShmSlotHeader*) slot;
+
+    __atomic_store_n (&shdr->seq, 2 * frameno + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+
+    shdr->timestamp = timestamp;
+    shdr->data_len = data_len;
+    shdr->metadata_len = metadata_len;
+    uint8_t *slot_metadata = slot + SHM_SLOT_HEADER_SIZE;
+    uint8_t *slot_data = slot_metadata + ROUND_UP (header->max_metadata_len, 64);
+    if (metadata_len)
+        memcpy (slot_metadata, metadata, metadata_len);
+    memcpy (slot_data, data, data_len);
+
+    __atomic_store_n (&shdr->seq, 2 * frameno + 2, __ATOMIC_RELEASE);
+    __atomic_store_n (&header->write_count, frameno + 1, __ATOMIC_RELEASE);
+
+    wake_readers (header);
+    return 0;
+}
+
+// ============== CamShmReader ===============
+
+CamShmReader *
+cam_shm_reader_new (const char *name)
+{
+    char *shm_name = make_shm_name (name);
+    if (!shm_name) return NULL;
+
+    int fd = shm_open (shm_name, O_RDWR, 0);
+    if (fd < 0) {
+        dbg (DBG_INPUT, "CamShm: unable to open %s: %s\n", shm_name,
+                strerror (errno));
+        free (shm_name);
+        return NULL;
+    }
+    free (shm_name);
+
+    struct stat st;
+    if (fstat (fd, &st) < 0 || st.st_size < SHM_HEADER_SIZE) {
+        close (fd);
+        return NULL;
+    }
+
+    // readers need write access too, for the waiter count
+    ShmHeader *header = mmap (NULL, st.st_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0);
+    close (fd);
+    if (header == MAP_FAILED)
+        return NULL;
+
+    if (__atomic_load_n (&header->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC ||
+            header->version != SHM_VERSION ||
+            SHM_HEADER_SIZE + (size_t) header->nslots * header->slot_size >
+            (size_t) st.st_size) {
+        err ("CamShm: %s is not a valid frame ring\n", name);
+        munmap (header, st.st_size);
+        return NULL;
+    }
+
+    CamShmReader *self = calloc (1, sizeof (CamShmReader));
+    self->header = header;
+    self->map_size = st.st_size;
+    self->next_frameno = __atomic_load_n (&header->write_count,
+            __ATOMIC_ACQUIRE);
+    self->dropped = 0;
+    return self;
+}
+
+void
+cam_shm_reader_destroy (CamShmReader *self)
+{
+    munmap (self->header, self->map_size);
+    free (self);
+}
+
+void
+cam_shm_reader_get_format (const CamShmReader *self,
+        CamShmFrameFormat *format)
+{
+    *format = self->header->format;
+}
+
+int
+cam_shm_reader_get_max_data_len (const CamShmReader *self)
+{
+    return self->header->max_data_len;
+}
+
+int
+cam_shm_reader_get_max_metadata_len (const CamShmReader *self)
+{
+    return self->header->max_metadata_len;
+}
+
+void
+cam_shm_reader_resync (CamShmReader *self)
+{
+    self->next_frameno = __atomic_load_n (&self->header->write_count,
+            __ATOMIC_ACQUIRE);
+}
+
+uint64_t
+cam_shm_reader_get_dropped (const CamShmReader *self)
+{
+    return self->dropped;
+}
+
+static int64_t
+_monotonic_ms (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int
+cam_shm_reader_wait (CamShmReader *self, int timeout_ms)
+{
+    ShmHeader *header = self->header;
+    int64_t deadline = timeout_ms > 0 ? _monotonic_ms () + timeout_ms : 0;
+
+    while (1) {
+        uint32_t futex_word =
+            __atomic_load_n (&header->futex_word, __ATOMIC_ACQUIRE);
+        if (__atomic_load_n (&header->closed, __ATOMIC_ACQUIRE))
+            return -1;
+        if (__atomic_load_n (&header->write_count, __ATOMIC_ACQUIRE) >
+                self->next_frameno)
+            return 1;
+
+        int remaining_ms = -1;
+        if (timeout_ms >= 0) {
+            remaining_ms = timeout_ms ? deadline - _monotonic_ms () : 0;
+            if (remaining_ms <= 0)
+                return 0;
+        }
+
+#ifdef __linux__
+        struct timespec ts = { remaining_ms / 1000,
+            (remaining_ms % 1000) * 1000000 };
+        __atomic_add_fetch (&header->nwaiters, 1, __ATOMIC_ACQ_REL);
+        syscall (SYS_futex, &header->futex_word, FUTEX_WAIT, futex_word,
+                remaining_ms >= 0 ? &ts : NULL, NULL, 0);
+        __atomic_sub_fetch (&header->nwaiters, 1, __ATOMIC_ACQ_REL);
+#else
+        struct timespec ts = { 0, 1000000 };
+        nanosleep (&ts, NULL);
+#endif
+    }
+}
+
+int
+cam_shm_reader_read (CamShmReader *self, CamShmFrameInfo *info,
+        uint8_t *data, uint8_t *metadata)
+{
+    ShmHeader *header = self->header;
+
+    while (1) {
+        if (__atomic_load_n (&header->closed, __ATOMIC_ACQUIRE))
+            return -1;
+
+        uint64_t write_count =
+            __atomic_load_n (&header->write_count, __ATOMIC_ACQUIRE);
+        if (self->next_frameno >= write_count)
+            return 0;
+
+        // The writer may already be overwriting the slot of the oldest
+        // frame, so a reader that is a whole ring behind skips ahead to the
+        // newest frame.
+        if (write_count - self->next_frameno >= header->nslots) {
+            self->dropped += write_count - 1 - self->next_frameno;
+            self->next_frameno = write_count - 1;
+        }
+
+        uint64_t frameno = self->next_frameno;
+        uint8_t *slot = get_slot (header, frameno);
+        ShmSlotHeader *shdr = (ShmSlotHeader*) slot;
+
+        uint64_t seq = __atomic_load_n (&shdr->seq, __ATOMIC_ACQUIRE);
+        if (seq != 2 * frameno + 2) {
+            // overwritten since we checked write_count.  Try again.
+            continue;
+        }
+
+        int64_t timestamp = shdr->timestamp;
+        uint32_t data_len = shdr->data_len;
+        uint32_t metadata_len = shdr->metadata_len;
+        if (data_len > header->max_data_len)
+            data_len = header->max_data_len;
+        if (metadata_len > header->max_metadata_len)
+            metadata_len = header->max_metadata_len;
+
+        uint8_t *slot_metadata = slot + SHM_SLOT_HEADER_SIZE;
+        uint8_t *slot_data =
+            slot_metadata + ROUND_UP (header->max_metadata_len, 64);
+        if (metadata && metadata_len)
+            memcpy (metadata, slot_metadata, metadata_len);
+        memcpy (data, slot_data, data_len);
+
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+        if (__atomic_load_n (&shdr->seq, __ATOMIC_RELAXED) != seq) {
+            // the writer lapped us while we were copying
+            self->dropped++;
+            self->next_frameno++;
+            continue;
+        }
+
+        self->next_frameno++;
+        info->frameno = frameno;
+        info->timestamp = timestamp;
+        info->data_len = data_len;
+        info->metadata_len = metadata ? metadata_len : 0;
+        return 1;
+    }
+}
+
+// ============== metadata ===============
+
+/* A serialized metadata dictionary is a sequence of entries, each:
+ *    uint32_t key_len      (including the terminating NUL)
+ *    char     key[key_len]
+ *    uint32_t value_len
+ *    uint8_t  value[value_len]
+ * Integers are in host byte order.
+ */
+int
+cam_shm_metadata_append (uint8_t *buf, int buf_len, int buf_max,
+        const char *key, const uint8_t *value, int value_len)
+{
+    uint32_t key_len = strlen (key) + 1;
+    uint32_t vlen = value_len;
+    if (buf_len + 8 + key_len + vlen > buf_max)
+        return -1;
+    memcpy (buf + buf_len, &key_len, 4);
+    memcpy (buf + buf_len + 4, key, key_len);
+    memcpy (buf + buf_len + 4 + key_len, &vlen, 4);
+    memcpy (buf + buf_len + 8 + key_len, value, vlen);
+    return buf_len + 8 + key_len + vlen;
+}
+
+int
+cam_shm_metadata_next (const uint8_t *buf, int buf_len, int *pos,
+        const char **key, const uint8_t **value, int *value_len)
+{
+    uint32_t key_len, vlen;
+    int p = *pos;
+    if (p + 4 > buf_len) return -1;
+    memcpy (&key_len, buf + p, 4);
+    if (key_len == 0 || p + 8 + key_len > buf_len) return -1;
+    if (buf[p + 4 + key_len - 1] != 0) return -1;
+    memcpy (&vlen, buf + p + 4 + key_len, 4);
+    if (p + 8 + key_len + vlen > buf_len) return -1;
+
+    *key = (const char*) buf + p + 4;
+    *value = buf + p + 8 + key_len;
+    *value_len = vlen;
+    *pos = p + 8 + key_len + vlen;
+    return 0;
+}
@@ -0,0 +1,225 @@
+#ifndef __cam_shm_h__
+#define __cam_shm_h__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * SECTION:shm
+ * @short_description: Shared memory frame ring for delivering images to other
+ * processes on the same machine.
+ *
+ * A CamShmWriter publishes frames into a POSIX shared memory object that is
+ * organized as a ring of fixed-size slots.  Each slot holds the frame format,
+ * timestamp, metadata dictionary, and image data of one frame.  Any number
+ * of CamShmReader objects, possibly in other processes, can attach to the
+ * ring by name and read frames as they are published.  The writer never
+ * waits for readers; a reader that falls more than one ring length behind
+ * skips ahead to the newest frame.
+ *
+ * Readers are notified of new frames with a futex on Linux, and fall back to
+ * polling on other platforms.
+ *
+ * This API does not depend on GLib, and can be used by programs that do not
+ * otherwise use Camunits.  The <literal>output.shm</literal> and
+ * <literal>input.shm</literal> plugins are built on top of it.
+ */
+
+typedef struct _CamShmWriter CamShmWriter;
+typedef struct _CamShmReader CamShmReader;
+
+#define CAM_SHM_FORMAT_NAME_MAX 64
+
+/**
+ * CamShmFrameFormat:
+ *
+ * Describes the images published in a shared memory ring.  All frames in a
+ * ring have the same format.
+ */
+typedef struct _CamShmFrameFormat {
+    uint32_t pixelformat;
+    uint32_t width;
+    uint32_t height;
+    uint32_t row_stride;
+    char name[CAM_SHM_FORMAT_NAME_MAX];
+} CamShmFrameFormat;
+
+/**
+ * CamShmFrameInfo:
+ * @frameno: sequence number of the frame within the ring, starting at 0.
+ * @timestamp: frame timestamp, microseconds since the epoch.
+ * @data_len: size of the image data, in bytes.
+ * @metadata_len: size of the serialized metadata dictionary, in bytes.
+ */
+typedef struct _CamShmFrameInfo {
+    uint64_t frameno;
+    int64_t timestamp;
+    uint32_t data_len;
+    uint32_t metadata_len;
+} CamShmFrameInfo;
+
+/**
+ * cam_shm_writer_new:
+ * @name: name of the shared memory ring.  Readers attach using the same name.
+ * @format: the format of the frames to publish.
+ * @nslots: number of frames in the ring.
+ * @max_data_len: capacity of each slot for image data, in bytes.
+ * @max_metadata_len: capacity of each slot for metadata, in bytes.
+ *
+ * Creates a new shared memory ring, replacing any existing ring with the
+ * same name.  Readers attached to a replaced ring are told that it has been
+ * closed.
+ *
+ * Returns: a new CamShmWriter, or NULL on failure.
+ */
+CamShmWriter * cam_shm_writer_new (const char *name,
+        const CamShmFrameFormat *format, int nslots, int max_data_len,
+        int max_metadata_len);
+
+/**
+ * cam_shm_writer_destroy:
+ *
+ * Marks the ring as closed, wakes up all readers, and removes the shared
+ * memory object.
+ */
+void cam_shm_writer_destroy (CamShmWriter *self);
+
+/**
+ * cam_shm_writer_publish:
+ * @timestamp: frame timestamp
+ * @data: image data
+ * @data_len: size of @data, in bytes
+ * @metadata: metadata serialized with cam_shm_metadata_append().  May be NULL.
+ * @metadata_len: size of @metadata, in bytes
+ *
+ * Copies a frame into the next slot of the ring and wakes up any waiting
+ * readers.
+ *
+ * Returns: 0 on success, -1 if the frame doesn't fit in a slot.
+ */
+int cam_shm_writer_publish (CamShmWriter *self, int64_t timestamp,
+        const uint8_t *data, int data_len,
+        const uint8_t *metadata, int metadata_len);
+
+/**
+ * cam_shm_reader_new:
+ * @name: name of the shared memory ring to attach to.
+ *
+ * Attaches to an existing shared memory ring.  The first frame read will be
+ * the next frame published after attaching.
+ *
+ * Returns: a new CamShmReader, or NULL if there is no ring named @name.
+ */
+CamShmReader * cam_shm_reader_new (const char *name);
+
+void cam_shm_reader_destroy (CamShmReader *self);
+
+/**
+ * cam_shm_reader_get_format:
+ *
+ * Retrieves the format of the frames in the ring.
+ */
+void cam_shm_reader_get_format (const CamShmReader *self,
+        CamShmFrameFormat *format);
+
+/**
+ * cam_shm_reader_get_max_data_len:
+ *
+ * Returns: the largest image size that a slot can hold.  A buffer this
+ * large is always sufficient for cam_shm_reader_read().
+ */
+int cam_shm_reader_get_max_data_len (const CamShmReader *self);
+
+/**
+ * cam_shm_reader_get_max_metadata_len:
+ *
+ * Returns: the largest serialized metadata dictionary that a slot can hold.
+ */
+int cam_shm_reader_get_max_metadata_len (const CamShmReader *self);
+
+/**
+ * cam_shm_reader_wait:
+ * @timeout_ms: maximum time to wait, in milliseconds.  If negative, wait
+ *              forever.
+ *
+ * Waits until there is a frame that has not yet been read.
+ *
+ * Returns: 1 if a frame is available, 0 on timeout, -1 if the writer has
+ * closed the ring.
+ */
+int cam_shm_reader_wait (CamShmReader *self, int timeout_ms);
+
+/**
+ * cam_shm_reader_read:
+ * @info: output parameter.  Information about the frame.
+ * @data: output buffer for the image data.  Must be at least
+ *        cam_shm_reader_get_max_data_len() bytes.
+ * @metadata: output buffer for the serialized metadata.  Must be at least
+ *        cam_shm_reader_get_max_metadata_len() bytes.  May be NULL, in which
+ *        case metadata is not copied.
+ *
+ * Copies the next unread frame out of the ring, without waiting.  If the
+ * reader has fallen too far behind, older frames are skipped and counted as
+ * dropped.
+ *
+ * Returns: 1 if a frame was read, 0 if there are no unread frames, -1 if the
+ * writer has closed the ring.
+ */
+int cam_shm_reader_read (CamShmReader *self, CamShmFrameInfo *info,
+        uint8_t *data, uint8_t *metadata);
+
+/**
+ * cam_shm_reader_resync:
+ *
+ * Skips the frames that have been published but not yet read, without
+ * counting them as dropped.  As after cam_shm_reader_new(), the next frame
+ * read will be the next frame published.
+ */
+void cam_shm_reader_resync (CamShmReader *self);
+
+/**
+ * cam_shm_reader_get_dropped:
+ *
+ * Returns: the number of frames this reader has skipped because the writer
+ * overwrote them before they could be read.
+ */
+uint64_t cam_shm_reader_get_dropped (const CamShmReader *self);
+
+/**
+ * cam_shm_metadata_append:
+ * @buf: the buffer holding the serialized dictionary.
+ * @buf_len: current size of the serialized dictionary.
+ * @buf_max: capacity of @buf
+ *
+ * Appends a key/value pair to a serialized metadata dictionary.
+ *
+ * Returns: the new size of the serialized dictionary, or -1 if the entry
+ * does not fit.
+ */
+int cam_shm_metadata_append (uint8_t *buf, int buf_len, int buf_max,
+        const char *key, const uint8_t *value, int value_len);
+
+/**
+ * cam_shm_metadata_next:
+ * @buf: serialized metadata dictionary.
+ * @buf_len: size of the serialized dictionary.
+ * @pos: iterator.  Set to 0 to retrieve the first entry.
+ * @key: output parameter.  Points to a NUL-terminated key within @buf.
+ * @value: output parameter.  Points to the value within @buf.
+ * @value_len: output parameter.  Size of the value, in bytes.
+ *
+ * Iterates through the entries of a serialized metadata dictionary.
+ *
+ * Returns: 0 if an entry was retrieved, -1 when there are no more entries.
+ */
+int cam_shm_metadata_next (const uint8_t *buf, int buf_len, int *pos,
+        const char **key, const uint8_t **value, int *value_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,460 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "thread_pool.h"
+#include "trace.h"
+#include "dbg.h"
+
+#define err(args...) fprintf (stderr, args)
+
+struct _CamThreadPoolTask {
+    CamThreadPool *pool;
+    CamThreadPoolFunc func;
+    void *user_data;
+    int done;
+
+    // the helper tasks of cam_thread_pool_parallel_for are never waited on,
+    // and release themselves when they finish.
+    int autofree;
+};
+
+typedef struct _worker_t {
+    CamThreadPool *pool;
+    GThread *thread;
+    int index;
+    int affinity_serial;
+} worker_t;
+
+struct _CamThreadPool {
+    GAsyncQueue *queue;
+    worker_t *workers;
+    int nworkers;
+
+    // protects the done flags of tasks, and is signalled whenever a task or
+    // a parallel_for band completes
+    GMutex *done_mutex;
+    GCond *done_cond;
+
+    GMutex *affinity_mutex;
+    int *cpus;
+    int ncpus;
+    int affinity_serial;
+};
+
+typedef struct _range_job_t {
+    CamThreadPool *pool;
+    CamThreadPoolRangeFunc func;
+    void *user_data;
+    int start;
+    int end;
+    int band;
+    int nbands;
+    int next_band;
+    int ndone;
+    int refcount;
+} range_job_t;
+
+static CamThreadPoolTask QUIT_REQUEST;
+
+G_LOCK_DEFINE_STATIC (default_pool);
+static CamThreadPool *default_pool = NULL;
+
+static void
+apply_affinity (worker_t *worker)
+{
+    CamThreadPool *pool = worker->pool;
+    g_mutex_lock (pool->affinity_mutex);
+    worker->affinity_serial = pool->affinity_serial;
+    int status;
+    if (pool->ncpus)
+        status = cam_thread_set_affinity (
+                &pool->cpus[worker->index % pool->ncpus], 1);
+    else
+        status = cam_thread_set_affinity (NULL, 0);
+    if (0 != status)
+        err ("ThreadPool: unable to set the affinity of worker %d\n",
+                worker->index);
+    g_mutex_unlock (pool->affinity_mutex);
+}
+
+static void
+run_task (CamThreadPoolTask *task)
+{
+    CamThreadPool *pool = task->pool;
+    task->func (task->user_data);
+
+    if (task->autofree) {
+        g_slice_free (CamThreadPoolTask, task);
+        return;
+    }
+    g_mutex_lock (pool->done_mutex);
+    task->done = 1;
+    g_cond_broadcast (pool->done_cond);
+    g_mutex_unlock (pool->done_mutex);
+}
+
+static gpointer
+worker_thread (gpointer user_data)
+{
+    worker_t *worker = (worker_t*) user_data;
+    CamThreadPool *pool = worker->pool;
+    dbg (DBG_MANAGER, "ThreadPool: worker %d started\n", worker->index);
+    char *thread_name = g_strdup_printf ("worker %d", worker->index);
+    cam_trace_set_thread_name (thread_name);
+    g_free (thread_name);
+
+    while (1) {
+        CamThreadPoolTask *task =
+            (CamThreadPoolTask*) g_async_queue_pop (pool->queue);
+        if (task == &QUIT_REQUEST)
+            break;
+        if (g_atomic_int_get (&pool->affinity_serial) !=
+                worker->affinity_serial)
+            apply_affinity (worker);
+        run_task (task);
+    }
+    dbg (DBG_MANAGER, "ThreadPool: worker %d exiting\n", worker->index);
+    return NULL;
+}
+
+CamThreadPool *
+cam_thread_pool_new (int nthreads)
+{
+    if (!g_thread_supported ()) g_thread_init (NULL);
+
+    if (nthreads < 0)
+        nthreads = sysconf (_SC_NPROCESSORS_ONLN);
+    if (nthreads < 0)
+        nthreads = 1;
+
+    CamThreadPool *self = g_slice_new0 (CamThreadPool);
+    self->queue = g_async_queue_new ();
+    self->done_mutex = g_mutex_new ();
+    self->done_cond = g_cond_new ();
+    self->affinity_mutex = g_mutex_new ();
+    self->workers = g_new0 (worker_t, MAX (nthreads, 1));
+
+    for (int i = 0; i < nthreads; i++) {
+        worker_t *worker = &self->workers[self->nworkers];
+        worker->pool = self;
+        worker->index = i;
+        worker->thread = g_thread_create (worker_thread, worker, TRUE, NULL);
+        if (!worker->thread) {
+            err ("ThreadPool: unable to start worker thread %d\n", i);
+            break;
+        }
+        self->nworkers++;
+    }
+    dbg (DBG_MANAGER, "ThreadPool: started %d workers\n", self->nworkers);
+    return self;
+}
+
+void
+cam_thread_pool_destroy (CamThreadPool *self)
+{
+    g_assert (self != default_pool);
+
+    // the workers finish everything queued ahead of the quit requests
+    for (int i = 0; i < self->nworkers; i++)
+        g_async_queue_push (self->queue, &QUIT_REQUEST);
+    for (int i = 0; i < self->nworkers; i++)
+        g_thread_join (self->workers[i].thread);
+
+    g_async_queue_unref (self->queue);
+    g_mutex_free (self->done_mutex);
+    g_cond_free (self->done_cond);
+    g_mutex_free (self->affinity_mutex);
+    g_free (self->workers);
+    free (self->cpus);
+    g_slice_free (CamThreadPool, self);
+}
+
+CamThreadPool *
+cam_thread_pool_get_default (void)
+{
+    if (!g_thread_supported ()) g_thread_init (NULL);
+
+    G_LOCK (default_pool);
+    if (!default_pool) {
+        int nthreads = -1;
+        const char *env = getenv ("CAMUNITS_NUM_THREADS");
+        if (env && strlen (env))
+            nthreads = atoi (env);
+        default_pool = cam_thread_pool_new (nthreads);
+    }
+    G_UNLOCK (default_pool);
+    return default_pool;
+}
+
+int
+cam_thread_pool_get_num_threads (const CamThreadPool *self)
+{
+    return self->nworkers;
+}
+
+void
+cam_thread_pool_set_affinity (CamThreadPool *self, const int *cpus,
+        int ncpus)
+{
+    g_mutex_lock (self->affinity_mutex);
+    free (self->cpus);
+    self->cpus = NULL;
+    self->ncpus = 0;
+    if (cpus && ncpus > 0) {
+        self->cpus = (int*) malloc (ncpus * sizeof (int));
+        memcpy (self->cpus, cpus, ncpus * sizeof (int));
+        self->ncpus = ncpus;
+    }
+    g_atomic_int_inc (&self->affinity_serial);
+    g_mutex_unlock (self->affinity_mutex);
+}
+
+static CamThreadPoolTask *
+_submit (CamThreadPool *self, CamThreadPoolFunc func, void *user_data,
+        int autofree)
+{
+    CamThreadPoolTask *task = g_slice_new0 (CamThreadPoolTask);
+    task->pool = self;
+    task->func = func;
+    task->user_data = user_data;
+    task->autofree = autofree;
+
+    if (!self->nworkers) {
+        run_task (task);
+        return autofree ? NULL : task;
+    }
+    g_async_queue_push (self->queue, task);
+    return task;
+}
+
+CamThreadPoolTask *
+cam_thread_pool_submit (CamThreadPool *self, CamThreadPoolFunc func,
+        void *user_data)
+{
+    return _submit (self, func, user_data, 0);
+}
+
+void
+cam_thread_pool_task_wait (CamThreadPoolTask *task)
+{
+    CamThreadPool *pool = task->pool;
+    g_mutex_lock (pool->done_mutex);
+    while (!task->done)
+        g_cond_wait (pool->done_cond, pool->done_mutex);
+    g_mutex_unlock (pool->done_mutex);
+    g_slice_free (CamThreadPoolTask, task);
+}
+
+static void
+range_job_unref (range_job_t *job)
+{
+    if (g_atomic_int_dec_and_test (&job->refcount))
+        g_slice_free (range_job_t, job);
+}
+
+/* Claims and processes bands until there are none left */
+static void
+run_bands (range_job_t *job)
+{
+    int b;
+    while ((b = g_atomic_int_exchange_and_add (&job->next_band, 1)) <
+            job->nbands) {
+        int start = job->start + b * job->band;
+        int end = MIN (start + job->band, job->end);
+        int64_t t0 = cam_trace_is_enabled () ? cam_trace_now () : 0;
+        job->func (start, end, job->user_data);
+        if (t0)
+            cam_trace_add_complete ("pool", "parallel_for", t0,
+                    cam_trace_now (), 0);
+
+        if (g_atomic_int_exchange_and_add (&job->ndone, 1) + 1 ==
+                job->nbands) {
+            g_mutex_lock (job->pool->done_mutex);
+            g_cond_broadcast (job->pool->done_cond);
+            g_mutex_unlock (job->pool->done_mutex);
+        }
+    }
+}
+
+static void
+range_helper (void *user_data)
+{
+    range_job_t *job = (range_job_t*) user_data;
+    run_bands (job);
+    range_job_unref (job);
+}
+
+void
+cam_thread_pool_parallel_for (CamThreadPool *self, int start, int end,
+        int grain, CamThreadPoolRangeFunc func, void *user_data)
+{
+    if (end <= start)
+        return;
+    if (grain < 1)
+        grain = 1;
+
+    int ngrains = (end - start + grain - 1) / grain;
+    int nbands = MIN (ngrains, self->nworkers + 1);
+    if (nbands <= 1) {
+        func (start, end, user_data);
+        return;
+    }
+    int band = (ngrains + nbands - 1) / nbands * grain;
+    nbands = (end - start + band - 1) / band;
+
+    range_job_t *job = g_slice_new0 (range_job_t);
+    job->pool = self;
+    job->func = func;
+    job->user_data = user_data;
+    job->start = start;
+    job->end = end;
+    job->band = band;
+    job->nbands = nbands;
+    // one reference for each helper, and one for the caller
+    job->refcount = nbands;
+
+    for (int i = 0; i < nbands - 1; i++)
+        _submit (self, range_helper, job, 1);
+
+    // the calling thread works too, so that progress is made even when all
+    // of the workers are busy, or this is called from inside a task
+    run_bands (job);
+
+    g_mutex_lock (self->done_mutex);
+    while (g_atomic_int_get (&job->ndone) < nbands)
+        g_cond_wait (self->done_cond, self->done_mutex);
+    g_mutex_unlock (self->done_mutex);
+    range_job_unref (job);
+}
+
+int
+cam_thread_set_affinity (const int *cpus, int ncpus)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO (&set);
+    if (cpus && ncpus > 0) {
+        for (int i = 0; i < ncpus; i++) {
+            if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE)
+                return -1;
+            CPU_SET (cpus[i], &set);
+        }
+    } else {
+        long n = sysconf (_SC_NPROCESSORS_CONF);
+        for (int i = 0; i < n && i < CPU_SETSIZE; i++)
+            CPU_SET (i, &set);
+    }
+    return sched_setaffinity (0, sizeof (set), &set) ? -1 : 0;
+#else
+    return (cpus && ncpus > 0) ? -1 : 0;
+#endif
+}
+
+static int
+_posix_policy (CamThreadSchedPolicy policy)
+{
+    switch (policy) {
+        case CAM_THREAD_SCHED_FIFO:
+            return SCHED_FIFO;
+        case CAM_THREAD_SCHED_RR:
+            return SCHED_RR;
+        default:
+            return SCHED_OTHER;
+    }
+}
+
+int
+cam_thread_check_priority (CamThreadSchedPolicy policy, int priority)
+{
+    if (policy == CAM_THREAD_SCHED_OTHER)
+        return 0;
+    int ppolicy = _posix_policy (policy);
+    if (priority < sched_get_priority_min (ppolicy) ||
+        priority > sched_get_priority_max (ppolicy))
+        return -1;
+    return 0;
+}
+
+int
+cam_thread_set_scheduling (CamThreadSchedPolicy policy, int priority)
+{
+    if (0 != cam_thread_check_priority (policy, priority))
+        return -1;
+
+    struct sched_param param;
+    memset (&param, 0, sizeof (param));
+    if (policy != CAM_THREAD_SCHED_OTHER)
+        param.sched_priority = priority;
+    return pthread_setschedparam (pthread_self (), _posix_policy (policy),
+            &param) ? -1 : 0;
+}
+
+static const char *_policy_names[] = { "other", "fifo", "rr" };
+
+const char *
+cam_thread_sched_policy_to_string (CamThreadSchedPolicy policy)
+{
+    if (policy < CAM_THREAD_SCHED_OTHER || policy > CAM_THREAD_SCHED_RR)
+        return NULL;
+    return _policy_names[policy];
+}
+
+int
+cam_thread_sched_policy_from_string (const char *str,
+        CamThreadSchedPolicy *policy)
+{
+    for (int i = CAM_THREAD_SCHED_OTHER; i <= CAM_THREAD_SCHED_RR; i++) {
+        if (!strcmp (str, _policy_names[i])) {
+            *policy = (CamThreadSchedPolicy) i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int *
+cam_thread_parse_cpu_list (const char *str, int *ncpus)
+{
+    GArray *cpus = g_array_new (FALSE, FALSE, sizeof (int));
+    const char *p = str;
+
+    while (*p) {
+        char *e = NULL;
+        long first = strtol (p, &e, 10);
+        if (e == p || first < 0)
+            goto fail;
+        long last = first;
+        p = e;
+        if (*p == '-') {
+            last = strtol (p + 1, &e, 10);
+            if (e == p + 1 || last < first || last - first > 4096)
+                goto fail;
+            p = e;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            int c = cpu;
+            g_array_append_val (cpus, c);
+        }
+        if (*p == ',')
+            p++;
+        else if (*p)
+            goto fail;
+    }
+    if (!cpus->len)
+        goto fail;
+
+    *ncpus = cpus->len;
+    int *result = (int*) malloc (cpus->len * sizeof (int));
+    memcpy (result, cpus->data, cpus->len * sizeof (int));
+    g_array_free (cpus, TRUE);
+    return result;
+
+fail:
+    g_array_free (cpus, TRUE);
+    return NULL;
+}
@@ -0,0 +1,214 @@
+#ifndef __cam_thread_pool_h__
+#define __cam_thread_pool_h__
+
+#include <glib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * SECTION:thread_pool
+ * @short_description: Worker threads shared by all units in a process.
+ *
+ * A CamThreadPool runs tasks on a fixed set of worker threads.  Units that
+ * want to spread their work across several cores should use the default
+ * pool, returned by cam_thread_pool_get_default(), instead of starting
+ * threads of their own.  All of the chains in a process then share one
+ * thread per core, instead of each unit oversubscribing the machine.
+ *
+ * Most image processing parallelizes naturally over bands of rows, which is
+ * what cam_thread_pool_parallel_for() does.  The calling thread processes
+ * bands too, so it is safe to call from inside a task, and a pool with no
+ * worker threads simply runs everything in the calling thread.
+ *
+ * The default pool has one thread for each online CPU.  Setting the
+ * CAMUNITS_NUM_THREADS environment variable overrides this, and 0 disables
+ * the workers entirely.
+ *
+ * cam_thread_set_affinity() and cam_thread_set_scheduling() change the CPU
+ * affinity and scheduling policy of the calling thread.  #CamUnitChain uses
+ * them to keep capture threads from being preempted.
+ */
+
+typedef struct _CamThreadPool CamThreadPool;
+typedef struct _CamThreadPoolTask CamThreadPoolTask;
+
+/**
+ * CamThreadPoolFunc:
+ * @user_data: the data passed to cam_thread_pool_submit()
+ *
+ * A task run by a worker thread.
+ */
+typedef void (*CamThreadPoolFunc) (void *user_data);
+
+/**
+ * CamThreadPoolRangeFunc:
+ * @start: first index of the band
+ * @end: one past the last index of the band
+ * @user_data: the data passed to cam_thread_pool_parallel_for()
+ *
+ * Processes one band of a cam_thread_pool_parallel_for() range.
+ */
+typedef void (*CamThreadPoolRangeFunc) (int start, int end, void *user_data);
+
+/**
+ * CamThreadSchedPolicy:
+ * @CAM_THREAD_SCHED_OTHER: the default time-sharing policy.
+ * @CAM_THREAD_SCHED_FIFO: real-time, first-in first-out.
+ * @CAM_THREAD_SCHED_RR: real-time, round-robin.
+ *
+ * Scheduling policies for cam_thread_set_scheduling().  The real-time
+ * policies usually require root or CAP_SYS_NICE.
+ */
+typedef enum {
+    CAM_THREAD_SCHED_OTHER = 0,
+    CAM_THREAD_SCHED_FIFO,
+    CAM_THREAD_SCHED_RR
+} CamThreadSchedPolicy;
+
+/**
+ * cam_thread_pool_new:
+ * @nthreads: number of worker threads.  If negative, one thread is started
+ *            for each online CPU.
+ *
+ * Returns: a new CamThreadPool.
+ */
+CamThreadPool * cam_thread_pool_new (int nthreads);
+
+/**
+ * cam_thread_pool_destroy:
+ *
+ * Waits for all submitted tasks to finish, then stops the worker threads.
+ * The default pool must not be destroyed.
+ */
+void cam_thread_pool_destroy (CamThreadPool *self);
+
+/**
+ * cam_thread_pool_get_default:
+ *
+ * Returns: the thread pool shared by all units in the process.  It is
+ * created on first use, and lasts until the process exits.
+ */
+CamThreadPool * cam_thread_pool_get_default (void);
+
+/**
+ * cam_thread_pool_get_num_threads:
+ *
+ * Returns: the number of worker threads in the pool.
+ */
+int cam_thread_pool_get_num_threads (const CamThreadPool *self);
+
+/**
+ * cam_thread_pool_set_affinity:
+ * @cpus: the CPUs that the worker threads may run on, or NULL to let them
+ *        run on any CPU.
+ * @ncpus: the number of entries in @cpus.
+ *
+ * Hints that the worker threads should be kept on specific CPUs, e.g. to
+ * keep them away from a core reserved for capture.  Worker i is pinned to
+ * @cpus[i % @ncpus], starting with the next task it runs.  This has no
+ * effect on systems without sched_setaffinity().
+ */
+void cam_thread_pool_set_affinity (CamThreadPool *self, const int *cpus,
+        int ncpus);
+
+/**
+ * cam_thread_pool_submit:
+ * @func: the function to run
+ * @user_data: passed to @func
+ *
+ * Queues @func to run on a worker thread.  If the pool has no workers, @func
+ * runs immediately in the calling thread.
+ *
+ * Returns: a handle that must be passed to cam_thread_pool_task_wait().
+ */
+CamThreadPoolTask * cam_thread_pool_submit (CamThreadPool *self,
+        CamThreadPoolFunc func, void *user_data);
+
+/**
+ * cam_thread_pool_task_wait:
+ *
+ * Blocks until @task has finished, and then releases it.
+ */
+void cam_thread_pool_task_wait (CamThreadPoolTask *task);
+
+/**
+ * cam_thread_pool_parallel_for:
+ * @start: first index of the range
+ * @end: one past the last index of the range
+ * @grain: bands are a multiple of this many indices long, except for the
+ *         last one, and are never shorter than @grain.  Use 2 for images
+ *         whose rows must be processed in pairs, such as Bayer or 4:2:0
+ *         images.
+ * @func: called once for each band
+ * @user_data: passed to @func
+ *
+ * Splits [@start, @end) into at most one band for each worker thread and one
+ * for the calling thread, and calls @func on each band in parallel.  Returns
+ * when all of the bands have been processed.
+ */
+void cam_thread_pool_parallel_for (CamThreadPool *self, int start, int end,
+        int grain, CamThreadPoolRangeFunc func, void *user_data);
+
+/**
+ * cam_thread_set_affinity:
+ * @cpus: the CPUs that the calling thread may run on, or NULL to allow all
+ *        CPUs.
+ * @ncpus: the number of entries in @cpus.
+ *
+ * Returns: 0 on success, -1 on failure or if CPU affinity is not supported.
+ */
+int cam_thread_set_affinity (const int *cpus, int ncpus);
+
+/**
+ * cam_thread_set_scheduling:
+ * @policy: the scheduling policy
+ * @priority: the static priority.  Must be within the range allowed for
+ *            @policy, and is ignored for #CAM_THREAD_SCHED_OTHER.
+ *
+ * Sets the scheduling policy and priority of the calling thread.
+ *
+ * Returns: 0 on success, -1 on failure.
+ */
+int cam_thread_set_scheduling (CamThreadSchedPolicy policy, int priority);
+
+/**
+ * cam_thread_check_priority:
+ *
+ * Returns: 0 if @priority is valid for @policy, -1 if not.
+ */
+int cam_thread_check_priority (CamThreadSchedPolicy policy, int priority);
+
+/**
+ * cam_thread_sched_policy_to_string:
+ *
+ * Returns: "other", "fifo", or "rr".
+ */
+const char * cam_thread_sched_policy_to_string (CamThreadSchedPolicy policy);
+
+/**
+ * cam_thread_sched_policy_from_string:
+ * @str: "other", "fifo", or "rr"
+ * @policy: output parameter
+ *
+ * Returns: 0 on success, -1 if @str is not a policy name.
+ */
+int cam_thread_sched_policy_from_string (const char *str,
+        CamThreadSchedPolicy *policy);
+
+/**
+ * cam_thread_parse_cpu_list:
+ * @str: a comma-separated list of CPU numbers and ranges, e.g. "0,2-3".
+ * @ncpus: output parameter.  Set to the number of CPUs in the list.
+ *
+ * Returns: a newly allocated array of CPU numbers that must be released with
+ * free(), or NULL if @str is not a valid list.
+ */
+int * cam_thread_parse_cpu_list (const char *str, int *ncpus);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
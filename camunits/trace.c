@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "trace.h"
+
+#define err(args...) fprintf (stderr, args)
+
+typedef struct _trace_event_t {
+    const char *category;
+    const char *name;
+    int64_t ts;
+    int64_t dur;
+    int64_t frame_timestamp;
+    char phase;
+} trace_event_t;
+
+/* The events of one thread.  Only the owning thread writes to it.  head is
+ * the number of events ever recorded, and is published with an atomic store
+ * after each event is written, so a reader can tell which slots may have
+ * been overwritten while it was copying them. */
+typedef struct _trace_buffer_t {
+    int tid;
+    const char *thread_name;
+    int head;
+    trace_event_t events[CAM_TRACE_EVENTS_PER_THREAD];
+} trace_buffer_t;
+
+static volatile int trace_enabled = 0;
+
+static GStaticPrivate thread_buffer = G_STATIC_PRIVATE_INIT;
+
+// names are kept separately from buffers, so that threads can be named
+// before tracing starts without allocating a buffer
+static GStaticPrivate thread_name = G_STATIC_PRIVATE_INIT;
+
+// every buffer ever created.  Buffers outlive their threads, so that the
+// events of threads that have exited are still written.
+G_LOCK_DEFINE_STATIC (buffers);
+static GList *buffers = NULL;
+static int next_tid = 1;
+
+static char *exit_filename = NULL;
+
+void
+cam_trace_start (void)
+{
+    if (!g_thread_supported ()) g_thread_init (NULL);
+    g_atomic_int_set (&trace_enabled, 1);
+}
+
+void
+cam_trace_stop (void)
+{
+    g_atomic_int_set (&trace_enabled, 0);
+}
+
+gboolean
+cam_trace_is_enabled (void)
+{
+    return trace_enabled;
+}
+
+int64_t
+cam_trace_now (void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    if (0 == clock_gettime (CLOCK_MONOTONIC, &ts))
+        return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static trace_buffer_t *
+get_thread_buffer (void)
+{
+    trace_buffer_t *buf = g_static_private_get (&thread_buffer);
+    if (buf)
+        return buf;
+
+    buf = (trace_buffer_t*) calloc (1, sizeof (trace_buffer_t));
+    if (!buf)
+        return NULL;
+    buf->thread_name = g_static_private_get (&thread_name);
+    G_LOCK (buffers);
+    buf->tid = next_tid++;
+    buffers = g_list_append (buffers, buf);
+    G_UNLOCK (buffers);
+    g_static_private_set (&thread_buffer, buf, NULL);
+    return buf;
+}
+
+void
+cam_trace_set_thread_name (const char *name)
+{
+    if (!g_thread_supported ()) g_thread_init (NULL);
+    const char *interned = g_intern_string (name);
+    g_static_private_set (&thread_name, (gpointer) interned, NULL);
+    trace_buffer_t *buf = g_static_private_get (&thread_buffer);
+    if (buf)
+        buf->thread_name = interned;
+}
+
+static void
+add_event (char phase, const char *category, const char *name,
+        int64_t ts, int64_t dur, int64_t frame_timestamp)
+{
+    trace_buffer_t *buf = get_thread_buffer ();
+    if (!buf)
+        return;
+    trace_event_t *ev =
+        &buf->events[buf->head % CAM_TRACE_EVENTS_PER_THREAD];
+    ev->category = category;
+    ev->name = name;
+    ev->ts = ts;
+    ev->dur = dur;
+    ev->frame_timestamp = frame_timestamp;
+    ev->phase = phase;
+    g_atomic_int_set (&buf->head, buf->head + 1);
+}
+
+void
+cam_trace_add_complete (const char *category, const char *name,
+        int64_t start, int64_t end, int64_t frame_timestamp)
+{
+    if (!trace_enabled)
+        return;
+    add_event ('X', category, name, start, end - start, frame_timestamp);
+}
+
+void
+cam_trace_add_instant (const char *category, const char *name,
+        int64_t frame_timestamp)
+{
+    if (!trace_enabled)
+        return;
+    add_event ('i', category, name, cam_trace_now (), 0, frame_timestamp);
+}
+
+static void
+write_json_string (FILE *fp, const char *str)
+{
+    fputc ('"', fp);
+    for (const char *c = str; *c; c++) {
+        if (*c == '"' || *c == '\\')
+            fprintf (fp, "\\%c", *c);
+        else if ((unsigned char) *c < 0x20)
+            fprintf (fp, "\\u%04x", *c);
+        else
+            fputc (*c, fp);
+    }
+    fputc ('"', fp);
+}
+
+static int
+write_buffer (FILE *fp, int pid, trace_buffer_t *buf, int first)
+{
+    if (buf->thread_name) {
+        fprintf (fp, "%s\n{\"ph\":\"M\",\"name\":\"thread_name\","
+                "\"pid\":%d,\"tid\":%d,\"args\":{\"name\":",
+                first ? "" : ",", pid, buf->tid);
+        write_json_string (fp, buf->thread_name);
+        fprintf (fp, "}}");
+        first = 0;
+    }
+
+    // copy the events out before formatting them, so that the window in
+    // which the owning thread can overwrite them is as short as possible
+    int head = g_atomic_int_get (&buf->head);
+    int n = MIN (head, CAM_TRACE_EVENTS_PER_THREAD);
+    trace_event_t *events = (trace_event_t*) malloc (n * sizeof (trace_event_t));
+    if (!events && n)
+        return first;
+    for (int i = 0; i < n; i++) {
+        int index = head - n + i;
+        events[i] = buf->events[index % CAM_TRACE_EVENTS_PER_THREAD];
+    }
+
+    // slots up to the one currently being written may have been overwritten
+    // while they were copied
+    int new_head = g_atomic_int_get (&buf->head);
+    int valid_from = new_head - CAM_TRACE_EVENTS_PER_THREAD + 1;
+
+    for (int i = 0; i < n; i++) {
+        int index = head - n + i;
+        if (index < valid_from)
+            continue;
+        trace_event_t *ev = &events[i];
+        fprintf (fp, "%s\n{\"ph\":\"%c\",\"cat\":\"%s\",\"name\":",
+                first ? "" : ",", ev->phase, ev->category);
+        write_json_string (fp, ev->name);
+        fprintf (fp, ",\"pid\":%d,\"tid\":%d,\"ts\":%"G_GINT64_FORMAT,
+                pid, buf->tid, ev->ts);
+        if (ev->phase == 'X')
+            fprintf (fp, ",\"dur\":%"G_GINT64_FORMAT, ev->dur);
+        else
+            fprintf (fp, ",\"s\":\"t\"");
+        if (ev->frame_timestamp)
+            fprintf (fp, ",\"args\":{\"frame\":%"G_GINT64_FORMAT"}",
+                    ev->frame_timestamp);
+        fputc ('}', fp);
+        first = 0;
+    }
+    free (events);
+    return first;
+}
+
+int
+cam_trace_write (const char *filename)
+{
+    FILE *fp = fopen (filename, "w");
+    if (!fp) {
+        perror ("Trace");
+        return -1;
+    }
+    int pid = getpid ();
+    fprintf (fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    G_LOCK (buffers);
+    int first = 1;
+    for (GList *biter = buffers; biter; biter = biter->next)
+        first = write_buffer (fp, pid, (trace_buffer_t*) biter->data, first);
+    G_UNLOCK (buffers);
+
+    fprintf (fp, "\n]}\n");
+    if (0 != fclose (fp)) {
+        perror ("Trace");
+        return -1;
+    }
+    return 0;
+}
+
+static void
+write_at_exit (void)
+{
+    cam_trace_stop ();
+    if (0 == cam_trace_write (exit_filename))
+        err ("Trace: wrote %s\n", exit_filename);
+}
+
+void
+cam_trace_write_on_exit (const char *filename)
+{
+    if (!exit_filename)
+        atexit (write_at_exit);
+    free (exit_filename);
+    exit_filename = strdup (filename);
+    cam_trace_start ();
+    cam_trace_set_thread_name ("main");
+}
@@ -0,0 +1,138 @@
+#ifndef __cam_trace_h__
+#define __cam_trace_h__
+
+#include <stdint.h>
+#include <glib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * SECTION:trace
+ * @short_description: Timeline of per-frame unit execution, for debugging
+ * latency.
+ *
+ * When tracing is enabled, every unit records when it started and finished
+ * processing each frame, and on which thread.  The chain records each frame
+ * it captures from an input unit, and the worker threads of the
+ * #CamThreadPool record the bands that they process.  Processing done
+ * synchronously inside a frame-ready signal nests inside the event of the
+ * unit that emitted it, so the timeline of a capture shows the whole
+ * downstream chain under it.
+ *
+ * Each thread records into its own fixed-size ring of events without taking
+ * any locks, so tracing can be left on for long runs.  Only the most recent
+ * #CAM_TRACE_EVENTS_PER_THREAD events of each thread are kept.
+ * cam_trace_write() dumps the events in the Chrome trace event JSON format,
+ * which can be loaded into chrome://tracing or the Perfetto UI.
+ *
+ * When tracing is disabled, which is the default, each instrumented point
+ * costs a single test of a global flag.
+ *
+ * To observe processes that were not started with tracing enabled,
+ * configure camunits with --enable-usdt.  This compiles static tracepoints
+ * into the same places, which bpftrace or SystemTap can attach to at any
+ * time.  Example bpftrace scripts are in tools/bpftrace.
+ */
+
+/**
+ * CAM_TRACE_EVENTS_PER_THREAD:
+ *
+ * The number of events kept for each thread.
+ */
+#define CAM_TRACE_EVENTS_PER_THREAD 65536
+
+/**
+ * cam_trace_start:
+ *
+ * Starts recording events.
+ */
+void cam_trace_start (void);
+
+/**
+ * cam_trace_stop:
+ *
+ * Stops recording events.  Events already recorded are kept, and can still
+ * be written with cam_trace_write().
+ */
+void cam_trace_stop (void);
+
+/**
+ * cam_trace_is_enabled:
+ *
+ * Returns: TRUE if events are being recorded.
+ */
+gboolean cam_trace_is_enabled (void);
+
+/**
+ * cam_trace_now:
+ *
+ * Returns: the current time, in microseconds, on the clock used for trace
+ * events.
+ */
+int64_t cam_trace_now (void);
+
+/**
+ * cam_trace_set_thread_name:
+ * @name: a name for the calling thread, e.g. "input [convert.colorspace]".
+ *
+ * Names the calling thread in the trace.  This may be called before tracing
+ * starts.
+ */
+void cam_trace_set_thread_name (const char *name);
+
+/**
+ * cam_trace_add_complete:
+ * @category: the event category, e.g. "unit".  Must be a static string.
+ * @name: the event name, usually a unit id.  Must be a static string, or
+ *        one returned by g_intern_string(), since events refer to it until
+ *        they are written.
+ * @start: the time the event started, from cam_trace_now().
+ * @end: the time the event finished, from cam_trace_now().
+ * @frame_timestamp: the timestamp of the frame being processed, or 0.
+ *
+ * Records an event with a duration on the calling thread.  Does nothing if
+ * tracing is disabled.
+ */
+void cam_trace_add_complete (const char *category, const char *name,
+        int64_t start, int64_t end, int64_t frame_timestamp);
+
+/**
+ * cam_trace_add_instant:
+ * @category: the event category.  Must be a static string.
+ * @name: the event name.  Must be static or interned, as for
+ *        cam_trace_add_complete().
+ * @frame_timestamp: the timestamp of the frame involved, or 0.
+ *
+ * Records an instantaneous event, e.g. a dropped frame, on the calling
+ * thread.  Does nothing if tracing is disabled.
+ */
+void cam_trace_add_instant (const char *category, const char *name,
+        int64_t frame_timestamp);
+
+/**
+ * cam_trace_write:
+ * @filename: the file to write.
+ *
+ * Writes all recorded events to @filename in the Chrome trace event JSON
+ * format.  This may be called while other threads are recording.
+ *
+ * Returns: 0 on success, -1 on failure.
+ */
+int cam_trace_write (const char *filename);
+
+/**
+ * cam_trace_write_on_exit:
+ * @filename: the file to write.
+ *
+ * Starts recording events, and arranges for them to be written to @filename
+ * when the process exits normally.
+ */
+void cam_trace_write_on_exit (const char *filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
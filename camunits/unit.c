@@ -7,6 +7,8 @@
 
 #include "camunits-gmarshal.h"
 #include "unit.h"
+#include "trace.h"
+#include "probes.h"
 
 #include "dbg.h"
 
@@ -14,6 +16,10 @@
 
 #define DEFAULT_NBUFFERS 60
 
+// maximum number of frames that may be waiting for a threaded unit before
+// new frames are dropped
+#define MAX_THREADED_INPUT_FRAMES 4
+
 enum {
     CONTROL_VALUE_CHANGED_SIGNAL,
     CONTROL_PARAMETERS_CHANGED_SIGNAL,
@@ -54,7 +60,36 @@ struct _CamUnitPriv {
     int requested_width;
     int requested_height;
     char * requested_format_name;
+
+    // threaded input dispatch.  When input_thread is non-NULL, frames from
+    // the input unit are queued on input_q and processed by input_thread.
+    // input_mutex is held while input_thread processes a frame, which
+    // includes all processing done by units downstream of this one.
+    GAsyncQueue *input_q;
+    GThread *input_thread;
+    GStaticRecMutex input_mutex;
+
+    // CPU affinity and scheduling of input_thread.  Protected by
+    // sched_mutex.  input_thread applies them whenever sched_serial differs
+    // from the serial it last applied.
+    GMutex *sched_mutex;
+    int *sched_cpus;
+    int sched_ncpus;
+    CamThreadSchedPolicy sched_policy;
+    int sched_priority;
+    int sched_serial;
+
+    // the unit id, interned for use as a trace event name
+    const char *trace_name;
+};
+
+typedef struct _ThreadedInputMsg ThreadedInputMsg;
+struct _ThreadedInputMsg {
+    CamFrameBuffer *buf;
+    CamUnitFormat *fmt;
 };
+
+static int INPUT_THREAD_QUIT_REQUEST = 0;
 #define CAM_UNIT_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), CAM_TYPE_UNIT, CamUnitPriv))
 
 static guint cam_unit_signals[LAST_SIGNAL] = { 0 };
@@ -76,6 +111,7 @@ static void on_input_unit_status_changed (CamUnit *input_unit, void *user_data);
 static void on_input_frame_ready (CamUnit *input_unit, 
         const CamFrameBuffer *buf, const CamUnitFormat *infmt, 
         void *user_data);
+static void stop_input_thread (CamUnit *self);
 
 G_DEFINE_TYPE (CamUnit, cam_unit, G_TYPE_INITIALLY_UNOWNED);
 
@@ -107,6 +143,19 @@ cam_unit_init (CamUnit *self)
     priv->requested_width = 0;
     priv->requested_height = 0;
     priv->requested_format_name = NULL;
+
+    priv->input_q = NULL;
+    priv->input_thread = NULL;
+    g_static_rec_mutex_init (&priv->input_mutex);
+
+    priv->sched_mutex = NULL;
+    priv->sched_cpus = NULL;
+    priv->sched_ncpus = 0;
+    priv->sched_policy = CAM_THREAD_SCHED_OTHER;
+    priv->sched_priority = 0;
+    priv->sched_serial = 0;
+
+    priv->trace_name = "unit";
 }
 
 static void
@@ -116,6 +165,12 @@ cam_unit_finalize (GObject *obj)
     CamUnitPriv *priv = CAM_UNIT_GET_PRIVATE(self);
     dbg(DBG_UNIT, "CamUnit finalize [%s]\n", priv->unit_id);
 
+    stop_input_thread (self);
+    g_static_rec_mutex_free (&priv->input_mutex);
+    if (priv->sched_mutex)
+        g_mutex_free (priv->sched_mutex);
+    free (priv->sched_cpus);
+
     if (priv->name) { free (priv->name); }
     if (priv->unit_id) { free (priv->unit_id); }
     if (priv->input_unit) { 
@@ -390,9 +445,203 @@ on_input_frame_ready (CamUnit *input_unit, const CamFrameBuffer *inbuf,
     CamUnit *self = CAM_UNIT (user_data);
     CamUnitPriv *priv = CAM_UNIT_GET_PRIVATE(self);
     CamUnitClass *klass = CAM_UNIT_GET_CLASS (self);
-    if (klass->on_input_frame_ready && priv->is_streaming) {
+    if (! klass->on_input_frame_ready || ! priv->is_streaming) return;
+
+    if (! priv->input_thread) {
+        int64_t start = cam_trace_is_enabled () ? cam_trace_now () : 0;
+        CAM_PROBE2 (unit_frame_begin, priv->unit_id, inbuf->timestamp);
         klass->on_input_frame_ready (self, inbuf, infmt);
+        CAM_PROBE2 (unit_frame_end, priv->unit_id, inbuf->timestamp);
+        if (start)
+            cam_trace_add_complete ("unit", priv->trace_name, start,
+                    cam_trace_now (), inbuf->timestamp);
+        return;
     }
+
+    if (g_async_queue_length (priv->input_q) >= MAX_THREADED_INPUT_FRAMES) {
+        dbg (DBG_UNIT, "[%s] input thread is behind, dropping frame\n",
+                priv->unit_id);
+        cam_trace_add_instant ("drop", priv->trace_name, inbuf->timestamp);
+        CAM_PROBE2 (unit_frame_drop, priv->unit_id, inbuf->timestamp);
+        return;
+    }
+
+    // Buffers that own their data are shared with the input thread by
+    // reference.  Buffers that wrap memory owned by someone else (e.g. a
+    // driver's DMA buffer) are only valid for the duration of this call, so
+    // those are copied.
+    ThreadedInputMsg *msg = (ThreadedInputMsg*) malloc (sizeof (*msg));
+    if (inbuf->owns_data) {
+        msg->buf = CAM_FRAMEBUFFER (g_object_ref ((CamFrameBuffer*) inbuf));
+    } else {
+        msg->buf = cam_framebuffer_new_alloc (inbuf->bytesused);
+        memcpy (msg->buf->data, inbuf->data, inbuf->bytesused);
+        msg->buf->bytesused = inbuf->bytesused;
+        cam_framebuffer_copy_metadata (msg->buf, inbuf);
+    }
+    msg->fmt = CAM_UNIT_FORMAT (g_object_ref ((CamUnitFormat*) infmt));
+    g_async_queue_push (priv->input_q, msg);
+}
+
+static void
+apply_input_thread_scheduling (CamUnit *self, int *applied_serial)
+{
+    CamUnitPriv *priv = CAM_UNIT_GET_PRIVATE(self);
+    g_mutex_lock (priv->sched_mutex);
+    *applied_serial = priv->sched_serial;
+    if (0 != cam_thread_set_affinity (priv->sched_cpus, priv->sched_ncpus))
+        err ("Unit: [%s] unable to set input thread CPU affinity\n",
+                priv->unit_id);
+    if (0 != cam_thread_set_scheduling (priv->sched_policy,
+                priv->sched_priority))
+        err ("Unit: [%s] unable to set input thread scheduling policy %s\n",
+                priv->unit_id,
+                cam_thread_sched_policy_to_string (priv->sched_policy));
+    g_mutex_unlock (priv->sched_mutex);
+}
+
+static void *
+input_thread (void *user_data)
+{
+    CamUnit *self = CAM_UNIT (user_data);
+    CamUnitPriv *priv = CAM_UNIT_GET_PRIVATE(self);
+    CamUnitClass *klass = CAM_UNIT_GET_CLASS (self);
+    dbg (DBG_UNIT, "[%s] input thread started\n", priv->unit_id);
+    char *thread_name = g_strdup_printf ("input [%s]", priv->unit_id);
+    cam_trace_set_thread_name (thread_name);
+    g_free (thread_name);
+
+    // a new thread has the default scheduling, so only non-default settings
+    // need to be applied
+    int applied_serial = 0;
+
+    while (1) {
+        void *m = g_async_queue_pop (priv->input_q);
+        if (m == &INPUT_THREAD_QUIT_REQUEST) break;
+
+        if (g_atomic_int_get (&priv->sched_serial) != applied_serial)
+            apply_input_thread_scheduling (self, &applied_serial);
+
+        ThreadedInputMsg *msg = (ThreadedInputMsg*) m;
+        g_static_rec_mutex_lock (&priv->input_mutex);
+        if (priv->is_streaming) {
+            int64_t start = cam_trace_is_enabled () ? cam_trace_now () : 0;
+            CAM_PROBE2 (unit_frame_begin, priv->unit_id,
+                    msg->buf->timestamp);
+            klass->on_input_frame_ready (self, msg->buf, msg->fmt);
+            CAM_PROBE2 (unit_frame_end, priv->unit_id, msg->buf->timestamp);
+            if (start)
+                cam_trace_add_complete ("unit", priv->trace_name, start,
+                        cam_trace_now (), msg->buf->timestamp);
+        }
+        g_static_rec_mutex_unlock (&priv->input_mutex);
+        g_object_unref (msg->buf);
+        g_object_unref (msg->fmt);
+        free (msg);
+    }
+
+    dbg (DBG_UNIT, "[%s] input thread exiting\n", priv->unit_id);
+    return NULL;
+}
+
+static void
+stop_input_thread (CamUnit *self)
+{
+    CamUnitPriv *priv = CAM_UNIT_GET_PRIVATE(self);
+    if (! priv->input_thread) return;
+
+    g_async_queue_push (priv->input_q, &INPUT_THREAD_QUIT_REQUEST);
+    g_thread_join (priv->input_thread);
+    priv->input_thread = NULL;
+
+    // discard any frames that were never processed
+    ThreadedInputMsg *msg;
+    while ((msg = g_async_queue_try_pop (priv->input_q))) {
+        g_object_unref (msg->buf);
+        g_object_unref (msg->fmt);
+        free (msg);
+    }
+    g_async_queue_unref (priv->input_q);
+    priv->input_q = NULL;
+}
+
+int
+cam_unit_set_threaded_input (CamUnit *self, gboolean threaded)
+{
+    CamUnitPriv *priv = CAM_UNIT_GET_PRIVATE(self);
+    if (threaded == (priv->input_thread != NULL)) return 0;
+
+    if (! threaded) {
+        dbg (DBG_UNIT, "[%s] disabling threaded input\n", priv->unit_id);
+        stop_input_thread (self);
+        return 0;
+    }
+
+    if (priv->flags & CAM_UNIT_RENDERS_GL) {
+        err ("Unit: [%s] renders OpenGL and cannot use threaded input\n",
+                priv->unit_id);
+        return -1;
+    }
+
+    dbg (DBG_UNIT, "[%s] enabling threaded input\n", priv->unit_id);
+    if (!g_thread_supported ()) g_thread_init (NULL);
+    if (!priv->sched_mutex)
+        priv->sched_mutex = g_mutex_new ();
+    priv->input_q = g_async_queue_new ();
+    priv->input_thread = g_thread_create (input_thread, self, TRUE, NULL);
+    if (! priv->input_thread) {
+        err ("Unit: [%s] unable to create input thread\n", priv->unit_id);
+        g_async_queue_unref (priv->input_q);
+        priv->input_q = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+gboolean
+cam_unit_get_threaded_input (const CamUnit *self)
+{
+    CamUnitPriv *priv = CAM_UNIT_GET_PRIVATE(self);
+    return priv->input_thread != NULL;
+}
+
+void
+cam_unit_set_input_thread_scheduling (CamUnit *self, const int *cpus,
+        int ncpus, CamThreadSchedPolicy policy, int priority)
+{
+    CamUnitPriv *priv = CAM_UNIT_GET_PRIVATE(self);
+    if (!g_thread_supported ()) g_thread_init (NULL);
+    if (!priv->sched_mutex)
+        priv->sched_mutex = g_mutex_new ();
+
+    g_mutex_lock (priv->sched_mutex);
+    free (priv->sched_cpus);
+    priv->sched_cpus = NULL;
+    priv->sched_ncpus = 0;
+    if (cpus && ncpus > 0) {
+        priv->sched_cpus = (int*) malloc (ncpus * sizeof (int));
+        memcpy (priv->sched_cpus, cpus, ncpus * sizeof (int));
+        priv->sched_ncpus = ncpus;
+    }
+    priv->sched_policy = policy;
+    priv->sched_priority = priority;
+    g_atomic_int_inc (&priv->sched_serial);
+    g_mutex_unlock (priv->sched_mutex);
+}
+
+/*
+ * Returns the input mutex of the nearest unit at or upstream of self that
+ * processes its input in a separate thread, or NULL if there is none.  That
+ * mutex must be held while self changes its streaming state.
+ */
+static GStaticRecMutex *
+get_threaded_input_mutex (CamUnit *self)
+{
+    for (CamUnit *unit=self; unit; unit=cam_unit_get_input (unit)) {
+        CamUnitPriv *priv = CAM_UNIT_GET_PRIVATE(unit);
+        if (priv->input_thread) return &priv->input_mutex;
+    }
+    return NULL;
 }
 
 static CamUnitFormat *
@@ -457,7 +706,12 @@ cam_unit_stream_init (CamUnit * self, const CamUnitFormat *format)
     dbg(DBG_UNIT, "[%s] default stream init [%s]\n",
             priv->unit_id, priv->fmt->name);
 
-    if (0 == CAM_UNIT_GET_CLASS (self)->stream_init (self, format)) {
+    GStaticRecMutex *mutex = get_threaded_input_mutex (self);
+    if (mutex) g_static_rec_mutex_lock (mutex);
+    int status = CAM_UNIT_GET_CLASS (self)->stream_init (self, format);
+    if (mutex) g_static_rec_mutex_unlock (mutex);
+
+    if (0 == status) {
         cam_unit_set_is_streaming (self, TRUE);
         return 0;
     } else {
@@ -470,9 +724,23 @@ cam_unit_stream_shutdown (CamUnit * self)
 { 
     CamUnitPriv *priv = CAM_UNIT_GET_PRIVATE(self);
     if (! priv->is_streaming) return 0;
-    if (0 == CAM_UNIT_GET_CLASS (self)->stream_shutdown (self)) {
-        cam_unit_set_is_streaming (self, FALSE);
+
+    // hold the input mutex so that an input thread can't be processing a
+    // frame while the unit releases its resources.  is_streaming is cleared
+    // before the mutex is released so that no frames are processed after
+    // shutdown.  The status-changed signal is emitted afterwards.
+    GStaticRecMutex *mutex = get_threaded_input_mutex (self);
+    if (mutex) g_static_rec_mutex_lock (mutex);
+    int status = CAM_UNIT_GET_CLASS (self)->stream_shutdown (self);
+    if (0 == status) {
+        priv->is_streaming = FALSE;
         priv->fmt = NULL;
+    }
+    if (mutex) g_static_rec_mutex_unlock (mutex);
+
+    if (0 == status) {
+        g_signal_emit (G_OBJECT(self),
+                cam_unit_signals[STATUS_CHANGED_SIGNAL], 0);
         return 0;
     } else {
         return -1;
@@ -630,6 +898,7 @@ cam_unit_set_id (CamUnit *self, const char *unit_id)
     CamUnitPriv *priv = CAM_UNIT_GET_PRIVATE(self);
     free (priv->unit_id);
     priv->unit_id = strdup (unit_id);
+    priv->trace_name = g_intern_string (unit_id);
 }
 
 /*
@@ -897,6 +1166,8 @@ cam_unit_produce_frame (CamUnit *self, const CamFrameBuffer *buffer,
             __last_warn_utime = now;
         }
     }
+    CAM_PROBE3 (unit_produce_frame, priv->unit_id, buffer->timestamp,
+            buffer->bytesused);
     g_signal_emit (G_OBJECT (self),
             cam_unit_signals[FRAME_READY_SIGNAL], 0, buffer, fmt);
 }
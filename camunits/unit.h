@@ -9,6 +9,7 @@
 #include "pixels.h"
 
 #include "framebuffer.h"
+#include "thread_pool.h"
 #include "unit_format.h"
 #include "unit_control.h"
 
@@ -163,6 +164,55 @@ int cam_unit_set_input (CamUnit * self, CamUnit * input);
  */
 CamUnit * cam_unit_get_input (CamUnit *self);
 
+/**
+ * cam_unit_set_threaded_input:
+ * @threaded: TRUE to process input frames on a dedicated thread, FALSE to
+ *            process them in the thread that produced them (the default).
+ *
+ * Normally, a filter unit processes each frame synchronously, from within
+ * the frame-ready signal of its input unit.  When threaded input is enabled,
+ * incoming frames are instead queued and processed by a worker thread owned
+ * by the unit, so that the unit, and every unit fed by it, runs in parallel
+ * with its input unit.  This is typically used to run several branches of a
+ * #CamUnitChain concurrently.
+ *
+ * Frame buffers that own their data are handed to the worker thread by
+ * reference, and are not copied.  Frame buffers that wrap memory owned
+ * elsewhere (see cam_framebuffer_new()) are copied once.  A unit that
+ * recycles its output buffer should allocate a new one whenever the
+ * previous buffer is still referenced.  If the worker thread falls behind by
+ * more than a few frames, new frames are dropped.
+ *
+ * Units that render with OpenGL can not use threaded input.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+int cam_unit_set_threaded_input (CamUnit *self, gboolean threaded);
+
+/**
+ * cam_unit_get_threaded_input:
+ *
+ * Returns: TRUE if the unit processes input frames on its own thread.
+ */
+gboolean cam_unit_get_threaded_input (const CamUnit *self);
+
+/**
+ * cam_unit_set_input_thread_scheduling:
+ * @cpus: the CPUs that the input thread may run on, or NULL for any CPU.
+ * @ncpus: the number of entries in @cpus.
+ * @policy: the scheduling policy of the input thread.
+ * @priority: the priority of the input thread.  See
+ *            cam_thread_set_scheduling().
+ *
+ * Sets the CPU affinity and scheduling policy of the thread used for
+ * threaded input (see cam_unit_set_threaded_input()).  The settings take
+ * effect before the next frame is processed, and are kept if threaded input
+ * is disabled and enabled again.  #CamUnitChain calls this for all of its
+ * units when its own scheduling options change.
+ */
+void cam_unit_set_input_thread_scheduling (CamUnit *self, const int *cpus,
+        int ncpus, CamThreadSchedPolicy policy, int priority);
+
 gboolean cam_unit_is_streaming (const CamUnit * self);
 
 uint32_t cam_unit_get_flags (const CamUnit *self);
@@ -3,11 +3,15 @@
 #include <string.h>
 #include <inttypes.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include <glib-object.h>
 
 #include "camunits-gmarshal.h"
 #include "unit_chain.h"
+#include "trace.h"
+#include "probes.h"
 #include "dbg.h"
 
 #define err(args...) fprintf (stderr, args)
@@ -29,6 +33,13 @@ struct _CamUnitChain {
 
     GList *units;
 
+    /*
+     * Maps a unit to its input unit, for units that do not take their input
+     * from the unit immediately preceding them (i.e. branches).  Neither keys
+     * nor values hold a reference; both are always members of units.
+     */
+    GHashTable *branch_inputs;
+
     /*
      * link within units that points to the next unit in the chain ready to 
      * generate frames.
@@ -36,6 +47,18 @@ struct _CamUnitChain {
     GList *pending_unit_link;
 
     gboolean streaming_desired;
+
+    // CPU affinity and scheduling of the threads that run the chain.
+    // sched_serial is incremented whenever they change, and the dispatching
+    // thread applies them when applied_sched_serial falls behind.
+    int *cpus;
+    int ncpus;
+    CamThreadSchedPolicy sched_policy;
+    int sched_priority;
+    int sched_serial;
+    int applied_sched_serial;
+
+    gboolean mlocked;
 };
 
 struct _CamUnitChainClass {
@@ -58,6 +81,7 @@ static void cam_unit_chain_finalize (GObject *obj);
 static gboolean update_unit_status (CamUnitChain *self, CamUnit *unit,
        gboolean streaming_desired);
 static CamUnit * update_unit_statuses (CamUnitChain *self);
+static void relink_units (CamUnitChain *self);
 
 static gboolean cam_unit_chain_source_prepare (GSource *source, gint *timeout);
 static gboolean cam_unit_chain_source_check (GSource *source);
@@ -74,12 +98,21 @@ cam_unit_chain_init (CamUnitChain *self)
     dbg (DBG_CHAIN, "constructor\n");
     self->manager = NULL;
     self->units = NULL;
+    self->branch_inputs = g_hash_table_new (g_direct_hash, g_direct_equal);
     self->source_funcs.prepare  = cam_unit_chain_source_prepare;
     self->source_funcs.check    = cam_unit_chain_source_check;
     self->source_funcs.dispatch = cam_unit_chain_source_dispatch;
     self->source_funcs.finalize = cam_unit_chain_source_finalize;
     self->streaming_desired = FALSE;
 
+    self->cpus = NULL;
+    self->ncpus = 0;
+    self->sched_policy = CAM_THREAD_SCHED_OTHER;
+    self->sched_priority = 0;
+    self->sched_serial = 0;
+    self->applied_sched_serial = 0;
+    self->mlocked = FALSE;
+
     self->event_source = (CamUnitChainSource*) g_source_new (
             &self->source_funcs, sizeof (CamUnitChainSource));
     self->event_source->chain = self;
@@ -184,6 +217,10 @@ cam_unit_chain_finalize (GObject *obj)
         g_object_unref (unit);
     }
     g_list_free (self->units);
+    g_hash_table_destroy (self->branch_inputs);
+    free (self->cpus);
+    if (self->mlocked)
+        cam_unit_chain_set_mlock (self, FALSE);
 
     // unref the CamUnitManager
     if (self->manager) {
@@ -236,6 +273,10 @@ cam_unit_chain_insert_unit (CamUnitChain *self, CamUnit *unit,
     dbgl (DBG_REF, "ref_sink unit [%s]\n", cam_unit_get_id (unit));
     g_object_ref_sink (unit);
 
+    if (self->sched_serial)
+        cam_unit_set_input_thread_scheduling (unit, self->cpus, self->ncpus,
+                self->sched_policy, self->sched_priority);
+
     GList *link = g_list_nth (self->units, position);
     assert (link->data == unit);
 
@@ -256,14 +297,11 @@ cam_unit_chain_insert_unit (CamUnitChain *self, CamUnit *unit,
         update_unit_status (self, unit, self->streaming_desired);
     }
 
-    // if the new unit comes before the end of the chain, then set the next
-    // unit's input
-    if (link->next) {
-        CamUnit *next_unit = (CamUnit*) link->next->data;
-        update_unit_status (self, next_unit, FALSE);
-        cam_unit_set_input (next_unit, unit);
-        update_unit_status (self, next_unit, self->streaming_desired);
-    } else {
+    // if the new unit comes before the end of the chain, then the unit after
+    // it (unless it's a branch) now takes its input from the new unit
+    relink_units (self);
+
+    if (! link->next) {
         // if the new unit is the last unit in the chain, then subscribe to its
         // frame-ready event and unsubscribe to the previous last unit's event.
         if (link->prev) {
@@ -317,22 +355,36 @@ cam_unit_chain_remove_unit (CamUnitChain *self, CamUnit *unit)
 
     CamUnit *prev = link->prev ? CAM_UNIT (link->prev->data) : NULL;
     CamUnit *next = link->next ? CAM_UNIT (link->next->data) : NULL;
+    CamUnit *input = cam_unit_get_input (unit);
+
+    // branches fed by the unit being removed are fed by its input instead
+    for (GList *uiter=link->next; uiter; uiter=uiter->next) {
+        if (g_hash_table_lookup (self->branch_inputs, uiter->data) != unit)
+            continue;
+        if (input)
+            g_hash_table_insert (self->branch_inputs, uiter->data, input);
+        else
+            g_hash_table_remove (self->branch_inputs, uiter->data);
+    }
+    g_hash_table_remove (self->branch_inputs, unit);
 
+    g_signal_handlers_disconnect_by_func (unit, on_last_unit_frame_ready, self);
     update_unit_status (self, unit, FALSE);
     cam_unit_set_input (unit, NULL);
 
     self->units = g_list_delete_link (self->units, link);
     g_signal_handlers_disconnect_by_func (unit, on_unit_status_changed, self);
+    if (self->sched_serial)
+        cam_unit_set_input_thread_scheduling (unit, NULL, 0,
+                CAM_THREAD_SCHED_OTHER, 0);
     g_signal_emit (G_OBJECT (self), chain_signals[UNIT_REMOVED_SIGNAL],
             0, unit);
     dbgl (DBG_REF, "unref unit [%s]\n", cam_unit_get_id (unit));
     g_object_unref (unit);
 
-    if (next) {
-        update_unit_status (self, next, FALSE);
-        cam_unit_set_input (next, prev);
-        update_unit_status (self, next, self->streaming_desired);
-    } else if (prev) {
+    relink_units (self);
+
+    if (! next && prev) {
         // if this unit was the last in the chain, and it has a predecessor,
         // then subscribe to its predecessor's frame-ready signal
         g_signal_connect (G_OBJECT (prev), "frame-ready",
@@ -406,35 +458,19 @@ cam_unit_chain_reorder_unit (CamUnitChain *self, CamUnit *unit,
         new_index < 0 || 
         new_index >= g_list_length (self->units)) return -1;
 
-    GList *oldlink = g_list_nth (self->units, old_index);
-    if (oldlink->next) {
-        CamUnit *oldnext = CAM_UNIT (oldlink->next->data);
-        CamUnit *oldprev = oldlink->prev ? 
-            CAM_UNIT (oldlink->prev->data) : 
-            NULL;
-        update_unit_status (self, oldnext, FALSE);
-        cam_unit_set_input (oldnext, oldprev);
-        update_unit_status (self, oldnext, self->streaming_desired);
-    }
+    CamUnit *old_last = cam_unit_chain_get_last_unit (self);
 
     self->units = g_list_remove (self->units, unit);
-
     self->units = g_list_insert (self->units, unit, new_index);
-    GList *link = g_list_nth (self->units, new_index);
 
-    update_unit_status (self, unit, FALSE);
-    if (link->prev) {
-        CamUnit *prev_unit = CAM_UNIT (link->prev->data);
-        cam_unit_set_input (unit, prev_unit);
-    } else {
-        cam_unit_set_input (unit, NULL);
-    }
-    update_unit_status (self, unit, self->streaming_desired);
-    if (link->next) {
-        CamUnit *next_unit = CAM_UNIT (link->next->data);
-        update_unit_status (self, next_unit, FALSE);
-        cam_unit_set_input (next_unit, unit);
-        update_unit_status (self, next_unit, self->streaming_desired);
+    relink_units (self);
+
+    CamUnit *new_last = cam_unit_chain_get_last_unit (self);
+    if (new_last != old_last) {
+        g_signal_handlers_disconnect_by_func (old_last, 
+                on_last_unit_frame_ready, self);
+        g_signal_connect (G_OBJECT (new_last), "frame-ready",
+                G_CALLBACK (on_last_unit_frame_ready), self);
     }
 
     g_signal_emit (G_OBJECT (self), chain_signals[UNIT_REORDERED_SIGNAL],
@@ -443,6 +479,81 @@ cam_unit_chain_reorder_unit (CamUnitChain *self, CamUnit *unit,
     return 0;
 }
 
+static int
+_unit_precedes (GList *link, const CamUnit *unit)
+{
+    for (GList *uiter=link->prev; uiter; uiter=uiter->prev) {
+        if (uiter->data == unit) return 1;
+    }
+    return 0;
+}
+
+static CamUnit *
+_get_desired_input (CamUnitChain *self, GList *link)
+{
+    CamUnit *input = g_hash_table_lookup (self->branch_inputs, link->data);
+    if (input) return input;
+    return link->prev ? CAM_UNIT (link->prev->data) : NULL;
+}
+
+/*
+ * Makes sure that every unit in the chain is connected to the correct input
+ * unit, restarting those units whose input has changed.  Branch inputs that
+ * no longer precede their unit (e.g. after a reorder) are discarded.
+ */
+static void
+relink_units (CamUnitChain *self)
+{
+    for (GList *uiter=self->units; uiter; uiter=uiter->next) {
+        CamUnit *unit = CAM_UNIT (uiter->data);
+        CamUnit *branch_input = 
+            g_hash_table_lookup (self->branch_inputs, unit);
+        if (branch_input && ! _unit_precedes (uiter, branch_input)) {
+            dbg (DBG_CHAIN, "[%s] no longer follows [%s], dropping branch\n",
+                    cam_unit_get_id (unit), cam_unit_get_id (branch_input));
+            g_hash_table_remove (self->branch_inputs, unit);
+        }
+
+        CamUnit *input = _get_desired_input (self, uiter);
+        if (cam_unit_get_input (unit) == input) 
+            continue;
+        update_unit_status (self, unit, FALSE);
+        cam_unit_set_input (unit, input);
+        update_unit_status (self, unit, self->streaming_desired);
+    }
+}
+
+int
+cam_unit_chain_set_unit_input (CamUnitChain *self, CamUnit *unit, 
+        CamUnit *input)
+{
+    GList *link = g_list_find (self->units, unit);
+    if (! link) return -1;
+
+    if (input && ! _unit_precedes (link, input)) {
+        dbg (DBG_CHAIN, "[%s] can't take input from [%s]\n",
+                cam_unit_get_id (unit), cam_unit_get_id (input));
+        return -1;
+    }
+
+    dbg (DBG_CHAIN, "setting input of [%s] to [%s]\n",
+            cam_unit_get_id (unit), input ? cam_unit_get_id (input) : "NULL");
+
+    if (! input || (link->prev && link->prev->data == input)) {
+        g_hash_table_remove (self->branch_inputs, unit);
+    } else {
+        g_hash_table_insert (self->branch_inputs, unit, input);
+    }
+    relink_units (self);
+    return 0;
+}
+
+gboolean
+cam_unit_chain_unit_is_branch (const CamUnitChain *self, const CamUnit *unit)
+{
+    return NULL != g_hash_table_lookup (self->branch_inputs, unit);
+}
+
 CamUnit * 
 cam_unit_chain_all_units_stream_init (CamUnitChain *self) 
 {
@@ -579,6 +690,126 @@ cam_unit_chain_source_check (GSource *source)
     return FALSE;
 }
 
+/* Applies the chain's scheduling options to the calling thread, which is the
+ * thread that dispatches the chain. */
+static void
+apply_scheduling (CamUnitChain *self)
+{
+    self->applied_sched_serial = self->sched_serial;
+    if (0 != cam_thread_set_affinity (self->cpus, self->ncpus))
+        err ("Chain: unable to set CPU affinity\n");
+    if (0 != cam_thread_set_scheduling (self->sched_policy,
+                self->sched_priority))
+        err ("Chain: unable to set scheduling policy %s, priority %d\n",
+                cam_thread_sched_policy_to_string (self->sched_policy),
+                self->sched_priority);
+}
+
+static void
+update_units_scheduling (CamUnitChain *self)
+{
+    self->sched_serial++;
+    for (GList *uiter=self->units; uiter; uiter=uiter->next) {
+        cam_unit_set_input_thread_scheduling (CAM_UNIT (uiter->data),
+                self->cpus, self->ncpus, self->sched_policy,
+                self->sched_priority);
+    }
+}
+
+int
+cam_unit_chain_set_cpu_affinity (CamUnitChain *self, const int *cpus,
+        int ncpus)
+{
+    if (!cpus)
+        ncpus = 0;
+    long ncpus_conf = sysconf (_SC_NPROCESSORS_CONF);
+    for (int i=0; i<ncpus; i++) {
+        if (cpus[i] < 0 || (ncpus_conf > 0 && cpus[i] >= ncpus_conf)) {
+            err ("Chain: invalid CPU %d\n", cpus[i]);
+            return -1;
+        }
+    }
+
+    free (self->cpus);
+    self->cpus = NULL;
+    self->ncpus = 0;
+    if (ncpus > 0) {
+        self->cpus = (int*) malloc (ncpus * sizeof (int));
+        memcpy (self->cpus, cpus, ncpus * sizeof (int));
+        self->ncpus = ncpus;
+    }
+    update_units_scheduling (self);
+    return 0;
+}
+
+const int *
+cam_unit_chain_get_cpu_affinity (const CamUnitChain *self, int *ncpus)
+{
+    *ncpus = self->ncpus;
+    return self->cpus;
+}
+
+int
+cam_unit_chain_set_scheduling (CamUnitChain *self,
+        CamThreadSchedPolicy policy, int priority)
+{
+    if (0 != cam_thread_check_priority (policy, priority)) {
+        err ("Chain: invalid priority %d for scheduling policy %s\n",
+                priority, cam_thread_sched_policy_to_string (policy));
+        return -1;
+    }
+    self->sched_policy = policy;
+    self->sched_priority = (policy == CAM_THREAD_SCHED_OTHER) ? 0 : priority;
+    update_units_scheduling (self);
+    return 0;
+}
+
+void
+cam_unit_chain_get_scheduling (const CamUnitChain *self,
+        CamThreadSchedPolicy *policy, int *priority)
+{
+    if (policy)
+        *policy = self->sched_policy;
+    if (priority)
+        *priority = self->sched_priority;
+}
+
+// memory locking applies to the whole process, so it is only undone when no
+// chain wants it any more
+static int mlock_count = 0;
+G_LOCK_DEFINE_STATIC (mlock_count);
+
+int
+cam_unit_chain_set_mlock (CamUnitChain *self, gboolean mlock)
+{
+    if (mlock == self->mlocked)
+        return 0;
+    int status = 0;
+    G_LOCK (mlock_count);
+    if (mlock) {
+        if (0 == mlock_count &&
+                0 != mlockall (MCL_CURRENT | MCL_FUTURE)) {
+            perror ("Chain: mlockall");
+            status = -1;
+        } else {
+            mlock_count++;
+        }
+    } else {
+        if (0 == --mlock_count)
+            munlockall ();
+    }
+    G_UNLOCK (mlock_count);
+    if (0 == status)
+        self->mlocked = mlock;
+    return status;
+}
+
+gboolean
+cam_unit_chain_get_mlock (const CamUnitChain *self)
+{
+    return self->mlocked;
+}
+
 static gboolean
 cam_unit_chain_source_dispatch (GSource *source, GSourceFunc callback, 
         void *user_data)
@@ -592,9 +823,20 @@ cam_unit_chain_source_dispatch (GSource *source, GSourceFunc callback,
         return FALSE;
     }
 
+    if (self->applied_sched_serial != self->sched_serial)
+        apply_scheduling (self);
+
     CamUnit *unit = CAM_UNIT (self->pending_unit_link->data);
-    if (cam_unit_is_streaming (unit))
+    if (cam_unit_is_streaming (unit)) {
+        int64_t start = cam_trace_is_enabled () ? cam_trace_now () : 0;
+        CAM_PROBE1 (chain_dispatch_begin, cam_unit_get_id (unit));
         cam_unit_try_produce_frame (unit, 0);
+        CAM_PROBE1 (chain_dispatch_end, cam_unit_get_id (unit));
+        if (start)
+            cam_trace_add_complete ("capture",
+                    g_intern_string (cam_unit_get_id (unit)), start,
+                    cam_trace_now (), 0);
+    }
     self->pending_unit_link = NULL;
 
     return TRUE;
@@ -694,7 +936,22 @@ cam_unit_chain_snapshot (const CamUnitChain *self)
     GString *result = 
         g_string_new ("<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n");
 
-    g_string_append (result, "<chain>\n");
+    g_string_append (result, "<chain");
+    if (self->ncpus) {
+        g_string_append (result, " cpus=\"");
+        for (int i=0; i<self->ncpus; i++)
+            g_string_append_printf (result, "%s%d", i ? "," : "",
+                    self->cpus[i]);
+        g_string_append (result, "\"");
+    }
+    if (self->sched_policy != CAM_THREAD_SCHED_OTHER) {
+        g_string_append_printf (result, " sched=\"%s\" priority=\"%d\"",
+                cam_thread_sched_policy_to_string (self->sched_policy),
+                self->sched_priority);
+    }
+    if (self->mlocked)
+        g_string_append (result, " mlock=\"1\"");
+    g_string_append (result, ">\n");
 
     // loop through all units and output their states
     for (GList *uiter=self->units; uiter; uiter=uiter->next) {
@@ -704,6 +961,17 @@ cam_unit_chain_snapshot (const CamUnitChain *self)
         g_string_append_printf (result, "    <unit id=\"%s\"", 
                 cam_unit_get_id (unit));
 
+        // branch input and threading
+        CamUnit *branch_input = 
+            g_hash_table_lookup (self->branch_inputs, unit);
+        if (branch_input) {
+            g_string_append_printf (result, " input=\"%d\"",
+                    g_list_index (self->units, branch_input));
+        }
+        if (cam_unit_get_threaded_input (unit)) {
+            g_string_append (result, " threaded=\"1\"");
+        }
+
         // output format?
         const CamUnitFormat *fmt = cam_unit_get_output_format (unit);
         if (fmt) {
@@ -781,6 +1049,63 @@ typedef struct {
     GQuark error_domain;
 } ChainParseContext;
 
+static void
+_parse_chain_attributes (ChainParseContext *cpc,
+        const char **attribute_names, const char **attribute_values,
+        GError **error)
+{
+    CamThreadSchedPolicy policy = cpc->chain->sched_policy;
+    int priority = cpc->chain->sched_priority;
+    int have_sched = 0;
+
+    for (int i=0; attribute_names[i]; i++) {
+        if (!strcmp (attribute_names[i], "cpus")) {
+            int ncpus = 0;
+            int *cpus = cam_thread_parse_cpu_list (attribute_values[i],
+                    &ncpus);
+            if (!cpus || 0 != cam_unit_chain_set_cpu_affinity (cpc->chain,
+                        cpus, ncpus)) {
+                *error = g_error_new (CAM_ERROR_DOMAIN, 0, 
+                        "Invalid CPU list [%s]", attribute_values[i]);
+                free (cpus);
+                return;
+            }
+            free (cpus);
+        } else if (!strcmp (attribute_names[i], "sched")) {
+            if (0 != cam_thread_sched_policy_from_string (
+                        attribute_values[i], &policy)) {
+                *error = g_error_new (CAM_ERROR_DOMAIN, 0, 
+                        "Unrecognized scheduling policy \"%s\"", 
+                        attribute_values[i]);
+                return;
+            }
+            have_sched = 1;
+        } else if (!strcmp (attribute_names[i], "priority")) {
+            char *e = NULL;
+            priority = strtol (attribute_values[i], &e, 10);
+            if (e == attribute_values[i]) {
+                *error = g_error_new (CAM_ERROR_DOMAIN, 0, 
+                        "Invalid priority [%s]", attribute_values[i]);
+                return;
+            }
+            have_sched = 1;
+        } else if (!strcmp (attribute_names[i], "mlock")) {
+            cam_unit_chain_set_mlock (cpc->chain, atoi (attribute_values[i]));
+        } else {
+            *error = g_error_new (CAM_ERROR_DOMAIN, 0, 
+                    "Unrecognized attribute \"%s\"", attribute_names[i]);
+            return;
+        }
+    }
+
+    if (have_sched &&
+        0 != cam_unit_chain_set_scheduling (cpc->chain, policy, priority)) {
+        *error = g_error_new (CAM_ERROR_DOMAIN, 0, 
+                "Invalid priority %d for scheduling policy %s", priority,
+                cam_thread_sched_policy_to_string (policy));
+    }
+}
+
 static void
 _start_element (GMarkupParseContext *ctx, const char *element_name,
         const char **attribute_names, const char **attribute_values,
@@ -791,6 +1116,8 @@ _start_element (GMarkupParseContext *ctx, const char *element_name,
     if (!strcmp (element_name, "chain")) {
         if (! cpc->in_chain) {
             cpc->in_chain = 1;
+            _parse_chain_attributes (cpc, attribute_names, attribute_values,
+                    error);
         } else {
             *error = g_error_new (CAM_ERROR_DOMAIN, 0, 
                     "Unexpected <chain> element");
@@ -815,6 +1142,8 @@ _start_element (GMarkupParseContext *ctx, const char *element_name,
         int height = -1;
         CamPixelFormat pfmt = CAM_PIXEL_FORMAT_ANY;
         char *fmt_name = NULL;
+        CamUnit *input = NULL;
+        int threaded = 0;
 
         for (int i=0; attribute_names[i]; i++) {
             if (!strcmp (attribute_names[i], "id")) {
@@ -852,6 +1181,19 @@ _start_element (GMarkupParseContext *ctx, const char *element_name,
                 pfmt = ev->value;
             } else if (!strcmp (attribute_names[i], "format_name")) {
                 fmt_name = g_strcompress(attribute_values[i]);
+            } else if (!strcmp (attribute_names[i], "input")) {
+                char *e = NULL;
+                int index = strtol (attribute_values[i], &e, 10);
+                if (e != attribute_values[i] && index >= 0)
+                    input = g_list_nth_data (cpc->chain->units, index);
+                if (! input) {
+                    *error = g_error_new (CAM_ERROR_DOMAIN, 0, 
+                            "Invalid unit input [%s]", attribute_values[i]);
+                    free(fmt_name);
+                    return;
+                }
+            } else if (!strcmp (attribute_names[i], "threaded")) {
+                threaded = atoi (attribute_values[i]);
             } else {
                 *error = g_error_new (CAM_ERROR_DOMAIN, 0, 
                         "Unrecognized attribute \"%s\"", attribute_names[i]);
@@ -878,6 +1220,10 @@ _start_element (GMarkupParseContext *ctx, const char *element_name,
                 fmt_name);
 
         cam_unit_chain_insert_unit_tail (cpc->chain, cpc->unit);
+        if (input)
+            cam_unit_chain_set_unit_input (cpc->chain, cpc->unit, input);
+        if (threaded)
+            cam_unit_set_threaded_input (cpc->unit, TRUE);
 
         free(fmt_name);
         return;
@@ -20,6 +20,26 @@ extern "C" {
  * The CamUnitChain handles the tedium of connecting units together,
  * consolidating their file descriptors and timers (for input units) and
  * attaching the units to a GMainLoop.
+ *
+ * By default, each unit in the chain takes its input from the unit
+ * immediately before it.  A unit can instead take its input from any earlier
+ * unit (see cam_unit_chain_set_unit_input()), which starts a new branch.
+ * Several units can be fed by the same unit, all of which receive the same
+ * #CamFrameBuffer objects.  Combined with cam_unit_set_threaded_input(), this
+ * allows a single input unit to feed several branches that run in parallel,
+ * e.g. one that logs raw frames and one that compresses a preview.
+ *
+ * To reduce capture jitter on a loaded machine, the threads that run a chain
+ * can be pinned to specific CPUs with cam_unit_chain_set_cpu_affinity() and
+ * given a real-time scheduling policy with cam_unit_chain_set_scheduling().
+ * These apply to the thread that dispatches the chain's event source, and to
+ * the input threads of units in the chain.  cam_unit_chain_set_mlock() keeps
+ * the process's memory, including all frame buffers, from being paged out.
+ * All three can also be set by attributes of the &lt;chain&gt; element of a
+ * chain description, e.g.
+ * <programlisting>
+ * &lt;chain cpus="2-3" sched="fifo" priority="50" mlock="1"&gt;
+ * </programlisting>
  */
 
 typedef struct _CamUnitChain CamUnitChain;
@@ -187,6 +207,40 @@ int cam_unit_chain_get_unit_index (CamUnitChain *self, const CamUnit *unit);
 int cam_unit_chain_reorder_unit (CamUnitChain *self, CamUnit *unit,
         int new_index);
 
+/**
+ * cam_unit_chain_set_unit_input:
+ * @self: the CamUnitChain
+ * @unit: the target CamUnit
+ * @input: the unit that @unit should take its input from.  Must come before
+ *         @unit in the chain.  If NULL, or the unit immediately preceding
+ *         @unit, then @unit takes its input from its predecessor as usual.
+ *
+ * Makes @unit the start of a branch fed by @input.  Units following @unit
+ * continue to take their input from their predecessors, so they become part
+ * of the same branch.  If @input is later removed from the chain, the branch
+ * is fed by the input of @input instead.  If a reorder places @unit before
+ * @input, the branch is discarded.
+ *
+ * Note that if the last unit of the chain is on a branch that uses threaded
+ * input, then the chain's frame-ready signal is emitted from that branch's
+ * thread.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+int cam_unit_chain_set_unit_input (CamUnitChain *self, CamUnit *unit,
+        CamUnit *input);
+
+/**
+ * cam_unit_chain_unit_is_branch:
+ * @self: the CamUnitChain
+ * @unit: the unit to check
+ *
+ * Returns: TRUE if @unit takes its input from a unit other than the one
+ * immediately preceding it.
+ */
+gboolean cam_unit_chain_unit_is_branch (const CamUnitChain *self, 
+        const CamUnit *unit);
+
 /**
  * cam_unit_chain_all_units_stream_init:
  * @self: the CamUnitChain
@@ -230,6 +284,79 @@ int cam_unit_chain_attach_glib (CamUnitChain *self, int priority,
  */
 void cam_unit_chain_detach_glib (CamUnitChain *self);
 
+/**
+ * cam_unit_chain_set_cpu_affinity:
+ * @cpus: the CPUs that the chain's threads may run on, or NULL to allow all
+ *        CPUs.
+ * @ncpus: the number of entries in @cpus.
+ *
+ * Pins the threads that run the chain to @cpus.  The dispatching thread is
+ * pinned the next time it dispatches the chain, and the input thread of
+ * each unit before it processes its next frame.  Units added to the chain
+ * later are pinned as well.
+ *
+ * Returns: 0 on success, -1 if @cpus contains an invalid CPU number.
+ */
+int cam_unit_chain_set_cpu_affinity (CamUnitChain *self, const int *cpus,
+        int ncpus);
+
+/**
+ * cam_unit_chain_get_cpu_affinity:
+ * @ncpus: output parameter.  Set to the number of entries in the result.
+ *
+ * Returns: the CPUs set with cam_unit_chain_set_cpu_affinity(), or NULL if
+ * the chain's threads may run on any CPU.  The array belongs to the chain.
+ */
+const int * cam_unit_chain_get_cpu_affinity (const CamUnitChain *self,
+        int *ncpus);
+
+/**
+ * cam_unit_chain_set_scheduling:
+ * @policy: the scheduling policy for the chain's threads
+ * @priority: the priority for the chain's threads.  Ignored for
+ *            #CAM_THREAD_SCHED_OTHER.
+ *
+ * Sets the scheduling policy of the threads that run the chain, which take
+ * effect at the same time as cam_unit_chain_set_cpu_affinity().  Real-time
+ * policies usually require root or CAP_SYS_NICE.  If a thread can not be
+ * given the policy, a warning is printed and it keeps running with its
+ * current policy.
+ *
+ * Returns: 0 on success, -1 if @priority is not valid for @policy.
+ */
+int cam_unit_chain_set_scheduling (CamUnitChain *self,
+        CamThreadSchedPolicy policy, int priority);
+
+/**
+ * cam_unit_chain_get_scheduling:
+ * @policy: output parameter.  May be NULL.
+ * @priority: output parameter.  May be NULL.
+ */
+void cam_unit_chain_get_scheduling (const CamUnitChain *self,
+        CamThreadSchedPolicy *policy, int *priority);
+
+/**
+ * cam_unit_chain_set_mlock:
+ * @mlock: TRUE to lock memory, FALSE to unlock it.
+ *
+ * Locks all current and future memory of the process into RAM with
+ * mlockall(), so that frame buffers and the pages of the capture path are
+ * never paged out.  Note that this affects the whole process, not only the
+ * chain.  Memory stays locked until every chain that locked it has unlocked
+ * it or been destroyed.  Locking usually requires root, CAP_IPC_LOCK, or a
+ * sufficient RLIMIT_MEMLOCK.
+ *
+ * Returns: 0 on success, -1 on failure.
+ */
+int cam_unit_chain_set_mlock (CamUnitChain *self, gboolean mlock);
+
+/**
+ * cam_unit_chain_get_mlock:
+ *
+ * Returns: TRUE if memory was locked with cam_unit_chain_set_mlock().
+ */
+gboolean cam_unit_chain_get_mlock (const CamUnitChain *self);
+
 /**
  * cam_unit_chain_snapshot:
  *
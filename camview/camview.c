@@ -9,6 +9,7 @@
 #include <gtk/gtk.h>
 
 #include <camunits/cam.h>
+#include <camunits/trace.h>
 #include <camunits-gtk/cam-gtk.h>
 
 #include "gtk_util.h"
@@ -26,6 +27,17 @@ typedef struct _state_t {
     char *extra_plugin_path;
     int use_gui;
 
+    // low-latency options, applied after the chain file is loaded
+    int *cpus;
+    int ncpus;
+    int *worker_cpus;
+    int nworker_cpus;
+    int have_sched;
+    int have_priority;
+    CamThreadSchedPolicy sched_policy;
+    int sched_priority;
+    int mlock;
+
     GtkWindow *window;
     GtkWidget *manager_frame;
     GtkWidget *chain_frame;
@@ -36,6 +48,16 @@ typedef struct _state_t {
     int64_t last_fps_utime;
 } state_t;
 
+// long options without a short equivalent
+enum {
+    OPT_CPUS = 256,
+    OPT_WORKER_CPUS,
+    OPT_SCHED,
+    OPT_PRIORITY,
+    OPT_MLOCK,
+    OPT_TRACE
+};
+
 // ==================== signal handlers =====================
 
 static void
@@ -364,6 +386,32 @@ state_setup (state_t *self)
         free (xml_str);
     }
 
+    if (self->cpus && 0 != cam_unit_chain_set_cpu_affinity (self->chain,
+                self->cpus, self->ncpus))
+        return -1;
+    if (self->worker_cpus)
+        cam_thread_pool_set_affinity (cam_thread_pool_get_default (),
+                self->worker_cpus, self->nworker_cpus);
+    if (self->have_sched || self->have_priority) {
+        // an option that isn't given keeps the setting of the chain file
+        CamThreadSchedPolicy policy;
+        int priority;
+        cam_unit_chain_get_scheduling (self->chain, &policy, &priority);
+        if (self->have_sched)
+            policy = self->sched_policy;
+        if (self->have_priority)
+            priority = self->sched_priority;
+        if (self->have_priority && policy == CAM_THREAD_SCHED_OTHER) {
+            fprintf (stderr, "--priority needs a real-time policy, "
+                    "from --sched or the chain file\n");
+            return -1;
+        }
+        if (0 != cam_unit_chain_set_scheduling (self->chain, policy, priority))
+            return -1;
+    }
+    if (self->mlock && 0 != cam_unit_chain_set_mlock (self->chain, TRUE))
+        return -1;
+
     return 0;
 }
 
@@ -378,6 +426,8 @@ state_cleanup (state_t *self)
     if(self->manager)
         g_object_unref (self->manager);
     free (self->xml_fname);
+    free (self->cpus);
+    free (self->worker_cpus);
     return 0;
 }
 
@@ -396,10 +446,37 @@ usage()
     "  --plugin-path PATH   Add the directories in PATH to the plugin\n"
     "                       search path.  PATH should be a colon-delimited\n"
     "                       list.\n"
-    "  -h, --help           Show this help text and exit\n");
+    "  -h, --help           Show this help text and exit\n"
+    "\n"
+    "Low-latency options.  These override the settings of a chain file.\n"
+    "  --cpus LIST          Pin the capture and processing threads of the\n"
+    "                       chain to the CPUs in LIST, e.g. 2,3 or 2-3.\n"
+    "  --worker-cpus LIST   Pin the shared worker threads to the CPUs in\n"
+    "                       LIST.\n"
+    "  --sched POLICY       Scheduling policy for the chain's threads: other,\n"
+    "                       fifo, or rr.\n"
+    "  --priority N         Real-time priority for --sched fifo or rr, or for\n"
+    "                       the policy of the chain file.\n"
+    "  --mlock              Lock all memory, including frame buffers, into\n"
+    "                       RAM.\n"
+    "\n"
+    "  --trace FILE         Record when each unit processes each frame, and\n"
+    "                       write the timeline to FILE on exit, in the Chrome\n"
+    "                       trace format.\n");
     exit(1);
 }
 
+static int *
+parse_cpus_arg (const char *arg, int *ncpus)
+{
+    int *cpus = cam_thread_parse_cpu_list (arg, ncpus);
+    if (!cpus) {
+        fprintf (stderr, "Invalid CPU list [%s]\n", arg);
+        usage ();
+    }
+    return cpus;
+}
+
 int main (int argc, char **argv)
 {
     state_t * self = (state_t*) calloc (1, sizeof (state_t));
@@ -412,6 +489,12 @@ int main (int argc, char **argv)
         { "chain", required_argument, 0, 'c' },
         { "plugin-path", required_argument, 0, 'p' },
         { "no-gui", no_argument, 0, 'u' },
+        { "cpus", required_argument, 0, OPT_CPUS },
+        { "worker-cpus", required_argument, 0, OPT_WORKER_CPUS },
+        { "sched", required_argument, 0, OPT_SCHED },
+        { "priority", required_argument, 0, OPT_PRIORITY },
+        { "mlock", no_argument, 0, OPT_MLOCK },
+        { "trace", required_argument, 0, OPT_TRACE },
         { 0, 0, 0, 0 }
     };
 
@@ -427,6 +510,33 @@ int main (int argc, char **argv)
             case 'p':
                 self->extra_plugin_path = strdup (optarg);
                 break;
+            case OPT_CPUS:
+                free (self->cpus);
+                self->cpus = parse_cpus_arg (optarg, &self->ncpus);
+                break;
+            case OPT_WORKER_CPUS:
+                free (self->worker_cpus);
+                self->worker_cpus = parse_cpus_arg (optarg,
+                        &self->nworker_cpus);
+                break;
+            case OPT_SCHED:
+                if (0 != cam_thread_sched_policy_from_string (optarg,
+                            &self->sched_policy)) {
+                    fprintf (stderr, "Unrecognized policy [%s]\n", optarg);
+                    usage ();
+                }
+                self->have_sched = 1;
+                break;
+            case OPT_PRIORITY:
+                self->sched_priority = atoi (optarg);
+                self->have_priority = 1;
+                break;
+            case OPT_MLOCK:
+                self->mlock = 1;
+                break;
+            case OPT_TRACE:
+                cam_trace_write_on_exit (optarg);
+                break;
             case 'h':
             default:
                 usage ();
@@ -0,0 +1,342 @@
+/*
+ * Measures the throughput of the channel reordering functions in
+ * camunits/pixels.h against plain byte-at-a-time loops, and checks that
+ * both give the same results.  Odd widths and padded strides are used so
+ * that the row tails are exercised.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <sys/time.h>
+
+#include <camunits/pixels.h>
+
+typedef int (*conv_func_t) (uint8_t *dest, int dstride, int dwidth,
+        int dheight, const uint8_t *src, int sstride);
+
+/* Scalar versions, as the library implemented them before the SIMD
+ * kernels were added.  The PIXEL macro expands to the per-pixel body. */
+#define SCALAR_CONVERSION(name, PIXEL) \
+    static int name (uint8_t *dest, int dstride, int dwidth, int dheight, \
+            const uint8_t *src, int sstride) \
+    { \
+        for (int i = 0; i < dheight; i++) { \
+            uint8_t *d = dest + i * dstride; \
+            const uint8_t *s = src + i * sstride; \
+            for (int j = 0; j < dwidth; j++) { PIXEL; } \
+        } \
+        return 0; \
+    }
+
+SCALAR_CONVERSION (scalar_gray_to_rgb,
+        d[3*j] = d[3*j+1] = d[3*j+2] = s[j])
+SCALAR_CONVERSION (scalar_gray_to_rgba,
+        d[4*j] = d[4*j+1] = d[4*j+2] = s[j]; d[4*j+3] = 0xff)
+SCALAR_CONVERSION (scalar_rgb_to_bgr,
+        d[3*j] = s[3*j+2]; d[3*j+1] = s[3*j+1]; d[3*j+2] = s[3*j])
+SCALAR_CONVERSION (scalar_rgb_to_bgra,
+        d[4*j] = s[3*j+2]; d[4*j+1] = s[3*j+1]; d[4*j+2] = s[3*j];
+        d[4*j+3] = 0xff)
+SCALAR_CONVERSION (scalar_bgra_to_bgr,
+        d[3*j] = s[4*j]; d[3*j+1] = s[4*j+1]; d[3*j+2] = s[4*j+2])
+SCALAR_CONVERSION (scalar_bgra_to_rgb,
+        d[3*j] = s[4*j+2]; d[3*j+1] = s[4*j+1]; d[3*j+2] = s[4*j])
+
+typedef struct {
+    const char *name;
+    int out_bpp;
+    conv_func_t func;
+    conv_func_t scalar;
+} conversion_t;
+
+static conversion_t conversions[] = {
+    { "gray -> rgb",  3, cam_pixel_convert_8u_gray_to_8u_RGB,
+        scalar_gray_to_rgb },
+    { "gray -> rgba", 4, cam_pixel_convert_8u_gray_to_8u_RGBA,
+        scalar_gray_to_rgba },
+    { "rgb -> bgr",   3, cam_pixel_convert_8u_rgb_to_8u_bgr,
+        scalar_rgb_to_bgr },
+    { "bgr -> rgb",   3, cam_pixel_convert_8u_bgr_to_8u_rgb,
+        scalar_rgb_to_bgr },
+    { "rgb -> bgra",  4, cam_pixel_convert_8u_rgb_to_8u_bgra,
+        scalar_rgb_to_bgra },
+    { "bgra -> bgr",  3, cam_pixel_convert_8u_bgra_to_8u_bgr,
+        scalar_bgra_to_bgr },
+    { "bgra -> rgb",  3, cam_pixel_convert_8u_bgra_to_8u_rgb,
+        scalar_bgra_to_rgb },
+};
+#define NUM_CONVERSIONS (sizeof (conversions) / sizeof (conversions[0]))
+
+/* Checks cam_pixel_split_bayer_planes_8u against a scalar split.  The
+ * source rows are padded to 16 bytes, as the debayer units do, so widths
+ * that are an odd multiple of 16 exercise the kernel's last-column
+ * fix-up.  Returns 0 if the results match. */
+static int
+check_bayer_split (int width, int height)
+{
+    int sstride = (width + 0xf) & ~0xf;
+    int pwidth = width / 2;
+    int pheight = height / 2;
+    int pstride = ((pwidth + 0xf) & ~0xf) + 32;
+    uint8_t *src, *planes[4];
+    if (posix_memalign ((void**) &src, 16, sstride * height))
+        return 1;
+    for (int i = 0; i < sstride * height; i++)
+        src[i] = rand ();
+    for (int p = 0; p < 4; p++)
+        if (posix_memalign ((void**) &planes[p], 16, pstride * pheight))
+            return 1;
+
+    int ok = 0 == cam_pixel_split_bayer_planes_8u (planes, pstride,
+            src, sstride, pwidth, pheight);
+    for (int i = 0; i < pheight && ok; i++) {
+        for (int j = 0; j < pwidth && ok; j++) {
+            const uint8_t *s = src + 2 * i * sstride + 2 * j;
+            ok = planes[0][i * pstride + j] == s[0] &&
+                planes[1][i * pstride + j] == s[1] &&
+                planes[2][i * pstride + j] == s[sstride] &&
+                planes[3][i * pstride + j] == s[sstride + 1];
+        }
+    }
+    printf ("bayer split    %4dx%-4d %s\n", width, height,
+            ok ? "ok" : "MISMATCH");
+
+    free (src);
+    for (int p = 0; p < 4; p++)
+        free (planes[p]);
+    return !ok;
+}
+
+/* Runs cam_pixel_convert_bayer_to_8u_i420 on an image, and on the same
+ * image widened to a multiple of 32 pixels, and compares the parts of the
+ * results that are away from the right border.  Returns 0 if they match. */
+static int
+check_bayer_i420 (int width, int height)
+{
+    int wide = (width + 0x1f) & ~0x1f;
+    uint8_t *src = malloc (wide * height);
+    uint8_t *dst = malloc (width * height * 3 / 2);
+    uint8_t *ref = malloc (wide * height * 3 / 2);
+    for (int i = 0; i < wide * height; i++)
+        src[i] = rand ();
+
+    int ok = 0 == cam_pixel_convert_bayer_to_8u_i420 (dst, width, width,
+                height, src, wide, CAM_PIXEL_FORMAT_BAYER_GRBG) &&
+        0 == cam_pixel_convert_bayer_to_8u_i420 (ref, wide, wide,
+                height, src, wide, CAM_PIXEL_FORMAT_BAYER_GRBG);
+    int cwidth = width / 2 - 4;
+    for (int i = 0; i < height && ok; i++)
+        ok = !memcmp (dst + i * width, ref + i * wide, 2 * cwidth);
+    // the U and V planes together have as many rows as the Y plane
+    for (int i = 0; i < height && ok; i++)
+        ok = !memcmp (dst + width * height + i * width / 2,
+                ref + wide * height + i * wide / 2, cwidth);
+    printf ("bayer -> i420  %4dx%-4d %s\n", width, height,
+            ok ? "ok" : "MISMATCH");
+
+    free (src);
+    free (dst);
+    free (ref);
+    return !ok;
+}
+
+/* Checks the NV12 conversions at an odd width.  The image is allocated at
+ * exactly its size, so that reading past the end of the last chroma row is
+ * caught by a memory checker.  The last column of each row repeats the luma
+ * of the column before it and shares its chroma, so the two must convert to
+ * the same color.  Returns 0 if they do. */
+static int
+check_nv12 (int width, int height)
+{
+    int size = width * height + width * (height / 2);
+    uint8_t *src = malloc (size);
+    uint8_t *dst = malloc (width * height * 4);
+    for (int i = 0; i < size; i++)
+        src[i] = rand ();
+    for (int i = 0; i < height && width > 1; i++)
+        src[i * width + width - 1] = src[i * width + width - 2];
+
+    int ok = 1;
+    for (int bpp = 3; bpp <= 4 && ok; bpp++) {
+        if (bpp == 3)
+            cam_pixel_convert_8u_nv12_to_8u_rgb (dst, width * bpp, width,
+                    height, src, width);
+        else
+            cam_pixel_convert_8u_nv12_to_8u_bgra (dst, width * bpp, width,
+                    height, src, width);
+        for (int i = 0; i < height && ok && width > 1; i++) {
+            uint8_t *d = dst + i * width * bpp + (width - 2) * bpp;
+            ok = !memcmp (d, d + bpp, bpp);
+        }
+    }
+    printf ("nv12 -> rgb    %4dx%-4d %s\n", width, height,
+            ok ? "ok" : "MISMATCH");
+
+    free (src);
+    free (dst);
+    return !ok;
+}
+
+/* Converts NV12 and I420 images whose planes are in separate buffers with
+ * padded rows, as a multi-planar V4L2 device delivers them, and compares the
+ * results with converting the same images packed.  Returns 0 if they match. */
+static int
+check_planes (int width, int height)
+{
+    int cwidth = (width + 1) / 2;
+    int ystride = width + 64;
+    int cstride = cwidth * 2 + 64;
+    int size = width * height * 3 / 2;
+    uint8_t *packed = malloc (size);
+    uint8_t *y = malloc (ystride * height);
+    uint8_t *c[2] = { malloc (cstride * height / 2),
+        malloc (cstride * height / 2) };
+    uint8_t *dst = malloc (width * height * 4);
+    uint8_t *ref = malloc (width * height * 4);
+    for (int i = 0; i < size; i++)
+        packed[i] = rand ();
+    for (int i = 0; i < height; i++)
+        memcpy (y + i * ystride, packed + i * width, width);
+    const uint8_t *chroma = packed + width * height;
+
+    // NV12: one plane of interleaved chroma
+    for (int i = 0; i < height / 2; i++)
+        memcpy (c[0] + i * cstride, chroma + i * width, width);
+    cam_pixel_convert_8u_nv12_to_8u_rgb (ref, width * 3, width, height,
+            packed, width);
+    cam_pixel_convert_8u_nv12_planes_to_8u_rgb (dst, width * 3, width,
+            height, y, ystride, c[0], cstride);
+    int ok = !memcmp (dst, ref, width * height * 3);
+    cam_pixel_convert_8u_nv12_to_8u_bgra (ref, width * 4, width, height,
+            packed, width);
+    cam_pixel_convert_8u_nv12_planes_to_8u_bgra (dst, width * 4, width,
+            height, y, ystride, c[0], cstride);
+    ok = ok && !memcmp (dst, ref, width * height * 4);
+
+    // I420: the U plane, then the V plane
+    for (int p = 0; p < 2; p++)
+        for (int i = 0; i < height / 2; i++)
+            memcpy (c[p] + i * cstride, chroma + (p * height / 2 + i) *
+                    (width / 2), width / 2);
+    cam_pixel_convert_8u_yuv420p_to_8u_rgb (ref, width * 3, width, height,
+            packed, width);
+    cam_pixel_convert_8u_i420_planes_to_8u_rgb (dst, width * 3, width,
+            height, y, ystride, c[0], c[1], cstride);
+    ok = ok && !memcmp (dst, ref, width * height * 3);
+
+    printf ("planes -> rgb  %4dx%-4d %s\n", width, height,
+            ok ? "ok" : "MISMATCH");
+
+    free (packed);
+    free (y);
+    free (c[0]);
+    free (c[1]);
+    free (dst);
+    free (ref);
+    return !ok;
+}
+
+static int64_t
+_timestamp_now (void)
+{
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void
+usage (const char *progname)
+{
+    fprintf (stderr, "usage: %s [options]\n"
+            "\n"
+            "  -w WIDTH      image width (default 1923)\n"
+            "  -h HEIGHT     image height (default 1080)\n"
+            "  -n ITERS      iterations per conversion (default 200)\n",
+            progname);
+    exit (1);
+}
+
+int
+main (int argc, char **argv)
+{
+    int width = 1923;
+    int height = 1080;
+    int iters = 200;
+    int c;
+    while ((c = getopt (argc, argv, "w:h:n:")) >= 0) {
+        switch (c) {
+            case 'w': width = atoi (optarg); break;
+            case 'h': height = atoi (optarg); break;
+            case 'n': iters = atoi (optarg); break;
+            default: usage (argv[0]);
+        }
+    }
+    if (width < 1 || height < 1 || iters < 1)
+        usage (argv[0]);
+
+    // pad the strides, and offset the buffers so that they are unaligned
+    int sstride = width * 4 + 7;
+    int dstride = width * 4 + 5;
+    uint8_t *src_buf = malloc (sstride * height + 1);
+    uint8_t *dst_buf = malloc (dstride * height + 3);
+    uint8_t *ref_buf = malloc (dstride * height + 3);
+    uint8_t *src = src_buf + 1;
+    uint8_t *dst = dst_buf + 3;
+    uint8_t *ref = ref_buf + 3;
+    for (int i = 0; i < sstride * height; i++)
+        src[i] = rand ();
+
+    int status = 0;
+    printf ("%dx%d, %d iterations\n\n", width, height, iters);
+    printf ("%-14s %12s %14s %8s\n", "", "scalar MP/s", "camunits MP/s",
+            "speedup");
+
+    for (int ci = 0; ci < NUM_CONVERSIONS; ci++) {
+        conversion_t *conv = &conversions[ci];
+
+        memset (dst, 0, dstride * height);
+        memset (ref, 0, dstride * height);
+        conv->scalar (ref, dstride, width, height, src, sstride);
+        conv->func (dst, dstride, width, height, src, sstride);
+        int ok = 1;
+        for (int i = 0; i < height && ok; i++)
+            ok = !memcmp (dst + i * dstride, ref + i * dstride,
+                    width * conv->out_bpp);
+        if (!ok)
+            status = 1;
+
+        int64_t t0 = _timestamp_now ();
+        for (int n = 0; n < iters; n++)
+            conv->scalar (ref, dstride, width, height, src, sstride);
+        int64_t t1 = _timestamp_now ();
+        for (int n = 0; n < iters; n++)
+            conv->func (dst, dstride, width, height, src, sstride);
+        int64_t t2 = _timestamp_now ();
+
+        double mpix = (double) width * height * iters;
+        printf ("%-14s %12.1f %14.1f %7.1fx%s\n", conv->name,
+                mpix / (t1 - t0), mpix / (t2 - t1),
+                (double) (t1 - t0) / (t2 - t1),
+                ok ? "" : "  MISMATCH");
+    }
+
+    cam_pixel_check_sse2 ();
+    static const int bayer_widths[] = { 40, 1000, 1928, 2440, 1920 };
+    printf ("\n");
+    for (int i = 0; i < sizeof (bayer_widths) / sizeof (int); i++)
+        status |= check_bayer_split (bayer_widths[i], 16);
+    status |= check_bayer_i420 (40, 8);
+    status |= check_bayer_i420 (1922, 1080);
+    status |= check_bayer_i420 (1928, 1080);
+    status |= check_nv12 (1, 2);
+    status |= check_nv12 (35, 8);
+    status |= check_nv12 (1923, 1080);
+    status |= check_planes (64, 16);
+    status |= check_planes (1920, 1080);
+
+    free (src_buf);
+    free (dst_buf);
+    free (ref_buf);
+    return status;
+}
@@ -0,0 +1,176 @@
+/*
+ * Measures how fast frames can be streamed between two processes through
+ * a CamFrameSocketWriter and CamFrameSocketReader.  This is the transport
+ * used by the output.socket and input.socket plugins.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <glib.h>
+#include <glib-object.h>
+#include <camunits/frame_socket.h>
+#include <camunits/pixels.h>
+
+static int64_t
+_timestamp_now (void)
+{
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void
+usage (const char *progname)
+{
+    fprintf (stderr, "usage: %s [options]\n"
+            "\n"
+            "  -w WIDTH      frame width (default 1920)\n"
+            "  -h HEIGHT     frame height (default 1080)\n"
+            "  -n NFRAMES    number of frames to send (default 1000)\n"
+            "  -t BYTES      memfd threshold (default 65536)\n"
+            "  -s PATH       socket path (default /tmp/camunits-socket-bench)\n",
+            progname);
+    exit (1);
+}
+
+static int
+run_reader (const char *path)
+{
+    CamFrameSocketReader *reader = NULL;
+    for (int i = 0; i < 500 && !reader; i++) {
+        reader = cam_frame_socket_reader_new (path, 1000);
+        if (!reader)
+            usleep (10000);
+    }
+    if (!reader) {
+        fprintf (stderr, "reader: unable to connect to %s\n", path);
+        return 1;
+    }
+
+    int64_t nframes = 0;
+    int64_t nbytes = 0;
+    int64_t start = 0;
+    int64_t end = 0;
+    uint32_t checksum = 0;
+    CamFrameBuffer *frame;
+    CamLogFrameInfo info;
+    while ((frame = cam_frame_socket_reader_read (reader, &info))) {
+        if (!nframes)
+            start = _timestamp_now ();
+        // touch every page so that the data is actually delivered
+        for (int i = 0; i < frame->bytesused; i += 4096)
+            checksum += frame->data[i];
+        nframes++;
+        nbytes += frame->bytesused;
+        end = _timestamp_now ();
+        g_object_unref (frame);
+    }
+    cam_frame_socket_reader_destroy (reader);
+
+    double elapsed = (end - start) * 1e-6;
+    printf ("reader: received %"G_GINT64_FORMAT" frames, "
+            "%.1f MB in %.3f s (checksum %u)\n",
+            nframes, nbytes * 1e-6, elapsed, checksum);
+    if (elapsed > 0)
+        printf ("reader: %.1f frames/s, %.2f GB/s\n",
+                (nframes - 1) / elapsed, nbytes * 1e-9 / elapsed);
+    return 0;
+}
+
+static int
+run_writer (const char *path, int width, int height, int nframes,
+        int memfd_threshold)
+{
+    CamLogFrameFormat format = {
+        .width = width,
+        .height = height,
+        .stride = width * 4,
+        .pixelformat = CAM_PIXEL_FORMAT_BGRA,
+    };
+    CamFrameSocketWriter *writer =
+        cam_frame_socket_writer_new (path, &format, memfd_threshold);
+    if (!writer)
+        return 1;
+
+    int64_t wait_start = _timestamp_now ();
+    while (!cam_frame_socket_writer_accept_clients (writer)) {
+        if (_timestamp_now () - wait_start > 5000000) {
+            fprintf (stderr, "writer: no reader connected\n");
+            cam_frame_socket_writer_destroy (writer);
+            return 1;
+        }
+        usleep (1000);
+    }
+
+    CamFrameBuffer *frame = cam_framebuffer_new_alloc (height * width * 4);
+    memset (frame->data, 0x55, frame->length);
+    frame->bytesused = frame->length;
+
+    int nsent = 0;
+    int64_t start = _timestamp_now ();
+    for (int i = 0; i < nframes; i++) {
+        frame->timestamp = _timestamp_now ();
+        int status = cam_frame_socket_writer_publish (writer, frame);
+        if (status < 0)
+            break;
+        nsent += status;
+    }
+    double elapsed = (_timestamp_now () - start) * 1e-6;
+
+    // give the reader a moment to drain its socket before disconnecting it
+    usleep (200000);
+    printf ("writer: sent %d frames in %.3f s, %"G_GUINT64_FORMAT
+            " dropped by a full socket\n", nsent, elapsed,
+            cam_frame_socket_writer_get_dropped (writer));
+
+    g_object_unref (frame);
+    cam_frame_socket_writer_destroy (writer);
+    return 0;
+}
+
+int main (int argc, char **argv)
+{
+    int width = 1920;
+    int height = 1080;
+    int nframes = 1000;
+    int memfd_threshold = 65536;
+    const char *path = "/tmp/camunits-socket-bench";
+
+    int c;
+    while ((c = getopt (argc, argv, "w:h:n:t:s:")) >= 0) {
+        switch (c) {
+            case 'w': width = atoi (optarg); break;
+            case 'h': height = atoi (optarg); break;
+            case 'n': nframes = atoi (optarg); break;
+            case 't': memfd_threshold = atoi (optarg); break;
+            case 's': path = optarg; break;
+            default: usage (argv[0]);
+        }
+    }
+    if (width <= 0 || height <= 0 || nframes <= 0)
+        usage (argv[0]);
+
+    g_type_init ();
+
+    printf ("%d frames of %dx%d BGRA (%.1f MB each), memfd threshold %d\n",
+            nframes, width, height, width * height * 4 * 1e-6,
+            memfd_threshold);
+    fflush (stdout);
+
+    pid_t pid = fork ();
+    if (pid < 0) {
+        perror ("fork");
+        return 1;
+    }
+    if (pid == 0)
+        return run_reader (path);
+
+    int status = run_writer (path, width, height, nframes, memfd_threshold);
+    waitpid (pid, NULL, 0);
+    return status;
+}
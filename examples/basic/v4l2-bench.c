@@ -0,0 +1,183 @@
+/*
+ * Measures the overhead and frame pacing of the input.v4l2 unit, using the
+ * emulated V4L2 device in plugins/v4l2/v4l2_emulator.c so that no camera is
+ * needed:
+ *
+ *   v4l2-bench -e plugins/v4l2/.libs/v4l2_emulator.so
+ *
+ * The emulator is configured with the CAMUNITS_V4L2_EMU_* environment
+ * variables described in its source.  Latency is measured from the time the
+ * emulated driver filled a buffer to the time the unit emitted it, which
+ * requires the monotonic buffer timestamps that the emulator and most real
+ * drivers produce.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/resource.h>
+
+#include <glib.h>
+#include <camunits/cam.h>
+
+typedef struct {
+    GMainLoop *mainloop;
+    int nframes;
+    int count;
+    int64_t first_time;
+    int64_t last_time;
+    double latency_sum;
+    int64_t latency_max;
+    double interval_sum;
+    double interval_sq_sum;
+    int64_t interval_max;
+} bench_t;
+
+static int64_t
+_monotonic_now (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t
+_cpu_time (void)
+{
+    struct rusage ru;
+    getrusage (RUSAGE_SELF, &ru);
+    return (int64_t) (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 +
+        ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static void
+on_frame_ready (CamUnit *unit, const CamFrameBuffer *buf,
+        const CamUnitFormat *fmt, void *user_data)
+{
+    bench_t *b = (bench_t*) user_data;
+    int64_t now = _monotonic_now ();
+
+    int64_t latency = now - buf->timestamp;
+    b->latency_sum += latency;
+    if (latency > b->latency_max)
+        b->latency_max = latency;
+
+    if (b->count) {
+        int64_t interval = now - b->last_time;
+        b->interval_sum += interval;
+        b->interval_sq_sum += (double) interval * interval;
+        if (interval > b->interval_max)
+            b->interval_max = interval;
+    } else {
+        b->first_time = now;
+    }
+    b->last_time = now;
+
+    if (++b->count == b->nframes)
+        g_main_loop_quit (b->mainloop);
+}
+
+static void
+usage (const char *progname)
+{
+    fprintf (stderr, "usage: %s [options]\n"
+            "\n"
+            "  -e PATH       preload the V4L2 emulator library at PATH\n"
+            "  -u UNIT_ID    unit to benchmark (default input.v4l2:0)\n"
+            "  -n NFRAMES    number of frames to measure (default 300)\n"
+            "  -l            enable the unit's latest-only mode\n",
+            progname);
+    exit (1);
+}
+
+int main (int argc, char **argv)
+{
+    const char *unit_id = "input.v4l2:0";
+    const char *emulator = NULL;
+    int nframes = 300;
+    int latest_only = 0;
+
+    int c;
+    while ((c = getopt (argc, argv, "e:u:n:l")) >= 0) {
+        switch (c) {
+            case 'e': emulator = optarg; break;
+            case 'u': unit_id = optarg; break;
+            case 'n': nframes = atoi (optarg); break;
+            case 'l': latest_only = 1; break;
+            default: usage (argv[0]);
+        }
+    }
+    if (nframes < 2)
+        usage (argv[0]);
+
+    // the emulator must be loaded before anything opens a device, so
+    // restart the program with it preloaded
+    if (emulator && !g_getenv ("CAMUNITS_V4L2_BENCH_PRELOADED")) {
+        g_setenv ("LD_PRELOAD", emulator, TRUE);
+        g_setenv ("CAMUNITS_V4L2_BENCH_PRELOADED", "1", TRUE);
+        execv ("/proc/self/exe", argv);
+        perror ("execv");
+        return 1;
+    }
+
+    g_type_init ();
+
+    CamUnitChain *chain = cam_unit_chain_new ();
+    CamUnit *unit = cam_unit_chain_add_unit_by_id (chain, unit_id);
+    if (!unit) {
+        fprintf (stderr, "unable to create unit %s\n", unit_id);
+        g_object_unref (chain);
+        return 1;
+    }
+    if (latest_only)
+        cam_unit_set_control_boolean (unit, "latest-only", 1);
+
+    if (cam_unit_chain_all_units_stream_init (chain)) {
+        fprintf (stderr, "unable to start %s\n", unit_id);
+        g_object_unref (chain);
+        return 1;
+    }
+    const CamUnitFormat *fmt = cam_unit_get_output_format (unit);
+    printf ("%s: %s %dx%d\n", unit_id,
+            cam_pixel_format_nickname (fmt->pixelformat),
+            fmt->width, fmt->height);
+
+    bench_t b;
+    memset (&b, 0, sizeof (b));
+    b.mainloop = g_main_loop_new (NULL, FALSE);
+    b.nframes = nframes;
+    g_signal_connect (G_OBJECT (unit), "frame-ready",
+            G_CALLBACK (on_frame_ready), &b);
+    cam_unit_chain_attach_glib (chain, 1000, NULL);
+
+    int64_t cpu_start = _cpu_time ();
+    g_main_loop_run (b.mainloop);
+    int64_t cpu_used = _cpu_time () - cpu_start;
+
+    int nintervals = b.count - 1;
+    double elapsed = (b.last_time - b.first_time) * 1e-6;
+    double mean_interval = b.interval_sum / nintervals;
+    double jitter = sqrt (MAX (0, b.interval_sq_sum / nintervals -
+                mean_interval * mean_interval));
+    CamUnitControl *dropped_ctl = cam_unit_find_control (unit, "dropped");
+
+    printf ("frames:        %d in %.3f s (%.1f frames/s)\n",
+            b.count, elapsed, nintervals / elapsed);
+    printf ("latency:       mean %.1f us, max %"G_GINT64_FORMAT" us\n",
+            b.latency_sum / b.count, b.latency_max);
+    printf ("interval:      mean %.1f us, stddev %.1f us, "
+            "max %"G_GINT64_FORMAT" us\n",
+            mean_interval, jitter, b.interval_max);
+    printf ("cpu:           %.1f us per frame\n", (double) cpu_used / b.count);
+    if (dropped_ctl)
+        printf ("driver drops:  %d\n",
+                cam_unit_control_get_int (dropped_ctl));
+
+    cam_unit_chain_all_units_stream_shutdown (chain);
+    g_main_loop_unref (b.mainloop);
+    g_object_unref (chain);
+    return 0;
+}
@@ -3,19 +3,30 @@
 #include <string.h>
 
 #include "camunits/plugin.h"
+#include "camunits/thread_pool.h"
 #include "camunits/dbg.h"
 
 #define err(args...) fprintf(stderr, args)
 
+// frames smaller than this are converted in the calling thread, since
+// splitting them up costs more than it saves
+#define MIN_BANDED_PIXELS (320 * 240)
+#define BAND_GRAIN_ROWS 16
+
 typedef struct _CamColorConversionFilter CamColorConversionFilter;
 
 struct _CamColorConversionFilter {
     CamUnit parent;
 
     int (*cc_func)(CamColorConversionFilter *self, 
-        const CamUnitFormat *infmt, const CamFrameBuffer *inbuf,
-        const CamUnitFormat *outfmt, CamFrameBuffer *outbuf);
+        const CamUnitFormat *infmt, const uint8_t *src,
+        const CamUnitFormat *outfmt, uint8_t *dst, int height);
+    int bandable;
     GList *conversions;
+
+    // where the planes of the NV12 or I420 frame being converted are
+    int plane_offsets[3];
+    int plane_strides[3];
 };
 
 typedef struct _CamColorConversionFilterClass {
@@ -56,29 +67,29 @@ static void on_input_frame_ready (CamUnit *super, const CamFrameBuffer *inbuf,
         const CamUnitFormat *infmt);
 
 typedef int (*cc_func_t)(CamColorConversionFilter *self, 
-        const CamUnitFormat *infmt, const CamFrameBuffer *inbuf,
-        const CamUnitFormat *outfmt, CamFrameBuffer *outbuf);
+        const CamUnitFormat *infmt, const uint8_t *src,
+        const CamUnitFormat *outfmt, uint8_t *dst, int height);
 
 #define DECL_STANDARD_CONV(name, conversion_func) \
     static inline int name (CamColorConversionFilter *self, \
-        const CamUnitFormat *infmt, const CamFrameBuffer *inbuf, \
-        const CamUnitFormat *outfmt, CamFrameBuffer *outbuf) \
+        const CamUnitFormat *infmt, const uint8_t *src, \
+        const CamUnitFormat *outfmt, uint8_t *dst, int height) \
     { \
-        return conversion_func (outbuf->data, outfmt->row_stride, \
-            outfmt->width, outfmt->height, inbuf->data, infmt->row_stride); \
+        return conversion_func (dst, outfmt->row_stride, \
+            outfmt->width, height, src, infmt->row_stride); \
     }
 
 #define DECL_STANDARD_CONV_DEFAULT_STRIDE(name, conversion_func, stride_multiplier) \
     static inline int name (CamColorConversionFilter *self, \
-        const CamUnitFormat *infmt, const CamFrameBuffer *inbuf, \
-        const CamUnitFormat *outfmt, CamFrameBuffer *outbuf) \
+        const CamUnitFormat *infmt, const uint8_t *src, \
+        const CamUnitFormat *outfmt, uint8_t *dst, int height) \
     { \
         if(0 == infmt->row_stride) \
-            return conversion_func (outbuf->data, outfmt->row_stride, \
-                outfmt->width, outfmt->height, inbuf->data, infmt->width * stride_multiplier); \
+            return conversion_func (dst, outfmt->row_stride, \
+                outfmt->width, height, src, infmt->width * stride_multiplier); \
         else \
-            return conversion_func (outbuf->data, outfmt->row_stride, \
-                outfmt->width, outfmt->height, inbuf->data, infmt->row_stride); \
+            return conversion_func (dst, outfmt->row_stride, \
+                outfmt->width, height, src, infmt->row_stride); \
     }
 
 DECL_STANDARD_CONV (gray_to_rgb, cam_pixel_convert_8u_gray_to_8u_RGB)
@@ -87,19 +98,63 @@ DECL_STANDARD_CONV (rgb_to_gray, cam_pixel_convert_8u_rgb_to_8u_gray)
 DECL_STANDARD_CONV (rgb_to_bgr, cam_pixel_convert_8u_rgb_to_8u_bgr)
 DECL_STANDARD_CONV (rgb_to_bgra, cam_pixel_convert_8u_rgb_to_8u_bgra)
 
-DECL_STANDARD_CONV (yuv420p_to_rgb, cam_pixel_convert_8u_yuv420p_to_8u_rgb)
-DECL_STANDARD_CONV (yuv420p_to_rgba, cam_pixel_convert_8u_yuv420p_to_8u_rgba)
-DECL_STANDARD_CONV (yuv420p_to_bgr, cam_pixel_convert_8u_yuv420p_to_8u_bgr)
-DECL_STANDARD_CONV (yuv420p_to_bgra, cam_pixel_convert_8u_yuv420p_to_8u_bgra)
-DECL_STANDARD_CONV (yuv420p_to_gray, cam_pixel_convert_8u_yuv420p_to_8u_gray)
+/* Conversions from NV12 and I420 read each plane where _find_planes found
+ * it.  Gray only needs the Y plane. */
+#define DECL_Y_PLANE_CONV(name, conversion_func) \
+    static inline int name (CamColorConversionFilter *self, \
+        const CamUnitFormat *infmt, const uint8_t *src, \
+        const CamUnitFormat *outfmt, uint8_t *dst, int height) \
+    { \
+        return conversion_func (dst, outfmt->row_stride, outfmt->width, \
+            height, src + self->plane_offsets[0], self->plane_strides[0]); \
+    }
+
+#define DECL_NV12_CONV(name, conversion_func) \
+    static inline int name (CamColorConversionFilter *self, \
+        const CamUnitFormat *infmt, const uint8_t *src, \
+        const CamUnitFormat *outfmt, uint8_t *dst, int height) \
+    { \
+        return conversion_func (dst, outfmt->row_stride, outfmt->width, \
+            height, src + self->plane_offsets[0], self->plane_strides[0], \
+            src + self->plane_offsets[1], self->plane_strides[1]); \
+    }
+
+#define DECL_I420_CONV(name, conversion_func) \
+    static inline int name (CamColorConversionFilter *self, \
+        const CamUnitFormat *infmt, const uint8_t *src, \
+        const CamUnitFormat *outfmt, uint8_t *dst, int height) \
+    { \
+        return conversion_func (dst, outfmt->row_stride, outfmt->width, \
+            height, src + self->plane_offsets[0], self->plane_strides[0], \
+            src + self->plane_offsets[1], src + self->plane_offsets[2], \
+            self->plane_strides[1]); \
+    }
+
+DECL_I420_CONV (yuv420p_to_rgb, cam_pixel_convert_8u_i420_planes_to_8u_rgb)
+DECL_I420_CONV (yuv420p_to_rgba, cam_pixel_convert_8u_i420_planes_to_8u_rgba)
+DECL_I420_CONV (yuv420p_to_bgr, cam_pixel_convert_8u_i420_planes_to_8u_bgr)
+DECL_I420_CONV (yuv420p_to_bgra, cam_pixel_convert_8u_i420_planes_to_8u_bgra)
+DECL_Y_PLANE_CONV (yuv420p_to_gray, cam_pixel_convert_8u_yuv420p_to_8u_gray)
 
 DECL_STANDARD_CONV_DEFAULT_STRIDE (yuyv_to_bgra, cam_pixel_convert_8u_yuyv_to_8u_bgra, 2)
 DECL_STANDARD_CONV_DEFAULT_STRIDE (yuyv_to_gray, cam_pixel_convert_8u_yuyv_to_8u_gray, 2)
 DECL_STANDARD_CONV_DEFAULT_STRIDE (yuyv_to_rgb, cam_pixel_convert_8u_yuyv_to_8u_rgb, 2)
+DECL_STANDARD_CONV_DEFAULT_STRIDE (yuyv_to_i420, cam_pixel_convert_8u_yuyv_to_8u_i420, 2)
 
 DECL_STANDARD_CONV_DEFAULT_STRIDE (uyvy_to_bgra, cam_pixel_convert_8u_uyvy_to_8u_bgra, 2)
 DECL_STANDARD_CONV_DEFAULT_STRIDE (uyvy_to_gray, cam_pixel_convert_8u_uyvy_to_8u_gray, 2)
 DECL_STANDARD_CONV_DEFAULT_STRIDE (uyvy_to_rgb, cam_pixel_convert_8u_uyvy_to_8u_rgb, 2)
+DECL_STANDARD_CONV_DEFAULT_STRIDE (uyvy_to_i420, cam_pixel_convert_8u_uyvy_to_8u_i420, 2)
+
+DECL_NV12_CONV (nv12_to_rgb, cam_pixel_convert_8u_nv12_planes_to_8u_rgb)
+DECL_NV12_CONV (nv12_to_bgra, cam_pixel_convert_8u_nv12_planes_to_8u_bgra)
+DECL_Y_PLANE_CONV (nv12_to_gray, cam_pixel_convert_8u_nv12_to_8u_gray)
+
+DECL_STANDARD_CONV_DEFAULT_STRIDE (yuv411p_to_rgb, cam_pixel_convert_8u_yuv411p_to_8u_rgb, 1)
+DECL_STANDARD_CONV_DEFAULT_STRIDE (yuv411p_to_bgra, cam_pixel_convert_8u_yuv411p_to_8u_bgra, 1)
+
+DECL_STANDARD_CONV_DEFAULT_STRIDE (iyu2_to_rgb, cam_pixel_convert_8u_iyu2_to_8u_rgb, 3)
+DECL_STANDARD_CONV_DEFAULT_STRIDE (iyu2_to_bgra, cam_pixel_convert_8u_iyu2_to_8u_bgra, 3)
 
 DECL_STANDARD_CONV (iyu1_to_bgra, cam_pixel_convert_8u_iyu1_to_8u_bgra)
 DECL_STANDARD_CONV (iyu1_to_gray, cam_pixel_convert_8u_iyu1_to_8u_gray)
@@ -107,25 +162,151 @@ DECL_STANDARD_CONV (iyu1_to_rgb, cam_pixel_convert_8u_iyu1_to_8u_rgb)
 
 DECL_STANDARD_CONV (bgra_to_rgb, cam_pixel_convert_8u_bgra_to_8u_rgb)
 DECL_STANDARD_CONV (bgra_to_bgr, cam_pixel_convert_8u_bgra_to_8u_bgr)
+DECL_STANDARD_CONV (bgra_to_i420, cam_pixel_convert_8u_bgra_to_8u_i420)
 DECL_STANDARD_CONV (bgr_to_rgb, cam_pixel_convert_8u_bgr_to_8u_rgb)
 #undef DECL_STANDARD_CONV
+#undef DECL_Y_PLANE_CONV
+#undef DECL_NV12_CONV
+#undef DECL_I420_CONV
 
 static inline int 
 gray_8u_to_32f (CamColorConversionFilter *self,
-        const CamUnitFormat *infmt, const CamFrameBuffer *inbuf,
-        const CamUnitFormat *outfmt, CamFrameBuffer *outbuf)
+        const CamUnitFormat *infmt, const uint8_t *src,
+        const CamUnitFormat *outfmt, uint8_t *dst, int height)
 {
-    return cam_pixel_convert_8u_gray_to_32f_gray ((float*)outbuf->data, 
+    return cam_pixel_convert_8u_gray_to_32f_gray ((float*)dst, 
             outfmt->row_stride,
-            outfmt->width, outfmt->height, inbuf->data, infmt->row_stride);
+            outfmt->width, height, src, infmt->row_stride);
+}
+
+/* 16-bit formats.  These work on individual samples, so GRAY16 and RGB16
+ * share the same functions. */
+static inline int
+swap_16u (CamColorConversionFilter *self,
+        const CamUnitFormat *infmt, const uint8_t *src,
+        const CamUnitFormat *outfmt, uint8_t *dst, int height)
+{
+    int channels = cam_pixel_format_bpp (infmt->pixelformat) / 16;
+    return cam_pixel_convert_16u_swap_bytes (dst, outfmt->row_stride,
+            outfmt->width * channels, height,
+            src, infmt->row_stride);
+}
+
+static inline int
+reduce_16u_to_8u (CamColorConversionFilter *self,
+        const CamUnitFormat *infmt, const uint8_t *src,
+        const CamUnitFormat *outfmt, uint8_t *dst, int height)
+{
+    int channels = cam_pixel_format_bpp (infmt->pixelformat) / 16;
+    int big_endian = (infmt->pixelformat == CAM_PIXEL_FORMAT_BE_GRAY16 ||
+                      infmt->pixelformat == CAM_PIXEL_FORMAT_BE_RGB16);
+    return cam_pixel_convert_16u_gray_to_8u_gray (dst,
+            outfmt->row_stride, outfmt->width * channels, height,
+            src, infmt->row_stride, 8, big_endian);
+}
+
+static inline int
+bayer16_to_rgb16 (CamColorConversionFilter *self,
+        const CamUnitFormat *infmt, const uint8_t *src,
+        const CamUnitFormat *outfmt, uint8_t *dst, int height)
+{
+    return cam_pixel_convert_bayer16_to_16u_rgb (dst,
+            outfmt->row_stride, outfmt->width, height,
+            src, infmt->row_stride, infmt->pixelformat);
+}
+
+static inline int
+bayer16_to_bgra (CamColorConversionFilter *self,
+        const CamUnitFormat *infmt, const uint8_t *src,
+        const CamUnitFormat *outfmt, uint8_t *dst, int height)
+{
+    return cam_pixel_convert_bayer16_to_8u_bgra (dst,
+            outfmt->row_stride, outfmt->width, height,
+            src, infmt->row_stride, infmt->pixelformat, 8);
+}
+
+/* I420 is described by the stride of its Y plane.  The U and V planes that
+ * follow it each add a quarter of its size. */
+static int
+_frame_size (const CamUnitFormat *fmt)
+{
+    if (fmt->pixelformat == CAM_PIXEL_FORMAT_I420)
+        return fmt->height * fmt->row_stride * 3 / 2;
+    return fmt->height * fmt->row_stride;
+}
+
+/* Finds the planes of an NV12 or I420 frame.  Frames from multi-planar
+ * devices say where their planes are, see cam_framebuffer_set_planes.
+ * Otherwise each plane follows the previous one.  Returns -1 if the frame's
+ * plane layout doesn't fit the format or the frame. */
+static int
+_find_planes (CamColorConversionFilter *self, const CamFrameBuffer *inbuf,
+        const CamUnitFormat *infmt)
+{
+    int nplanes = infmt->pixelformat == CAM_PIXEL_FORMAT_I420 ? 3 : 2;
+    int n = cam_framebuffer_get_planes (inbuf, 3, self->plane_offsets,
+            self->plane_strides);
+    if (n == 0) {
+        int s = infmt->row_stride ? infmt->row_stride : infmt->width;
+        int ysize = s * infmt->height;
+        self->plane_offsets[0] = 0;
+        self->plane_strides[0] = s;
+        self->plane_offsets[1] = ysize;
+        if (nplanes == 3) {
+            self->plane_strides[1] = s / 2;
+            self->plane_offsets[2] = ysize + ysize / 4;
+            self->plane_strides[2] = s / 2;
+        } else {
+            self->plane_strides[1] = s;
+        }
+        return 0;
+    }
+    if (n != nplanes)
+        return -1;
+    // I420 conversions take one stride for both chroma planes
+    if (nplanes == 3 && self->plane_strides[1] != self->plane_strides[2])
+        return -1;
+    for (int p = 0; p < nplanes; p++) {
+        int rows = p ? (infmt->height + 1) / 2 : infmt->height;
+        if ((int64_t) self->plane_offsets[p] +
+                (int64_t) rows * self->plane_strides[p] > inbuf->bytesused)
+            return -1;
+    }
+    return 0;
 }
 
 typedef struct _conv_info_t {
     CamPixelFormat inpfmt;
     CamPixelFormat outpfmt;
     cc_func_t func;
+    int bandable;
 } conv_info_t;
 
+/* A conversion can be split into bands of rows and run on the thread pool
+ * if each output row depends only on the input row at the same position.
+ * Planar formats keep their chroma planes after the last row, and Bayer
+ * demosaicing reads the neighbouring rows, so neither can be banded. */
+static int
+_rows_independent (CamPixelFormat pfmt)
+{
+    switch (pfmt) {
+        case CAM_PIXEL_FORMAT_I420:
+        case CAM_PIXEL_FORMAT_NV12:
+        case CAM_PIXEL_FORMAT_YUV411P:
+        case CAM_PIXEL_FORMAT_BE_BAYER16_BGGR:
+        case CAM_PIXEL_FORMAT_BE_BAYER16_GBRG:
+        case CAM_PIXEL_FORMAT_BE_BAYER16_GRBG:
+        case CAM_PIXEL_FORMAT_BE_BAYER16_RGGB:
+        case CAM_PIXEL_FORMAT_LE_BAYER16_BGGR:
+        case CAM_PIXEL_FORMAT_LE_BAYER16_GBRG:
+        case CAM_PIXEL_FORMAT_LE_BAYER16_GRBG:
+        case CAM_PIXEL_FORMAT_LE_BAYER16_RGGB:
+            return 0;
+        default:
+            return 1;
+    }
+}
+
 static void
 add_conv (CamColorConversionFilter *self,
         CamPixelFormat inpfmt, CamPixelFormat outpfmt, cc_func_t func)
@@ -134,6 +315,7 @@ add_conv (CamColorConversionFilter *self,
     ci->inpfmt = inpfmt;
     ci->outpfmt = outpfmt;
     ci->func = func;
+    ci->bandable = _rows_independent (inpfmt) && _rows_independent (outpfmt);
     self->conversions = g_list_append (self->conversions, ci);
 }
 
@@ -142,7 +324,7 @@ cam_color_conversion_filter_init( CamColorConversionFilter *self )
 {
     dbg(DBG_FILTER, "color_conv filter constructor\n");
     add_conv (self, CAM_PIXEL_FORMAT_GRAY, CAM_PIXEL_FORMAT_RGB,  gray_to_rgb);
-//    add_conv (self, CAM_PIXEL_FORMAT_GRAY, CAM_PIXEL_FORMAT_FLOAT_GRAY32, 
+//    add_conv (self, CAM_PIXEL_FORMAT_GRAY, CAM_PIXEL_FORMAT_FLOAT_GRAY32,
 //            gray_8u_to_32f);
     add_conv (self, CAM_PIXEL_FORMAT_RGB,  CAM_PIXEL_FORMAT_GRAY, rgb_to_gray);
     add_conv (self, CAM_PIXEL_FORMAT_RGB,  CAM_PIXEL_FORMAT_BGRA, rgb_to_bgra);
@@ -158,19 +340,70 @@ cam_color_conversion_filter_init( CamColorConversionFilter *self )
     add_conv (self, CAM_PIXEL_FORMAT_YUYV, CAM_PIXEL_FORMAT_BGRA, yuyv_to_bgra);
     add_conv (self, CAM_PIXEL_FORMAT_YUYV, CAM_PIXEL_FORMAT_GRAY, yuyv_to_gray);
     add_conv (self, CAM_PIXEL_FORMAT_YUYV, CAM_PIXEL_FORMAT_RGB, yuyv_to_rgb);
+    add_conv (self, CAM_PIXEL_FORMAT_YUYV, CAM_PIXEL_FORMAT_I420, yuyv_to_i420);
 
     add_conv (self, CAM_PIXEL_FORMAT_UYVY, CAM_PIXEL_FORMAT_BGRA, uyvy_to_bgra);
     add_conv (self, CAM_PIXEL_FORMAT_UYVY, CAM_PIXEL_FORMAT_GRAY, uyvy_to_gray);
     add_conv (self, CAM_PIXEL_FORMAT_UYVY, CAM_PIXEL_FORMAT_RGB, uyvy_to_rgb);
+    add_conv (self, CAM_PIXEL_FORMAT_UYVY, CAM_PIXEL_FORMAT_I420, uyvy_to_i420);
 
     add_conv (self, CAM_PIXEL_FORMAT_IYU1, CAM_PIXEL_FORMAT_BGRA, iyu1_to_bgra);
     add_conv (self, CAM_PIXEL_FORMAT_IYU1, CAM_PIXEL_FORMAT_GRAY, iyu1_to_gray);
     add_conv (self, CAM_PIXEL_FORMAT_IYU1, CAM_PIXEL_FORMAT_RGB, iyu1_to_rgb);
 
+    add_conv (self, CAM_PIXEL_FORMAT_NV12, CAM_PIXEL_FORMAT_RGB, nv12_to_rgb);
+    add_conv (self, CAM_PIXEL_FORMAT_NV12, CAM_PIXEL_FORMAT_BGRA, nv12_to_bgra);
+    add_conv (self, CAM_PIXEL_FORMAT_NV12, CAM_PIXEL_FORMAT_GRAY, nv12_to_gray);
+
+    add_conv (self, CAM_PIXEL_FORMAT_YUV411P, CAM_PIXEL_FORMAT_RGB,
+            yuv411p_to_rgb);
+    add_conv (self, CAM_PIXEL_FORMAT_YUV411P, CAM_PIXEL_FORMAT_BGRA,
+            yuv411p_to_bgra);
+
+    add_conv (self, CAM_PIXEL_FORMAT_IYU2, CAM_PIXEL_FORMAT_RGB, iyu2_to_rgb);
+    add_conv (self, CAM_PIXEL_FORMAT_IYU2, CAM_PIXEL_FORMAT_BGRA, iyu2_to_bgra);
+
     add_conv (self, CAM_PIXEL_FORMAT_BGRA, CAM_PIXEL_FORMAT_RGB, bgra_to_rgb);
     add_conv (self, CAM_PIXEL_FORMAT_BGRA, CAM_PIXEL_FORMAT_BGR, bgra_to_bgr);
+    add_conv (self, CAM_PIXEL_FORMAT_BGRA, CAM_PIXEL_FORMAT_I420, bgra_to_i420);
     add_conv (self, CAM_PIXEL_FORMAT_BGR, CAM_PIXEL_FORMAT_RGB, bgr_to_rgb);
 
+    add_conv (self, CAM_PIXEL_FORMAT_BE_GRAY16, CAM_PIXEL_FORMAT_LE_GRAY16,
+            swap_16u);
+    add_conv (self, CAM_PIXEL_FORMAT_LE_GRAY16, CAM_PIXEL_FORMAT_BE_GRAY16,
+            swap_16u);
+    add_conv (self, CAM_PIXEL_FORMAT_BE_RGB16, CAM_PIXEL_FORMAT_LE_RGB16,
+            swap_16u);
+    add_conv (self, CAM_PIXEL_FORMAT_LE_RGB16, CAM_PIXEL_FORMAT_BE_RGB16,
+            swap_16u);
+    add_conv (self, CAM_PIXEL_FORMAT_BE_GRAY16, CAM_PIXEL_FORMAT_GRAY,
+            reduce_16u_to_8u);
+    add_conv (self, CAM_PIXEL_FORMAT_LE_GRAY16, CAM_PIXEL_FORMAT_GRAY,
+            reduce_16u_to_8u);
+    add_conv (self, CAM_PIXEL_FORMAT_BE_RGB16, CAM_PIXEL_FORMAT_RGB,
+            reduce_16u_to_8u);
+    add_conv (self, CAM_PIXEL_FORMAT_LE_RGB16, CAM_PIXEL_FORMAT_RGB,
+            reduce_16u_to_8u);
+
+    CamPixelFormat be_bayer16[] = {
+        CAM_PIXEL_FORMAT_BE_BAYER16_BGGR, CAM_PIXEL_FORMAT_BE_BAYER16_GBRG,
+        CAM_PIXEL_FORMAT_BE_BAYER16_GRBG, CAM_PIXEL_FORMAT_BE_BAYER16_RGGB
+    };
+    CamPixelFormat le_bayer16[] = {
+        CAM_PIXEL_FORMAT_LE_BAYER16_BGGR, CAM_PIXEL_FORMAT_LE_BAYER16_GBRG,
+        CAM_PIXEL_FORMAT_LE_BAYER16_GRBG, CAM_PIXEL_FORMAT_LE_BAYER16_RGGB
+    };
+    for (int i=0; i<4; i++) {
+        add_conv (self, be_bayer16[i], CAM_PIXEL_FORMAT_BE_RGB16,
+                bayer16_to_rgb16);
+        add_conv (self, be_bayer16[i], CAM_PIXEL_FORMAT_BGRA,
+                bayer16_to_bgra);
+        add_conv (self, le_bayer16[i], CAM_PIXEL_FORMAT_LE_RGB16,
+                bayer16_to_rgb16);
+        add_conv (self, le_bayer16[i], CAM_PIXEL_FORMAT_BGRA,
+                bayer16_to_bgra);
+    }
+
     self->cc_func = NULL;
 
     g_signal_connect( G_OBJECT(self), "input-format-changed",
@@ -224,6 +457,10 @@ cam_color_conversion_filter_stream_init (CamUnit * super,
         if (ci->inpfmt  == infmt->pixelformat &&
             ci->outpfmt == outfmt->pixelformat) {
             self->cc_func = ci->func;
+            self->bandable = ci->bandable;
+            // make sure the SIMD kernels are selected before the first frame
+            // is converted by several threads at once
+            cam_pixel_check_sse2 ();
             return 0;
         }
     }
@@ -232,6 +469,26 @@ cam_color_conversion_filter_stream_init (CamUnit * super,
     return -1;
 }
 
+typedef struct _band_job_t {
+    CamColorConversionFilter *self;
+    const CamUnitFormat *infmt;
+    const uint8_t *src;
+    const CamUnitFormat *outfmt;
+    uint8_t *dst;
+    int status;
+} band_job_t;
+
+static void
+_convert_band (int start, int end, void *user_data)
+{
+    band_job_t *job = (band_job_t*) user_data;
+    const uint8_t *src = job->src + start * job->infmt->row_stride;
+    uint8_t *dst = job->dst + start * job->outfmt->row_stride;
+    if (0 != job->self->cc_func (job->self, job->infmt, src, job->outfmt,
+                dst, end - start))
+        job->status = -1;
+}
+
 static void 
 on_input_frame_ready (CamUnit *super, const CamFrameBuffer *inbuf, 
         const CamUnitFormat *infmt)
@@ -241,14 +498,33 @@ on_input_frame_ready (CamUnit *super, const CamFrameBuffer *inbuf,
 
     if (!self->cc_func) return;
 
+    if ((infmt->pixelformat == CAM_PIXEL_FORMAT_NV12 ||
+            infmt->pixelformat == CAM_PIXEL_FORMAT_I420) &&
+            0 != _find_planes (self, inbuf, infmt)) {
+        err ("ColorConversion: frame has a bad plane layout\n");
+        return;
+    }
+
     const CamUnitFormat *outfmt = cam_unit_get_output_format(super);
-    int out_buf_size = outfmt->height * outfmt->row_stride;
+    int out_buf_size = _frame_size (outfmt);
     CamFrameBuffer *outbuf = cam_framebuffer_new_alloc (out_buf_size);
 
-    int status = self->cc_func (self, infmt, inbuf, outfmt, outbuf);
+    int status;
+    if (self->bandable && infmt->row_stride > 0 &&
+            outfmt->width * outfmt->height >= MIN_BANDED_PIXELS) {
+        band_job_t job = { self, infmt, inbuf->data, outfmt, outbuf->data, 0 };
+        cam_thread_pool_parallel_for (cam_thread_pool_get_default (), 0,
+                outfmt->height, BAND_GRAIN_ROWS, _convert_band, &job);
+        status = job.status;
+    } else {
+        status = self->cc_func (self, infmt, inbuf->data, outfmt,
+                outbuf->data, outfmt->height);
+    }
 
     if (0 == status) {
         cam_framebuffer_copy_metadata(outbuf, inbuf);
+        // the output planes follow one another
+        cam_framebuffer_set_planes (outbuf, 0, NULL, NULL);
         outbuf->bytesused = out_buf_size;
         cam_unit_produce_frame (super, outbuf, outfmt);
     }
@@ -268,6 +544,8 @@ on_input_format_changed (CamUnit *super, const CamUnitFormat *infmt)
 
         if (ci->inpfmt == infmt->pixelformat) {
             int stride = infmt->width * cam_pixel_format_bpp(ci->outpfmt) / 8;
+            if (ci->outpfmt == CAM_PIXEL_FORMAT_I420)
+                stride = (infmt->width + 1) & ~1;
 
             cam_unit_add_output_format (super, ci->outpfmt,
                     NULL, infmt->width, infmt->height, 
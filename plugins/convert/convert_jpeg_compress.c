@@ -50,6 +50,9 @@ static int _jpeg_compress_8u_rgb (const uint8_t * src, int width, int height,
         int stride, uint8_t * dest, int * destsize, int quality);
 static int _jpeg_compress_8u_bgra (const uint8_t * src, int width, int height, 
         int stride, uint8_t * dest, int * destsize, int quality);
+static int _jpeg_compress_8u_i420 (const uint8_t * const * planes,
+        const int * strides, int width, int height, uint8_t * dest,
+        int * destsize, int quality);
 
 // ============== CamConvertJpegCompress ===============
 static void on_input_frame_ready (CamUnit * super, const CamFrameBuffer *inbuf,
@@ -104,6 +107,37 @@ _stream_shutdown (CamUnit * super)
     return 0;
 }
 
+/* Finds the planes of an I420 frame.  Frames from multi-planar devices say
+ * where their planes are, see cam_framebuffer_set_planes.  Otherwise each
+ * plane follows the previous one.  Returns -1 if the frame's plane layout
+ * doesn't fit the frame. */
+static int
+_find_i420_planes (const CamFrameBuffer *inbuf, const CamUnitFormat *infmt,
+        const uint8_t **planes, int *strides)
+{
+    int offsets[3];
+    int n = cam_framebuffer_get_planes (inbuf, 3, offsets, strides);
+    if (n == 0) {
+        int s = infmt->row_stride ? infmt->row_stride : infmt->width;
+        int ysize = s * infmt->height;
+        offsets[0] = 0;
+        offsets[1] = ysize;
+        offsets[2] = ysize + ysize / 4;
+        strides[0] = s;
+        strides[1] = strides[2] = s / 2;
+    } else if (n != 3) {
+        return -1;
+    }
+    for (int p = 0; p < 3; p++) {
+        int rows = p ? (infmt->height + 1) / 2 : infmt->height;
+        if (n && (int64_t) offsets[p] + (int64_t) rows * strides[p] >
+                inbuf->bytesused)
+            return -1;
+        planes[p] = inbuf->data + offsets[p];
+    }
+    return 0;
+}
+
 static void 
 on_input_frame_ready (CamUnit *super, const CamFrameBuffer *inbuf,
         const CamUnitFormat *infmt)
@@ -112,6 +146,14 @@ on_input_frame_ready (CamUnit *super, const CamFrameBuffer *inbuf,
     CamConvertJpegCompress * self = (CamConvertJpegCompress*)super;
     const CamUnitFormat *outfmt = cam_unit_get_output_format(super);
 
+    // if a downstream unit is still holding on to the previous output
+    // buffer (e.g. a threaded branch), then don't overwrite it.
+    if (G_OBJECT (self->outbuf)->ref_count > 1) {
+        int buf_sz = self->outbuf->length;
+        g_object_unref (self->outbuf);
+        self->outbuf = cam_framebuffer_new_alloc (buf_sz);
+    }
+
     int width = infmt->width;
     int height = infmt->height;
     int outsize = self->outbuf->length;
@@ -126,8 +168,19 @@ on_input_frame_ready (CamUnit *super, const CamFrameBuffer *inbuf,
     else if (infmt->pixelformat == CAM_PIXEL_FORMAT_GRAY)
         _jpeg_compress_8u_gray (inbuf->data, width, height, infmt->row_stride,
                 self->outbuf->data, &outsize, quality);
+    else if (infmt->pixelformat == CAM_PIXEL_FORMAT_I420) {
+        const uint8_t *planes[3];
+        int strides[3];
+        if (0 != _find_i420_planes (inbuf, infmt, planes, strides)) {
+            err ("JpegCompress: frame has a bad plane layout\n");
+            return;
+        }
+        _jpeg_compress_8u_i420 (planes, strides, width, height,
+                self->outbuf->data, &outsize, quality);
+    }
 
     cam_framebuffer_copy_metadata(self->outbuf, inbuf);
+    cam_framebuffer_set_planes (self->outbuf, 0, NULL, NULL);
     self->outbuf->bytesused = outsize;
 
     cam_unit_produce_frame (super, self->outbuf, outfmt);
@@ -142,7 +195,8 @@ on_input_format_changed (CamUnit *super, const CamUnitFormat *infmt)
 
     if (! (infmt->pixelformat == CAM_PIXEL_FORMAT_GRAY ||
            infmt->pixelformat == CAM_PIXEL_FORMAT_RGB ||
-           infmt->pixelformat == CAM_PIXEL_FORMAT_BGRA)) return;
+           infmt->pixelformat == CAM_PIXEL_FORMAT_BGRA ||
+           infmt->pixelformat == CAM_PIXEL_FORMAT_I420)) return;
 
     cam_unit_add_output_format (super, CAM_PIXEL_FORMAT_MJPEG,
             NULL, infmt->width, infmt->height, 0);
@@ -277,3 +331,113 @@ _jpeg_compress_8u_bgra (const uint8_t * src, int width, int height, int stride,
     jpeg_destroy_compress (&cinfo);
     return 0;
 }
+
+/* Copies a row into a buffer of padded_width bytes, replicating the last
+ * sample into the padding */
+static JSAMPROW
+_pad_row (uint8_t * dest, const uint8_t * src, int width, int padded_width)
+{
+    memcpy (dest, src, width);
+    memset (dest + width, src[width-1], padded_width - width);
+    return (JSAMPROW) dest;
+}
+
+/* Compresses I420 directly from its planes, through libjpeg's raw data
+ * interface.  This skips the colorspace conversion and chroma downsampling
+ * that libjpeg would otherwise perform, and which would undo the conversion
+ * to RGB that feeding it RGB requires.  libjpeg reads whole 16x16 MCUs, so
+ * rows and columns past the edge of the image are replicated. */
+static int 
+_jpeg_compress_8u_i420 (const uint8_t * const * planes, const int * strides,
+        int width, int height, uint8_t * dest, int * destsize, int quality)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    struct jpeg_destination_mgr jdest;
+    int out_size = *destsize;
+
+    if (width < 2 || height < 2)
+        return -1;
+
+    cinfo.err = jpeg_std_error (&jerr);
+    jpeg_create_compress (&cinfo);
+    jdest.next_output_byte = dest;
+    jdest.free_in_buffer = out_size;
+    jdest.init_destination = init_destination;
+    jdest.empty_output_buffer = empty_output_buffer;
+    jdest.term_destination = term_destination;
+    cinfo.dest = &jdest;
+
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_YCbCr;
+    jpeg_set_defaults (&cinfo);
+    jpeg_set_quality (&cinfo, quality, TRUE);
+    cinfo.raw_data_in = TRUE;
+#if JPEG_LIB_VERSION >= 70
+    cinfo.do_fancy_downsampling = FALSE;
+#endif
+    cinfo.comp_info[0].h_samp_factor = 2;
+    cinfo.comp_info[0].v_samp_factor = 2;
+    cinfo.comp_info[1].h_samp_factor = 1;
+    cinfo.comp_info[1].v_samp_factor = 1;
+    cinfo.comp_info[2].h_samp_factor = 1;
+    cinfo.comp_info[2].v_samp_factor = 1;
+
+    const uint8_t * src = planes[0];
+    const uint8_t * uplane = planes[1];
+    const uint8_t * vplane = planes[2];
+    int stride = strides[0];
+    int cwidth = width / 2;
+    int cheight = height / 2;
+
+    // rows only need to be copied when the width is not a whole number of
+    // MCUs
+    int padded_width = (width + 15) & ~15;
+    uint8_t * pad = NULL;
+    uint8_t * upad = NULL;
+    uint8_t * vpad = NULL;
+    if (padded_width != width) {
+        pad = (uint8_t*) malloc (padded_width * 16 + padded_width / 2 * 16);
+        upad = pad + padded_width * 16;
+        vpad = upad + padded_width / 2 * 8;
+    }
+
+    JSAMPROW yrows[16];
+    JSAMPROW urows[8];
+    JSAMPROW vrows[8];
+    JSAMPARRAY rows[3] = { yrows, urows, vrows };
+
+    jpeg_start_compress (&cinfo, TRUE);
+    while (cinfo.next_scanline < height) {
+        int row = cinfo.next_scanline;
+        int k;
+        for (k = 0; k < 16; k++) {
+            const uint8_t * y = src + MIN (row + k, height - 1) * stride;
+            yrows[k] = pad ?
+                _pad_row (pad + k * padded_width, y, width, padded_width) :
+                (JSAMPROW) y;
+        }
+        for (k = 0; k < 8; k++) {
+            int crow = MIN (row / 2 + k, cheight - 1);
+            const uint8_t * u = uplane + crow * strides[1];
+            const uint8_t * v = vplane + crow * strides[2];
+            if (pad) {
+                urows[k] = _pad_row (upad + k * padded_width / 2, u,
+                        cwidth, padded_width / 2);
+                vrows[k] = _pad_row (vpad + k * padded_width / 2, v,
+                        cwidth, padded_width / 2);
+            } else {
+                urows[k] = (JSAMPROW) u;
+                vrows[k] = (JSAMPROW) v;
+            }
+        }
+        jpeg_write_raw_data (&cinfo, rows, 16);
+    }
+    jpeg_finish_compress (&cinfo);
+    *destsize = out_size - jdest.free_in_buffer;
+    jpeg_destroy_compress (&cinfo);
+    free (pad);
+    return 0;
+}
@@ -116,6 +116,14 @@ on_input_frame_ready (CamUnit *super, const CamFrameBuffer *inbuf,
         return;
     }
 
+    // if a downstream unit is still holding on to the previous output
+    // buffer (e.g. a threaded branch), then don't overwrite it.
+    if (G_OBJECT (self->outbuf)->ref_count > 1) {
+        int buf_sz = self->outbuf->length;
+        g_object_unref (self->outbuf);
+        self->outbuf = cam_framebuffer_new_alloc (buf_sz);
+    }
+
     _jpeg_decompress (inbuf->data, inbuf->bytesused,
                 self->outbuf->data, infmt->width, infmt->height, 
                 outfmt->row_stride, out_space);
@@ -1,6 +1,8 @@
 #include <stdio.h>
+#include <string.h>
 
 #include <camunits/plugin.h>
+#include <camunits/format_planner.h>
 #include <camunits/dbg.h>
 
 #define err(args...) fprintf(stderr, args)
@@ -9,7 +11,9 @@ typedef struct _CamConvertToRgb8 {
     CamUnit parent;
 
     /*< private >*/
-    CamUnit *worker;
+    // conversion units planned by CamFormatPlanner.  Each takes its input
+    // from the one before it, and the last one produces RGB.
+    GList *workers;
     CamUnitManager *manager;
 } CamConvertToRgb8;
 
@@ -67,7 +71,7 @@ cam_convert_to_rgb8_init (CamConvertToRgb8 *self)
 {
     cam_unit_set_preferred_format (CAM_UNIT (self), CAM_PIXEL_FORMAT_RGB, 0, 0,
             NULL);
-    self->worker = NULL;
+    self->workers = NULL;
     self->manager = cam_unit_manager_get_and_ref();
     g_signal_connect (G_OBJECT(self), "input-format-changed",
             G_CALLBACK(on_input_format_changed), NULL);
@@ -79,15 +83,26 @@ cam_convert_to_rgb8_new()
     return (CamConvertToRgb8*)(g_object_new(cam_convert_to_rgb8_get_type(), NULL));
 }
 
+static void
+_free_workers (CamConvertToRgb8 *self)
+{
+    if (!self->workers)
+        return;
+    CamUnit *last = CAM_UNIT (g_list_last (self->workers)->data);
+    g_signal_handlers_disconnect_by_func (last, on_worker_frame_ready, self);
+    for (GList *witer=self->workers; witer; witer=witer->next) {
+        cam_unit_set_input (CAM_UNIT (witer->data), NULL);
+        g_object_unref (witer->data);
+    }
+    g_list_free (self->workers);
+    self->workers = NULL;
+}
+
 static void
 _finalize (GObject * obj)
 {
     CamConvertToRgb8 *self = (CamConvertToRgb8*)obj;
-    if (self->worker) {
-        g_signal_handlers_disconnect_by_func (self->worker, 
-                on_worker_frame_ready, self);
-        g_object_unref (self->worker);
-    }
+    _free_workers (self);
     g_object_unref(self->manager);
 
     G_OBJECT_CLASS (cam_convert_to_rgb8_parent_class)->finalize (obj);
@@ -103,26 +118,31 @@ _stream_init (CamUnit * super, const CamUnitFormat * outfmt)
     if (input && infmt && infmt->pixelformat == CAM_PIXEL_FORMAT_RGB) {
         return 0;
     }
-    if (self->worker) {
-        CamUnitFormat *wfmt = 
-            CAM_UNIT_FORMAT (g_object_get_data (G_OBJECT (outfmt), 
-                "convert_to_rgb8:wfmt"));
-        if (!wfmt) return -1;
-        return cam_unit_stream_init (self->worker, wfmt);
-    } else {
+    if (!self->workers)
         return -1;
+
+    // Each worker's output formats are only known once the worker before
+    // it is streaming, so start them in order.  The planner set each
+    // worker's preferred format to the output of its step in the plan.
+    for (GList *witer=self->workers; witer; witer=witer->next) {
+        if (0 != cam_unit_stream_init (CAM_UNIT (witer->data), NULL)) {
+            _stream_shutdown (super);
+            return -1;
+        }
     }
+    return 0;
 }
 
 static int
 _stream_shutdown (CamUnit * super)
 {
     CamConvertToRgb8 *self = (CamConvertToRgb8*)super;
-    if (self->worker) {
-        return cam_unit_stream_shutdown (self->worker);
-    } else {
-        return 0;
+    int status = 0;
+    for (GList *witer=self->workers; witer; witer=witer->next) {
+        if (0 != cam_unit_stream_shutdown (CAM_UNIT (witer->data)))
+            status = -1;
     }
+    return status;
 }
 
 static void 
@@ -138,36 +158,26 @@ on_worker_frame_ready (CamUnit *worker, const CamFrameBuffer *inbuf,
         const CamUnitFormat *infmt, void *user_data)
 {
     CamUnit *super = CAM_UNIT (user_data);
-    if (infmt->pixelformat == CAM_PIXEL_FORMAT_RGB) {
-        cam_unit_produce_frame (super, inbuf, infmt);
+    const CamUnitFormat *outfmt = cam_unit_get_output_format(super);
+    if (infmt->pixelformat != CAM_PIXEL_FORMAT_RGB || !outfmt)
         return;
-    } else if (infmt->pixelformat == CAM_PIXEL_FORMAT_BGRA) {
-        int buf_sz = infmt->width*infmt->height*3;
-        CamFrameBuffer *outbuf = cam_framebuffer_new_alloc (buf_sz);
-        const CamUnitFormat *outfmt = cam_unit_get_output_format(super);
-        cam_pixel_convert_8u_bgra_to_8u_rgb(outbuf->data, 
-                outfmt->row_stride, infmt->width, infmt->height,
-                inbuf->data, infmt->row_stride);
 
-        cam_framebuffer_copy_metadata (outbuf, inbuf);
-        outbuf->bytesused = buf_sz;
-        cam_unit_produce_frame (super, outbuf, outfmt);
-        g_object_unref (outbuf);
+    if (infmt->row_stride == outfmt->row_stride) {
+        cam_unit_produce_frame (super, inbuf, outfmt);
         return;
     }
-}
 
-static void
-_maybe_set_worker(CamConvertToRgb8 *self, const char *unit_id)
-{
-    if(!self->worker && 
-        cam_unit_manager_find_unit_description(self->manager, unit_id)) {
-        self->worker = 
-            cam_unit_manager_create_unit_by_id(self->manager, unit_id);
-        if(self->worker) {
-            dbg(DBG_DRIVER, "using worker unit [%s]\n", unit_id);
-        }
+    // the last worker pads its rows differently than advertised
+    int buf_sz = outfmt->height * outfmt->row_stride;
+    CamFrameBuffer *outbuf = cam_framebuffer_new_alloc (buf_sz);
+    for (int i=0; i<outfmt->height; i++) {
+        memcpy (outbuf->data + i * outfmt->row_stride,
+                inbuf->data + i * infmt->row_stride, outfmt->width * 3);
     }
+    cam_framebuffer_copy_metadata (outbuf, inbuf);
+    outbuf->bytesused = buf_sz;
+    cam_unit_produce_frame (super, outbuf, outfmt);
+    g_object_unref (outbuf);
 }
 
 static void
@@ -177,12 +187,7 @@ on_input_format_changed (CamUnit *super, const CamUnitFormat *infmt)
     gboolean was_streaming = cam_unit_is_streaming(super);
     cam_unit_stream_shutdown (super);
 
-    if (self->worker) {
-        g_signal_handlers_disconnect_by_func (self->worker, 
-                on_worker_frame_ready, self);
-        g_object_unref (self->worker);
-        self->worker = NULL;
-    }
+    _free_workers (self);
     cam_unit_remove_all_output_formats (super);
     if (!infmt) return;
     if (infmt->pixelformat == CAM_PIXEL_FORMAT_RGB) {
@@ -190,68 +195,28 @@ on_input_format_changed (CamUnit *super, const CamUnitFormat *infmt)
                 infmt->name, infmt->width, infmt->height, 
                 infmt->row_stride);
     } else {
-        switch (infmt->pixelformat) {
-            case CAM_PIXEL_FORMAT_I420:
-            case CAM_PIXEL_FORMAT_GRAY:
-            case CAM_PIXEL_FORMAT_YUYV:
-            case CAM_PIXEL_FORMAT_UYVY:
-            case CAM_PIXEL_FORMAT_BGRA:
-            case CAM_PIXEL_FORMAT_BGR:
-                _maybe_set_worker(self, "convert.colorspace");
-                break;
-            case CAM_PIXEL_FORMAT_MJPEG:
-                // use the Intel IPP library for JPEG decompression if it
-                // is available
-                _maybe_set_worker(self, "ipp.jpeg_decompress");
-
-                // if not, then try the Framewave library.
-                _maybe_set_worker(self, "framewave.jpeg_decompress");
-
-                // Lastly, fall back to libjpeg
-                _maybe_set_worker(self, "convert.jpeg_decompress");
-                break;
-            case CAM_PIXEL_FORMAT_BAYER_BGGR:
-            case CAM_PIXEL_FORMAT_BAYER_RGGB:
-            case CAM_PIXEL_FORMAT_BAYER_GBRG:
-            case CAM_PIXEL_FORMAT_BAYER_GRBG:
-                _maybe_set_worker(self, "convert.fast_debayer");
-                break;
-            default:
-                return;
-        }
-
-        if(!self->worker) {
+        // find the cheapest sequence of units that converts to RGB.  The
+        // planner is rebuilt each time so that it sees newly loaded plugins.
+        CamPixelFormat rgb = CAM_PIXEL_FORMAT_RGB;
+        CamFormatPlanner *planner = cam_format_planner_new (self->manager);
+        int status = cam_format_planner_create_units (planner, self->manager,
+                cam_unit_get_input (super), infmt->pixelformat, &rgb, 1,
+                &self->workers);
+        cam_format_planner_destroy (planner);
+        if (0 != status || !self->workers) {
+            dbg (DBG_FILTER, "no conversion from %s to RGB\n",
+                    cam_pixel_format_nickname (infmt->pixelformat));
             return;
         }
-        g_object_ref_sink (self->worker);
 
-        g_signal_connect (G_OBJECT (self->worker), "frame-ready",
+        CamUnit *last = CAM_UNIT (g_list_last (self->workers)->data);
+        g_signal_connect (G_OBJECT (last), "frame-ready",
                 G_CALLBACK (on_worker_frame_ready), self);
-        cam_unit_set_input (self->worker, cam_unit_get_input(super));
-
-        GList * worker_formats = cam_unit_get_output_formats (self->worker);
-        for (GList *witer=worker_formats; witer; witer=witer->next) {
-            CamUnitFormat *wfmt = CAM_UNIT_FORMAT (witer->data);
-            if (wfmt->pixelformat == CAM_PIXEL_FORMAT_RGB) {
-                CamUnitFormat *my_fmt = cam_unit_add_output_format (super,
-                        wfmt->pixelformat, wfmt->name, wfmt->width, 
-                        wfmt->height, wfmt->row_stride);
-                g_object_set_data (G_OBJECT (my_fmt), "convert_to_rgb8:wfmt", 
-                        wfmt);
 
-            } else if (! strcmp(cam_unit_get_id(self->worker), 
-                        "convert.fast_debayer") &&
-                    wfmt->pixelformat == CAM_PIXEL_FORMAT_BGRA) {
-                // hack.  fast debayer filter only produces BGRA, so just do an
-                // internal conversion to RGB later on
-                CamUnitFormat *my_fmt = cam_unit_add_output_format (super,
-                        CAM_PIXEL_FORMAT_RGB, wfmt->name, wfmt->width, 
-                        wfmt->height, wfmt->width*3);
-                g_object_set_data (G_OBJECT (my_fmt), "convert_to_rgb8:wfmt", 
-                        wfmt);
-            }
-        }
-        g_list_free (worker_formats);
+        // the intermediate formats aren't known until the workers are
+        // streaming, but none of the conversions change the image size.
+        cam_unit_add_output_format (super, CAM_PIXEL_FORMAT_RGB,
+                infmt->name, infmt->width, infmt->height, infmt->width * 3);
     }
 
     if (was_streaming) {
@@ -1,8 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 #include "camunits/plugin.h"
+#include "camunits/thread_pool.h"
 #include "camunits/dbg.h"
 
 #ifdef __APPLE__
@@ -35,12 +37,39 @@ static CamPixelFormat _option_to_pfmt[] = {
     CAM_PIXEL_FORMAT_BAYER_RGGB
 };
 
+static CamPixelFormat _option_to_be_pfmt16[] = {
+    CAM_PIXEL_FORMAT_BE_BAYER16_GBRG,
+    CAM_PIXEL_FORMAT_BE_BAYER16_GRBG,
+    CAM_PIXEL_FORMAT_BE_BAYER16_BGGR,
+    CAM_PIXEL_FORMAT_BE_BAYER16_RGGB
+};
+
+static CamPixelFormat _option_to_le_pfmt16[] = {
+    CAM_PIXEL_FORMAT_LE_BAYER16_GBRG,
+    CAM_PIXEL_FORMAT_LE_BAYER16_GRBG,
+    CAM_PIXEL_FORMAT_LE_BAYER16_BGGR,
+    CAM_PIXEL_FORMAT_LE_BAYER16_RGGB
+};
+
+enum {
+    CURVE_LINEAR = 0,
+    CURVE_GAMMA
+};
+
 typedef struct _CamFastBayerFilter {
     CamUnit parent;
     CamUnitControl *bayer_tile_ctl;
+    CamUnitControl *bit_depth_ctl;
+    CamUnitControl *curve_ctl;
 
     uint8_t * aligned_buffer;
 
+    // 16-bit input is reduced to 8 bits here before interpolation
+    uint8_t * reduced;
+    int reduced_stride;
+    uint8_t * lut;
+    int lut_depth;
+
     uint8_t * planes[4];
     int plane_stride;
 } CamFastBayerFilter;
@@ -88,6 +117,25 @@ is_bayer_pixel_format(CamPixelFormat pfmt)
             pfmt == CAM_PIXEL_FORMAT_BAYER_RGGB);
 }
 
+static int
+is_be_bayer16_pixel_format(CamPixelFormat pfmt)
+{
+    return (pfmt == CAM_PIXEL_FORMAT_BE_BAYER16_GBRG ||
+            pfmt == CAM_PIXEL_FORMAT_BE_BAYER16_GRBG ||
+            pfmt == CAM_PIXEL_FORMAT_BE_BAYER16_BGGR ||
+            pfmt == CAM_PIXEL_FORMAT_BE_BAYER16_RGGB);
+}
+
+static int
+is_bayer16_pixel_format(CamPixelFormat pfmt)
+{
+    return (is_be_bayer16_pixel_format(pfmt) ||
+            pfmt == CAM_PIXEL_FORMAT_LE_BAYER16_GBRG ||
+            pfmt == CAM_PIXEL_FORMAT_LE_BAYER16_GRBG ||
+            pfmt == CAM_PIXEL_FORMAT_LE_BAYER16_BGGR ||
+            pfmt == CAM_PIXEL_FORMAT_LE_BAYER16_RGGB);
+}
+
 static void
 cam_fast_bayer_filter_init( CamFastBayerFilter *self )
 {
@@ -106,11 +154,26 @@ cam_fast_bayer_filter_init( CamFastBayerFilter *self )
     self->bayer_tile_ctl = cam_unit_add_control_enum (super, "tiling", 
             "Tiling", OPTION_GBRG, 1, tiling_entries);
 
+    CamUnitControlEnumValue curve_entries[] = {
+        { CURVE_LINEAR, "Linear", 1 },
+        { CURVE_GAMMA, "Gamma 2.2", 1 },
+        { 0, NULL, 0 }
+    };
+
+    // only used for 16-bit input
+    self->bit_depth_ctl = cam_unit_add_control_int (super, "bit-depth",
+            "Bit Depth (16-bit input)", 8, 16, 1, 16, 1);
+    self->curve_ctl = cam_unit_add_control_enum (super, "tone-curve",
+            "Tone Curve (16-bit input)", CURVE_LINEAR, 1, curve_entries);
+
     for (int i = 0; i < 4; i++) {
         self->planes[i] = NULL;
     }
 
     self->aligned_buffer = NULL;
+    self->reduced = NULL;
+    self->lut = NULL;
+    self->lut_depth = 0;
 
     g_signal_connect (G_OBJECT (self), "input-format-changed",
             G_CALLBACK (on_input_format_changed), self);
@@ -132,19 +195,28 @@ cam_fast_bayer_filter_stream_init (CamUnit * super, const CamUnitFormat * fmt)
     CamUnit * input = cam_unit_get_input(super);
     const CamUnitFormat * infmt = cam_unit_get_output_format(input);
 
-    if(is_bayer_pixel_format(infmt->pixelformat)) {
+    if(is_bayer_pixel_format(infmt->pixelformat) ||
+       is_bayer16_pixel_format(infmt->pixelformat)) {
         int tiling = OPTION_GBRG;
         switch (infmt->pixelformat) {
             case CAM_PIXEL_FORMAT_BAYER_GBRG:
+            case CAM_PIXEL_FORMAT_BE_BAYER16_GBRG:
+            case CAM_PIXEL_FORMAT_LE_BAYER16_GBRG:
                 tiling = OPTION_GBRG;
                 break;
             case CAM_PIXEL_FORMAT_BAYER_GRBG:
+            case CAM_PIXEL_FORMAT_BE_BAYER16_GRBG:
+            case CAM_PIXEL_FORMAT_LE_BAYER16_GRBG:
                 tiling = OPTION_GRBG;
                 break;
             case CAM_PIXEL_FORMAT_BAYER_BGGR:
+            case CAM_PIXEL_FORMAT_BE_BAYER16_BGGR:
+            case CAM_PIXEL_FORMAT_LE_BAYER16_BGGR:
                 tiling = OPTION_BGGR;
                 break;
             case CAM_PIXEL_FORMAT_BAYER_RGGB:
+            case CAM_PIXEL_FORMAT_BE_BAYER16_RGGB:
+            case CAM_PIXEL_FORMAT_LE_BAYER16_RGGB:
                 tiling = OPTION_RGGB;
                 break;
             default:
@@ -159,7 +231,18 @@ cam_fast_bayer_filter_stream_init (CamUnit * super, const CamUnitFormat * fmt)
 
     const CamUnitFormat *outfmt = cam_unit_get_output_format(super);
 
-    if (outfmt->pixelformat == CAM_PIXEL_FORMAT_GRAY) {
+    if (is_bayer16_pixel_format(infmt->pixelformat)) {
+        // a multiple of 32 bytes lets cam_pixel_split_bayer_planes_8u
+        // handle whole rows without its slower last-column fix-up
+        self->reduced_stride = (infmt->width + 0x1f)&(~0x1f);
+        self->reduced = MALLOC_ALIGNED (self->reduced_stride * infmt->height);
+    }
+
+    if (outfmt->pixelformat == CAM_PIXEL_FORMAT_BE_RGB16 ||
+        outfmt->pixelformat == CAM_PIXEL_FORMAT_LE_RGB16) {
+        // interpolated directly from the 16-bit input
+    }
+    else if (outfmt->pixelformat == CAM_PIXEL_FORMAT_GRAY) {
         int width = outfmt->width;
         int height = outfmt->height;
         self->plane_stride = ((width + 0xf)&(~0xf)) + 32;
@@ -195,6 +278,12 @@ cam_fast_bayer_filter_stream_shutdown (CamUnit * super)
     free(self->aligned_buffer);
     self->aligned_buffer = NULL;
 
+    free(self->reduced);
+    self->reduced = NULL;
+    free(self->lut);
+    self->lut = NULL;
+    self->lut_depth = 0;
+
     return 0;
 }
 
@@ -210,6 +299,74 @@ cam_fast_bayer_filter_new()
             g_object_new(cam_fast_bayer_filter_get_type(), NULL);
 }
 
+/* Reduces a 16-bit Bayer image to 8 bits, either by shifting or through a
+ * gamma curve, according to the bit-depth and tone-curve controls. */
+static void
+reduce_to_8u (CamFastBayerFilter *self, const CamFrameBuffer *inbuf,
+        const CamUnitFormat *infmt)
+{
+    int depth = cam_unit_control_get_int(self->bit_depth_ctl);
+    int big_endian = is_be_bayer16_pixel_format(infmt->pixelformat);
+
+    if (cam_unit_control_get_enum(self->curve_ctl) == CURVE_LINEAR) {
+        cam_pixel_convert_16u_gray_to_8u_gray (self->reduced,
+                self->reduced_stride, infmt->width, infmt->height,
+                inbuf->data, infmt->row_stride, depth - 8, big_endian);
+        return;
+    }
+
+    int lut_size = 1 << depth;
+    if (self->lut_depth != depth) {
+        free(self->lut);
+        self->lut = malloc(lut_size);
+        for (int i = 0; i < lut_size; i++)
+            self->lut[i] = 255 * pow((double)i / (lut_size - 1), 1 / 2.2) + 0.5;
+        self->lut_depth = depth;
+    }
+    cam_pixel_apply_lut_16u_to_8u (self->reduced, self->reduced_stride,
+            infmt->width, infmt->height, inbuf->data, infmt->row_stride,
+            self->lut, lut_size, big_endian);
+}
+
+/* Interpolation only reads the rows next to the one being interpolated, and
+ * the planes are bordered before it starts, so it is split into bands of
+ * rows on the shared thread pool.  Bands start on even rows, so that each
+ * band begins on the same Bayer row as the image. */
+#define BAND_GRAIN_ROWS 16
+
+typedef struct _interp_job_t {
+    CamFastBayerFilter *self;
+    uint8_t **planes;
+    uint8_t *dst;
+    const CamUnitFormat *outfmt;
+    CamPixelFormat tiling;
+} interp_job_t;
+
+static void
+_interpolate_gray_band (int start, int end, void *user_data)
+{
+    interp_job_t *job = (interp_job_t*) user_data;
+    cam_pixel_bayer_interpolate_to_8u_gray (
+            job->planes[0] + start * job->self->plane_stride,
+            job->self->plane_stride,
+            job->dst + start * job->outfmt->row_stride,
+            job->outfmt->row_stride, job->outfmt->width, end - start,
+            job->tiling);
+}
+
+static void
+_interpolate_bgra_band (int start, int end, void *user_data)
+{
+    interp_job_t *job = (interp_job_t*) user_data;
+    uint8_t *planes[4];
+    for (int i = 0; i < 4; i++)
+        planes[i] = job->planes[i] + (start / 2) * job->self->plane_stride;
+    cam_pixel_bayer_interpolate_to_8u_bgra (planes, job->self->plane_stride,
+            job->dst + start * job->outfmt->row_stride,
+            job->outfmt->row_stride, job->outfmt->width, end - start,
+            job->tiling);
+}
+
 static void 
 on_input_frame_ready (CamUnit *super, const CamFrameBuffer *inbuf,
         const CamUnitFormat *infmt)
@@ -219,13 +376,35 @@ on_input_frame_ready (CamUnit *super, const CamFrameBuffer *inbuf,
     const CamUnitFormat *outfmt = cam_unit_get_output_format(super);
 
     int out_buf_size = outfmt->height * outfmt->row_stride;
+    if (outfmt->pixelformat == CAM_PIXEL_FORMAT_I420)
+        out_buf_size = out_buf_size * 3 / 2;
     int in_buf_size = infmt->height * infmt->row_stride;
     CamFrameBuffer *outbuf = cam_framebuffer_new_alloc (out_buf_size);
 
     const uint8_t *in_data = inbuf->data;
+    int in_stride = infmt->row_stride;
+
+    int tiling_option = cam_unit_control_get_enum(self->bayer_tile_ctl);
+    CamPixelFormat tiling = _option_to_pfmt[tiling_option];
 
+    if (is_bayer16_pixel_format(infmt->pixelformat)) {
+        if (outfmt->pixelformat == CAM_PIXEL_FORMAT_BE_RGB16 ||
+            outfmt->pixelformat == CAM_PIXEL_FORMAT_LE_RGB16) {
+            CamPixelFormat pfmt16 =
+                is_be_bayer16_pixel_format(infmt->pixelformat) ?
+                _option_to_be_pfmt16[tiling_option] :
+                _option_to_le_pfmt16[tiling_option];
+            cam_pixel_convert_bayer16_to_16u_rgb (outbuf->data,
+                    outfmt->row_stride, outfmt->width, outfmt->height,
+                    inbuf->data, infmt->row_stride, pfmt16);
+            goto produce;
+        }
+        reduce_to_8u (self, inbuf, infmt);
+        in_data = self->reduced;
+        in_stride = self->reduced_stride;
+    }
     // if the input buffer is not 16-byte aligned, then make an aligned copy.
-    if(!CAM_IS_ALIGNED16(inbuf->data)) {
+    else if(!CAM_IS_ALIGNED16(inbuf->data)) {
         if(! self->aligned_buffer) {
             self->aligned_buffer = MALLOC_ALIGNED(in_buf_size);
         }
@@ -233,23 +412,20 @@ on_input_frame_ready (CamUnit *super, const CamFrameBuffer *inbuf,
         in_data = self->aligned_buffer;
     }
 
-    int tiling_option = cam_unit_control_get_enum(self->bayer_tile_ctl);
-    CamPixelFormat tiling = _option_to_pfmt[tiling_option];
-
     if (outfmt->pixelformat == CAM_PIXEL_FORMAT_GRAY) {
         uint8_t * plane = self->planes[0] + 2*self->plane_stride + 16;
         int i;
         for (i = 0; i < outfmt->height; i++) {
             uint8_t * drow = plane + i*self->plane_stride;
-            const uint8_t * srow = in_data + i*infmt->row_stride;
+            const uint8_t * srow = in_data + i*in_stride;
             memcpy (drow, srow, infmt->width);
             //memset (drow, 128, infmt->width);
         }
         cam_pixel_replicate_bayer_border_8u (plane, self->plane_stride,
                 outfmt->width, outfmt->height);
-        cam_pixel_bayer_interpolate_to_8u_gray (plane, self->plane_stride,
-                outbuf->data, outfmt->row_stride, outfmt->width,
-                outfmt->height, tiling);
+        interp_job_t job = { self, &plane, outbuf->data, outfmt, tiling };
+        cam_thread_pool_parallel_for (cam_thread_pool_get_default (), 0,
+                outfmt->height, BAND_GRAIN_ROWS, _interpolate_gray_band, &job);
 
         //uint8_t * d = outbuf->data + 8*outfmt->row_stride;
         //printf ("%d %d\n", d[0], d[1]);
@@ -266,18 +442,28 @@ on_input_frame_ready (CamUnit *super, const CamFrameBuffer *inbuf,
         int p_height = outfmt->height / 2;
 
         cam_pixel_split_bayer_planes_8u (planes, self->plane_stride,
-                in_data, infmt->row_stride, p_width, p_height);
+                in_data, in_stride, p_width, p_height);
         int i;
         for (i = 0; i < 4; i++)
             cam_pixel_replicate_border_8u (planes[i], self->plane_stride,
                     p_width, p_height);
 
-        cam_pixel_bayer_interpolate_to_8u_bgra (planes, self->plane_stride,
-                outbuf->data, outfmt->row_stride, outfmt->width, outfmt->height,
-                tiling);
+        if (outfmt->pixelformat == CAM_PIXEL_FORMAT_I420)
+            cam_pixel_bayer_interpolate_to_8u_i420 (planes,
+                    self->plane_stride, outbuf->data, outfmt->row_stride,
+                    outfmt->width, outfmt->height, tiling);
+        else {
+            interp_job_t job = { self, planes, outbuf->data, outfmt, tiling };
+            cam_thread_pool_parallel_for (cam_thread_pool_get_default (), 0,
+                    outfmt->height, BAND_GRAIN_ROWS, _interpolate_bgra_band,
+                    &job);
+        }
     }
 
+produce:
     cam_framebuffer_copy_metadata(outbuf, inbuf);
+    // the I420 planes follow one another
+    cam_framebuffer_set_planes (outbuf, 0, NULL, NULL);
     outbuf->bytesused = out_buf_size;
 
     cam_unit_produce_frame (super, outbuf, outfmt);
@@ -292,18 +478,26 @@ on_input_format_changed (CamUnit *super, const CamUnitFormat *infmt)
     if (!infmt) return;
 
     if (! is_bayer_pixel_format(infmt->pixelformat) &&
+        ! is_bayer16_pixel_format(infmt->pixelformat) &&
           infmt->pixelformat != CAM_PIXEL_FORMAT_GRAY) 
         return;
 
-    CamPixelFormat outfmts[2] = {
+    CamPixelFormat outfmts[4] = {
         CAM_PIXEL_FORMAT_BGRA,
-        CAM_PIXEL_FORMAT_GRAY
+        CAM_PIXEL_FORMAT_GRAY,
+        CAM_PIXEL_FORMAT_I420,
+        is_be_bayer16_pixel_format(infmt->pixelformat) ?
+            CAM_PIXEL_FORMAT_BE_RGB16 : CAM_PIXEL_FORMAT_LE_RGB16
     };
+    int noutfmts = is_bayer16_pixel_format(infmt->pixelformat) ? 4 : 3;
 
-    for (int i=0; i<2; i++) {
+    for (int i=0; i<noutfmts; i++) {
         CamPixelFormat out_pixelformat = outfmts[i];
 
+        // the stride of I420 is that of its Y plane
         int stride = infmt->width * cam_pixel_format_bpp(out_pixelformat) / 8;
+        if (out_pixelformat == CAM_PIXEL_FORMAT_I420)
+            stride = infmt->width;
 
         /* Stride must be 128-byte aligned */
         stride = (stride + 0x7f)&(~0x7f);
@@ -41,6 +41,7 @@ typedef struct _CamInputLog {
     CamUnitControl *adv_mode_ctl;
     CamUnitControl *adv_speed_ctl;
     CamUnitControl *fname_ctl;
+    CamUnitControl *stream_ctl;
     CamUnitControl *loop_ctl;
     CamUnitControl *loop_start_ctl;
     CamUnitControl *loop_end_ctl;
@@ -80,6 +81,7 @@ static CamUnit * driver_create_unit (CamUnitDriver *super,
         const CamUnitDescription * udesc);
 
 static int _log_set_file (CamInputLog *self, const char *fname);
+static int _log_load_stream (CamInputLog *self);
 
 static void
 cam_input_log_driver_init (CamInputLogDriver *self)
@@ -144,6 +146,10 @@ cam_input_log_init (CamInputLog *self)
     self->fname_ctl = cam_unit_add_control_string (super, "filename", 
             "Filename", "", 1);
     cam_unit_control_set_ui_hints (self->fname_ctl, CAM_UNIT_CONTROL_FILENAME);
+    self->stream_ctl = cam_unit_add_control_int (super,
+            "stream", "Stream", 0, 255, 1, 0, 1);
+    cam_unit_control_set_ui_hints (self->stream_ctl,
+            CAM_UNIT_CONTROL_SPINBUTTON);
 
     self->frame_ctl = cam_unit_add_control_int (super,
             "frame", "Frame", 0, 1, 1, 0, 0);
@@ -217,15 +223,34 @@ cam_input_log_new (const char *fname)
 static int 
 _log_set_file (CamInputLog *self, const char *fname)
 {
-    CamUnit *super = CAM_UNIT (self);
     if (self->camlog) cam_log_destroy (self->camlog);
-    cam_unit_remove_all_output_formats (super);
 
     self->camlog = cam_log_new (fname, "r");
     if (!self->camlog) {
-        goto fail;
+        cam_unit_remove_all_output_formats (CAM_UNIT (self));
+        cam_unit_control_modify_int (self->frame_ctl, 0, 1, 1, 0);
+        return -1;
     }
 
+    // keep playing the selected stream if the new log has it, and otherwise
+    // the stream of the first frame in the log
+    int stream = cam_unit_control_get_int (self->stream_ctl);
+    if (stream != cam_log_get_stream (self->camlog) &&
+            0 != cam_log_set_stream (self->camlog, stream))
+        cam_unit_control_force_set_int (self->stream_ctl,
+                cam_log_get_stream (self->camlog));
+
+    return _log_load_stream (self);
+}
+
+/* Sets the output format and the frame controls to those of the stream
+ * being read from the log. */
+static int
+_log_load_stream (CamInputLog *self)
+{
+    CamUnit *super = CAM_UNIT (self);
+    cam_unit_remove_all_output_formats (super);
+
     CamLogFrameFormat format;
     if (cam_log_get_frame_format (self->camlog, &format) < 0) {
         goto fail;
@@ -441,6 +466,23 @@ log_try_set_control (CamUnit *super, const CamUnitControl *ctl,
             g_value_set_string (actual, "");
             return FALSE;
         }
+    } else if (ctl == self->stream_ctl) {
+        if (! self->camlog) {
+            g_value_copy (proposed, actual);
+            return TRUE;
+        }
+        if (0 != cam_log_set_stream (self->camlog,
+                    g_value_get_int (proposed))) {
+            return FALSE;
+        }
+        if (cam_unit_is_streaming(super)) {
+            cam_unit_stream_shutdown (super);
+        }
+        g_value_copy (proposed, actual);
+        if (0 == _log_load_stream (self)) {
+            cam_unit_stream_init (super, NULL);
+        }
+        return TRUE;
     } else if(ctl == self->loop_ctl) {
         int loop_enable = g_value_get_boolean(proposed);
         cam_unit_control_set_enabled(self->loop_start_ctl, loop_enable);
@@ -0,0 +1,453 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <camunits/plugin.h>
+#include <camunits/dbg.h>
+#include <camunits/shm.h>
+
+#define err(args...) fprintf (stderr, args)
+
+#define MAX_QUEUED_FRAMES 4
+#define REATTACH_INTERVAL_USEC 500000
+
+typedef struct _CamInputShmDriver {
+    CamUnitDriver parent;
+} CamInputShmDriver;
+
+typedef struct _CamInputShmDriverClass {
+    CamUnitDriverClass parent_class;
+} CamInputShmDriverClass;
+
+typedef struct _CamInputShm {
+    CamUnit parent;
+
+    CamUnitControl *name_ctl;
+    CamUnitControl *dropped_ctl;
+
+    // as long as the reader thread is active, it "owns" reader
+    CamShmReader *reader;
+    CamShmFrameFormat format;
+    uint8_t *metadata_buf;
+
+    GThread *reader_thread;
+    GAsyncQueue *frame_q;
+    int notify_fds[2];
+    volatile int quit;
+    volatile int format_changed;
+
+    // frames dropped because the queue was full, or by readers that have
+    // since been replaced.  Only touched while the reader thread is not
+    // running, or by the reader thread itself.
+    int base_dropped;
+    // base_dropped plus the frames dropped by the current reader.  The
+    // reader thread updates it, so that the main thread never has to look
+    // at reader while the reader thread might replace it.
+    volatile int dropped;
+} CamInputShm;
+
+typedef struct _CamInputShmClass {
+    CamUnitClass parent_class;
+} CamInputShmClass;
+
+GType cam_input_shm_driver_get_type (void);
+GType cam_input_shm_get_type (void);
+
+static CamUnitDriver * cam_input_shm_driver_new (void);
+static CamInputShm * cam_input_shm_new (const char *name);
+
+CAM_PLUGIN_TYPE(CamInputShmDriver, cam_input_shm_driver, CAM_TYPE_UNIT_DRIVER);
+CAM_PLUGIN_TYPE(CamInputShm, cam_input_shm, CAM_TYPE_UNIT);
+
+/* These next two functions are required as entry points for the
+ * plug-in API. */
+void cam_plugin_initialize(GTypeModule * module);
+void cam_plugin_initialize(GTypeModule * module)
+{
+    cam_input_shm_driver_register_type(module);
+    cam_input_shm_register_type(module);
+}
+
+CamUnitDriver * cam_plugin_create(GTypeModule * module);
+CamUnitDriver * cam_plugin_create(GTypeModule * module)
+{
+    return cam_input_shm_driver_new();
+}
+
+// ============== CamInputShmDriver ===============
+
+static CamUnit * driver_create_unit (CamUnitDriver *super,
+        const CamUnitDescription * udesc);
+
+static void
+cam_input_shm_driver_init (CamInputShmDriver *self)
+{
+    dbg (DBG_DRIVER, "shm driver constructor\n");
+    CamUnitDriver *super = CAM_UNIT_DRIVER (self);
+    cam_unit_driver_set_name (super, "input", "shm");
+
+    cam_unit_driver_add_unit_description (super,
+            "Shared Memory Input", NULL, CAM_UNIT_EVENT_METHOD_FD);
+}
+
+static void
+cam_input_shm_driver_class_init (CamInputShmDriverClass *klass)
+{
+    dbg (DBG_DRIVER, "shm driver class initializer\n");
+    klass->parent_class.create_unit = driver_create_unit;
+}
+
+CamUnitDriver *
+cam_input_shm_driver_new ()
+{
+    return
+        CAM_UNIT_DRIVER (g_object_new (cam_input_shm_driver_get_type(), NULL));
+}
+
+static CamUnit *
+driver_create_unit (CamUnitDriver *super,
+        const CamUnitDescription * udesc)
+{
+    dbg (DBG_DRIVER, "shm driver creating new unit\n");
+
+    g_assert (cam_unit_description_get_driver(udesc) == super);
+    const char *unit_id = cam_unit_description_get_unit_id(udesc);
+
+    char **words = g_strsplit (unit_id, ":", 2);
+    CamInputShm *result = cam_input_shm_new (words[1]);
+    g_strfreev (words);
+
+    return CAM_UNIT (result);
+}
+
+// ============== CamInputShm ===============
+static void shm_finalize (GObject *obj);
+static int shm_stream_init (CamUnit *super, const CamUnitFormat *fmt);
+static int shm_stream_shutdown (CamUnit *super);
+static gboolean shm_try_produce_frame (CamUnit * super);
+static int shm_get_fileno (CamUnit *super);
+static gboolean shm_try_set_control (CamUnit *super,
+        const CamUnitControl *ctl, const GValue *proposed, GValue *actual);
+static int _shm_attach (CamInputShm *self, const char *name);
+static void * reader_thread (void *user_data);
+
+static void
+cam_input_shm_init (CamInputShm *self)
+{
+    dbg (DBG_INPUT, "shm constructor\n");
+    CamUnit *super = CAM_UNIT (self);
+
+    self->reader = NULL;
+    self->metadata_buf = NULL;
+    self->reader_thread = NULL;
+    self->frame_q = g_async_queue_new ();
+    self->quit = 0;
+    self->format_changed = 0;
+    self->base_dropped = 0;
+    self->dropped = 0;
+
+    // the reader thread writes a byte to this pipe for each frame queued,
+    // which gives the unit a file descriptor to poll on.
+    if (0 != pipe (self->notify_fds)) {
+        perror ("pipe");
+        self->notify_fds[0] = self->notify_fds[1] = -1;
+    } else {
+        fcntl (self->notify_fds[0], F_SETFL, O_NONBLOCK);
+        fcntl (self->notify_fds[1], F_SETFL, O_NONBLOCK);
+    }
+
+    self->name_ctl = cam_unit_add_control_string (super, "name",
+            "Ring Name", "", 1);
+    self->dropped_ctl = cam_unit_add_control_int (super, "dropped",
+            "Dropped Frames", 0, G_MAXINT, 1, 0, 0);
+}
+
+static void
+cam_input_shm_class_init (CamInputShmClass *klass)
+{
+    dbg (DBG_INPUT, "shm class initializer\n");
+    GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+    gobject_class->finalize = shm_finalize;
+
+    klass->parent_class.stream_init = shm_stream_init;
+    klass->parent_class.stream_shutdown = shm_stream_shutdown;
+    klass->parent_class.try_produce_frame = shm_try_produce_frame;
+    klass->parent_class.get_fileno = shm_get_fileno;
+    klass->parent_class.try_set_control = shm_try_set_control;
+    if (!g_thread_supported ()) g_thread_init (NULL);
+}
+
+static void
+shm_finalize (GObject *obj)
+{
+    dbg (DBG_INPUT, "shm finalize\n");
+    CamInputShm *self = (CamInputShm*)obj;
+    CamUnit *super = CAM_UNIT (obj);
+
+    if (cam_unit_is_streaming (super))
+        shm_stream_shutdown (super);
+    if (self->reader)
+        cam_shm_reader_destroy (self->reader);
+    g_async_queue_unref (self->frame_q);
+    if (self->notify_fds[0] >= 0) {
+        close (self->notify_fds[0]);
+        close (self->notify_fds[1]);
+    }
+    free (self->metadata_buf);
+    G_OBJECT_CLASS (cam_input_shm_parent_class)->finalize (obj);
+}
+
+CamInputShm *
+cam_input_shm_new (const char *name)
+{
+    CamInputShm *self =
+        (CamInputShm*) (g_object_new (cam_input_shm_get_type(), NULL));
+
+    if (name && strlen (name)) {
+        if (0 == _shm_attach (self, name)) {
+            cam_unit_control_force_set_string (self->name_ctl, name);
+        }
+    }
+    return self;
+}
+
+static int
+_shm_attach (CamInputShm *self, const char *name)
+{
+    CamUnit *super = CAM_UNIT (self);
+    if (self->reader) {
+        self->base_dropped += cam_shm_reader_get_dropped (self->reader);
+        cam_shm_reader_destroy (self->reader);
+        self->reader = NULL;
+    }
+    cam_unit_remove_all_output_formats (super);
+
+    self->reader = cam_shm_reader_new (name);
+    if (!self->reader) {
+        err ("InputShm: unable to attach to ring [%s]\n", name);
+        return -1;
+    }
+
+    cam_shm_reader_get_format (self->reader, &self->format);
+    free (self->metadata_buf);
+    self->metadata_buf =
+        malloc (cam_shm_reader_get_max_metadata_len (self->reader) + 1);
+
+    cam_unit_add_output_format (super, self->format.pixelformat,
+            strlen (self->format.name) ? self->format.name : NULL,
+            self->format.width, self->format.height,
+            self->format.row_stride);
+    return 0;
+}
+
+static void
+_flush_frame_q (CamInputShm *self)
+{
+    CamFrameBuffer *buf;
+    while ((buf = g_async_queue_try_pop (self->frame_q)))
+        g_object_unref (buf);
+    char discard[64];
+    while (read (self->notify_fds[0], discard, sizeof (discard)) > 0);
+}
+
+static int
+shm_stream_init (CamUnit *super, const CamUnitFormat *fmt)
+{
+    dbg (DBG_INPUT, "shm stream init\n");
+    CamInputShm *self = (CamInputShm*)super;
+    if (!self->reader || self->notify_fds[0] < 0)
+        return -1;
+
+    _flush_frame_q (self);
+    // start with the next frame published, rather than with the frames that
+    // were published while the unit was stopped
+    cam_shm_reader_resync (self->reader);
+    self->quit = 0;
+    self->format_changed = 0;
+    self->reader_thread = g_thread_create (reader_thread, self, TRUE, NULL);
+    return self->reader_thread ? 0 : -1;
+}
+
+static int
+shm_stream_shutdown (CamUnit *super)
+{
+    dbg (DBG_INPUT, "shm stream shutdown\n");
+    CamInputShm *self = (CamInputShm*)super;
+    if (self->reader_thread) {
+        self->quit = 1;
+        g_thread_join (self->reader_thread);
+        self->reader_thread = NULL;
+    }
+    _flush_frame_q (self);
+    return 0;
+}
+
+static int
+_formats_equal (const CamShmFrameFormat *a, const CamShmFrameFormat *b)
+{
+    return a->pixelformat == b->pixelformat &&
+        a->width == b->width && a->height == b->height &&
+        a->row_stride == b->row_stride;
+}
+
+/* Wakes up the main thread.  The pipe only fills up if the main thread has
+ * fallen far behind, in which case it has plenty of wakeups already. */
+static void
+_notify (CamInputShm *self)
+{
+    while (1 != write (self->notify_fds[1], "", 1)) {
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN)
+            perror ("InputShm: notify pipe write");
+        break;
+    }
+}
+
+static void
+_update_dropped (CamInputShm *self)
+{
+    g_atomic_int_set (&self->dropped, self->base_dropped +
+            (int) cam_shm_reader_get_dropped (self->reader));
+}
+
+static void *
+reader_thread (void *user_data)
+{
+    CamInputShm *self = (CamInputShm*)user_data;
+    const char *name = cam_unit_control_get_string (self->name_ctl);
+    char *ring_name = strdup (name ? name : "");
+    dbg (DBG_INPUT, "InputShm: reader thread started\n");
+
+    while (!self->quit) {
+        int status = cam_shm_reader_wait (self->reader, 100);
+        if (status == 0)
+            continue;
+
+        if (status < 0) {
+            // The writer closed the ring.  Wait for it to come back, and
+            // keep going if the frame format didn't change.
+            dbg (DBG_INPUT, "InputShm: ring [%s] closed\n", ring_name);
+            CamShmReader *new_reader = NULL;
+            while (!self->quit && !new_reader) {
+                g_usleep (REATTACH_INTERVAL_USEC);
+                new_reader = cam_shm_reader_new (ring_name);
+            }
+            if (!new_reader)
+                break;
+
+            CamShmFrameFormat new_format;
+            cam_shm_reader_get_format (new_reader, &new_format);
+            self->base_dropped += cam_shm_reader_get_dropped (self->reader);
+            cam_shm_reader_destroy (self->reader);
+            self->reader = new_reader;
+            free (self->metadata_buf);
+            self->metadata_buf =
+                malloc (cam_shm_reader_get_max_metadata_len (new_reader) + 1);
+            if (!_formats_equal (&new_format, &self->format)) {
+                self->format_changed = 1;
+                _notify (self);
+                break;
+            }
+            continue;
+        }
+
+        CamFrameBuffer *buf = cam_framebuffer_new_alloc (
+                cam_shm_reader_get_max_data_len (self->reader));
+        CamShmFrameInfo info;
+        status = cam_shm_reader_read (self->reader, &info, buf->data,
+                self->metadata_buf);
+        _update_dropped (self);
+        if (status != 1) {
+            g_object_unref (buf);
+            continue;
+        }
+        buf->bytesused = info.data_len;
+        buf->timestamp = info.timestamp;
+
+        int pos = 0;
+        const char *key;
+        const uint8_t *value;
+        int vlen;
+        while (0 == cam_shm_metadata_next (self->metadata_buf,
+                    info.metadata_len, &pos, &key, &value, &vlen)) {
+            cam_framebuffer_metadata_set (buf, key, value, vlen);
+        }
+
+        if (g_async_queue_length (self->frame_q) >= MAX_QUEUED_FRAMES) {
+            g_object_unref (buf);
+            self->base_dropped++;
+            _update_dropped (self);
+            continue;
+        }
+        g_async_queue_push (self->frame_q, buf);
+        _notify (self);
+    }
+
+    free (ring_name);
+    dbg (DBG_INPUT, "InputShm: reader thread exiting\n");
+    return NULL;
+}
+
+static gboolean
+shm_try_produce_frame (CamUnit *super)
+{
+    CamInputShm *self = (CamInputShm*)super;
+
+    char c;
+    if (read (self->notify_fds[0], &c, 1) != 1)
+        return FALSE;
+
+    if (self->format_changed) {
+        // The writer came back with a different format.  Restart with the
+        // new format.
+        err ("InputShm: frame format changed, restarting\n");
+        cam_unit_stream_shutdown (super);
+        _shm_attach (self, cam_unit_control_get_string (self->name_ctl));
+        cam_unit_stream_init (super, NULL);
+        return FALSE;
+    }
+
+    CamFrameBuffer *buf = g_async_queue_try_pop (self->frame_q);
+    if (!buf)
+        return FALSE;
+
+    cam_unit_produce_frame (super, buf, cam_unit_get_output_format (super));
+    g_object_unref (buf);
+
+    int dropped = g_atomic_int_get (&self->dropped);
+    if (dropped != cam_unit_control_get_int (self->dropped_ctl))
+        cam_unit_control_force_set_int (self->dropped_ctl, dropped);
+    return TRUE;
+}
+
+static int
+shm_get_fileno (CamUnit *super)
+{
+    return ((CamInputShm*) super)->notify_fds[0];
+}
+
+static gboolean
+shm_try_set_control (CamUnit *super, const CamUnitControl *ctl,
+        const GValue *proposed, GValue *actual)
+{
+    CamInputShm *self = (CamInputShm*)super;
+    if (ctl == self->name_ctl) {
+        if (cam_unit_is_streaming (super)) {
+            cam_unit_stream_shutdown (super);
+        }
+        const char *name = g_value_get_string (proposed);
+        if (0 == _shm_attach (self, name)) {
+            cam_unit_stream_init (super, NULL);
+            g_value_copy (proposed, actual);
+            return TRUE;
+        } else {
+            g_value_set_string (actual, "");
+            return FALSE;
+        }
+    }
+    return FALSE;
+}
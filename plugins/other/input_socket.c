@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <camunits/plugin.h>
+#include <camunits/dbg.h>
+#include <camunits/frame_socket.h>
+
+#define err(args...) fprintf (stderr, args)
+
+#define CONNECT_TIMEOUT_MS 2000
+
+typedef struct _CamInputSocketDriver {
+    CamUnitDriver parent;
+} CamInputSocketDriver;
+
+typedef struct _CamInputSocketDriverClass {
+    CamUnitDriverClass parent_class;
+} CamInputSocketDriverClass;
+
+typedef struct _CamInputSocket {
+    CamUnit parent;
+
+    CamUnitControl *path_ctl;
+
+    CamFrameSocketReader *reader;
+} CamInputSocket;
+
+typedef struct _CamInputSocketClass {
+    CamUnitClass parent_class;
+} CamInputSocketClass;
+
+GType cam_input_socket_driver_get_type (void);
+GType cam_input_socket_get_type (void);
+
+static CamUnitDriver * cam_input_socket_driver_new (void);
+static CamInputSocket * cam_input_socket_new (const char *path);
+
+CAM_PLUGIN_TYPE(CamInputSocketDriver, cam_input_socket_driver,
+        CAM_TYPE_UNIT_DRIVER);
+CAM_PLUGIN_TYPE(CamInputSocket, cam_input_socket, CAM_TYPE_UNIT);
+
+/* These next two functions are required as entry points for the
+ * plug-in API. */
+void cam_plugin_initialize(GTypeModule * module);
+void cam_plugin_initialize(GTypeModule * module)
+{
+    cam_input_socket_driver_register_type(module);
+    cam_input_socket_register_type(module);
+}
+
+CamUnitDriver * cam_plugin_create(GTypeModule * module);
+CamUnitDriver * cam_plugin_create(GTypeModule * module)
+{
+    return cam_input_socket_driver_new();
+}
+
+// ============== CamInputSocketDriver ===============
+
+static CamUnit * driver_create_unit (CamUnitDriver *super,
+        const CamUnitDescription * udesc);
+
+static void
+cam_input_socket_driver_init (CamInputSocketDriver *self)
+{
+    dbg (DBG_DRIVER, "socket driver constructor\n");
+    CamUnitDriver *super = CAM_UNIT_DRIVER (self);
+    cam_unit_driver_set_name (super, "input", "socket");
+
+    cam_unit_driver_add_unit_description (super,
+            "Socket Input", NULL, CAM_UNIT_EVENT_METHOD_FD);
+}
+
+static void
+cam_input_socket_driver_class_init (CamInputSocketDriverClass *klass)
+{
+    dbg (DBG_DRIVER, "socket driver class initializer\n");
+    klass->parent_class.create_unit = driver_create_unit;
+}
+
+CamUnitDriver *
+cam_input_socket_driver_new ()
+{
+    return CAM_UNIT_DRIVER (
+            g_object_new (cam_input_socket_driver_get_type(), NULL));
+}
+
+static CamUnit *
+driver_create_unit (CamUnitDriver *super,
+        const CamUnitDescription * udesc)
+{
+    dbg (DBG_DRIVER, "socket driver creating new unit\n");
+
+    g_assert (cam_unit_description_get_driver(udesc) == super);
+    const char *unit_id = cam_unit_description_get_unit_id(udesc);
+
+    char **words = g_strsplit (unit_id, ":", 2);
+    CamInputSocket *result = cam_input_socket_new (words[1]);
+    g_strfreev (words);
+
+    return CAM_UNIT (result);
+}
+
+// ============== CamInputSocket ===============
+static void socket_finalize (GObject *obj);
+static int socket_stream_init (CamUnit *super, const CamUnitFormat *fmt);
+static gboolean socket_try_produce_frame (CamUnit * super);
+static int socket_get_fileno (CamUnit *super);
+static gboolean socket_try_set_control (CamUnit *super,
+        const CamUnitControl *ctl, const GValue *proposed, GValue *actual);
+static int _socket_connect (CamInputSocket *self, const char *path);
+
+static void
+cam_input_socket_init (CamInputSocket *self)
+{
+    dbg (DBG_INPUT, "socket constructor\n");
+    CamUnit *super = CAM_UNIT (self);
+
+    self->reader = NULL;
+
+    self->path_ctl = cam_unit_add_control_string (super, "path",
+            "Socket Path", "", 1);
+}
+
+static void
+cam_input_socket_class_init (CamInputSocketClass *klass)
+{
+    dbg (DBG_INPUT, "socket class initializer\n");
+    GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+    gobject_class->finalize = socket_finalize;
+
+    klass->parent_class.stream_init = socket_stream_init;
+    klass->parent_class.try_produce_frame = socket_try_produce_frame;
+    klass->parent_class.get_fileno = socket_get_fileno;
+    klass->parent_class.try_set_control = socket_try_set_control;
+}
+
+static void
+socket_finalize (GObject *obj)
+{
+    dbg (DBG_INPUT, "socket finalize\n");
+    CamInputSocket *self = (CamInputSocket*)obj;
+
+    if (self->reader)
+        cam_frame_socket_reader_destroy (self->reader);
+    G_OBJECT_CLASS (cam_input_socket_parent_class)->finalize (obj);
+}
+
+CamInputSocket *
+cam_input_socket_new (const char *path)
+{
+    CamInputSocket *self =
+        (CamInputSocket*) (g_object_new (cam_input_socket_get_type(), NULL));
+
+    if (path && strlen (path)) {
+        if (0 == _socket_connect (self, path)) {
+            cam_unit_control_force_set_string (self->path_ctl, path);
+        }
+    }
+    return self;
+}
+
+static int
+_socket_connect (CamInputSocket *self, const char *path)
+{
+    CamUnit *super = CAM_UNIT (self);
+    if (self->reader) {
+        cam_frame_socket_reader_destroy (self->reader);
+        self->reader = NULL;
+    }
+    cam_unit_remove_all_output_formats (super);
+
+    self->reader = cam_frame_socket_reader_new (path, CONNECT_TIMEOUT_MS);
+    if (!self->reader) {
+        err ("InputSocket: unable to connect to [%s]\n", path);
+        return -1;
+    }
+
+    CamLogFrameFormat format;
+    cam_frame_socket_reader_get_format (self->reader, &format);
+    cam_unit_add_output_format (super, format.pixelformat, NULL,
+            format.width, format.height, format.stride);
+    return 0;
+}
+
+static int
+socket_stream_init (CamUnit *super, const CamUnitFormat *fmt)
+{
+    dbg (DBG_INPUT, "socket stream init\n");
+    CamInputSocket *self = (CamInputSocket*)super;
+    if (!self->reader)
+        return -1;
+    return 0;
+}
+
+static gboolean
+socket_try_produce_frame (CamUnit *super)
+{
+    CamInputSocket *self = (CamInputSocket*)super;
+    if (!self->reader)
+        return FALSE;
+
+    CamFrameBuffer *buf = cam_frame_socket_reader_read (self->reader, NULL);
+    if (!buf) {
+        err ("InputSocket: disconnected\n");
+        cam_unit_stream_shutdown (super);
+        cam_frame_socket_reader_destroy (self->reader);
+        self->reader = NULL;
+        return FALSE;
+    }
+
+    // the image data belongs to the reader, and is only valid until the
+    // next frame is read.
+    cam_unit_produce_frame (super, buf, cam_unit_get_output_format (super));
+    g_object_unref (buf);
+    return TRUE;
+}
+
+static int
+socket_get_fileno (CamUnit *super)
+{
+    CamInputSocket *self = (CamInputSocket*)super;
+    if (!self->reader)
+        return -1;
+    return cam_frame_socket_reader_get_fileno (self->reader);
+}
+
+static gboolean
+socket_try_set_control (CamUnit *super, const CamUnitControl *ctl,
+        const GValue *proposed, GValue *actual)
+{
+    CamInputSocket *self = (CamInputSocket*)super;
+    if (ctl == self->path_ctl) {
+        if (cam_unit_is_streaming (super)) {
+            cam_unit_stream_shutdown (super);
+        }
+        const char *path = g_value_get_string (proposed);
+        if (0 == _socket_connect (self, path)) {
+            cam_unit_stream_init (super, NULL);
+            g_value_copy (proposed, actual);
+            return TRUE;
+        } else {
+            g_value_set_string (actual, "");
+            return FALSE;
+        }
+    }
+    return FALSE;
+}
@@ -14,21 +14,47 @@
 
 #define MAX_UNWRITTEN_FRAMES 100
 
+/* A log file and the thread that writes frames to it.  Logger units that
+ * record to the same file as different streams share one writer, which
+ * merges the frames of their chains into the file in the order that they
+ * arrive. */
+typedef struct _LogWriter {
+    char *key;          // desired filename, if the writer is shared
+    char *fname;
+    int refcount;
+    uint8_t streams[256];   // nonzero for each stream with a unit attached
+    GAsyncQueue *msg_q;
+    GThread *thread;
+
+    // as long as the writer thread is active, it "owns" the camlog
+    CamLog *camlog;
+} LogWriter;
+
+typedef struct _LogWriterMsg {
+    int stream;
+    CamUnitFormat *fmt;
+    CamFrameBuffer *buf;
+} LogWriterMsg;
+
+static GList *shared_writers = NULL;
+G_LOCK_DEFINE_STATIC (shared_writers);
+
 typedef struct _CamLoggerUnit {
     CamUnit parent;
     CamUnitControl *record_ctl;
     CamUnitControl *desired_filename_ctl;
     CamUnitControl *auto_suffix_ctl;
+    CamUnitControl *keyframe_interval_ctl;
+    CamUnitControl *temporal_ctl;
+    CamUnitControl *align_data_ctl;
+    CamUnitControl *stream_ctl;
 //    CamUnitControl *actual_filename_ctl;
 
-    GAsyncQueue *msg_q;
-    GThread *writer_thread;
-
     char *fname;
     char *basename;
 
-    // as long as the writer thread is active, it "owns" these members
-    CamLog *camlog;
+    LogWriter *writer;
+    int stream;         // stream that the unit records to its writer
 } CamLoggerUnit;
 
 typedef struct _CamLoggerUnitClass {
@@ -63,6 +89,7 @@ static void log_finalize (GObject *obj);
 static gboolean try_set_control (CamUnit *super, 
         const CamUnitControl *ctl, const GValue *proposed, GValue *actual);
 static int load_camlog (CamLoggerUnit *self, const char *fname);
+static void release_writer (CamLoggerUnit *self);
 static void on_input_format_changed (CamUnit *super, 
         const CamUnitFormat *infmt);
 static void on_input_frame_ready (CamUnit *super, const CamFrameBuffer *inbuf,
@@ -76,7 +103,8 @@ cam_logger_unit_init (CamLoggerUnit *self)
     // constructor.  Initialize the unit with some reasonable defaults here.
     CamUnit *super = CAM_UNIT (self);
 
-    self->camlog = NULL;
+    self->writer = NULL;
+    self->stream = -1;
     self->fname = NULL;
     self->basename = NULL;
 
@@ -90,12 +118,18 @@ cam_logger_unit_init (CamLoggerUnit *self)
 //    self->actual_filename_ctl = cam_unit_add_control_string(super, 
 //            "actual-filename", "Filename Auto Suffix", "", 0);
 
+    self->keyframe_interval_ctl = cam_unit_add_control_int (super,
+            "keyframe-interval", "Keyframe Interval", 0, 1000, 1, 0, 1);
+    self->temporal_ctl = cam_unit_add_control_boolean (super,
+            "temporal-compression", "Temporal Compression", 0, 1);
+    self->align_data_ctl = cam_unit_add_control_boolean (super,
+            "page-align-data", "Page-Align Frame Data", 0, 1);
+    self->stream_ctl = cam_unit_add_control_int (super,
+            "stream", "Shared Log Stream", -1, 255, 1, -1, 1);
+
     self->record_ctl = cam_unit_add_control_boolean(super, "record", "Record", 
             0, 1); 
 
-    self->msg_q = g_async_queue_new ();
-    self->writer_thread = NULL;
-
     g_signal_connect (G_OBJECT (self), "input-format-changed",
             G_CALLBACK (on_input_format_changed), self);
 }
@@ -115,17 +149,7 @@ log_finalize (GObject *obj)
 {
     dbg (DBG_FILTER, "LoggerUnit: finalize\n");
     CamLoggerUnit *self = (CamLoggerUnit*)obj;
-    if (self->writer_thread) {
-        g_async_queue_push (self->msg_q, &WRITER_THREAD_QUIT_REQUEST);
-        g_thread_join (self->writer_thread);
-    }
-    g_async_queue_unref (self->msg_q);
-    
-    if (self->camlog) { 
-        dbg (DBG_FILTER, "LoggerUnit: closing camlog\n");
-        cam_log_destroy (self->camlog); 
-        self->camlog = NULL;
-    }
+    release_writer (self);
 
     free(self->fname);
     free(self->basename);
@@ -163,41 +187,116 @@ on_input_frame_ready (CamUnit *super, const CamFrameBuffer *inbuf,
 
     /* If a camlog is not already set, generate one with an
      * auto-generated filename. */
-    if (recording && !self->camlog)
+    if (recording && !self->writer)
         load_camlog (self, NULL);
 
-    if (recording && self->camlog) {
-        if (g_async_queue_length (self->msg_q) > MAX_UNWRITTEN_FRAMES * 2) {
+    if (recording && self->writer) {
+        // allow for the frames of every unit sharing the writer
+        LogWriter *w = self->writer;
+        if (g_async_queue_length (w->msg_q) >
+                MAX_UNWRITTEN_FRAMES * w->refcount) {
             fprintf (stderr, "%s:%d - disk too slow, dropping frame\n",
                     __FILE__, __LINE__);
         }
         else {
-            CamUnitFormat *fmt_copy = cam_unit_format_new (infmt->pixelformat,
+            LogWriterMsg *msg = g_slice_new (LogWriterMsg);
+            msg->stream = MAX (0, self->stream);
+            msg->fmt = cam_unit_format_new (infmt->pixelformat,
                     infmt->name, infmt->width, infmt->height, 
                     infmt->row_stride);
-            CamFrameBuffer *buf_copy = 
-                cam_framebuffer_new_alloc (inbuf->bytesused);
-            memcpy (buf_copy->data, inbuf->data, inbuf->bytesused);
-            buf_copy->bytesused = inbuf->bytesused;
-            cam_framebuffer_copy_metadata (buf_copy, inbuf);
-
-            g_async_queue_push (self->msg_q, fmt_copy);
-            g_async_queue_push (self->msg_q, buf_copy);
+            msg->buf = cam_framebuffer_new_alloc (inbuf->bytesused);
+            memcpy (msg->buf->data, inbuf->data, inbuf->bytesused);
+            msg->buf->bytesused = inbuf->bytesused;
+            cam_framebuffer_copy_metadata (msg->buf, inbuf);
+
+            g_async_queue_push (w->msg_q, msg);
         }
     }
 
     cam_unit_produce_frame (super, inbuf, infmt);
 }
 
+static LogWriter *
+log_writer_new (CamLoggerUnit *self, const char *fname)
+{
+    char filename[PATH_MAX];
+    if(cam_unit_control_get_boolean(self->auto_suffix_ctl)) {
+        /* Loop through possible file names until we find one that doesn't
+         * already exist.  This way, we never overwrite an existing file. */
+        int res;
+        int filenum = 0;
+        do {
+            struct stat statbuf;
+            snprintf (filename, sizeof (filename), "%s.%02d", fname, filenum);
+            res = stat (filename, &statbuf);
+            filenum++;
+        } while (res == 0);
+
+        if (errno != ENOENT) {
+            perror ("Error: checking for existing log filenames");
+            return NULL;
+        }
+    } else {
+        strncpy(filename, fname, sizeof(filename));
+    }
+
+    dbg (DBG_FILTER, "LoggerUnit: Trying to load log file [%s]\n", filename);
+    CamLog *camlog = cam_log_new (filename, "w");
+    if (!camlog) {
+        err ("LoggerUnit: unable to open new log file [%s]\n", filename);
+        return NULL;
+    }
+    cam_log_set_keyframe_interval (camlog,
+            cam_unit_control_get_int (self->keyframe_interval_ctl));
+    cam_log_set_temporal_compression (camlog,
+            cam_unit_control_get_boolean (self->temporal_ctl));
+    if (cam_unit_control_get_boolean (self->align_data_ctl))
+        cam_log_set_data_alignment (camlog, 4096);
+
+    LogWriter *w = (LogWriter*) calloc (1, sizeof (LogWriter));
+    w->fname = strdup (filename);
+    w->refcount = 1;
+    w->camlog = camlog;
+    w->msg_q = g_async_queue_new ();
+    w->thread = g_thread_create (writer_thread, w, TRUE, NULL);
+    return w;
+}
+
+static void
+release_writer (CamLoggerUnit *self)
+{
+    LogWriter *w = self->writer;
+    if (!w)
+        return;
+    self->writer = NULL;
+
+    G_LOCK (shared_writers);
+    if (self->stream >= 0)
+        w->streams[self->stream] = 0;
+    self->stream = -1;
+    int last = (0 == --w->refcount);
+    if (last && w->key)
+        shared_writers = g_list_remove (shared_writers, w);
+    G_UNLOCK (shared_writers);
+    if (!last)
+        return;
+
+    // the writer thread finishes the frames queued before the request
+    g_async_queue_push (w->msg_q, &WRITER_THREAD_QUIT_REQUEST);
+    g_thread_join (w->thread);
+    g_async_queue_unref (w->msg_q);
+
+    dbg (DBG_FILTER, "LoggerUnit: closing camlog\n");
+    cam_log_destroy (w->camlog);
+    free (w->key);
+    free (w->fname);
+    free (w);
+}
+
 static int
 load_camlog (CamLoggerUnit *self, const char *fname)
 {
-    if (self->writer_thread) {
-        g_async_queue_push (self->msg_q, &WRITER_THREAD_QUIT_REQUEST);
-        g_thread_join (self->writer_thread);
-        self->writer_thread = NULL;
-        // TODO flush data still remaining in the async queue
-    }
+    release_writer (self);
 
     char autoname[256];
     if (!fname || !strlen(fname)) {
@@ -213,53 +312,58 @@ load_camlog (CamLoggerUnit *self, const char *fname)
         fname = autoname;
     }
 
-    if (self->camlog) {
-        dbg (DBG_FILTER, "LoggerUnit: destroying existing camlog\n");
-        cam_log_destroy (self->camlog);
-        self->camlog = NULL;
-    }
-
     free(self->fname);
     self->fname = NULL;
     free(self->basename);
     self->basename = NULL;
     g_object_set_data(G_OBJECT(self), "actual-filename", self->fname);
 
-    char filename[PATH_MAX];
-    if(cam_unit_control_get_boolean(self->auto_suffix_ctl)) {
-        /* Loop through possible file names until we find one that doesn't
-         * already exist.  This way, we never overwrite an existing file. */
-        int res;
-        int filenum = 0;
-        do {
-            struct stat statbuf;
-            snprintf (filename, sizeof (filename), "%s.%02d", fname, filenum);
-            res = stat (filename, &statbuf);
-            filenum++;
-        } while (res == 0);
-
-        if (errno != ENOENT) {
-            perror ("Error: checking for existing log filenames");
-            return -1;
+    /* Units recording a stream share the writer of the first unit that
+     * asked for the same file, and with it that unit's log settings.  Two
+     * units can not record the same stream of a file. */
+    int stream = cam_unit_control_get_int (self->stream_ctl);
+    LogWriter *w = NULL;
+    int stream_in_use = 0;
+    G_LOCK (shared_writers);
+    if (stream >= 0) {
+        for (GList *iter = shared_writers; iter; iter = iter->next) {
+            LogWriter *shared = (LogWriter*) iter->data;
+            if (!strcmp (shared->key, fname)) {
+                if (shared->streams[stream]) {
+                    stream_in_use = 1;
+                } else {
+                    w = shared;
+                    w->refcount++;
+                }
+                break;
+            }
         }
-    } else {
-        strncpy(filename, fname, sizeof(filename));
     }
-
-    self->fname = strdup(filename);
-    self->basename = g_path_get_basename(filename);
-
-    dbg (DBG_FILTER, "LoggerUnit: Trying to load log file [%s]\n", filename);
-    self->camlog = cam_log_new (filename, "w");
-    if (!self->camlog) {
-        err ("LoggerUnit: unable to open new log file [%s]\n", filename);
+    if (!w && !stream_in_use) {
+        w = log_writer_new (self, fname);
+        if (w && stream >= 0) {
+            w->key = strdup (fname);
+            shared_writers = g_list_prepend (shared_writers, w);
+        }
+    }
+    if (w && stream >= 0)
+        w->streams[stream] = 1;
+    G_UNLOCK (shared_writers);
+    if (stream_in_use) {
+        err ("LoggerUnit: stream %d of [%s] is already being recorded\n",
+                stream, fname);
         return -1;
     }
+    if (!w)
+        return -1;
 
-    g_object_set_data(G_OBJECT(self), "actual-filename", self->fname);
-//    printf ("Logging frames to \"%s\"\n", filename);
+    self->writer = w;
+    self->stream = stream;
+    self->fname = strdup(w->fname);
+    self->basename = g_path_get_basename(w->fname);
 
-    self->writer_thread = g_thread_create (writer_thread, self, TRUE, NULL);
+    g_object_set_data(G_OBJECT(self), "actual-filename", self->fname);
+//    printf ("Logging frames to \"%s\"\n", w->fname);
 
     return 0;
 }
@@ -280,8 +384,18 @@ try_set_control (CamUnit *super,
         }
         g_value_copy (proposed, actual);
         cam_unit_control_set_enabled (self->desired_filename_ctl, !recording);
+        cam_unit_control_set_enabled (self->keyframe_interval_ctl,
+                !recording);
+        cam_unit_control_set_enabled (self->temporal_ctl, !recording);
+        cam_unit_control_set_enabled (self->align_data_ctl, !recording);
+        cam_unit_control_set_enabled (self->stream_ctl, !recording);
     } else if (ctl == self->desired_filename_ctl) {
         g_value_copy(proposed, actual);
+    } else if (ctl == self->keyframe_interval_ctl ||
+            ctl == self->temporal_ctl ||
+            ctl == self->align_data_ctl ||
+            ctl == self->stream_ctl) {
+        g_value_copy(proposed, actual);
     } else if(ctl == self->auto_suffix_ctl) {
         g_value_copy(proposed, actual);
     }
@@ -293,29 +407,29 @@ static void *
 writer_thread (void *user_data)
 {
     dbg (DBG_FILTER, "LoggerUnit: writer thread started\n");
-    CamLoggerUnit *self = (CamLoggerUnit*)user_data;
+    LogWriter *w = (LogWriter*)user_data;
 
     while (1) {
-        void *msg = g_async_queue_pop (self->msg_q);
-        if (msg == &WRITER_THREAD_QUIT_REQUEST)
+        void *qmsg = g_async_queue_pop (w->msg_q);
+        if (qmsg == &WRITER_THREAD_QUIT_REQUEST)
             break;
 
-        CamUnitFormat *infmt = CAM_UNIT_FORMAT (msg);
+        LogWriterMsg *msg = (LogWriterMsg*) qmsg;
         CamLogFrameFormat format = {
-            .pixelformat = infmt->pixelformat,
-            .width = infmt->width,
-            .height = infmt->height,
-            .stride = infmt->row_stride,
+            .pixelformat = msg->fmt->pixelformat,
+            .width = msg->fmt->width,
+            .height = msg->fmt->height,
+            .stride = msg->fmt->row_stride,
         };
-        CamFrameBuffer *inbuf =
-            CAM_FRAMEBUFFER (g_async_queue_pop (self->msg_q));
 
         // write the new frame to disk
-        if (cam_log_write_frame (self->camlog, &format, inbuf, NULL) < 0)
+        if (cam_log_write_stream_frame (w->camlog, msg->stream, &format,
+                    msg->buf, NULL) < 0)
             err ("LoggerUnit: Unable to write frame...\n");
 
-        g_object_unref (infmt);
-        g_object_unref (inbuf);
+        g_object_unref (msg->fmt);
+        g_object_unref (msg->buf);
+        g_slice_free (LogWriterMsg, msg);
     }
     dbg (DBG_FILTER, "LoggerUnit: writer thread exiting\n");
 
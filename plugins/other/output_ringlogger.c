@@ -0,0 +1,553 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+
+#include <camunits/plugin.h>
+#include <camunits/dbg.h>
+#include <camunits/log.h>
+
+#define err(args...) fprintf (stderr, args)
+
+#define MAX_UNWRITTEN_FRAMES 100
+
+#define DEFAULT_PRE_TRIGGER_SEC 10
+#define DEFAULT_POST_TRIGGER_SEC 5
+#define DEFAULT_RING_SIZE_MB 256
+
+typedef struct _RingEntry {
+    CamUnitFormat *fmt;
+    // wraps a region of the ring arena.  Does not own its data.
+    CamFrameBuffer *buf;
+} RingEntry;
+
+typedef struct _CamRingLoggerUnit {
+    CamUnit parent;
+    CamUnitControl *desired_filename_ctl;
+    CamUnitControl *pre_trigger_ctl;
+    CamUnitControl *post_trigger_ctl;
+    CamUnitControl *ring_size_ctl;
+    CamUnitControl *trigger_key_ctl;
+    CamUnitControl *trigger_ctl;
+    CamUnitControl *buffered_ctl;
+
+    // pre-trigger ring.  Frames are stored back to back in the arena, and
+    // ring holds a RingEntry for each one, oldest first.
+    uint8_t *arena;
+    int arena_size;
+    int write_pos;
+    GQueue *ring;
+
+    // nonzero while the writer thread is flushing the arena to disk
+    volatile int ring_busy;
+
+    // post-trigger frames queued for the writer thread and not yet written.
+    // The flushed ring does not count, so that a long pre-trigger window
+    // doesn't crowd out the frames after the trigger.
+    volatile int unwritten;
+
+    // nonzero while recording the frames after a trigger
+    int triggered;
+    int64_t post_trigger_end;
+    int prev_frame_had_key;
+
+    GAsyncQueue *msg_q;
+    GThread *writer_thread;
+    char *fname;
+
+    // as long as the writer thread is active, it "owns" these members
+    CamLog *camlog;
+} CamRingLoggerUnit;
+
+typedef struct _CamRingLoggerUnitClass {
+    CamUnitClass parent_class;
+} CamRingLoggerUnitClass;
+
+static CamRingLoggerUnit * cam_ring_logger_unit_new(void);
+
+GType cam_ring_logger_unit_get_type (void);
+CAM_PLUGIN_TYPE(CamRingLoggerUnit, cam_ring_logger_unit, CAM_TYPE_UNIT);
+
+/* These next two functions are required as entry points for the
+ * plug-in API. */
+void cam_plugin_initialize(GTypeModule * module);
+void cam_plugin_initialize(GTypeModule * module)
+{
+    cam_ring_logger_unit_register_type(module);
+}
+
+CamUnitDriver * cam_plugin_create(GTypeModule * module);
+CamUnitDriver * cam_plugin_create(GTypeModule * module)
+{
+    return cam_unit_driver_new_stock_full ("output", "ringlogger",
+            "Pre-trigger Ring Logger", 0,
+            (CamUnitConstructor)cam_ring_logger_unit_new, module);
+}
+
+static int WRITER_THREAD_QUIT_REQUEST = 0;
+static int RING_FLUSHED = 0;
+
+// ============== CamRingLoggerUnit ===============
+static void ringlog_finalize (GObject *obj);
+static int _stream_init (CamUnit *super, const CamUnitFormat *fmt);
+static int _stream_shutdown (CamUnit *super);
+static gboolean try_set_control (CamUnit *super,
+        const CamUnitControl *ctl, const GValue *proposed, GValue *actual);
+static void on_input_format_changed (CamUnit *super,
+        const CamUnitFormat *infmt);
+static void on_input_frame_ready (CamUnit *super, const CamFrameBuffer *inbuf,
+        const CamUnitFormat *infmt);
+static void * writer_thread (void *user_data);
+
+static void
+cam_ring_logger_unit_init (CamRingLoggerUnit *self)
+{
+    dbg (DBG_FILTER, "ring logger constructor\n");
+    CamUnit *super = CAM_UNIT (self);
+
+    self->arena = NULL;
+    self->arena_size = 0;
+    self->write_pos = 0;
+    self->ring = g_queue_new ();
+    self->ring_busy = 0;
+    self->unwritten = 0;
+    self->triggered = 0;
+    self->prev_frame_had_key = 0;
+    self->camlog = NULL;
+    self->fname = NULL;
+
+    self->desired_filename_ctl = cam_unit_add_control_string (super,
+            "desired-filename", "Filename", "", 1);
+    cam_unit_control_set_ui_hints (self->desired_filename_ctl,
+            CAM_UNIT_CONTROL_FILENAME);
+    self->pre_trigger_ctl = cam_unit_add_control_float (super,
+            "pre-trigger-sec", "Pre-trigger (s)", 0, 600, 1,
+            DEFAULT_PRE_TRIGGER_SEC, 1);
+    self->post_trigger_ctl = cam_unit_add_control_float (super,
+            "post-trigger-sec", "Post-trigger (s)", 0, 600, 1,
+            DEFAULT_POST_TRIGGER_SEC, 1);
+    self->ring_size_ctl = cam_unit_add_control_int (super,
+            "ring-size-mb", "Ring Size (MB)", 1, 2047, 1,
+            DEFAULT_RING_SIZE_MB, 1);
+    cam_unit_control_set_ui_hints (self->ring_size_ctl,
+            CAM_UNIT_CONTROL_SPINBUTTON);
+    self->trigger_key_ctl = cam_unit_add_control_string (super,
+            "trigger-metadata-key", "Trigger Metadata Key", "", 1);
+    self->trigger_ctl = cam_unit_add_control_boolean (super,
+            "trigger", "Trigger", 0, 1);
+    self->buffered_ctl = cam_unit_add_control_float (super,
+            "buffered-sec", "Buffered (s)", 0, 1e9, 1, 0, 0);
+
+    self->msg_q = g_async_queue_new ();
+    self->writer_thread = NULL;
+
+    g_signal_connect (G_OBJECT (self), "input-format-changed",
+            G_CALLBACK (on_input_format_changed), self);
+}
+
+static void
+cam_ring_logger_unit_class_init (CamRingLoggerUnitClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+    gobject_class->finalize = ringlog_finalize;
+    klass->parent_class.stream_init = _stream_init;
+    klass->parent_class.stream_shutdown = _stream_shutdown;
+    klass->parent_class.try_set_control = try_set_control;
+    klass->parent_class.on_input_frame_ready = on_input_frame_ready;
+    if (!g_thread_supported ()) g_thread_init (NULL);
+}
+
+static void
+ring_entry_free (RingEntry *entry)
+{
+    g_object_unref (entry->fmt);
+    g_object_unref (entry->buf);
+    free (entry);
+}
+
+static void
+ring_clear (CamRingLoggerUnit *self)
+{
+    RingEntry *entry;
+    while ((entry = g_queue_pop_head (self->ring)))
+        ring_entry_free (entry);
+    self->write_pos = 0;
+}
+
+static void
+stop_writer_thread (CamRingLoggerUnit *self)
+{
+    if (!self->writer_thread)
+        return;
+    if (self->triggered) {
+        g_async_queue_push (self->msg_q, &WRITER_THREAD_QUIT_REQUEST);
+        self->triggered = 0;
+    }
+    g_thread_join (self->writer_thread);
+    self->writer_thread = NULL;
+}
+
+static void
+ringlog_finalize (GObject *obj)
+{
+    dbg (DBG_FILTER, "RingLogger: finalize\n");
+    CamRingLoggerUnit *self = (CamRingLoggerUnit*)obj;
+    stop_writer_thread (self);
+    g_async_queue_unref (self->msg_q);
+
+    ring_clear (self);
+    g_queue_free (self->ring);
+    free (self->arena);
+    free (self->fname);
+
+    G_OBJECT_CLASS (cam_ring_logger_unit_parent_class)->finalize (obj);
+}
+
+static CamRingLoggerUnit *
+cam_ring_logger_unit_new ()
+{
+    return (CamRingLoggerUnit*)
+        (g_object_new (cam_ring_logger_unit_get_type(), NULL));
+}
+
+static void
+on_input_format_changed (CamUnit *super, const CamUnitFormat *infmt)
+{
+    cam_unit_remove_all_output_formats (super);
+    if (!infmt)
+        return;
+
+    // match the output format of the input unit
+    cam_unit_add_output_format (super, infmt->pixelformat,
+            infmt->name, infmt->width, infmt->height,
+            infmt->row_stride);
+}
+
+static int
+alloc_arena (CamRingLoggerUnit *self, int size_mb)
+{
+    ring_clear (self);
+    free (self->arena);
+    self->arena_size = size_mb << 20;
+    self->arena = (uint8_t*) malloc (self->arena_size);
+    if (!self->arena) {
+        err ("RingLogger: unable to allocate %d byte ring\n",
+                self->arena_size);
+        self->arena_size = 0;
+        return -1;
+    }
+    // touch every page now, so that filling the ring later doesn't fault
+    memset (self->arena, 0, self->arena_size);
+    return 0;
+}
+
+static int
+_stream_init (CamUnit *super, const CamUnitFormat *fmt)
+{
+    CamRingLoggerUnit *self = (CamRingLoggerUnit*)super;
+    dbg (DBG_FILTER, "RingLogger: stream init\n");
+    if (!self->arena && 0 != alloc_arena (self,
+                cam_unit_control_get_int (self->ring_size_ctl)))
+        return -1;
+    self->prev_frame_had_key = 0;
+    return 0;
+}
+
+static int
+_stream_shutdown (CamUnit *super)
+{
+    CamRingLoggerUnit *self = (CamRingLoggerUnit*)super;
+    dbg (DBG_FILTER, "RingLogger: stream shutdown\n");
+
+    // finish writing any event in progress.  Once the writer thread exits,
+    // it no longer uses the arena.
+    stop_writer_thread (self);
+    if (cam_unit_control_get_boolean (self->trigger_ctl))
+        cam_unit_control_force_set_boolean (self->trigger_ctl, 0);
+
+    ring_clear (self);
+    free (self->arena);
+    self->arena = NULL;
+    self->arena_size = 0;
+    cam_unit_control_force_set_float (self->buffered_ctl, 0);
+    return 0;
+}
+
+static int
+open_camlog (CamRingLoggerUnit *self)
+{
+    const char *fname =
+        cam_unit_control_get_string (self->desired_filename_ctl);
+    char autoname[256];
+    if (!fname || !strlen (fname)) {
+        time_t t = time (NULL);
+        struct tm ti;
+        localtime_r (&t, &ti);
+
+        char hostname[80];
+        gethostname (hostname, sizeof (hostname)-1);
+        snprintf (autoname, sizeof (autoname), "%d-%02d-%02d-cam-%s",
+                ti.tm_year+1900, ti.tm_mon+1, ti.tm_mday, hostname);
+
+        fname = autoname;
+    }
+
+    /* Each event gets its own file.  Loop through possible file names until
+     * we find one that doesn't already exist. */
+    char filename[PATH_MAX];
+    int res;
+    int filenum = 0;
+    do {
+        struct stat statbuf;
+        snprintf (filename, sizeof (filename), "%s.%02d", fname, filenum);
+        res = stat (filename, &statbuf);
+        filenum++;
+    } while (res == 0);
+
+    if (errno != ENOENT) {
+        perror ("Error: checking for existing log filenames");
+        return -1;
+    }
+
+    dbg (DBG_FILTER, "RingLogger: Trying to load log file [%s]\n", filename);
+    self->camlog = cam_log_new (filename, "w");
+    if (!self->camlog) {
+        err ("RingLogger: unable to open new log file [%s]\n", filename);
+        return -1;
+    }
+    free (self->fname);
+    self->fname = strdup (filename);
+    g_object_set_data (G_OBJECT (self), "actual-filename", self->fname);
+    return 0;
+}
+
+static int
+start_event (CamRingLoggerUnit *self)
+{
+    // the previous event has already been told to finish, so this only
+    // waits for the disk to catch up.
+    if (self->writer_thread) {
+        g_thread_join (self->writer_thread);
+        self->writer_thread = NULL;
+    }
+
+    if (0 != open_camlog (self))
+        return -1;
+
+    dbg (DBG_FILTER, "RingLogger: triggered, flushing %d buffered frames\n",
+            g_queue_get_length (self->ring));
+
+    // hand the contents of the ring to the writer thread.  The arena is off
+    // limits until the writer is done with it.
+    if (!g_queue_is_empty (self->ring)) {
+        self->ring_busy = 1;
+        RingEntry *entry;
+        while ((entry = g_queue_pop_head (self->ring))) {
+            g_async_queue_push (self->msg_q, entry->fmt);
+            g_async_queue_push (self->msg_q, entry->buf);
+            free (entry);
+        }
+        g_async_queue_push (self->msg_q, &RING_FLUSHED);
+    }
+    self->write_pos = 0;
+    self->unwritten = 0;
+    cam_unit_control_force_set_float (self->buffered_ctl, 0);
+
+    // the post-trigger window starts at the next frame
+    self->triggered = 1;
+    self->post_trigger_end = 0;
+    self->writer_thread = g_thread_create (writer_thread, self, TRUE, NULL);
+    return 0;
+}
+
+static void
+end_event (CamRingLoggerUnit *self)
+{
+    dbg (DBG_FILTER, "RingLogger: event finished\n");
+    g_async_queue_push (self->msg_q, &WRITER_THREAD_QUIT_REQUEST);
+    self->triggered = 0;
+}
+
+static void
+record_frame (CamRingLoggerUnit *self, const CamFrameBuffer *inbuf,
+        const CamUnitFormat *infmt)
+{
+    if (g_atomic_int_get (&self->unwritten) >= MAX_UNWRITTEN_FRAMES) {
+        fprintf (stderr, "%s:%d - disk too slow, dropping frame\n",
+                __FILE__, __LINE__);
+        return;
+    }
+    CamUnitFormat *fmt_copy = cam_unit_format_new (infmt->pixelformat,
+            infmt->name, infmt->width, infmt->height, infmt->row_stride);
+    CamFrameBuffer *buf_copy = cam_framebuffer_new_alloc (inbuf->bytesused);
+    memcpy (buf_copy->data, inbuf->data, inbuf->bytesused);
+    buf_copy->bytesused = inbuf->bytesused;
+    buf_copy->timestamp = inbuf->timestamp;
+    cam_framebuffer_copy_metadata (buf_copy, inbuf);
+
+    g_atomic_int_inc (&self->unwritten);
+    g_async_queue_push (self->msg_q, fmt_copy);
+    g_async_queue_push (self->msg_q, buf_copy);
+}
+
+static void
+buffer_frame (CamRingLoggerUnit *self, const CamFrameBuffer *inbuf,
+        const CamUnitFormat *infmt)
+{
+    int len = inbuf->bytesused;
+    if (!self->arena || len > self->arena_size)
+        return;
+
+    // find room for the frame, evicting the oldest frames as needed.  The
+    // frames in the ring always occupy one contiguous (possibly wrapped)
+    // region of the arena that ends at write_pos.
+    while (1) {
+        RingEntry *oldest = g_queue_peek_head (self->ring);
+        if (!oldest) {
+            if (self->write_pos + len > self->arena_size)
+                self->write_pos = 0;
+            break;
+        }
+        int head = oldest->buf->data - self->arena;
+        if (head >= self->write_pos) {
+            if (self->write_pos + len <= head)
+                break;
+            ring_entry_free (g_queue_pop_head (self->ring));
+        } else {
+            if (self->write_pos + len <= self->arena_size)
+                break;
+            self->write_pos = 0;
+        }
+    }
+
+    RingEntry *entry = (RingEntry*) malloc (sizeof (RingEntry));
+    entry->fmt = cam_unit_format_new (infmt->pixelformat, infmt->name,
+            infmt->width, infmt->height, infmt->row_stride);
+    entry->buf = cam_framebuffer_new (self->arena + self->write_pos, len);
+    memcpy (entry->buf->data, inbuf->data, len);
+    entry->buf->bytesused = len;
+    entry->buf->timestamp = inbuf->timestamp;
+    cam_framebuffer_copy_metadata (entry->buf, inbuf);
+    g_queue_push_tail (self->ring, entry);
+    self->write_pos += len;
+
+    // drop frames older than the pre-trigger window
+    int64_t window =
+        cam_unit_control_get_float (self->pre_trigger_ctl) * 1e6;
+    RingEntry *oldest;
+    while ((oldest = g_queue_peek_head (self->ring)) &&
+            inbuf->timestamp - oldest->buf->timestamp > window) {
+        ring_entry_free (g_queue_pop_head (self->ring));
+    }
+
+    oldest = g_queue_peek_head (self->ring);
+    cam_unit_control_force_set_float (self->buffered_ctl,
+            (inbuf->timestamp - oldest->buf->timestamp) * 1e-6);
+}
+
+static void
+on_input_frame_ready (CamUnit *super, const CamFrameBuffer *inbuf,
+        const CamUnitFormat *infmt)
+{
+    dbg (DBG_FILTER, "[%s] iterate\n", cam_unit_get_name (super));
+    CamRingLoggerUnit *self = (CamRingLoggerUnit*)super;
+
+    // trigger on the first frame that has the trigger metadata key
+    const char *key = cam_unit_control_get_string (self->trigger_key_ctl);
+    if (key && strlen (key)) {
+        int has_key = NULL != cam_framebuffer_metadata_get (inbuf, key, NULL);
+        if (has_key && !self->prev_frame_had_key && !self->triggered &&
+                0 == start_event (self))
+            cam_unit_control_force_set_boolean (self->trigger_ctl, 1);
+        self->prev_frame_had_key = has_key;
+    }
+
+    if (self->triggered) {
+        if (!self->post_trigger_end)
+            self->post_trigger_end = inbuf->timestamp +
+                cam_unit_control_get_float (self->post_trigger_ctl) * 1e6;
+        if (inbuf->timestamp > self->post_trigger_end) {
+            end_event (self);
+            cam_unit_control_force_set_boolean (self->trigger_ctl, 0);
+        } else
+            record_frame (self, inbuf, infmt);
+    }
+
+    if (!self->triggered && !g_atomic_int_get (&self->ring_busy))
+        buffer_frame (self, inbuf, infmt);
+
+    cam_unit_produce_frame (super, inbuf, infmt);
+}
+
+static gboolean
+try_set_control (CamUnit *super,
+        const CamUnitControl *ctl, const GValue *proposed, GValue *actual)
+{
+    CamRingLoggerUnit *self = (CamRingLoggerUnit*)super;
+
+    if (ctl == self->trigger_ctl) {
+        int trigger = g_value_get_boolean (proposed);
+        if (trigger && !self->triggered) {
+            if (0 != start_event (self))
+                return FALSE;
+        } else if (!trigger && self->triggered) {
+            end_event (self);
+        }
+    } else if (ctl == self->ring_size_ctl) {
+        // if the writer is using the arena, the new size takes effect the
+        // next time the unit starts streaming.
+        if (self->arena && !g_atomic_int_get (&self->ring_busy) &&
+                0 != alloc_arena (self, g_value_get_int (proposed)))
+            return FALSE;
+    }
+    g_value_copy (proposed, actual);
+    return TRUE;
+}
+
+static void *
+writer_thread (void *user_data)
+{
+    dbg (DBG_FILTER, "RingLogger: writer thread started\n");
+    CamRingLoggerUnit *self = (CamRingLoggerUnit*)user_data;
+
+    while (1) {
+        void *msg = g_async_queue_pop (self->msg_q);
+        if (msg == &WRITER_THREAD_QUIT_REQUEST)
+            break;
+        if (msg == &RING_FLUSHED) {
+            g_atomic_int_set (&self->ring_busy, 0);
+            continue;
+        }
+
+        CamUnitFormat *infmt = CAM_UNIT_FORMAT (msg);
+        CamLogFrameFormat format = {
+            .pixelformat = infmt->pixelformat,
+            .width = infmt->width,
+            .height = infmt->height,
+            .stride = infmt->row_stride,
+        };
+        CamFrameBuffer *inbuf =
+            CAM_FRAMEBUFFER (g_async_queue_pop (self->msg_q));
+
+        // write the new frame to disk
+        if (cam_log_write_frame (self->camlog, &format, inbuf, NULL) < 0)
+            err ("RingLogger: Unable to write frame...\n");
+
+        // frames queued before RING_FLUSHED come from the ring
+        if (!g_atomic_int_get (&self->ring_busy))
+            g_atomic_int_add (&self->unwritten, -1);
+
+        g_object_unref (infmt);
+        g_object_unref (inbuf);
+    }
+
+    cam_log_destroy (self->camlog);
+    self->camlog = NULL;
+    dbg (DBG_FILTER, "RingLogger: writer thread exiting\n");
+
+    return NULL;
+}
@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <camunits/plugin.h>
+#include <camunits/dbg.h>
+#include <camunits/shm.h>
+
+#define err(args...) fprintf (stderr, args)
+
+#define DEFAULT_RING_NAME "camunits"
+#define DEFAULT_NUM_SLOTS 8
+#define MAX_METADATA_LEN 65536
+
+typedef struct _CamShmOutput {
+    CamUnit parent;
+    CamUnitControl *name_ctl;
+    CamUnitControl *nslots_ctl;
+    CamUnitControl *publish_ctl;
+
+    CamShmWriter *writer;
+    uint8_t *metadata_buf;
+} CamShmOutput;
+
+typedef struct _CamShmOutputClass {
+    CamUnitClass parent_class;
+} CamShmOutputClass;
+
+static CamShmOutput * cam_shm_output_new(void);
+
+GType cam_shm_output_get_type (void);
+CAM_PLUGIN_TYPE(CamShmOutput, cam_shm_output, CAM_TYPE_UNIT);
+
+/* These next two functions are required as entry points for the
+ * plug-in API. */
+void cam_plugin_initialize(GTypeModule * module);
+void cam_plugin_initialize(GTypeModule * module)
+{
+    cam_shm_output_register_type(module);
+}
+
+CamUnitDriver * cam_plugin_create(GTypeModule * module);
+CamUnitDriver * cam_plugin_create(GTypeModule * module)
+{
+    return cam_unit_driver_new_stock_full ("output", "shm",
+            "Shared Memory Output", 0,
+            (CamUnitConstructor)cam_shm_output_new, module);
+}
+
+// ============== CamShmOutput ===============
+static void shm_finalize (GObject *obj);
+static int _stream_init (CamUnit *super, const CamUnitFormat *fmt);
+static int _stream_shutdown (CamUnit *super);
+static gboolean _try_set_control (CamUnit *super,
+        const CamUnitControl *ctl, const GValue *proposed, GValue *actual);
+static void on_input_format_changed (CamUnit *super,
+        const CamUnitFormat *infmt);
+static void on_input_frame_ready (CamUnit *super, const CamFrameBuffer *inbuf,
+        const CamUnitFormat *infmt);
+
+static void
+cam_shm_output_init (CamShmOutput *self)
+{
+    dbg (DBG_OUTPUT, "shm output constructor\n");
+    CamUnit *super = CAM_UNIT (self);
+
+    self->writer = NULL;
+    self->metadata_buf = malloc (MAX_METADATA_LEN);
+
+    self->name_ctl = cam_unit_add_control_string (super,
+            "name", "Ring Name", DEFAULT_RING_NAME, 1);
+    self->nslots_ctl = cam_unit_add_control_int (super,
+            "num-slots", "Ring Slots", 2, 64, 1, DEFAULT_NUM_SLOTS, 1);
+    cam_unit_control_set_ui_hints (self->nslots_ctl,
+            CAM_UNIT_CONTROL_SPINBUTTON);
+    self->publish_ctl = cam_unit_add_control_boolean (super,
+            "publish", "Publish", 1, 1);
+
+    g_signal_connect (G_OBJECT (self), "input-format-changed",
+            G_CALLBACK (on_input_format_changed), self);
+}
+
+static void
+cam_shm_output_class_init (CamShmOutputClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+    gobject_class->finalize = shm_finalize;
+    klass->parent_class.stream_init = _stream_init;
+    klass->parent_class.stream_shutdown = _stream_shutdown;
+    klass->parent_class.try_set_control = _try_set_control;
+    klass->parent_class.on_input_frame_ready = on_input_frame_ready;
+}
+
+static void
+shm_finalize (GObject *obj)
+{
+    dbg (DBG_OUTPUT, "shm output finalize\n");
+    CamShmOutput *self = (CamShmOutput*)obj;
+    if (self->writer) {
+        cam_shm_writer_destroy (self->writer);
+        self->writer = NULL;
+    }
+    free (self->metadata_buf);
+
+    G_OBJECT_CLASS (cam_shm_output_parent_class)->finalize (obj);
+}
+
+static CamShmOutput *
+cam_shm_output_new ()
+{
+    return (CamShmOutput*) (g_object_new (cam_shm_output_get_type(), NULL));
+}
+
+static void
+on_input_format_changed (CamUnit *super, const CamUnitFormat *infmt)
+{
+    cam_unit_remove_all_output_formats (super);
+    if (!infmt)
+        return;
+
+    // match the output format of the input unit
+    cam_unit_add_output_format (super, infmt->pixelformat,
+            infmt->name, infmt->width, infmt->height,
+            infmt->row_stride);
+}
+
+static int
+_create_writer (CamShmOutput *self, const CamUnitFormat *fmt,
+        const char *name, int nslots)
+{
+    if (self->writer) {
+        cam_shm_writer_destroy (self->writer);
+        self->writer = NULL;
+    }
+
+    CamShmFrameFormat shm_fmt;
+    memset (&shm_fmt, 0, sizeof (shm_fmt));
+    shm_fmt.pixelformat = fmt->pixelformat;
+    shm_fmt.width = fmt->width;
+    shm_fmt.height = fmt->height;
+    shm_fmt.row_stride = fmt->row_stride;
+    if (fmt->name)
+        strncpy (shm_fmt.name, fmt->name, CAM_SHM_FORMAT_NAME_MAX - 1);
+
+    // compressed formats don't have a fixed size, so leave enough room for
+    // a frame that is the size of an uncompressed BGRA image.
+    int bpp = cam_pixel_format_bpp (fmt->pixelformat);
+    int max_data_len = fmt->row_stride * fmt->height;
+    if (bpp > 0)
+        max_data_len = MAX (max_data_len, fmt->width * fmt->height * bpp / 8);
+    else
+        max_data_len = MAX (max_data_len, fmt->width * fmt->height * 4);
+
+    self->writer = cam_shm_writer_new (name, &shm_fmt, nslots,
+            max_data_len, MAX_METADATA_LEN);
+    return self->writer ? 0 : -1;
+}
+
+static int
+_stream_init (CamUnit *super, const CamUnitFormat *fmt)
+{
+    CamShmOutput *self = (CamShmOutput*)super;
+    dbg (DBG_OUTPUT, "shm output stream init\n");
+    return _create_writer (self, fmt,
+            cam_unit_control_get_string (self->name_ctl),
+            cam_unit_control_get_int (self->nslots_ctl));
+}
+
+static int
+_stream_shutdown (CamUnit *super)
+{
+    CamShmOutput *self = (CamShmOutput*)super;
+    dbg (DBG_OUTPUT, "shm output stream shutdown\n");
+    if (self->writer) {
+        cam_shm_writer_destroy (self->writer);
+        self->writer = NULL;
+    }
+    return 0;
+}
+
+static void
+on_input_frame_ready (CamUnit *super, const CamFrameBuffer *inbuf,
+        const CamUnitFormat *infmt)
+{
+    dbg (DBG_OUTPUT, "[%s] iterate\n", cam_unit_get_name (super));
+    CamShmOutput *self = (CamShmOutput*)super;
+
+    if (self->writer && cam_unit_control_get_boolean (self->publish_ctl)) {
+        // serialize the metadata dictionary
+        int metadata_len = 0;
+        GList *keys = cam_framebuffer_metadata_list_keys (inbuf);
+        for (GList *kiter=keys; kiter; kiter=kiter->next) {
+            const char *key = (const char*) kiter->data;
+            int vlen = 0;
+            const uint8_t *value =
+                cam_framebuffer_metadata_get (inbuf, key, &vlen);
+            int newlen = cam_shm_metadata_append (self->metadata_buf,
+                    metadata_len, MAX_METADATA_LEN, key, value, vlen);
+            if (newlen < 0) {
+                dbg (DBG_OUTPUT, "shm output: metadata too large, "
+                        "truncating\n");
+                break;
+            }
+            metadata_len = newlen;
+        }
+        g_list_free (keys);
+
+        if (0 != cam_shm_writer_publish (self->writer, inbuf->timestamp,
+                    inbuf->data, inbuf->bytesused,
+                    self->metadata_buf, metadata_len)) {
+            err ("ShmOutput: frame too large (%d bytes), dropping\n",
+                    inbuf->bytesused);
+        }
+    }
+
+    cam_unit_produce_frame (super, inbuf, infmt);
+}
+
+static gboolean
+_try_set_control (CamUnit *super,
+        const CamUnitControl *ctl, const GValue *proposed, GValue *actual)
+{
+    CamShmOutput *self = (CamShmOutput*)super;
+    const CamUnitFormat *fmt = cam_unit_get_output_format (super);
+
+    if (ctl == self->name_ctl) {
+        const char *name = g_value_get_string (proposed);
+        if (!name || !strlen (name) || strchr (name, '/'))
+            return FALSE;
+        if (self->writer && 0 != _create_writer (self, fmt, name,
+                    cam_unit_control_get_int (self->nslots_ctl)))
+            return FALSE;
+    } else if (ctl == self->nslots_ctl) {
+        if (self->writer && 0 != _create_writer (self, fmt,
+                    cam_unit_control_get_string (self->name_ctl),
+                    g_value_get_int (proposed)))
+            return FALSE;
+    }
+    g_value_copy (proposed, actual);
+    return TRUE;
+}
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <camunits/plugin.h>
+#include <camunits/dbg.h>
+#include <camunits/frame_socket.h>
+
+#define err(args...) fprintf (stderr, args)
+
+#define DEFAULT_SOCKET_PATH "/tmp/camunits-socket"
+#define DEFAULT_MEMFD_THRESHOLD 65536
+
+typedef struct _CamSocketOutput {
+    CamUnit parent;
+    CamUnitControl *path_ctl;
+    CamUnitControl *memfd_threshold_ctl;
+    CamUnitControl *clients_ctl;
+
+    CamFrameSocketWriter *writer;
+} CamSocketOutput;
+
+typedef struct _CamSocketOutputClass {
+    CamUnitClass parent_class;
+} CamSocketOutputClass;
+
+static CamSocketOutput * cam_socket_output_new(void);
+
+GType cam_socket_output_get_type (void);
+CAM_PLUGIN_TYPE(CamSocketOutput, cam_socket_output, CAM_TYPE_UNIT);
+
+/* These next two functions are required as entry points for the
+ * plug-in API. */
+void cam_plugin_initialize(GTypeModule * module);
+void cam_plugin_initialize(GTypeModule * module)
+{
+    cam_socket_output_register_type(module);
+}
+
+CamUnitDriver * cam_plugin_create(GTypeModule * module);
+CamUnitDriver * cam_plugin_create(GTypeModule * module)
+{
+    return cam_unit_driver_new_stock_full ("output", "socket",
+            "Socket Output", 0,
+            (CamUnitConstructor)cam_socket_output_new, module);
+}
+
+// ============== CamSocketOutput ===============
+static void socket_finalize (GObject *obj);
+static int _stream_init (CamUnit *super, const CamUnitFormat *fmt);
+static int _stream_shutdown (CamUnit *super);
+static gboolean _try_set_control (CamUnit *super,
+        const CamUnitControl *ctl, const GValue *proposed, GValue *actual);
+static void on_input_format_changed (CamUnit *super,
+        const CamUnitFormat *infmt);
+static void on_input_frame_ready (CamUnit *super, const CamFrameBuffer *inbuf,
+        const CamUnitFormat *infmt);
+
+static void
+cam_socket_output_init (CamSocketOutput *self)
+{
+    dbg (DBG_OUTPUT, "socket output constructor\n");
+    CamUnit *super = CAM_UNIT (self);
+
+    self->writer = NULL;
+
+    self->path_ctl = cam_unit_add_control_string (super,
+            "path", "Socket Path", DEFAULT_SOCKET_PATH, 1);
+    self->memfd_threshold_ctl = cam_unit_add_control_int (super,
+            "memfd-threshold", "Pass By FD Above (bytes)", 0, 64 << 20, 4096,
+            DEFAULT_MEMFD_THRESHOLD, 1);
+    cam_unit_control_set_ui_hints (self->memfd_threshold_ctl,
+            CAM_UNIT_CONTROL_SPINBUTTON);
+    self->clients_ctl = cam_unit_add_control_int (super,
+            "clients", "Clients", 0, G_MAXINT, 1, 0, 0);
+
+    g_signal_connect (G_OBJECT (self), "input-format-changed",
+            G_CALLBACK (on_input_format_changed), self);
+}
+
+static void
+cam_socket_output_class_init (CamSocketOutputClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+    gobject_class->finalize = socket_finalize;
+    klass->parent_class.stream_init = _stream_init;
+    klass->parent_class.stream_shutdown = _stream_shutdown;
+    klass->parent_class.try_set_control = _try_set_control;
+    klass->parent_class.on_input_frame_ready = on_input_frame_ready;
+}
+
+static void
+socket_finalize (GObject *obj)
+{
+    dbg (DBG_OUTPUT, "socket output finalize\n");
+    CamSocketOutput *self = (CamSocketOutput*)obj;
+    if (self->writer) {
+        cam_frame_socket_writer_destroy (self->writer);
+        self->writer = NULL;
+    }
+
+    G_OBJECT_CLASS (cam_socket_output_parent_class)->finalize (obj);
+}
+
+static CamSocketOutput *
+cam_socket_output_new ()
+{
+    return (CamSocketOutput*)
+        (g_object_new (cam_socket_output_get_type(), NULL));
+}
+
+static void
+on_input_format_changed (CamUnit *super, const CamUnitFormat *infmt)
+{
+    cam_unit_remove_all_output_formats (super);
+    if (!infmt)
+        return;
+
+    // match the output format of the input unit
+    cam_unit_add_output_format (super, infmt->pixelformat,
+            infmt->name, infmt->width, infmt->height,
+            infmt->row_stride);
+}
+
+static int
+_create_writer (CamSocketOutput *self, const CamUnitFormat *fmt,
+        const char *path)
+{
+    if (self->writer) {
+        cam_frame_socket_writer_destroy (self->writer);
+        self->writer = NULL;
+    }
+
+    CamLogFrameFormat log_fmt;
+    log_fmt.width = fmt->width;
+    log_fmt.height = fmt->height;
+    log_fmt.stride = fmt->row_stride;
+    log_fmt.pixelformat = fmt->pixelformat;
+
+    self->writer = cam_frame_socket_writer_new (path, &log_fmt,
+            cam_unit_control_get_int (self->memfd_threshold_ctl));
+    cam_unit_control_force_set_int (self->clients_ctl, 0);
+    return self->writer ? 0 : -1;
+}
+
+static int
+_stream_init (CamUnit *super, const CamUnitFormat *fmt)
+{
+    CamSocketOutput *self = (CamSocketOutput*)super;
+    dbg (DBG_OUTPUT, "socket output stream init\n");
+    return _create_writer (self, fmt,
+            cam_unit_control_get_string (self->path_ctl));
+}
+
+static int
+_stream_shutdown (CamUnit *super)
+{
+    CamSocketOutput *self = (CamSocketOutput*)super;
+    dbg (DBG_OUTPUT, "socket output stream shutdown\n");
+    if (self->writer) {
+        cam_frame_socket_writer_destroy (self->writer);
+        self->writer = NULL;
+    }
+    cam_unit_control_force_set_int (self->clients_ctl, 0);
+    return 0;
+}
+
+static void
+on_input_frame_ready (CamUnit *super, const CamFrameBuffer *inbuf,
+        const CamUnitFormat *infmt)
+{
+    dbg (DBG_OUTPUT, "[%s] iterate\n", cam_unit_get_name (super));
+    CamSocketOutput *self = (CamSocketOutput*)super;
+
+    if (self->writer) {
+        cam_frame_socket_writer_publish (self->writer, inbuf);
+        int nclients = cam_frame_socket_writer_accept_clients (self->writer);
+        if (nclients != cam_unit_control_get_int (self->clients_ctl))
+            cam_unit_control_force_set_int (self->clients_ctl, nclients);
+    }
+
+    cam_unit_produce_frame (super, inbuf, infmt);
+}
+
+static gboolean
+_try_set_control (CamUnit *super,
+        const CamUnitControl *ctl, const GValue *proposed, GValue *actual)
+{
+    CamSocketOutput *self = (CamSocketOutput*)super;
+    const CamUnitFormat *fmt = cam_unit_get_output_format (super);
+
+    if (ctl == self->path_ctl) {
+        const char *path = g_value_get_string (proposed);
+        if (!path || !strlen (path))
+            return FALSE;
+        if (self->writer && 0 != _create_writer (self, fmt, path))
+            return FALSE;
+    } else if (ctl == self->memfd_threshold_ctl) {
+        if (self->writer)
+            cam_frame_socket_writer_set_memfd_threshold (self->writer,
+                    g_value_get_int (proposed));
+    }
+    g_value_copy (proposed, actual);
+    return TRUE;
+}
@@ -15,6 +15,7 @@
 
 #include "camunits/plugin.h"
 #include "camunits/dbg.h"
+#include "camunits/probes.h"
 
 #define err(args...) fprintf(stderr, args)
 
@@ -43,9 +44,29 @@ typedef struct _CamV4L2 {
     int buffer_length;
     int buffers_outstanding;
 
+    // V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE for devices that only support the
+    // multi-planar API.  The planes of each multi-planar buffer are mapped
+    // one after the other into a single region, plane_offsets bytes from its
+    // start, so that a frame can be passed downstream without copying it.
+    // Each frame tells downstream units where its planes are with
+    // cam_framebuffer_set_planes.
+    enum v4l2_buf_type buf_type;
+    int num_planes;
+    int plane_offsets[VIDEO_MAX_PLANES];
+    int plane_strides[VIDEO_MAX_PLANES];
+
     int use_try_fmt;
 
+    // sequence number of the last buffer dequeued, for detecting frames
+    // dropped by the driver
+    uint32_t last_sequence;
+    int have_sequence;
+    int dropped;
+
     CamUnitControl *standard_ctl;
+    CamUnitControl *dropped_ctl;
+    CamUnitControl *queued_ctl;
+    CamUnitControl *latest_only_ctl;
 //    CamUnitControl *stream_ctl;
 } CamV4L2;
 
@@ -53,6 +74,13 @@ typedef struct _CamV4L2Class {
     CamUnitClass parent_class;
 } CamV4L2Class;
 
+enum {
+    LATENCY_BUDGET_EXCEEDED_SIGNAL,
+    LAST_SIGNAL
+};
+
+static guint cam_v4l2_signals[LAST_SIGNAL] = { 0 };
+
 GType cam_v4l2_driver_get_type (void);
 GType cam_v4l2_get_type (void);
 
@@ -151,7 +179,8 @@ open_v4l2_device (int num, struct v4l2_capability * cap)
         return -1;
     }
 
-    if (!(cap->capabilities & V4L2_CAP_VIDEO_CAPTURE)) {
+    if (!(cap->capabilities &
+                (V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_CAPTURE_MPLANE))) {
         close (fd);
         return -1;
     }
@@ -225,7 +254,12 @@ cam_v4l2_init (CamV4L2 * self)
     self->num_buffers = 0;
     self->buffer_length = 0;
     self->buffers_outstanding = 0;
+    self->buf_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    self->num_planes = 1;
     self->use_try_fmt = 1;
+    self->last_sequence = 0;
+    self->have_sequence = 0;
+    self->dropped = 0;
 }
 
 static void v4l2_finalize (GObject * obj);
@@ -249,6 +283,25 @@ cam_v4l2_class_init (CamV4L2Class * klass)
     klass->parent_class.try_produce_frame = v4l2_try_produce_frame;
     klass->parent_class.get_fileno = v4l2_get_fileno;
     klass->parent_class.try_set_control = v4l2_try_set_control;
+
+    /**
+     * CamV4L2::latency-budget-exceeded
+     * @unit: the CamV4L2 emitting the signal
+     * @lost: the number of frames the driver dropped
+     *
+     * Emitted when a gap in the driver's buffer sequence numbers shows that
+     * the driver dropped frames because all of its buffers were full, i.e.
+     * the chain did not return buffers to the driver quickly enough.  It is
+     * emitted before the first frame after the gap is produced.
+     */
+    cam_v4l2_signals[LATENCY_BUDGET_EXCEEDED_SIGNAL] =
+        g_signal_new ("latency-budget-exceeded",
+                G_TYPE_FROM_CLASS (klass),
+                G_SIGNAL_RUN_FIRST,
+                0, NULL, NULL,
+                g_cclosure_marshal_VOID__INT,
+                G_TYPE_NONE, 1,
+                G_TYPE_INT);
 }
 
 static void
@@ -287,12 +340,51 @@ open_camera_device(CamV4L2 *self)
     return self->fd;
 }
 
+/* Returns 1 if downstream units can find the planes of a frame of
+ * @pixelformat that the driver delivers in @num_planes planes. */
+static int
+_planes_supported (CamPixelFormat pixelformat, int num_planes)
+{
+    if (num_planes == 1)
+        return 1;
+    return (pixelformat == CAM_PIXEL_FORMAT_NV12 && num_planes == 2) ||
+        (pixelformat == CAM_PIXEL_FORMAT_I420 && num_planes == 3);
+}
+
 static int
 add_v4l2_format (CamV4L2 * self, uint32_t width, uint32_t height,
         CamPixelFormat cam_pixelformat, uint32_t v4l2_pixelformat)
 {
     struct v4l2_format *fmt = calloc (1, sizeof (struct v4l2_format));
-    fmt->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmt->type = self->buf_type;
+    if (self->buf_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        // the driver chooses the plane layout and row stride, so ask for
+        // them now instead of advertising a format that changes when
+        // streaming starts
+        fmt->fmt.pix_mp.width = width;
+        fmt->fmt.pix_mp.height = height;
+        fmt->fmt.pix_mp.pixelformat = v4l2_pixelformat;
+        fmt->fmt.pix_mp.field = V4L2_FIELD_ANY;
+        if (ioctl (self->fd, VIDIOC_TRY_FMT, fmt) < 0) {
+            perror ("VIDIOC_TRY_FMT");
+            free (fmt);
+            return -1;
+        }
+        if (!_planes_supported (cam_pixelformat,
+                    fmt->fmt.pix_mp.num_planes)) {
+            dbg (DBG_INPUT, "v4l2: can't produce %s from %d planes\n",
+                    cam_pixel_format_nickname (cam_pixelformat),
+                    fmt->fmt.pix_mp.num_planes);
+            free (fmt);
+            return -1;
+        }
+        CamUnitFormat *new_fmt = cam_unit_add_output_format (CAM_UNIT (self),
+                cam_pixelformat, NULL, fmt->fmt.pix_mp.width,
+                fmt->fmt.pix_mp.height,
+                fmt->fmt.pix_mp.plane_fmt[0].bytesperline);
+        g_object_set_data (G_OBJECT (new_fmt), "input_v4l2:v4l2_format", fmt);
+        return 0;
+    }
     fmt->fmt.pix.width = width;
     fmt->fmt.pix.height = height;
     fmt->fmt.pix.pixelformat = v4l2_pixelformat;
@@ -456,9 +548,20 @@ cam_v4l2_new (const char *path)
     if(open_camera_device(self) < 0) 
         goto fail;
 
+    // use the multi-planar API only if the device doesn't support the
+    // single-planar one
+    struct v4l2_capability cap;
+    memset (&cap, 0, sizeof (cap));
+    if (0 == ioctl (self->fd, VIDIOC_QUERYCAP, &cap) &&
+            !(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) &&
+            (cap.capabilities & V4L2_CAP_VIDEO_CAPTURE_MPLANE)) {
+        dbg (DBG_INPUT, "v4l2: %s is multi-planar\n", path);
+        self->buf_type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    }
+
     struct v4l2_cropcap cropcap;
     memset (&cropcap, 0, sizeof (cropcap));
-    cropcap.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    cropcap.type = self->buf_type;
     if (ioctl (self->fd, VIDIOC_CROPCAP, &cropcap) != 0) {
         fprintf (stderr, "Warning: %s does not support VIDIOC_CROPCAP\n", path);
     }
@@ -466,7 +569,7 @@ cam_v4l2_new (const char *path)
     struct v4l2_fmtdesc f;
     memset (&f, 0, sizeof (f));
     f.index = 0;
-    f.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    f.type = self->buf_type;
     int oldfindex = f.index;
 
     while (ioctl (self->fd, VIDIOC_ENUM_FMT, &f) == 0) {
@@ -479,6 +582,14 @@ cam_v4l2_new (const char *path)
         if (f.pixelformat == 0x32435750) { // 'PWC2'
             cam_pixelformat = CAM_PIXEL_FORMAT_I420;
         }
+        // formats whose planes are in separate buffers are produced as their
+        // contiguous counterparts, with the plane layout in each frame's
+        // metadata
+        if (f.pixelformat == V4L2_PIX_FMT_NV12M) {
+            cam_pixelformat = CAM_PIXEL_FORMAT_NV12;
+        } else if (f.pixelformat == V4L2_PIX_FMT_YUV420M) {
+            cam_pixelformat = CAM_PIXEL_FORMAT_I420;
+        }
 
         // HACK.  This seems to improve stability.
         open_camera_device(self);
@@ -525,11 +636,17 @@ cam_v4l2_new (const char *path)
 
     struct v4l2_format curfmt;
     memset (&curfmt, 0, sizeof (curfmt));
-    curfmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    curfmt.type = self->buf_type;
     if (ioctl (self->fd, VIDIOC_G_FMT, &curfmt) == 0) {
-        dbg (DBG_INPUT, "v4l2: current format: %dx%d\n", 
-                curfmt.fmt.pix.width, 
-                curfmt.fmt.pix.height);
+        if (self->buf_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+            dbg (DBG_INPUT, "v4l2: current format: %dx%d, %d planes\n",
+                    curfmt.fmt.pix_mp.width, curfmt.fmt.pix_mp.height,
+                    curfmt.fmt.pix_mp.num_planes);
+        } else {
+            dbg (DBG_INPUT, "v4l2: current format: %dx%d\n", 
+                    curfmt.fmt.pix.width, 
+                    curfmt.fmt.pix.height);
+        }
         if (ioctl (self->fd, VIDIOC_S_FMT, &curfmt) < 0) {
             err("V4L2:  Unable to set output format!\n");
         }
@@ -555,6 +672,94 @@ _unmap_buffers (CamV4L2 *self)
     self->buffers = NULL;
 }
 
+/* Maps the planes of a multi-planar buffer one after the other into a
+ * single region.  Planes must be mapped at page boundaries, so there may be
+ * a gap between the end of one plane and the start of the next. */
+static uint8_t *
+_map_planes (CamV4L2 *self, const struct v4l2_buffer *buffer)
+{
+    size_t page_size = sysconf (_SC_PAGESIZE);
+    size_t offsets[VIDEO_MAX_PLANES];
+    size_t total = 0;
+    for (int p = 0; p < buffer->length; p++) {
+        offsets[p] = total;
+        total += (buffer->m.planes[p].length + page_size - 1) &
+            ~(page_size - 1);
+    }
+
+    // reserve the address range, then map each plane over part of it
+    uint8_t *region = mmap (NULL, total, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED)
+        return NULL;
+    for (int p = 0; p < buffer->length; p++) {
+        void *plane = mmap (region + offsets[p], buffer->m.planes[p].length,
+                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                self->fd, buffer->m.planes[p].m.mem_offset);
+        if (plane == MAP_FAILED) {
+            munmap (region, total);
+            return NULL;
+        }
+        self->plane_offsets[p] = offsets[p];
+    }
+    self->buffer_length = total;
+    return region;
+}
+
+static uint8_t *
+_map_buffer (CamV4L2 *self, const struct v4l2_buffer *buffer)
+{
+    if (self->buf_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+        return _map_planes (self, buffer);
+
+    uint8_t *data = mmap (NULL, buffer->length,
+            PROT_READ | PROT_WRITE, MAP_SHARED,
+            self->fd, buffer->m.offset);
+    if (data == MAP_FAILED)
+        return NULL;
+    self->buffer_length = buffer->length;
+    return data;
+}
+
+/* Replaces @format, whose row stride was not the one the driver chose for
+ * it, with a format that has the driver's @row_stride, and starts streaming
+ * that instead.  The output formats can't change once the unit is
+ * streaming, and replacing them makes downstream units negotiate against
+ * the new format when they see that the unit has started. */
+static int
+_restart_with_stride (CamV4L2 *self, const CamUnitFormat *format,
+        int row_stride)
+{
+    CamUnit *super = CAM_UNIT (self);
+    GList *formats = cam_unit_get_output_formats (super);
+    CamUnitFormat *match = NULL;
+    for (GList *iter = formats; iter; iter = iter->next) {
+        g_object_ref (iter->data);
+        if (!match && cam_unit_format_equals (iter->data, format))
+            match = iter->data;
+    }
+    dbg (DBG_INPUT, "v4l2: row stride of %s is %d, not %d\n",
+            format->name, row_stride, format->row_stride);
+
+    CamUnitFormat *replacement = NULL;
+    cam_unit_remove_all_output_formats (super);
+    for (GList *iter = formats; iter; iter = iter->next) {
+        CamUnitFormat *old = CAM_UNIT_FORMAT (iter->data);
+        CamUnitFormat *new_fmt = cam_unit_add_output_format (super,
+                old->pixelformat, old->name, old->width, old->height,
+                old == match ? row_stride : old->row_stride);
+        g_object_set_data (G_OBJECT (new_fmt), "input_v4l2:v4l2_format",
+                g_object_get_data (G_OBJECT (old), "input_v4l2:v4l2_format"));
+        if (old == match)
+            replacement = new_fmt;
+        g_object_unref (old);
+    }
+    g_list_free (formats);
+    if (!replacement)
+        return -1;
+    return cam_unit_stream_init (super, replacement);
+}
+
 static int
 v4l2_stream_init (CamUnit * super, const CamUnitFormat * format)
 {
@@ -571,11 +776,42 @@ v4l2_stream_init (CamUnit * super, const CamUnitFormat * format)
         return -1;
     }
 
+    int row_stride = 0;
+    int expected_stride = format->row_stride;
+    if (self->buf_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        self->num_planes = fmt->fmt.pix_mp.num_planes;
+        for (int p = 0; p < self->num_planes; p++)
+            self->plane_strides[p] = fmt->fmt.pix_mp.plane_fmt[p].bytesperline;
+        row_stride = self->plane_strides[0];
+        if (!_planes_supported (format->pixelformat, self->num_planes)) {
+            err ("v4l2: can't produce %s from %d planes\n",
+                    cam_pixel_format_nickname (format->pixelformat),
+                    self->num_planes);
+            return -1;
+        }
+    } else {
+        self->num_planes = 1;
+        if (fmt->fmt.pix.height * fmt->fmt.pix.bytesperline <=
+                fmt->fmt.pix.sizeimage)
+            row_stride = fmt->fmt.pix.bytesperline;
+        // formats advertised without a stride have tightly packed rows
+        if (!expected_stride)
+            expected_stride = format->width *
+                cam_pixel_format_bpp (format->pixelformat) / 8;
+    }
+
+    // the driver may still choose a different stride than the one that was
+    // advertised.  When restarting after an error, it has already been
+    // corrected.
+    if (row_stride > 0 && row_stride != expected_stride &&
+            !cam_unit_is_streaming (super))
+        return _restart_with_stride (self, format, row_stride);
+
     // request kernel buffers
     struct v4l2_requestbuffers reqbuf;
     memset (&reqbuf, 0, sizeof (reqbuf));
     reqbuf.count = NUM_BUFFERS;
-    reqbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    reqbuf.type = self->buf_type;
     reqbuf.memory = V4L2_MEMORY_MMAP;
     if ( -1 == ioctl (self->fd, VIDIOC_REQBUFS, &reqbuf)) {
         if (errno == EINVAL) {
@@ -593,36 +829,46 @@ v4l2_stream_init (CamUnit * super, const CamUnitFormat * format)
     int i;
     for (i=0; i<self->num_buffers; i++) {
         struct v4l2_buffer buffer;
+        struct v4l2_plane planes[VIDEO_MAX_PLANES];
         memset (&buffer, 0, sizeof (buffer));
         buffer.type = reqbuf.type;
         buffer.memory = V4L2_MEMORY_MMAP;
         buffer.index = i;
+        if (self->buf_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+            memset (planes, 0, sizeof (planes));
+            buffer.m.planes = planes;
+            buffer.length = self->num_planes;
+        }
         if (-1 == ioctl (self->fd, VIDIOC_QUERYBUF, &buffer)) {
             perror ("VIDIOC_QUERYBUF");
             break;
         }
 
-        self->buffers[i] = mmap (NULL, buffer.length,
-                PROT_READ | PROT_WRITE, MAP_SHARED,
-                self->fd, buffer.m.offset);
+        self->buffers[i] = _map_buffer (self, &buffer);
+        if (!self->buffers[i]) {
+            perror ("mmap");
+            break;
+        }
         dbg (DBG_INPUT, "v4l2 mapped %p (%d bytes)\n",
-                self->buffers[i], buffer.length);
+                self->buffers[i], self->buffer_length);
 
         if (-1 == ioctl (self->fd, VIDIOC_QBUF, &buffer)) {
             perror ("VIDIOC_QBUF");
+            munmap (self->buffers[i], self->buffer_length);
             break;
         }
-
-        self->buffer_length = buffer.length;
     }
 
     if (i<self->num_buffers) {
-        for (int j=0; j<=i; j++)
-            munmap (self->buffers[i], self->buffer_length);
+        for (int j=0; j<i; j++)
+            munmap (self->buffers[j], self->buffer_length);
+        free (self->buffers);
+        self->buffers = NULL;
         return -1;
     }
 
     self->buffers_outstanding = 0;
+    self->have_sequence = 0;
 
 #if 0
     // special case for MJPEG
@@ -647,7 +893,7 @@ v4l2_stream_init (CamUnit * super, const CamUnitFormat * format)
     dbg (DBG_INPUT, "v4l2 mapped %d buffers of size %d\n", 
             self->num_buffers, self->buffer_length);
 
-    int streamontype = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    int streamontype = self->buf_type;
     if (-1 == ioctl (self->fd, VIDIOC_STREAMON, &streamontype)) {
         perror ("VIDIOC_STREAMON");
         err ("v4l2: couldn't start streaming images\n");
@@ -663,7 +909,7 @@ v4l2_stream_shutdown (CamUnit * super)
 {
     CamV4L2 * self = (CamV4L2*) (super);
 
-    int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    int type = self->buf_type;
     if (-1 == ioctl (self->fd, VIDIOC_STREAMOFF, &type)) {
         perror ("VIDIOC_STREAMOFF");
         err ("v4l2: couldn't stop streaming images\n");
@@ -676,7 +922,7 @@ v4l2_stream_shutdown (CamUnit * super)
     struct v4l2_requestbuffers reqbuf;
     memset (&reqbuf, 0, sizeof (reqbuf));
     reqbuf.count = 0;
-    reqbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    reqbuf.type = self->buf_type;
     reqbuf.memory = V4L2_MEMORY_MMAP;
     if (-1 == ioctl (self->fd, VIDIOC_REQBUFS, &reqbuf)) {
         fprintf (stderr, "Warning: v4l2 driver does not handle REQBUFS "
@@ -686,48 +932,184 @@ v4l2_stream_shutdown (CamUnit * super)
     return 0;
 }
 
+static void
+_set_metadata_uint (CamFrameBuffer *fbuf, const char *key, uint32_t val)
+{
+    char str[16];
+    int len = snprintf (str, sizeof (str), "%u", val);
+    cam_framebuffer_metadata_set (fbuf, key, (uint8_t*) str, len);
+}
+
+/* Returns the number of frames the driver dropped between the previous
+ * buffer and the one with sequence number @sequence. */
+static int
+_check_sequence (CamV4L2 *self, uint32_t sequence)
+{
+    int lost = 0;
+    uint32_t delta = sequence - self->last_sequence;
+    // drivers that don't count frames leave the sequence at 0.  A backwards
+    // jump means the driver restarted counting.
+    if (self->have_sequence && delta > 1 && delta < 0x80000000)
+        lost = delta - 1;
+    self->last_sequence = sequence;
+    self->have_sequence = 1;
+    self->dropped += lost;
+    return lost;
+}
+
+/* Returns the offset of the data of plane @p of a multi-planar buffer from
+ * the start of its mapping. */
+static int
+_plane_start (CamV4L2 *self, const struct v4l2_buffer *buf, int p)
+{
+    return self->plane_offsets[p] + buf->m.planes[p].data_offset;
+}
+
+static void
+_produce_buffer (CamV4L2 *self, const struct v4l2_buffer *buf,
+        const CamUnitFormat *outfmt)
+{
+    int queued = self->num_buffers - self->buffers_outstanding;
+
+    // TODO don't malloc
+    CamFrameBuffer * fbuf;
+    if (self->buf_type != V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        fbuf = cam_framebuffer_new (self->buffers[buf->index],
+                self->buffer_length);
+        fbuf->bytesused = buf->bytesused;
+    } else {
+        // the frame starts at the data of the first plane, and the other
+        // planes are wherever they were mapped
+        int start = _plane_start (self, buf, 0);
+        int last = self->num_planes - 1;
+        fbuf = cam_framebuffer_new (self->buffers[buf->index] + start,
+                self->buffer_length - start);
+        fbuf->bytesused = self->plane_offsets[last] +
+            buf->m.planes[last].bytesused - start;
+        if (self->num_planes > 1) {
+            int offsets[VIDEO_MAX_PLANES];
+            for (int p = 0; p < self->num_planes; p++)
+                offsets[p] = _plane_start (self, buf, p) - start;
+            cam_framebuffer_set_planes (fbuf, self->num_planes, offsets,
+                    self->plane_strides);
+        }
+    }
+    fbuf->timestamp = buf->timestamp.tv_sec * 1000000 + buf->timestamp.tv_usec;
+    _set_metadata_uint (fbuf, "Bus Timestamp", buf->sequence);
+    _set_metadata_uint (fbuf, "Dropped Frames", self->dropped);
+    _set_metadata_uint (fbuf, "Queued Buffers", queued);
+    cam_unit_produce_frame (CAM_UNIT (self), fbuf, outfmt);
+    g_object_unref (fbuf);
+
+    if (queued != cam_unit_control_get_int (self->queued_ctl))
+        cam_unit_control_force_set_int (self->queued_ctl, queued);
+}
+
+// returns a dequeued buffer to the driver
+static int
+_requeue_buffer (CamV4L2 *self, struct v4l2_buffer *buf)
+{
+    CAM_PROBE2 (v4l2_qbuf, self->fd, buf->index);
+    if (-1 == ioctl (self->fd, VIDIOC_QBUF, buf)) {
+        fprintf (stderr, "Error: QBUF ioctl failed: %s\n", strerror (errno));
+        return -1;
+    }
+    self->buffers_outstanding--;
+    return 0;
+}
+
 static gboolean
 v4l2_try_produce_frame (CamUnit * super)
 {
     CamV4L2 * self = (CamV4L2*) (super);
     const CamUnitFormat * outfmt = cam_unit_get_output_format (super);
+    int latest_only = cam_unit_control_get_boolean (self->latest_only_ctl);
 
-    /* If all buffers are already dequeued, V4L2 will keep waking us up
-     * because it puts an error condition on its file descriptor.  Thus,
-     * we bide our time and sleep a bit so we don't hose the CPU. */
-    if (self->buffers_outstanding == self->num_buffers) {
-        struct timespec st = { 0, 1000000 };
-        nanosleep (&st, NULL);
-        return FALSE;
-    }
-
+    /* Every buffer that is dequeued is returned to the driver before this
+     * function returns, so the driver always has buffers to fill and its
+     * file descriptor only becomes readable when a frame is ready.  Drain
+     * all of the frames that are ready in one wakeup, but no more than there
+     * are buffers, so that a fast camera can't starve the main loop. */
     struct v4l2_buffer buf;
-    memset (&buf, 0, sizeof (buf));
-    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buf.memory = V4L2_MEMORY_MMAP;
-    if (-1 == ioctl (self->fd, VIDIOC_DQBUF, &buf)) {
-        fprintf (stderr, "Warning: DQBUF ioctl failed: %s\n", strerror (errno));
+    struct v4l2_buffer latest;
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    struct v4l2_plane latest_planes[VIDEO_MAX_PLANES];
+    int ndequeued = 0;
+    int restart = 0;
+    while (ndequeued < self->num_buffers) {
+        memset (&buf, 0, sizeof (buf));
+        buf.type = self->buf_type;
+        buf.memory = V4L2_MEMORY_MMAP;
+        if (self->buf_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+            memset (planes, 0, sizeof (planes));
+            buf.m.planes = planes;
+            buf.length = self->num_planes;
+        }
+        if (-1 == ioctl (self->fd, VIDIOC_DQBUF, &buf)) {
+            if (errno == EAGAIN)
+                break;
+            fprintf (stderr, "Warning: DQBUF ioctl failed: %s\n",
+                    strerror (errno));
+            restart = 1;
+            break;
+        }
+        CAM_PROBE4 (v4l2_dqbuf, self->fd, buf.index, buf.sequence,
+                (int64_t) buf.timestamp.tv_sec * 1000000 +
+                buf.timestamp.tv_usec);
+        self->buffers_outstanding++;
+
+        int lost = _check_sequence (self, buf.sequence);
+        if (lost) {
+            dbg (DBG_INPUT, "v4l2: driver dropped %d frames before "
+                    "sequence %u\n", lost, buf.sequence);
+            CAM_PROBE3 (v4l2_frame_drop, self->fd, buf.sequence, lost);
+            g_signal_emit (G_OBJECT (self),
+                    cam_v4l2_signals[LATENCY_BUDGET_EXCEEDED_SIGNAL], 0, lost);
+        }
 
-        /* Restart the stream from scratch */
-        v4l2_stream_shutdown (super);
-        v4l2_stream_init (super, outfmt);
-        return FALSE;
+        if (latest_only) {
+            // hand the stale frame straight back to the driver
+            if (ndequeued && 0 != _requeue_buffer (self, &latest)) {
+                restart = 1;
+                break;
+            }
+            latest = buf;
+            if (self->buf_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+                memcpy (latest_planes, planes, sizeof (planes));
+                latest.m.planes = latest_planes;
+            }
+        } else {
+            _produce_buffer (self, &buf, outfmt);
+            // a downstream handler may have stopped the stream
+            if (!cam_unit_is_streaming (super))
+                return TRUE;
+            if (0 != _requeue_buffer (self, &buf)) {
+                restart = 1;
+                break;
+            }
+        }
+        ndequeued++;
     }
 
-    // TODO don't malloc
-    CamFrameBuffer * fbuf = cam_framebuffer_new (self->buffers[buf.index],
-            self->buffer_length);
-    fbuf->timestamp = buf.timestamp.tv_sec * 1000000 + buf.timestamp.tv_usec;
-//    fbuf->bus_timestamp = buf.sequence;
-    fbuf->bytesused = buf.bytesused;
-    cam_unit_produce_frame (super, fbuf, outfmt);
-    g_object_unref (fbuf);
+    if (latest_only && ndequeued && !restart) {
+        _produce_buffer (self, &latest, outfmt);
+        if (!cam_unit_is_streaming (super))
+            return TRUE;
+        if (0 != _requeue_buffer (self, &latest))
+            restart = 1;
+    }
 
-    // release v4l2 mmap buffer
-    if (-1 == ioctl (self->fd, VIDIOC_QBUF, &buf)) {
-        fprintf (stderr, "Error: QBUF ioctl failed: %s\n", strerror (errno));
+    if (self->dropped != cam_unit_control_get_int (self->dropped_ctl))
+        cam_unit_control_force_set_int (self->dropped_ctl, self->dropped);
+
+    if (restart) {
+        /* A buffer that can't be returned to the driver is lost to it, and
+         * once the driver has none left its file descriptor signals an error
+         * on every poll.  Restart the stream from scratch. */
+        v4l2_stream_shutdown (super);
+        v4l2_stream_init (super, outfmt);
     }
-    return TRUE;
+    return ndequeued > 0;
 }
 
 static int
@@ -919,6 +1301,13 @@ add_all_controls (CamUnit * super)
 
     add_user_controls (self);
 
+    self->dropped_ctl = cam_unit_add_control_int (super, "dropped",
+            "Dropped Frames", 0, G_MAXINT, 1, 0, 0);
+    self->queued_ctl = cam_unit_add_control_int (super, "queued",
+            "Queued Buffers", 0, G_MAXINT, 1, 0, 0);
+    self->latest_only_ctl = cam_unit_add_control_boolean (super,
+            "latest-only", "Latest Frame Only", 0, 1);
+
     return 0;
 }
 
@@ -951,6 +1340,10 @@ v4l2_try_set_control(CamUnit *super, const CamUnitControl *ctl,
         g_value_set_int (actual, val);
         return TRUE;
     }
+    if (ctl == self->latest_only_ctl) {
+        g_value_copy (proposed, actual);
+        return TRUE;
+    }
     if (!strncmp (ctl_id, "tuner-", strlen ("tuner-"))) {
         int tuner_id = GPOINTER_TO_INT (
             g_object_get_data (G_OBJECT (ctl), "input_v4l2:tuner-id")) - 1;
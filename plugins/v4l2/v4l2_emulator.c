@@ -0,0 +1,767 @@
+/*
+ * An emulated V4L2 capture device, for testing and benchmarking the
+ * input.v4l2 plugin without hardware.
+ *
+ * Load it with LD_PRELOAD.  It intercepts stat(), open(), close(), ioctl()
+ * and mmap() on one device path, and answers them like a simple capture
+ * driver with a single format and memory-mapped streaming I/O.  A
+ * generator thread fills queued buffers at a fixed frame rate.  Each open
+ * file descriptor is backed by an eventfd that becomes readable when a frame
+ * is ready, so poll(), select() and the GLib main loop work unmodified.
+ *
+ * The device is configured with environment variables:
+ *
+ *   CAMUNITS_V4L2_EMU_DEVICE   device path (default /dev/video0)
+ *   CAMUNITS_V4L2_EMU_FORMAT   fourcc: YUYV, UYVY, GREY, RGB3, BGR3, YU12
+ *                              or NV12 (default YUYV)
+ *   CAMUNITS_V4L2_EMU_SIZE     WIDTHxHEIGHT (default 640x480)
+ *   CAMUNITS_V4L2_EMU_FPS      frame rate (default 30).  0 produces a frame
+ *                              as soon as a buffer is queued.
+ *   CAMUNITS_V4L2_EMU_DROP     probability that a frame is dropped, leaving
+ *                              a gap in the sequence numbers (default 0)
+ *   CAMUNITS_V4L2_EMU_ERROR    probability that a VIDIOC_DQBUF fails with
+ *                              EIO (default 0)
+ *   CAMUNITS_V4L2_EMU_SEED     seed for the drop and error injection
+ *
+ * Frames that arrive while no buffer is queued are dropped, as a real driver
+ * does.
+ */
+
+// the intercepted functions are defined with their unsuffixed names, so the
+// large file redirections must be off
+#undef _FILE_OFFSET_BITS
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <linux/videodev2.h>
+
+#define err(args...) fprintf(stderr, args)
+
+#define MAX_FDS 16
+#define MAX_BUFFERS 32
+
+typedef enum {
+    BUF_IDLE,      // owned by the application
+    BUF_QUEUED,    // waiting to be filled
+    BUF_DONE       // filled, waiting to be dequeued
+} buffer_state_t;
+
+typedef struct _emu_buffer {
+    buffer_state_t state;
+    struct v4l2_buffer info;
+} emu_buffer_t;
+
+typedef struct _emu_device {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int initialized;
+
+    // configuration
+    char path[256];
+    uint32_t pixelformat;
+    int width;
+    int height;
+    int bytesperline;
+    int sizeimage;
+    double fps;
+    double drop_rate;
+    double error_rate;
+    unsigned int seed;
+
+    // open file descriptors.  Each one is an eventfd.
+    int fds[MAX_FDS];
+
+    // the buffers and the descriptor that allocated them
+    int owner_fd;
+    int memfd;
+    uint8_t *mem;
+    int buffer_stride;
+    int nbuffers;
+    emu_buffer_t buffers[MAX_BUFFERS];
+    // dequeue order of filled buffers
+    int done[MAX_BUFFERS];
+    int ndone;
+
+    int streaming;
+    pthread_t thread;
+    uint32_t sequence;
+} emu_device_t;
+
+static emu_device_t dev = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static int (*real_open) (const char *, int, ...);
+static int (*real_open64) (const char *, int, ...);
+static int (*real_close) (int);
+static int (*real_ioctl) (int, unsigned long, ...);
+static void * (*real_mmap) (void *, size_t, int, int, int, off_t);
+static void * (*real_mmap64) (void *, size_t, int, int, int, off64_t);
+static int (*real_stat) (const char *, struct stat *);
+static int (*real_stat64) (const char *, struct stat64 *);
+static int (*real___xstat) (int, const char *, struct stat *);
+static int (*real___xstat64) (int, const char *, struct stat64 *);
+
+static void
+load_real_functions (void)
+{
+    real_open = dlsym (RTLD_NEXT, "open");
+    real_open64 = dlsym (RTLD_NEXT, "open64");
+    real_close = dlsym (RTLD_NEXT, "close");
+    real_ioctl = dlsym (RTLD_NEXT, "ioctl");
+    real_mmap = dlsym (RTLD_NEXT, "mmap");
+    real_mmap64 = dlsym (RTLD_NEXT, "mmap64");
+    real_stat = dlsym (RTLD_NEXT, "stat");
+    real_stat64 = dlsym (RTLD_NEXT, "stat64");
+    real___xstat = dlsym (RTLD_NEXT, "__xstat");
+    real___xstat64 = dlsym (RTLD_NEXT, "__xstat64");
+}
+
+static double
+getenv_double (const char *name, double def)
+{
+    const char *val = getenv (name);
+    return val ? atof (val) : def;
+}
+
+static int
+bits_per_pixel (uint32_t pixelformat)
+{
+    switch (pixelformat) {
+        case V4L2_PIX_FMT_GREY: return 8;
+        case V4L2_PIX_FMT_YUV420:
+        case V4L2_PIX_FMT_NV12: return 12;
+        case V4L2_PIX_FMT_RGB24:
+        case V4L2_PIX_FMT_BGR24: return 24;
+        case V4L2_PIX_FMT_YUYV:
+        case V4L2_PIX_FMT_UYVY: return 16;
+        default: return 0;
+    }
+}
+
+static void
+set_image_size (int width, int height)
+{
+    dev.width = width;
+    dev.height = height;
+    int bpp = bits_per_pixel (dev.pixelformat);
+    // planar formats have a one byte per pixel luma plane
+    if (dev.pixelformat == V4L2_PIX_FMT_YUV420 ||
+            dev.pixelformat == V4L2_PIX_FMT_NV12)
+        dev.bytesperline = width;
+    else
+        dev.bytesperline = width * bpp / 8;
+    dev.sizeimage = width * height * bpp / 8;
+}
+
+// called with the mutex held
+static void
+init_device (void)
+{
+    if (dev.initialized)
+        return;
+    dev.initialized = 1;
+    load_real_functions ();
+
+    const char *path = getenv ("CAMUNITS_V4L2_EMU_DEVICE");
+    snprintf (dev.path, sizeof (dev.path), "%s", path ? path : "/dev/video0");
+
+    const char *fourcc = getenv ("CAMUNITS_V4L2_EMU_FORMAT");
+    if (!fourcc || strlen (fourcc) != 4)
+        fourcc = "YUYV";
+    dev.pixelformat = v4l2_fourcc (fourcc[0], fourcc[1], fourcc[2], fourcc[3]);
+    if (!bits_per_pixel (dev.pixelformat)) {
+        err ("v4l2 emulator: unsupported format %s, using YUYV\n", fourcc);
+        dev.pixelformat = V4L2_PIX_FMT_YUYV;
+    }
+
+    int width = 640, height = 480;
+    const char *size = getenv ("CAMUNITS_V4L2_EMU_SIZE");
+    if (size && (2 != sscanf (size, "%dx%d", &width, &height) ||
+                width <= 0 || height <= 0)) {
+        err ("v4l2 emulator: invalid size %s\n", size);
+        width = 640;
+        height = 480;
+    }
+    set_image_size (width, height);
+
+    dev.fps = getenv_double ("CAMUNITS_V4L2_EMU_FPS", 30);
+    dev.drop_rate = getenv_double ("CAMUNITS_V4L2_EMU_DROP", 0);
+    dev.error_rate = getenv_double ("CAMUNITS_V4L2_EMU_ERROR", 0);
+    dev.seed = getenv_double ("CAMUNITS_V4L2_EMU_SEED", 1);
+
+    for (int i = 0; i < MAX_FDS; i++)
+        dev.fds[i] = -1;
+    dev.owner_fd = -1;
+    dev.memfd = -1;
+}
+
+static int
+is_device_path (const char *path)
+{
+    pthread_mutex_lock (&dev.mutex);
+    init_device ();
+    pthread_mutex_unlock (&dev.mutex);
+    return path && !strcmp (path, dev.path);
+}
+
+// called with the mutex held
+static int
+is_device_fd (int fd)
+{
+    if (fd < 0)
+        return 0;
+    for (int i = 0; i < MAX_FDS; i++)
+        if (dev.fds[i] == fd)
+            return 1;
+    return 0;
+}
+
+static int
+lookup_fd (int fd)
+{
+    pthread_mutex_lock (&dev.mutex);
+    init_device ();
+    int result = is_device_fd (fd);
+    pthread_mutex_unlock (&dev.mutex);
+    return result;
+}
+
+static int64_t
+now_ns (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+fill_frame (uint8_t *data, uint32_t sequence)
+{
+    // a diagonal gradient that moves one pixel per frame
+    for (int y = 0; y < dev.sizeimage / dev.bytesperline; y++) {
+        uint8_t *row = data + y * dev.bytesperline;
+        for (int x = 0; x < dev.bytesperline; x++)
+            row[x] = x + y + sequence;
+    }
+}
+
+// called with the mutex held
+static void
+deliver_frame (void)
+{
+    uint32_t sequence = dev.sequence++;
+    if (dev.drop_rate > 0 && rand_r (&dev.seed) < dev.drop_rate * RAND_MAX)
+        return;
+
+    int index = -1;
+    for (int i = 0; i < dev.nbuffers; i++) {
+        if (dev.buffers[i].state == BUF_QUEUED) {
+            index = i;
+            break;
+        }
+    }
+    if (index < 0)
+        return;
+
+    emu_buffer_t *buf = &dev.buffers[index];
+    fill_frame (dev.mem + (size_t) index * dev.buffer_stride, sequence);
+
+    int64_t t = now_ns ();
+    buf->info.timestamp.tv_sec = t / 1000000000;
+    buf->info.timestamp.tv_usec = (t % 1000000000) / 1000;
+    buf->info.sequence = sequence;
+    buf->info.bytesused = dev.sizeimage;
+    buf->info.flags = V4L2_BUF_FLAG_MAPPED | V4L2_BUF_FLAG_DONE |
+        V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+    buf->state = BUF_DONE;
+    dev.done[dev.ndone++] = index;
+
+    uint64_t one = 1;
+    if (write (dev.owner_fd, &one, sizeof (one)) != sizeof (one))
+        err ("v4l2 emulator: unable to signal frame: %s\n", strerror (errno));
+}
+
+static void *
+generator_thread (void *user_data)
+{
+    int64_t period = dev.fps > 0 ? 1000000000 / dev.fps : 0;
+    int64_t next = now_ns () + period;
+
+    pthread_mutex_lock (&dev.mutex);
+    while (dev.streaming) {
+        if (period) {
+            struct timespec ts = { next / 1000000000, next % 1000000000 };
+            pthread_mutex_unlock (&dev.mutex);
+            clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            pthread_mutex_lock (&dev.mutex);
+            if (!dev.streaming)
+                break;
+            next += period;
+        } else {
+            // free running: wait for a buffer to fill
+            int queued = 0;
+            for (int i = 0; i < dev.nbuffers; i++)
+                queued |= dev.buffers[i].state == BUF_QUEUED;
+            if (!queued) {
+                pthread_cond_wait (&dev.cond, &dev.mutex);
+                continue;
+            }
+        }
+        deliver_frame ();
+    }
+    pthread_mutex_unlock (&dev.mutex);
+    return NULL;
+}
+
+// called with the mutex held
+static void
+stop_streaming (void)
+{
+    if (!dev.streaming)
+        return;
+    dev.streaming = 0;
+    pthread_cond_broadcast (&dev.cond);
+    pthread_mutex_unlock (&dev.mutex);
+    pthread_join (dev.thread, NULL);
+    pthread_mutex_lock (&dev.mutex);
+
+    for (int i = 0; i < dev.nbuffers; i++)
+        dev.buffers[i].state = BUF_IDLE;
+    dev.ndone = 0;
+    // reset the eventfd
+    uint64_t count;
+    while (read (dev.owner_fd, &count, sizeof (count)) == sizeof (count));
+}
+
+// called with the mutex held
+static void
+free_buffers (void)
+{
+    stop_streaming ();
+    if (dev.mem)
+        munmap (dev.mem, (size_t) dev.nbuffers * dev.buffer_stride);
+    if (dev.memfd >= 0)
+        real_close (dev.memfd);
+    dev.mem = NULL;
+    dev.memfd = -1;
+    dev.nbuffers = 0;
+    dev.owner_fd = -1;
+}
+
+// ============================ ioctls =============================
+
+static int
+emu_querycap (struct v4l2_capability *cap)
+{
+    memset (cap, 0, sizeof (*cap));
+    snprintf ((char*) cap->driver, sizeof (cap->driver), "camunits-emu");
+    snprintf ((char*) cap->card, sizeof (cap->card), "Emulated camera");
+    snprintf ((char*) cap->bus_info, sizeof (cap->bus_info), "emulator");
+    cap->version = 0x00010000;
+    cap->capabilities = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING |
+        V4L2_CAP_DEVICE_CAPS;
+    cap->device_caps = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+    return 0;
+}
+
+static int
+emu_enum_fmt (struct v4l2_fmtdesc *f)
+{
+    if (f->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || f->index != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    f->flags = 0;
+    f->pixelformat = dev.pixelformat;
+    snprintf ((char*) f->description, sizeof (f->description), "%.4s",
+            (char*) &dev.pixelformat);
+    return 0;
+}
+
+static int
+emu_enum_framesizes (struct v4l2_frmsizeenum *fs)
+{
+    if (fs->index != 0 || fs->pixel_format != dev.pixelformat) {
+        errno = EINVAL;
+        return -1;
+    }
+    fs->type = V4L2_FRMSIZE_TYPE_DISCRETE;
+    fs->discrete.width = dev.width;
+    fs->discrete.height = dev.height;
+    return 0;
+}
+
+static int
+emu_fmt (unsigned long request, struct v4l2_format *fmt)
+{
+    if (fmt->type != V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (request == VIDIOC_S_FMT && dev.nbuffers) {
+        errno = EBUSY;
+        return -1;
+    }
+    // the size and format are fixed
+    memset (&fmt->fmt.pix, 0, sizeof (fmt->fmt.pix));
+    fmt->fmt.pix.width = dev.width;
+    fmt->fmt.pix.height = dev.height;
+    fmt->fmt.pix.pixelformat = dev.pixelformat;
+    fmt->fmt.pix.field = V4L2_FIELD_NONE;
+    fmt->fmt.pix.bytesperline = dev.bytesperline;
+    fmt->fmt.pix.sizeimage = dev.sizeimage;
+    fmt->fmt.pix.colorspace = V4L2_COLORSPACE_SRGB;
+    return 0;
+}
+
+static int
+emu_reqbufs (int fd, struct v4l2_requestbuffers *req)
+{
+    if (req->type != V4L2_BUF_TYPE_VIDEO_CAPTURE ||
+            req->memory != V4L2_MEMORY_MMAP) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (dev.owner_fd >= 0 && dev.owner_fd != fd) {
+        errno = EBUSY;
+        return -1;
+    }
+    free_buffers ();
+    if (req->count == 0)
+        return 0;
+
+    int count = req->count > MAX_BUFFERS ? MAX_BUFFERS : req->count;
+    long page_size = sysconf (_SC_PAGESIZE);
+    dev.buffer_stride = (dev.sizeimage + page_size - 1) & ~(page_size - 1);
+    dev.memfd = syscall (SYS_memfd_create, "v4l2-emulator", 0);
+    size_t total = (size_t) count * dev.buffer_stride;
+    if (dev.memfd < 0 || ftruncate (dev.memfd, total) < 0 ||
+            MAP_FAILED == (dev.mem = real_mmap (NULL, total,
+                    PROT_READ | PROT_WRITE, MAP_SHARED, dev.memfd, 0))) {
+        if (dev.memfd >= 0)
+            real_close (dev.memfd);
+        dev.mem = NULL;
+        dev.memfd = -1;
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        emu_buffer_t *buf = &dev.buffers[i];
+        memset (buf, 0, sizeof (*buf));
+        buf->state = BUF_IDLE;
+        buf->info.index = i;
+        buf->info.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf->info.memory = V4L2_MEMORY_MMAP;
+        buf->info.m.offset = i * dev.buffer_stride;
+        buf->info.length = dev.sizeimage;
+        buf->info.field = V4L2_FIELD_NONE;
+        buf->info.flags = V4L2_BUF_FLAG_MAPPED;
+    }
+    dev.nbuffers = count;
+    dev.owner_fd = fd;
+    req->count = count;
+    return 0;
+}
+
+static int
+emu_querybuf (struct v4l2_buffer *b)
+{
+    if (b->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || b->index >= dev.nbuffers) {
+        errno = EINVAL;
+        return -1;
+    }
+    *b = dev.buffers[b->index].info;
+    return 0;
+}
+
+static int
+emu_qbuf (struct v4l2_buffer *b)
+{
+    if (b->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || b->index >= dev.nbuffers ||
+            dev.buffers[b->index].state != BUF_IDLE) {
+        errno = EINVAL;
+        return -1;
+    }
+    dev.buffers[b->index].state = BUF_QUEUED;
+    dev.buffers[b->index].info.flags =
+        V4L2_BUF_FLAG_MAPPED | V4L2_BUF_FLAG_QUEUED;
+    pthread_cond_broadcast (&dev.cond);
+    return 0;
+}
+
+static int
+emu_dqbuf (int fd, struct v4l2_buffer *b)
+{
+    if (b->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || fd != dev.owner_fd) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!dev.streaming) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!dev.ndone) {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (dev.error_rate > 0 && rand_r (&dev.seed) < dev.error_rate * RAND_MAX) {
+        errno = EIO;
+        return -1;
+    }
+
+    uint64_t count;
+    if (read (fd, &count, sizeof (count)) != sizeof (count))
+        err ("v4l2 emulator: eventfd out of sync\n");
+
+    int index = dev.done[0];
+    memmove (dev.done, dev.done + 1, --dev.ndone * sizeof (int));
+    dev.buffers[index].state = BUF_IDLE;
+    dev.buffers[index].info.flags &= ~V4L2_BUF_FLAG_DONE;
+    *b = dev.buffers[index].info;
+    return 0;
+}
+
+static int
+emu_streamon (int fd, int *type)
+{
+    if (*type != V4L2_BUF_TYPE_VIDEO_CAPTURE || fd != dev.owner_fd ||
+            !dev.nbuffers) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (dev.streaming)
+        return 0;
+    dev.streaming = 1;
+    dev.sequence = 0;
+    if (0 != pthread_create (&dev.thread, NULL, generator_thread, NULL)) {
+        dev.streaming = 0;
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+static int
+emu_ioctl (int fd, unsigned long request, void *arg)
+{
+    switch (request) {
+        case VIDIOC_QUERYCAP:
+            return emu_querycap (arg);
+        case VIDIOC_ENUM_FMT:
+            return emu_enum_fmt (arg);
+        case VIDIOC_ENUM_FRAMESIZES:
+            return emu_enum_framesizes (arg);
+        case VIDIOC_G_FMT:
+        case VIDIOC_S_FMT:
+        case VIDIOC_TRY_FMT:
+            return emu_fmt (request, arg);
+        case VIDIOC_REQBUFS:
+            return emu_reqbufs (fd, arg);
+        case VIDIOC_QUERYBUF:
+            return emu_querybuf (arg);
+        case VIDIOC_QBUF:
+            return emu_qbuf (arg);
+        case VIDIOC_DQBUF:
+            return emu_dqbuf (fd, arg);
+        case VIDIOC_STREAMON:
+            return emu_streamon (fd, arg);
+        case VIDIOC_STREAMOFF:
+            if (fd != dev.owner_fd) {
+                errno = EINVAL;
+                return -1;
+            }
+            stop_streaming ();
+            return 0;
+        default:
+            // no inputs, standards, tuners, crop or controls
+            errno = EINVAL;
+            return -1;
+    }
+}
+
+// ======================== intercepted calls ==========================
+
+static int
+emu_open (void)
+{
+    pthread_mutex_lock (&dev.mutex);
+    int slot = -1;
+    for (int i = 0; i < MAX_FDS && slot < 0; i++)
+        if (dev.fds[i] < 0)
+            slot = i;
+    int fd = -1;
+    if (slot < 0) {
+        errno = EMFILE;
+    } else {
+        fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd >= 0)
+            dev.fds[slot] = fd;
+    }
+    pthread_mutex_unlock (&dev.mutex);
+    return fd;
+}
+
+int
+open (const char *path, int flags, ...)
+{
+    va_list ap;
+    va_start (ap, flags);
+    mode_t mode = (flags & O_CREAT) ? va_arg (ap, int) : 0;
+    va_end (ap);
+    if (is_device_path (path))
+        return emu_open ();
+    return real_open (path, flags, mode);
+}
+
+int
+open64 (const char *path, int flags, ...)
+{
+    va_list ap;
+    va_start (ap, flags);
+    mode_t mode = (flags & O_CREAT) ? va_arg (ap, int) : 0;
+    va_end (ap);
+    if (is_device_path (path))
+        return emu_open ();
+    return real_open64 (path, flags, mode);
+}
+
+int
+close (int fd)
+{
+    pthread_mutex_lock (&dev.mutex);
+    init_device ();
+    if (is_device_fd (fd)) {
+        if (fd == dev.owner_fd)
+            free_buffers ();
+        for (int i = 0; i < MAX_FDS; i++)
+            if (dev.fds[i] == fd)
+                dev.fds[i] = -1;
+    }
+    pthread_mutex_unlock (&dev.mutex);
+    return real_close (fd);
+}
+
+int
+ioctl (int fd, unsigned long request, ...)
+{
+    va_list ap;
+    va_start (ap, request);
+    void *arg = va_arg (ap, void *);
+    va_end (ap);
+
+    pthread_mutex_lock (&dev.mutex);
+    init_device ();
+    if (is_device_fd (fd)) {
+        int result = emu_ioctl (fd, request, arg);
+        pthread_mutex_unlock (&dev.mutex);
+        return result;
+    }
+    pthread_mutex_unlock (&dev.mutex);
+    return real_ioctl (fd, request, arg);
+}
+
+static void *
+emu_mmap (size_t length, int prot, int flags, off_t offset)
+{
+    pthread_mutex_lock (&dev.mutex);
+    void *result = MAP_FAILED;
+    if (dev.memfd < 0 || offset < 0 || offset % dev.buffer_stride ||
+            offset / dev.buffer_stride >= dev.nbuffers ||
+            length > dev.buffer_stride) {
+        errno = EINVAL;
+    } else {
+        result = real_mmap (NULL, length, prot, flags, dev.memfd, offset);
+    }
+    pthread_mutex_unlock (&dev.mutex);
+    return result;
+}
+
+void *
+mmap (void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+    if (lookup_fd (fd))
+        return emu_mmap (length, prot, flags, offset);
+    return real_mmap (addr, length, prot, flags, fd, offset);
+}
+
+void *
+mmap64 (void *addr, size_t length, int prot, int flags, int fd,
+        off64_t offset)
+{
+    if (lookup_fd (fd))
+        return emu_mmap (length, prot, flags, offset);
+    return real_mmap64 (addr, length, prot, flags, fd, offset);
+}
+
+static void
+fill_stat (struct stat *st)
+{
+    memset (st, 0, sizeof (*st));
+    st->st_mode = S_IFCHR | 0666;
+    st->st_rdev = makedev (81, 0);
+}
+
+int
+stat (const char *path, struct stat *st)
+{
+    if (is_device_path (path)) {
+        fill_stat (st);
+        return 0;
+    }
+    return real_stat (path, st);
+}
+
+int
+stat64 (const char *path, struct stat64 *st)
+{
+    if (is_device_path (path)) {
+        struct stat st32;
+        fill_stat (&st32);
+        memset (st, 0, sizeof (*st));
+        st->st_mode = st32.st_mode;
+        st->st_rdev = st32.st_rdev;
+        return 0;
+    }
+    return real_stat64 (path, st);
+}
+
+// older glibc implements stat() as an inline wrapper around these
+int __xstat (int ver, const char *path, struct stat *st);
+int __xstat64 (int ver, const char *path, struct stat64 *st);
+
+int
+__xstat (int ver, const char *path, struct stat *st)
+{
+    if (is_device_path (path)) {
+        fill_stat (st);
+        return 0;
+    }
+    return real___xstat (ver, path, st);
+}
+
+int
+__xstat64 (int ver, const char *path, struct stat64 *st)
+{
+    if (is_device_path (path)) {
+        return stat64 (path, st);
+    }
+    return real___xstat64 (ver, path, st);
+}